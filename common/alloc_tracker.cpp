@@ -0,0 +1,165 @@
+//
+// Counting operator new and delete, see alloc_tracker.h
+//
+
+#include "alloc_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<std::uint64_t> allocation_count{0};
+std::atomic<std::uint64_t> allocated_bytes{0};
+
+/**
+ * @param alignment 0 for what malloc guarantees, otherwise a power of two
+ */
+void *counted_allocation(std::size_t size, std::size_t alignment = 0) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  // malloc(0) may return null, operator new may not
+  if (size == 0) {
+    size = 1;
+  }
+  for (;;) {
+    void *p = nullptr;
+    if (alignment == 0) {
+      p = std::malloc(size);
+    } else if (posix_memalign(&p, std::max(alignment, sizeof(void *)), size) != 0) {
+      p = nullptr;
+    }
+    if (p != nullptr) {
+      return p;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+bool is_power_of_two(std::uint64_t n) noexcept {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+} // namespace
+
+alloc_counts allocated() noexcept {
+  alloc_counts c;
+  c.allocations = allocation_count.load(std::memory_order_relaxed);
+  c.bytes = allocated_bytes.load(std::memory_order_relaxed);
+  return c;
+}
+
+void frame_alloc_monitor::end_frame() {
+  last_frame_ = frame_.counts();
+  frames_++;
+  if (frames_ <= static_cast<std::uint64_t>(warmup_frames_) || last_frame_.allocations == 0) {
+    return;
+  }
+  allocating_frames_++;
+  if (is_power_of_two(allocating_frames_)) {
+    std::cout << name_ << ": frame " << frames_ << " made " << last_frame_.allocations << " heap allocations ("
+              << last_frame_.bytes << " bytes), " << allocating_frames_ << " allocating frames so far" << std::endl;
+  }
+}
+
+void *operator new(std::size_t size) {
+  return counted_allocation(size);
+}
+
+void *operator new[](std::size_t size) {
+  return counted_allocation(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return counted_allocation(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return counted_allocation(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+
+// posix_memalign memory is released with free like the rest
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  try {
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  try {
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+#endif
@@ -0,0 +1,98 @@
+//
+// Counts heap allocations, to check that frames in a steady state allocate nothing.
+// Linking alloc_tracker.cpp replaces the global operator new and delete of the program with ones that
+// count every allocation. Only C++ allocations are seen, malloc of C libraries and the GL driver is not.
+// The over-aligned forms taking std::align_val_t are replaced and counted as well where the compiler has
+// them (C++17 or -faligned-new), in C++14 there are none for new of over-aligned types to call.
+//
+
+#ifndef COMMON_ALLOC_TRACKER_H
+#define COMMON_ALLOC_TRACKER_H
+
+#include <cstdint>
+
+/**
+ * Allocations made with operator new, by all threads
+ */
+struct alloc_counts {
+  std::uint64_t allocations = 0;
+  std::uint64_t bytes = 0;
+
+  alloc_counts operator-(const alloc_counts &since) const noexcept {
+    alloc_counts d;
+    d.allocations = allocations - since.allocations;
+    d.bytes = bytes - since.bytes;
+    return d;
+  }
+};
+
+/**
+ * @return allocations since the program started
+ */
+alloc_counts allocated() noexcept;
+
+/**
+ * Allocations within a scope, of all threads while it lives or since the last restart
+ */
+class alloc_scope {
+public:
+  alloc_scope() noexcept : start_(allocated()) {}
+
+  void restart() noexcept {
+    start_ = allocated();
+  }
+
+  alloc_counts counts() const noexcept {
+    return allocated() - start_;
+  }
+
+private:
+  alloc_counts start_;
+};
+
+/**
+ * Watches the frames of a game for heap allocations.
+ * The first frames load and grow their buffers, after those every frame that allocates is reported.
+ */
+class frame_alloc_monitor {
+public:
+  /**
+   * @param name written in front of the reports
+   * @param warmup_frames frames which may allocate
+   */
+  explicit frame_alloc_monitor(const char *name, int warmup_frames = 120) noexcept
+      : name_(name), warmup_frames_(warmup_frames) {}
+
+  void begin_frame() noexcept {
+    frame_.restart();
+  }
+
+  /**
+   * Report the frame if it allocated after the warm-up, reports thin out to powers of two
+   */
+  void end_frame();
+
+  /**
+   * @return allocations of the last frame
+   */
+  const alloc_counts &last_frame() const noexcept {
+    return last_frame_;
+  }
+
+  /**
+   * @return frames after the warm-up which allocated
+   */
+  std::uint64_t allocating_frames() const noexcept {
+    return allocating_frames_;
+  }
+
+private:
+  const char *name_;
+  int warmup_frames_;
+  std::uint64_t frames_ = 0;
+  std::uint64_t allocating_frames_ = 0;
+  alloc_scope frame_;
+  alloc_counts last_frame_;
+};
+
+#endif //COMMON_ALLOC_TRACKER_H
@@ -0,0 +1,244 @@
+//
+// Microbenchmark harness for the CPU paths of the projects, needs no window.
+// Every case is calibrated until one sample runs long enough for the clock to be precise, then sampled
+// repeatedly. The report gives the median with its spread and a confidence interval for the mean, so
+// a regression can be told apart from noise, and can be written as JSON for scripts to compare runs.
+// Usage: bench [--json path|-] [--filter text] [--samples n] [--min-sample-ms ms]
+//
+
+#ifndef COMMON_BENCH_H
+#define COMMON_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Keep the compiler from optimising away the computation of value
+ */
+template<typename T>
+inline void do_not_optimize(const T &value) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+/**
+ * Timings of one case, all per item
+ */
+struct bench_result {
+  std::string name;
+  double items_per_call = 0;
+  long long calls_per_sample = 0;
+  int samples = 0;
+  double median_ns = 0;
+  double mad_ns = 0;  // median absolute deviation, scaled to match the standard deviation of normal noise
+  double mean_ns = 0;
+  double stddev_ns = 0;
+  double ci95_ns = 0; // half width of the 95 % confidence interval of the mean
+  double min_ns = 0;
+  double max_ns = 0;
+  int outliers = 0;   // samples further than 3 MADs from the median
+};
+
+class bench_suite {
+public:
+  /**
+   * @param suite name written to the report
+   */
+  bench_suite(std::string suite, int argc, char **argv) : suite_(std::move(suite)) {
+    for (int i = 1; i < argc; i++) {
+      const bool has_value = i + 1 < argc;
+      if (std::strcmp(argv[i], "--json") == 0 && has_value) {
+        json_path_ = argv[++i];
+      } else if (std::strcmp(argv[i], "--filter") == 0 && has_value) {
+        filter_ = argv[++i];
+      } else if (std::strcmp(argv[i], "--samples") == 0 && has_value) {
+        samples_ = std::max(std::atoi(argv[++i]), 2);
+      } else if (std::strcmp(argv[i], "--min-sample-ms") == 0 && has_value) {
+        min_sample_seconds_ = std::max(std::atof(argv[++i]), 0.01) / 1000;
+      } else {
+        std::cout << "Unknown argument " << argv[i] << std::endl;
+        usage_error_ = true;
+      }
+    }
+    if (!quiet()) {
+      std::printf("%-40s %12s %10s %12s %8s\n", "case", "median ns", "mad", "mean +- ci95", "outliers");
+    }
+  }
+
+  /**
+   * Time a case
+   * @param items work done by one call, results are per item
+   * @param call the code under test, put its results through do_not_optimize
+   */
+  template<typename Call>
+  void run(const std::string &name, double items, Call &&call) {
+    if (usage_error_ || (!filter_.empty() && name.find(filter_) == std::string::npos)) {
+      return;
+    }
+
+    // Doubling the calls until a sample is long enough also warms up caches and branch predictors
+    long long calls = 1;
+    while (time_calls(call, calls) < min_sample_seconds_ && calls < (1LL << 40)) {
+      calls *= 2;
+    }
+
+    std::vector<double> per_item(static_cast<std::size_t>(samples_));
+    for (auto &sample : per_item) {
+      sample = time_calls(call, calls) * 1e9 / (static_cast<double>(calls) * items);
+    }
+    results_.push_back(summarise(name, items, calls, per_item));
+    print(results_.back());
+  }
+
+  const std::vector<bench_result> &results() const noexcept {
+    return results_;
+  }
+
+  /**
+   * Write the JSON report if one was asked for
+   * @return exit code for main
+   */
+  int finish() const {
+    if (usage_error_) {
+      std::cout << "Usage: bench [--json path|-] [--filter text] [--samples n] [--min-sample-ms ms]" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (json_path_.empty()) {
+      return EXIT_SUCCESS;
+    }
+    if (json_path_ == "-") {
+      write_json(std::cout);
+      return EXIT_SUCCESS;
+    }
+    std::ofstream out(json_path_);
+    write_json(out);
+    if (!out) {
+      std::cout << "Can't write " << json_path_ << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  std::string suite_;
+  std::string json_path_;
+  std::string filter_;
+  int samples_ = 21;
+  double min_sample_seconds_ = 0.01;
+  bool usage_error_ = false;
+  std::vector<bench_result> results_;
+
+  bool quiet() const noexcept {
+    return json_path_ == "-";
+  }
+
+  template<typename Call>
+  static double time_calls(Call &call, long long calls) {
+    const auto start = std::chrono::steady_clock::now();
+    for (long long i = 0; i < calls; i++) {
+      call();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const std::size_t n = values.size();
+    return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+  }
+
+  /**
+   * @return 0.975 quantile of Student's t distribution
+   */
+  static double t_quantile(int degrees_of_freedom) noexcept {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    constexpr int entries = sizeof(table) / sizeof(table[0]);
+    return degrees_of_freedom <= entries ? table[std::max(degrees_of_freedom, 1) - 1] : 1.96;
+  }
+
+  static bench_result summarise(const std::string &name, double items, long long calls,
+                                const std::vector<double> &samples) {
+    bench_result r;
+    r.name = name;
+    r.items_per_call = items;
+    r.calls_per_sample = calls;
+    r.samples = static_cast<int>(samples.size());
+    r.median_ns = median(samples);
+    std::vector<double> deviations;
+    for (double s : samples) {
+      deviations.push_back(std::fabs(s - r.median_ns));
+    }
+    r.mad_ns = 1.4826 * median(deviations);
+
+    double sum = 0;
+    for (double s : samples) {
+      sum += s;
+    }
+    r.mean_ns = sum / r.samples;
+    double squares = 0;
+    for (double s : samples) {
+      squares += (s - r.mean_ns) * (s - r.mean_ns);
+    }
+    r.stddev_ns = std::sqrt(squares / (r.samples - 1));
+    r.ci95_ns = t_quantile(r.samples - 1) * r.stddev_ns / std::sqrt(static_cast<double>(r.samples));
+    r.min_ns = *std::min_element(samples.begin(), samples.end());
+    r.max_ns = *std::max_element(samples.begin(), samples.end());
+    for (double d : deviations) {
+      r.outliers += d > 3 * r.mad_ns ? 1 : 0;
+    }
+    return r;
+  }
+
+  void print(const bench_result &r) const {
+    if (!quiet()) {
+      std::printf("%-40s %12.3f %10.3f %12.3f +- %-8.3f %3d\n", r.name.c_str(), r.median_ns, r.mad_ns, r.mean_ns,
+                  r.ci95_ns, r.outliers);
+      std::fflush(stdout);
+    }
+  }
+
+  static void write_string(std::ostream &out, const std::string &s) {
+    out << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out << '\\';
+      }
+      out << c;
+    }
+    out << '"';
+  }
+
+  void write_json(std::ostream &out) const {
+    out.precision(6);
+    out << "{\n  \"suite\": ";
+    write_string(out, suite_);
+    out << ",\n  \"unit\": \"ns per item\",\n  \"samples\": " << samples_
+        << ",\n  \"min_sample_ms\": " << min_sample_seconds_ * 1000 << ",\n  \"results\": [";
+    for (std::size_t i = 0; i < results_.size(); i++) {
+      const bench_result &r = results_[i];
+      out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+      write_string(out, r.name);
+      out << ", \"items_per_call\": " << r.items_per_call << ", \"calls_per_sample\": " << r.calls_per_sample
+          << ", \"samples\": " << r.samples << ", \"median\": " << r.median_ns << ", \"mad\": " << r.mad_ns
+          << ", \"mean\": " << r.mean_ns << ", \"stddev\": " << r.stddev_ns << ", \"ci95\": " << r.ci95_ns
+          << ", \"min\": " << r.min_ns << ", \"max\": " << r.max_ns << ", \"outliers\": " << r.outliers << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+};
+
+#endif //COMMON_BENCH_H
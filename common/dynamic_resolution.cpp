@@ -0,0 +1,173 @@
+//
+// Resolution controller and scaled render target, see dynamic_resolution.h
+//
+
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+/**
+ * Remove argument i and the value after it
+ */
+void remove_option(int &argc, char **argv, int i) {
+  for (int j = i; j + 2 <= argc; j++) {
+    argv[j] = argv[j + 2];
+  }
+  argc -= 2;
+}
+
+} // namespace
+
+float resolution_controller::next_frame() {
+  const auto now = std::chrono::steady_clock::now();
+  const float frame_ms = started_ ? std::chrono::duration<float, std::milli>(now - last_frame_).count()
+                                  : params_.target_ms;
+  started_ = true;
+  last_frame_ = now;
+  return update(frame_ms);
+}
+
+float resolution_controller::update(float frame_ms) noexcept {
+  last_frame_ms_ = frame_ms;
+  if (!fixed_) {
+    // Relative error, positive with time to spare. A hitch of twice the budget or more counts the same,
+    // so one stalled frame doesn't throw the resolution down
+    const float error = std::max(-1.0f, std::min(1.0f, (params_.target_ms - frame_ms) / params_.target_ms));
+    // The integral stays within the scales, so it doesn't wind up while the scale sits at a clamp
+    integral_ = std::max(params_.min_scale, std::min(params_.max_scale, integral_ + params_.integral * error));
+    scale_ = std::max(params_.min_scale, std::min(params_.max_scale, integral_ + params_.proportional * error));
+  }
+  if (log_.is_open()) {
+    log_ << frames_ << ',' << frame_ms << ',' << scale_ << '\n';
+  }
+  frames_++;
+  return scale_;
+}
+
+void resolution_controller::fix(float scale) noexcept {
+  fixed_ = true;
+  scale_ = std::max(0.01f, std::min(1.0f, scale));
+}
+
+bool resolution_controller::log_to(const char *path) {
+  log_.open(path);
+  if (!log_) {
+    std::cout << "Can't write " << path << std::endl;
+    return false;
+  }
+  log_ << "frame,frame_ms,scale\n";
+  return true;
+}
+
+bool resolution_controller::parse_args(int &argc, char **argv) {
+  int i = 1;
+  while (i < argc) {
+    const bool scale = std::strcmp(argv[i], "--resolution-scale") == 0;
+    const bool log = std::strcmp(argv[i], "--resolution-log") == 0;
+    if (!scale && !log) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cout << argv[i] << " needs a value" << std::endl;
+      return false;
+    }
+    if (scale) {
+      fix(static_cast<float>(std::atof(argv[i + 1])));
+    } else if (!log_to(argv[i + 1])) {
+      return false;
+    }
+    remove_option(argc, argv, i);
+  }
+  return true;
+}
+
+scaled_render_target::~scaled_render_target() {
+  release();
+}
+
+bool scaled_render_target::init() {
+  supported_ = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+  if (!supported_) {
+    std::cout << "Framebuffer objects unavailable, drawing at full resolution" << std::endl;
+  }
+  return supported_;
+}
+
+void scaled_render_target::resize(int window_width, int window_height) {
+  window_width_ = window_width;
+  window_height_ = window_height;
+  if (!supported_) {
+    return;
+  }
+  release();
+  glGenRenderbuffers(1, &colour_);
+  glBindRenderbuffer(GL_RENDERBUFFER, colour_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window_width, window_height);
+  glGenRenderbuffers(1, &depth_);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, window_width, window_height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer_);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colour_);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "Offscreen target incomplete, drawing at full resolution" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    release();
+    supported_ = false;
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void scaled_render_target::begin(float scale) {
+  if (!supported_ || framebuffer_ == 0) {
+    width_ = window_width_;
+    height_ = window_height_;
+    glViewport(0, 0, width_, height_);
+    return;
+  }
+  width_ = std::max(1, static_cast<int>(static_cast<float>(window_width_) * scale + 0.5f));
+  height_ = std::max(1, static_cast<int>(static_cast<float>(window_height_) * scale + 0.5f));
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_);
+  glViewport(0, 0, width_, height_);
+  // Clearing ignores the viewport, only the scissor keeps it from filling the unused part
+  glScissor(0, 0, width_, height_);
+  glEnable(GL_SCISSOR_TEST);
+}
+
+void scaled_render_target::end() {
+  if (!supported_ || framebuffer_ == 0) {
+    return;
+  }
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, width_, height_, 0, 0, window_width_, window_height_, GL_COLOR_BUFFER_BIT,
+                    width_ == window_width_ && height_ == window_height_ ? GL_NEAREST : GL_LINEAR);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, window_width_, window_height_);
+}
+
+void scaled_render_target::release() {
+  if (framebuffer_ != 0) {
+    glDeleteFramebuffers(1, &framebuffer_);
+    framebuffer_ = 0;
+  }
+  if (colour_ != 0) {
+    glDeleteRenderbuffers(1, &colour_);
+    colour_ = 0;
+  }
+  if (depth_ != 0) {
+    glDeleteRenderbuffers(1, &depth_);
+    depth_ = 0;
+  }
+}
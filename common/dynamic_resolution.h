@@ -0,0 +1,138 @@
+//
+// Dynamic resolution: frames are drawn into an offscreen target at a fraction of the window size and
+// scaled up into the window. A PI controller picks the fraction every frame from how long the frames
+// take against a budget, so when filling pixels is what makes a frame slow, fewer pixels get filled.
+// The frame time is the time between frames, with vsync on the budget should sit above the refresh
+// interval or the controller can only ever lower the resolution.
+//
+
+#ifndef COMMON_DYNAMIC_RESOLUTION_H
+#define COMMON_DYNAMIC_RESOLUTION_H
+
+#include "GL/glew.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+
+struct resolution_params {
+  float target_ms = 1000.0f / 50;
+  float proportional = 0.3f; // scale per relative error of a frame
+  float integral = 0.05f;    // scale per relative error, summed over the frames
+  float min_scale = 0.4f;
+  float max_scale = 1;
+};
+
+class resolution_controller {
+public:
+  explicit resolution_controller(resolution_params params = resolution_params{}) noexcept
+      : params_(params), integral_(params.max_scale), scale_(params.max_scale) {}
+
+  /**
+   * Measure the time since the last call and pick the scale of the next frame
+   * @return the scale
+   */
+  float next_frame();
+
+  /**
+   * Pick the scale after a frame which took frame_ms
+   * @return the scale
+   */
+  float update(float frame_ms) noexcept;
+
+  /**
+   * Keep the scale, for benchmarks which need the same work every frame
+   */
+  void fix(float scale) noexcept;
+
+  bool fixed() const noexcept {
+    return fixed_;
+  }
+
+  float scale() const noexcept {
+    return scale_;
+  }
+
+  float last_frame_ms() const noexcept {
+    return last_frame_ms_;
+  }
+
+  /**
+   * Write the frame time and the scale of every frame as CSV from now on
+   * @return false if the file can't be written
+   */
+  bool log_to(const char *path);
+
+  /**
+   * Take --resolution-scale s and --resolution-log path out of the arguments, leaving the others
+   * @return false if one of them is missing its value or can't be used
+   */
+  bool parse_args(int &argc, char **argv);
+
+private:
+  resolution_params params_;
+  float integral_; // the integral term starts at the highest scale and the error moves it down
+  float scale_;
+  float last_frame_ms_ = 0;
+  bool fixed_ = false;
+  bool started_ = false;
+  std::chrono::steady_clock::time_point last_frame_;
+  std::ofstream log_;
+  std::uint64_t frames_ = 0;
+};
+
+/**
+ * Offscreen colour and depth buffers of the window size, drawn into at a scale and copied into the window.
+ * The buffers keep the full size, a lower scale only uses their lower left part, so changing the
+ * scale every frame allocates nothing.
+ */
+class scaled_render_target {
+public:
+  scaled_render_target() = default;
+
+  ~scaled_render_target();
+
+  scaled_render_target(const scaled_render_target &) = delete;
+
+  scaled_render_target &operator=(const scaled_render_target &) = delete;
+
+  /**
+   * Check for framebuffer objects, needs the GL context.
+   * Without them frames are drawn straight into the window at full size.
+   * @return false if frames can't be scaled
+   */
+  bool init();
+
+  /**
+   * Size the buffers for a window, call from the reshape callback
+   */
+  void resize(int window_width, int window_height);
+
+  /**
+   * Draw into the target from here on, at scale times the window size, sets the viewport
+   */
+  void begin(float scale);
+
+  /**
+   * Scale what was drawn up into the window and draw into the window from here on
+   */
+  void end();
+
+  bool supported() const noexcept {
+    return supported_;
+  }
+
+private:
+  bool supported_ = false;
+  GLuint framebuffer_ = 0;
+  GLuint colour_ = 0;
+  GLuint depth_ = 0;
+  int window_width_ = 0;
+  int window_height_ = 0;
+  int width_ = 0; // of the frame being drawn
+  int height_ = 0;
+
+  void release();
+};
+
+#endif //COMMON_DYNAMIC_RESOLUTION_H
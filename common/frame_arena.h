@@ -0,0 +1,128 @@
+//
+// Bump allocator for data which only lives for one frame.
+// Allocating moves a pointer through one block, reset at the start of the next frame frees everything
+// at once. When a frame needs more than the block, the rest comes from the heap and the block grows to
+// fit at the next reset, so after a few frames the arena allocates nothing.
+//
+
+#ifndef COMMON_FRAME_ARENA_H
+#define COMMON_FRAME_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+class frame_arena {
+public:
+  /**
+   * @param capacity bytes of the block
+   */
+  explicit frame_arena(std::size_t capacity) : block_(new unsigned char[capacity]), capacity_(capacity) {}
+
+  frame_arena(const frame_arena &) = delete;
+
+  frame_arena &operator=(const frame_arena &) = delete;
+
+  /**
+   * @param alignment power of two, at most that of std::max_align_t
+   * @return memory valid until the next reset
+   */
+  void *allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) {
+    const std::size_t at = (used_ + alignment - 1) & ~(alignment - 1);
+    if (at + bytes <= capacity_) {
+      used_ = at + bytes;
+      return block_.get() + at;
+    }
+    // Heap memory is aligned for every fundamental type
+    overflow_.emplace_back(new unsigned char[bytes]);
+    overflow_bytes_ += bytes + alignment;
+    return overflow_.back().get();
+  }
+
+  /**
+   * Uninitialised array, only for types that need no destructor since reset runs none
+   */
+  template<typename T>
+  T *allocate_array(std::size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value, "the arena doesn't destroy what it holds");
+    return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  /**
+   * Free everything allocated since the last reset, grow the block if it was too small
+   */
+  void reset() {
+    if (!overflow_.empty()) {
+      capacity_ = (capacity_ + overflow_bytes_) * 2;
+      block_.reset(new unsigned char[capacity_]);
+      overflow_.clear();
+      overflow_bytes_ = 0;
+    }
+    used_ = 0;
+  }
+
+  std::size_t used() const noexcept {
+    return used_;
+  }
+
+  std::size_t capacity() const noexcept {
+    return capacity_;
+  }
+
+private:
+  std::unique_ptr<unsigned char[]> block_;
+  std::size_t capacity_;
+  std::size_t used_ = 0;
+  std::vector<std::unique_ptr<unsigned char[]>> overflow_;
+  std::size_t overflow_bytes_ = 0; // with room for alignment
+};
+
+/**
+ * Standard allocator on a frame arena, for containers which are dropped before the reset
+ */
+template<typename T>
+class arena_allocator {
+public:
+  using value_type = T;
+
+  explicit arena_allocator(frame_arena &arena) noexcept : arena_(&arena) {}
+
+  template<typename U>
+  arena_allocator(const arena_allocator<U> &other) noexcept : arena_(other.arena()) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  /**
+   * Memory goes back with the reset of the arena
+   */
+  void deallocate(T *, std::size_t) noexcept {}
+
+  frame_arena *arena() const noexcept {
+    return arena_;
+  }
+
+private:
+  frame_arena *arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept {
+  return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept {
+  return !(a == b);
+}
+
+/**
+ * Vector living in a frame arena
+ */
+template<typename T>
+using frame_vector = std::vector<T, arena_allocator<T>>;
+
+#endif //COMMON_FRAME_ARENA_H
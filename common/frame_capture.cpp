@@ -0,0 +1,378 @@
+//
+// Frame capture through a ring of pixel buffer objects, see frame_capture.h
+//
+
+#include "frame_capture.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+constexpr int bytes_per_pixel = 4;
+
+void put_u16(unsigned char *at, unsigned value) noexcept {
+  at[0] = static_cast<unsigned char>(value);
+  at[1] = static_cast<unsigned char>(value >> 8);
+}
+
+void put_u32(unsigned char *at, std::uint32_t value) noexcept {
+  for (int i = 0; i < 4; i++) {
+    at[i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+/**
+ * A row of BGRA pixels as RGB
+ */
+void to_rgb(const unsigned char *bgra, int width, unsigned char *rgb) noexcept {
+  for (int x = 0; x < width; x++) {
+    rgb[3 * x] = bgra[4 * x + 2];
+    rgb[3 * x + 1] = bgra[4 * x + 1];
+    rgb[3 * x + 2] = bgra[4 * x];
+  }
+}
+
+/**
+ * A row of BGRA pixels as BGR padded to 4 bytes, like BMP rows are
+ * @return bytes of the row
+ */
+std::size_t to_bgr(const unsigned char *bgra, int width, unsigned char *bgr) noexcept {
+  for (int x = 0; x < width; x++) {
+    bgr[3 * x] = bgra[4 * x];
+    bgr[3 * x + 1] = bgra[4 * x + 1];
+    bgr[3 * x + 2] = bgra[4 * x + 2];
+  }
+  const std::size_t bytes = 3 * static_cast<std::size_t>(width);
+  const std::size_t padded = (bytes + 3) & ~std::size_t{3};
+  std::memset(bgr + bytes, 0, padded - bytes);
+  return padded;
+}
+
+const char *extension(capture_format format) noexcept {
+  return format == capture_format::bmp ? ".bmp" : ".ppm";
+}
+
+} // namespace
+
+constexpr int frame_capture::ring_size;
+constexpr int frame_capture::frame_pool;
+
+frame_capture::~frame_capture() {
+  stop();
+}
+
+bool frame_capture::parse_args(int &argc, char **argv) {
+  int i = 1;
+  while (i < argc) {
+    const bool format = std::strcmp(argv[i], "--capture") == 0;
+    const bool target = std::strcmp(argv[i], "--capture-to") == 0;
+    if (!format && !target) {
+      i++;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      std::cout << argv[i] << " needs a value" << std::endl;
+      return false;
+    }
+    const char *value = argv[i + 1];
+    if (target) {
+      requested_target_ = value;
+    } else if (std::strcmp(value, "ppm") == 0) {
+      requested_format_ = capture_format::ppm;
+    } else if (std::strcmp(value, "bmp") == 0) {
+      requested_format_ = capture_format::bmp;
+    } else if (std::strcmp(value, "raw") == 0) {
+      requested_format_ = capture_format::raw;
+    } else {
+      std::cout << "Unknown capture format " << value << ", use ppm, bmp or raw" << std::endl;
+      return false;
+    }
+    requested_ = requested_ || format;
+    for (int j = i; j + 2 <= argc; j++) {
+      argv[j] = argv[j + 2];
+    }
+    argc -= 2;
+  }
+  return true;
+}
+
+bool frame_capture::init() {
+  if (!requested_) {
+    return true;
+  }
+  std::string target = requested_target_;
+  if (target.empty() && requested_format_ != capture_format::raw) {
+    target = "capture_";
+  }
+  return start(requested_format_, target);
+}
+
+bool frame_capture::start(capture_format format, const std::string &target) {
+  if (active_) {
+    return true;
+  }
+  if (!(GLEW_VERSION_3_2 || GLEW_ARB_sync) || !(GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object)) {
+    std::cout << "Capturing needs pixel buffer objects and fences" << std::endl;
+    return false;
+  }
+  format_ = format;
+  target_ = target;
+  if (format_ == capture_format::raw) {
+    if (target_.empty() || target_ == "-") {
+      // The stream owns stdout, messages of the game go to stderr meanwhile
+      stdout_ = std::cout.rdbuf(std::cerr.rdbuf());
+      raw_file_.close();
+      stdout_stream_.rdbuf(stdout_);
+      raw_ = &stdout_stream_;
+    } else {
+      raw_file_.open(target_, std::ios::binary);
+      if (!raw_file_) {
+        std::cout << "Can't write " << target_ << std::endl;
+        return false;
+      }
+      raw_ = &raw_file_;
+    }
+    raw_width_ = 0;
+    raw_height_ = 0;
+  }
+
+  for (auto &slot : ring_) {
+    glGenBuffers(1, &slot.buffer);
+    slot.width = 0;
+    slot.height = 0;
+  }
+  next_ = 0;
+  frame_number_ = 0;
+  captured_ = 0;
+  dropped_ = 0;
+  gl_thread_ms_ = 0;
+  free_.clear();
+  queued_.clear();
+  free_.reserve(frame_pool);
+  queued_.reserve(frame_pool);
+  for (int i = 0; i < frame_pool; i++) {
+    free_.push_back(i);
+  }
+  stopping_ = false;
+  writer_ = std::thread([this] { write_frames(); });
+  active_ = true;
+  return true;
+}
+
+void frame_capture::capture(int width, int height) {
+  if (!active_) {
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  collect(false);
+
+  readback &slot = ring_[next_];
+  if (slot.fence != nullptr) {
+    // The oldest readback still runs, waiting for it would stall the frame
+    dropped_++;
+  } else {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.width != width || slot.height != height) {
+      glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(width) * height * bytes_per_pixel, nullptr,
+                   GL_STREAM_READ);
+      slot.width = width;
+      slot.height = height;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadBuffer(GL_BACK);
+    // BGRA is what the driver stores, reading it is a copy rather than a conversion
+    glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.number = frame_number_;
+    next_ = (next_ + 1) % ring_size;
+  }
+  frame_number_++;
+  gl_thread_ms_ += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void frame_capture::collect(bool wait) {
+  for (int i = 0; i < ring_size; i++) {
+    readback &slot = ring_[(next_ + i) % ring_size];
+    if (slot.fence == nullptr) {
+      continue;
+    }
+    const GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                           wait ? GLuint64{1000000000} : 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      // Later readbacks wait too, so frames come out in order
+      return;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    if (status == GL_WAIT_FAILED) {
+      dropped_++;
+      continue;
+    }
+    deliver(slot);
+  }
+}
+
+void frame_capture::deliver(readback &slot) {
+  if (format_ == capture_format::raw) {
+    if (raw_width_ == 0) {
+      raw_width_ = slot.width;
+      raw_height_ = slot.height;
+      std::cout << "Raw capture of " << raw_width_ << "x" << raw_height_ << " rgb24 frames" << std::endl;
+    }
+    if (slot.width != raw_width_ || slot.height != raw_height_) {
+      dropped_++;
+      return;
+    }
+  }
+
+  int f;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      // The writer is behind
+      dropped_++;
+      return;
+    }
+    f = free_.back();
+    free_.pop_back();
+  }
+
+  frame &target = frames_[f];
+  const std::size_t bytes = static_cast<std::size_t>(slot.width) * slot.height * bytes_per_pixel;
+  target.pixels.resize(bytes);
+  target.width = slot.width;
+  target.height = slot.height;
+  target.number = slot.number;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(bytes), GL_MAP_READ_BIT);
+  const bool copied = mapped != nullptr;
+  if (copied) {
+    std::memcpy(target.pixels.data(), mapped, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (copied) {
+      queued_.push_back(f);
+      captured_++;
+    } else {
+      free_.push_back(f);
+      dropped_++;
+    }
+  }
+  wake_.notify_one();
+}
+
+void frame_capture::stop() {
+  if (!active_) {
+    return;
+  }
+  collect(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+  for (auto &slot : ring_) {
+    if (slot.fence != nullptr) {
+      glDeleteSync(slot.fence);
+      slot.fence = nullptr;
+      dropped_++;
+    }
+    glDeleteBuffers(1, &slot.buffer);
+    slot.buffer = 0;
+  }
+  if (raw_ != nullptr) {
+    raw_->flush();
+    raw_ = nullptr;
+    raw_file_.close();
+  }
+  if (stdout_ != nullptr) {
+    std::cout.rdbuf(stdout_);
+    stdout_ = nullptr;
+  }
+  active_ = false;
+
+  std::cout << "Captured " << captured_ << " frames, dropped " << dropped_ << ", "
+            << (frame_number_ > 0 ? gl_thread_ms_ / static_cast<double>(frame_number_) : 0)
+            << " ms per frame on the GL thread" << std::endl;
+}
+
+void frame_capture::write_frames() {
+  std::vector<unsigned char> row;
+  for (;;) {
+    int f;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || !queued_.empty(); });
+      // Write everything queued before finishing
+      if (queued_.empty()) {
+        return;
+      }
+      f = queued_.front();
+      queued_.erase(queued_.begin());
+    }
+    write(frames_[f], row);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(f);
+    }
+  }
+}
+
+void frame_capture::write(const frame &f, std::vector<unsigned char> &row) {
+  const std::size_t stride = static_cast<std::size_t>(f.width) * bytes_per_pixel;
+  row.resize(static_cast<std::size_t>(f.width) * 3 + 3);
+
+  if (format_ == capture_format::raw) {
+    // Top row first, as video tools read raw frames
+    for (int y = f.height - 1; y >= 0; y--) {
+      to_rgb(f.pixels.data() + static_cast<std::size_t>(y) * stride, f.width, row.data());
+      raw_->write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(f.width) * 3);
+    }
+    if (!*raw_) {
+      std::cerr << "Can't write the raw capture stream" << std::endl;
+    }
+    return;
+  }
+
+  char number[16];
+  std::snprintf(number, sizeof(number), "%06llu", static_cast<unsigned long long>(f.number));
+  const std::string path = target_ + number + extension(format_);
+  std::ofstream out(path, std::ios::binary);
+  if (format_ == capture_format::ppm) {
+    out << "P6\n" << f.width << ' ' << f.height << "\n255\n";
+    for (int y = f.height - 1; y >= 0; y--) {
+      to_rgb(f.pixels.data() + static_cast<std::size_t>(y) * stride, f.width, row.data());
+      out.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(f.width) * 3);
+    }
+  } else {
+    // BMP rows are stored bottom up, like GL reads them
+    const std::size_t row_bytes = (static_cast<std::size_t>(f.width) * 3 + 3) & ~std::size_t{3};
+    const std::size_t image_bytes = row_bytes * static_cast<std::size_t>(f.height);
+    unsigned char header[54] = {'B', 'M'};
+    put_u32(header + 2, static_cast<std::uint32_t>(sizeof(header) + image_bytes));
+    put_u32(header + 10, sizeof(header));
+    put_u32(header + 14, 40);
+    put_u32(header + 18, static_cast<std::uint32_t>(f.width));
+    put_u32(header + 22, static_cast<std::uint32_t>(f.height));
+    put_u16(header + 26, 1);
+    put_u16(header + 28, 24);
+    put_u32(header + 34, static_cast<std::uint32_t>(image_bytes));
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    for (int y = 0; y < f.height; y++) {
+      const std::size_t bytes = to_bgr(f.pixels.data() + static_cast<std::size_t>(y) * stride, f.width, row.data());
+      out.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(bytes));
+    }
+  }
+  if (!out) {
+    std::cerr << "Can't write " << path << std::endl;
+  }
+}
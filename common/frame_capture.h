@@ -0,0 +1,133 @@
+//
+// Records the frames of a game without stalling it.
+// Every frame the back buffer is read into one of a ring of pixel buffer objects, which the driver fills
+// while the GL thread goes on. A fence tells when a buffer is done, only then it is mapped and copied out,
+// a few frames later, and a writer thread turns the copies into PPM or BMP files or raw RGB on stdout.
+// When the ring or the writer falls behind, frames are dropped rather than waited for.
+// Usage: --capture ppm|bmp|raw [--capture-to prefix], raw goes to stdout unless a path is given
+//
+
+#ifndef COMMON_FRAME_CAPTURE_H
+#define COMMON_FRAME_CAPTURE_H
+
+#include "GL/glew.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class capture_format {
+  ppm, bmp, raw
+};
+
+class frame_capture {
+public:
+  static constexpr int ring_size = 3;   // frames being read back
+  static constexpr int frame_pool = 8;  // frames copied out and waiting for the writer
+
+  frame_capture() = default;
+
+  ~frame_capture();
+
+  frame_capture(const frame_capture &) = delete;
+
+  frame_capture &operator=(const frame_capture &) = delete;
+
+  /**
+   * Take --capture and --capture-to out of the arguments, leaving the others
+   * @return false if one of them is missing its value or names no format
+   */
+  bool parse_args(int &argc, char **argv);
+
+  /**
+   * Start capturing if the arguments asked for it, needs the GL context
+   * @return false if capturing was asked for but can't be done
+   */
+  bool init();
+
+  /**
+   * @param target prefix of the numbered files, or path of the raw stream, - or empty for stdout
+   */
+  bool start(capture_format format, const std::string &target);
+
+  /**
+   * Read the back buffer of the window, call after drawing and before swapping
+   */
+  void capture(int width, int height);
+
+  /**
+   * Wait for the frames still read back, write them and end the writer
+   */
+  void stop();
+
+  bool active() const noexcept {
+    return active_;
+  }
+
+private:
+  /**
+   * Pixel buffer object of the ring
+   */
+  struct readback {
+    GLuint buffer = 0;
+    GLsync fence = nullptr; // set while the buffer is being filled
+    int width = 0;
+    int height = 0;
+    std::uint64_t number = 0;
+  };
+
+  /**
+   * Copy of a frame, bottom row first and 4 bytes per pixel in BGRA order like GL reads it
+   */
+  struct frame {
+    std::vector<unsigned char> pixels;
+    int width = 0;
+    int height = 0;
+    std::uint64_t number = 0;
+  };
+
+  bool requested_ = false;
+  capture_format requested_format_ = capture_format::ppm;
+  std::string requested_target_;
+
+  bool active_ = false;
+  capture_format format_ = capture_format::ppm;
+  std::string target_;
+  readback ring_[ring_size];
+  int next_ = 0;                 // slot of the next readback, the oldest one in flight
+  std::uint64_t frame_number_ = 0;
+  std::uint64_t captured_ = 0;
+  std::uint64_t dropped_ = 0;
+  double gl_thread_ms_ = 0;      // time capture took on the GL thread
+
+  std::thread writer_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  frame frames_[frame_pool];
+  std::vector<int> free_;        // frames for the GL thread to copy into
+  std::vector<int> queued_;      // frames for the writer, oldest first
+  std::streambuf *stdout_ = nullptr; // real stdout while std::cout goes to stderr for the raw stream
+  std::ostream stdout_stream_{nullptr};
+  std::ofstream raw_file_;
+  std::ostream *raw_ = nullptr;
+  int raw_width_ = 0;            // size of the raw stream, frames of another size are dropped
+  int raw_height_ = 0;
+
+  /**
+   * Hand on the readbacks which are done, oldest first, stop at one still running unless waiting
+   */
+  void collect(bool wait);
+
+  void deliver(readback &slot);
+
+  void write_frames();
+
+  void write(const frame &f, std::vector<unsigned char> &row);
+};
+
+#endif //COMMON_FRAME_CAPTURE_H
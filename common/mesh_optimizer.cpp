@@ -0,0 +1,559 @@
+//
+// Mesh generation, vertex cache and overdraw ordering and quantisation, see mesh_optimizer.h
+//
+
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+
+namespace {
+
+constexpr std::uint32_t no_vertex = ~std::uint32_t{0};
+
+vec3 position_of(const mesh_vertex &v) noexcept {
+  return {v.position[0], v.position[1], v.position[2]};
+}
+
+/**
+ * Triangle with the given vertices, wound counterclockwise seen from where the normals point.
+ * Triangles without area, like those at the poles of a sphere, are left out.
+ */
+void add_triangle(mesh &m, vec3 a, vec3 na, vec3 b, vec3 nb, vec3 c, vec3 nc) {
+  const vec3 face = cross(b - a, c - a);
+  const float edge = std::max(dot(b - a, b - a), std::max(dot(c - a, c - a), dot(c - b, c - b)));
+  if (dot(face, face) <= 1e-12f * edge * edge) {
+    return;
+  }
+  if (dot(face, na + nb + nc) < 0) {
+    std::swap(b, c);
+    std::swap(nb, nc);
+  }
+  const vec3 points[] = {a, b, c};
+  const vec3 normals[] = {na, nb, nc};
+  for (int i = 0; i < 3; i++) {
+    m.indices.push_back(static_cast<std::uint32_t>(m.vertices.size()));
+    m.vertices.push_back({{points[i].x, points[i].y, points[i].z}, {normals[i].x, normals[i].y, normals[i].z}});
+  }
+}
+
+/**
+ * Two triangles of the quad a b c d, going around it
+ */
+void add_quad(mesh &m, vec3 a, vec3 na, vec3 b, vec3 nb, vec3 c, vec3 nc, vec3 d, vec3 nd) {
+  add_triangle(m, a, na, b, nb, c, nc);
+  add_triangle(m, a, na, c, nc, d, nd);
+}
+
+std::uint32_t float_bits(float f) noexcept {
+  f += 0.0f; // -0 becomes 0
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+std::uint32_t hash_vertex(const mesh_vertex &v) noexcept {
+  std::uint32_t h = 2166136261u;
+  for (int i = 0; i < 3; i++) {
+    h = (h ^ float_bits(v.position[i])) * 16777619u;
+    h = (h ^ float_bits(v.normal[i])) * 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+bool same_vertex(const mesh_vertex &a, const mesh_vertex &b) noexcept {
+  for (int i = 0; i < 3; i++) {
+    if (float_bits(a.position[i]) != float_bits(b.position[i]) || float_bits(a.normal[i]) != float_bits(b.normal[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Scores of Forsyth's article
+constexpr float cache_decay_power = 1.5f;
+constexpr float last_triangle_score = 0.75f;
+constexpr float valence_boost_scale = 2.0f;
+constexpr float valence_boost_power = 0.5f;
+constexpr int valence_table_size = 32;
+
+/**
+ * Forsyth's vertex scores, looked up rather than computed with pow for every change
+ */
+class vertex_scores {
+public:
+  explicit vertex_scores(int cache_size) : cache_(static_cast<std::size_t>(cache_size)) {
+    for (int i = 0; i < cache_size; i++) {
+      cache_[static_cast<std::size_t>(i)] =
+          i < 3 ? last_triangle_score
+                : std::pow(1 - static_cast<float>(i - 3) / static_cast<float>(std::max(cache_size - 3, 1)),
+                           cache_decay_power);
+    }
+    for (int i = 0; i < valence_table_size; i++) {
+      valence_[i] = valence(static_cast<std::uint32_t>(i));
+    }
+  }
+
+  /**
+   * @param position in the cache, -1 if the vertex isn't in it
+   * @param remaining triangles still to be emitted which use the vertex
+   */
+  float operator()(int position, std::uint32_t remaining) const noexcept {
+    if (remaining == 0) {
+      return -1;
+    }
+    const float cached = position >= 0 ? cache_[static_cast<std::size_t>(position)] : 0;
+    return cached + (remaining < valence_table_size ? valence_[remaining] : valence(remaining));
+  }
+
+private:
+  std::vector<float> cache_;
+  float valence_[valence_table_size];
+
+  static float valence(std::uint32_t remaining) noexcept {
+    return remaining == 0 ? 0 : valence_boost_scale * std::pow(static_cast<float>(remaining), -valence_boost_power);
+  }
+};
+
+/**
+ * FIFO post-transform cache, a vertex is in it while fewer than size others were added after it
+ */
+class fifo_cache {
+public:
+  fifo_cache(std::size_t vertices, int size)
+      : added_(vertices, 0), size_(static_cast<std::uint32_t>(size)), time_(static_cast<std::uint32_t>(size) + 1) {}
+
+  /**
+   * @return 1 if the vertex had to be transformed
+   */
+  int use(std::uint32_t vertex) noexcept {
+    if (time_ - added_[vertex] <= size_) {
+      return 0;
+    }
+    added_[vertex] = time_++;
+    return 1;
+  }
+
+  void clear() noexcept {
+    time_ += size_ + 1;
+  }
+
+private:
+  std::vector<std::uint32_t> added_;
+  std::uint32_t size_;
+  std::uint32_t time_;
+};
+
+/**
+ * Run of triangles in the overdraw ordering
+ */
+struct triangle_cluster {
+  std::size_t first;
+  std::size_t last;
+  float sort_key;
+};
+
+} // namespace
+
+void add_sphere(mesh &m, vec3 centre, float radius, int slices, int stacks) {
+  auto direction = [slices, stacks](int slice, int stack) {
+    // The poles exactly, so the triangles there lose their third corner and all slices share the vertex
+    if (stack == 0 || stack == stacks) {
+      return vec3{0, stack == 0 ? -1.0f : 1.0f, 0};
+    }
+    const float latitude = vecmath_pi * (static_cast<float>(stack) / static_cast<float>(stacks) - 0.5f);
+    const float longitude = 2 * vecmath_pi * static_cast<float>(slice % slices) / static_cast<float>(slices);
+    return vec3{std::cos(latitude) * std::cos(longitude), std::sin(latitude),
+                std::cos(latitude) * std::sin(longitude)};
+  };
+  for (int stack = 0; stack < stacks; stack++) {
+    for (int slice = 0; slice < slices; slice++) {
+      const vec3 a = direction(slice, stack);
+      const vec3 b = direction(slice + 1, stack);
+      const vec3 c = direction(slice + 1, stack + 1);
+      const vec3 d = direction(slice, stack + 1);
+      add_quad(m, centre + a * radius, a, centre + b * radius, b, centre + c * radius, c, centre + d * radius, d);
+    }
+  }
+}
+
+void add_cone(mesh &m, vec3 base, float radius, float height, int slices, int stacks) {
+  const float slant = std::sqrt(radius * radius + height * height);
+  auto rim = [slices](int slice) {
+    // The last slice ends where the first begins, bit for bit
+    const float angle = 2 * vecmath_pi * static_cast<float>(slice % slices) / static_cast<float>(slices);
+    return vec3{std::cos(angle), 0, std::sin(angle)};
+  };
+  auto side_normal = [&rim, radius, height, slant](int slice) {
+    const vec3 r = rim(slice);
+    return vec3{r.x * height / slant, radius / slant, r.z * height / slant};
+  };
+  auto side_point = [&rim, base, radius, height, stacks](int slice, int stack) {
+    const float t = static_cast<float>(stack) / static_cast<float>(stacks);
+    return base + rim(slice) * (radius * (1 - t)) + vec3{0, height * t, 0};
+  };
+  const vec3 down{0, -1, 0};
+  for (int slice = 0; slice < slices; slice++) {
+    add_triangle(m, base, down, base + rim(slice) * radius, down, base + rim(slice + 1) * radius, down);
+    const vec3 n0 = side_normal(slice);
+    const vec3 n1 = side_normal(slice + 1);
+    for (int stack = 0; stack < stacks; stack++) {
+      add_quad(m, side_point(slice, stack), n0, side_point(slice + 1, stack), n1,
+               side_point(slice + 1, stack + 1), n1, side_point(slice, stack + 1), n0);
+    }
+  }
+}
+
+void add_box(mesh &m, vec3 centre, float size, int steps) {
+  const vec3 axes[] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  const float step = size / static_cast<float>(steps);
+  for (int axis = 0; axis < 3; axis++) {
+    const vec3 &u = axes[(axis + 1) % 3];
+    const vec3 &v = axes[(axis + 2) % 3];
+    for (float side : {-1.0f, 1.0f}) {
+      const vec3 normal = axes[axis] * side;
+      const vec3 corner = centre + normal * (size / 2) - u * (size / 2) - v * (size / 2);
+      for (int i = 0; i < steps; i++) {
+        for (int j = 0; j < steps; j++) {
+          const vec3 a = corner + u * (step * static_cast<float>(i)) + v * (step * static_cast<float>(j));
+          add_quad(m, a, normal, a + u * step, normal, a + u * step + v * step, normal, a + v * step, normal);
+        }
+      }
+    }
+  }
+}
+
+mesh_stats measure_mesh(const std::vector<std::uint32_t> &indices, std::size_t vertices,
+                        std::size_t bytes_per_vertex) {
+  mesh_stats stats;
+  stats.vertices = vertices;
+  stats.triangles = indices.size() / 3;
+  stats.bytes_per_vertex = bytes_per_vertex;
+  stats.vertex_bytes = vertices * bytes_per_vertex;
+  stats.index_bytes = indices.size() * (vertices <= 65536 ? 2 : 4);
+  if (indices.empty()) {
+    return stats;
+  }
+  fifo_cache cache(vertices, mesh_stats_cache_size);
+  std::size_t transformed = 0;
+  for (std::uint32_t index : indices) {
+    transformed += static_cast<std::size_t>(cache.use(index));
+  }
+  stats.acmr = static_cast<float>(transformed) / static_cast<float>(stats.triangles);
+  stats.atvr = static_cast<float>(transformed) / static_cast<float>(vertices);
+  return stats;
+}
+
+std::size_t deduplicate_vertices(mesh &m) {
+  // Open addressing over at least twice as many slots as vertices, a slot holds the new vertex number
+  std::size_t slots = 64;
+  while (slots < 2 * m.vertices.size()) {
+    slots *= 2;
+  }
+  std::vector<std::uint32_t> table(slots, no_vertex);
+  std::vector<std::uint32_t> remap(m.vertices.size());
+  std::vector<mesh_vertex> unique;
+  unique.reserve(m.vertices.size());
+  for (std::size_t i = 0; i < m.vertices.size(); i++) {
+    const mesh_vertex &v = m.vertices[i];
+    std::size_t slot = hash_vertex(v) & (slots - 1);
+    while (table[slot] != no_vertex && !same_vertex(unique[table[slot]], v)) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    if (table[slot] == no_vertex) {
+      table[slot] = static_cast<std::uint32_t>(unique.size());
+      unique.push_back(v);
+    }
+    remap[i] = table[slot];
+  }
+  for (auto &index : m.indices) {
+    index = remap[index];
+  }
+  m.vertices = std::move(unique);
+  return m.vertices.size();
+}
+
+void optimize_vertex_cache(std::vector<std::uint32_t> &indices, std::size_t vertices, int cache_size) {
+  const std::size_t triangles = indices.size() / 3;
+  if (triangles == 0) {
+    return;
+  }
+  cache_size = std::max(cache_size, 4);
+  const vertex_scores score(cache_size);
+
+  // Triangles of every vertex, the ones emitted are swapped out of the front of the vertex's range
+  std::vector<std::uint32_t> remaining(vertices, 0);
+  for (std::size_t i = 0; i < triangles * 3; i++) {
+    remaining[indices[i]]++;
+  }
+  std::vector<std::uint32_t> first(vertices + 1, 0);
+  for (std::size_t v = 0; v < vertices; v++) {
+    first[v + 1] = first[v] + remaining[v];
+  }
+  std::vector<std::uint32_t> adjacent(triangles * 3);
+  {
+    std::vector<std::uint32_t> fill(first.begin(), first.end() - 1);
+    for (std::size_t t = 0; t < triangles; t++) {
+      for (int k = 0; k < 3; k++) {
+        adjacent[fill[indices[3 * t + k]]++] = static_cast<std::uint32_t>(t);
+      }
+    }
+  }
+
+  std::vector<int> position(vertices, -1);
+  std::vector<float> vertex_score(vertices);
+  for (std::size_t v = 0; v < vertices; v++) {
+    vertex_score[v] = score(-1, remaining[v]);
+  }
+  std::vector<float> triangle_score(triangles);
+  std::vector<bool> emitted(triangles, false);
+  std::size_t best = 0;
+  for (std::size_t t = 0; t < triangles; t++) {
+    triangle_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] +
+                        vertex_score[indices[3 * t + 2]];
+    if (triangle_score[t] > triangle_score[best]) {
+      best = t;
+    }
+  }
+
+  // The cache holds three more entries while a triangle is added, those fall out afterwards
+  std::vector<std::uint32_t> cache;
+  std::vector<std::uint32_t> next_cache;
+  cache.reserve(static_cast<std::size_t>(cache_size) + 3);
+  next_cache.reserve(static_cast<std::size_t>(cache_size) + 3);
+  std::vector<std::uint32_t> ordered(triangles * 3);
+  std::size_t scan = 0; // triangles before it are all emitted
+
+  for (std::size_t out = 0; out < triangles; out++) {
+    if (best == triangles) {
+      // Nothing in the cache has triangles left, start again with the next triangle not emitted
+      while (emitted[scan]) {
+        scan++;
+      }
+      best = scan;
+    }
+    const std::uint32_t *triangle = &indices[3 * best];
+    std::copy(triangle, triangle + 3, &ordered[3 * out]);
+    emitted[best] = true;
+
+    next_cache.assign(triangle, triangle + 3);
+    for (int k = 0; k < 3; k++) {
+      const std::uint32_t v = triangle[k];
+      std::uint32_t *begin = &adjacent[first[v]];
+      std::uint32_t *end = begin + remaining[v];
+      std::uint32_t *at = std::find(begin, end, static_cast<std::uint32_t>(best));
+      std::swap(*at, *(end - 1));
+      remaining[v]--;
+    }
+    for (std::uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        next_cache.push_back(v);
+      }
+    }
+    std::swap(cache, next_cache);
+
+    // New scores for everything which moved in the cache or fell out of it, carried to their triangles
+    for (std::size_t i = 0; i < cache.size(); i++) {
+      const std::uint32_t v = cache[i];
+      position[v] = i < static_cast<std::size_t>(cache_size) ? static_cast<int>(i) : -1;
+      const float updated = score(position[v], remaining[v]);
+      const float change = updated - vertex_score[v];
+      vertex_score[v] = updated;
+      for (std::uint32_t a = first[v]; a < first[v] + remaining[v]; a++) {
+        triangle_score[adjacent[a]] += change;
+      }
+    }
+    if (cache.size() > static_cast<std::size_t>(cache_size)) {
+      cache.resize(static_cast<std::size_t>(cache_size));
+    }
+
+    best = triangles;
+    float best_score = -1;
+    for (std::uint32_t v : cache) {
+      for (std::uint32_t a = first[v]; a < first[v] + remaining[v]; a++) {
+        const std::uint32_t t = adjacent[a];
+        if (triangle_score[t] > best_score) {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+  }
+  std::copy(ordered.begin(), ordered.end(), indices.begin());
+}
+
+void optimize_overdraw(std::vector<std::uint32_t> &indices, const std::vector<mesh_vertex> &vertices,
+                       float threshold) {
+  const std::size_t triangles = indices.size() / 3;
+  if (triangles == 0 || threshold < 1) {
+    return;
+  }
+
+  // Hard boundaries where the cache misses all three vertices, the order restarts there anyway
+  fifo_cache cache(vertices.size(), mesh_stats_cache_size);
+  std::vector<std::size_t> hard{0};
+  for (std::size_t t = 0; t < triangles; t++) {
+    const int misses = cache.use(indices[3 * t]) + cache.use(indices[3 * t + 1]) + cache.use(indices[3 * t + 2]);
+    if (misses == 3 && t > 0) {
+      hard.push_back(t);
+    }
+  }
+  hard.push_back(triangles);
+
+  // Soft boundaries within them, a cluster ends as soon as its ACMR with a cold cache is close enough
+  std::vector<triangle_cluster> clusters;
+  for (std::size_t h = 0; h + 1 < hard.size(); h++) {
+    const std::size_t begin = hard[h];
+    const std::size_t end = hard[h + 1];
+    cache.clear();
+    std::size_t misses = 0;
+    for (std::size_t t = begin; t < end; t++) {
+      for (int k = 0; k < 3; k++) {
+        misses += static_cast<std::size_t>(cache.use(indices[3 * t + k]));
+      }
+    }
+    const float limit = threshold * static_cast<float>(misses) / static_cast<float>(end - begin);
+
+    cache.clear();
+    misses = 0;
+    std::size_t start = begin;
+    for (std::size_t t = begin; t < end; t++) {
+      for (int k = 0; k < 3; k++) {
+        misses += static_cast<std::size_t>(cache.use(indices[3 * t + k]));
+      }
+      if (t + 1 == end || static_cast<float>(misses) / static_cast<float>(t + 1 - start) <= limit) {
+        clusters.push_back({start, t + 1, 0});
+        start = t + 1;
+        misses = 0;
+        cache.clear();
+      }
+    }
+  }
+
+  // Area weighted centres and normals
+  vec3 mesh_centre;
+  float mesh_area = 0;
+  std::vector<vec3> centres(clusters.size());
+  std::vector<vec3> normals(clusters.size());
+  for (std::size_t c = 0; c < clusters.size(); c++) {
+    float area = 0;
+    for (std::size_t t = clusters[c].first; t < clusters[c].last; t++) {
+      const vec3 a = position_of(vertices[indices[3 * t]]);
+      const vec3 b = position_of(vertices[indices[3 * t + 1]]);
+      const vec3 d = position_of(vertices[indices[3 * t + 2]]);
+      const vec3 face = cross(b - a, d - a);
+      const float face_area = length(face);
+      centres[c] += (a + b + d) * (face_area / 3);
+      normals[c] += face;
+      area += face_area;
+    }
+    mesh_centre += centres[c];
+    mesh_area += area;
+    if (area > 0) {
+      centres[c] *= 1 / area;
+    }
+  }
+  if (mesh_area > 0) {
+    mesh_centre *= 1 / mesh_area;
+  }
+  for (std::size_t c = 0; c < clusters.size(); c++) {
+    clusters[c].sort_key = dot(centres[c] - mesh_centre, normalize(normals[c]));
+  }
+  std::stable_sort(clusters.begin(), clusters.end(), [](const triangle_cluster &a, const triangle_cluster &b) {
+    return a.sort_key > b.sort_key;
+  });
+
+  std::vector<std::uint32_t> ordered;
+  ordered.reserve(indices.size());
+  for (const auto &cluster : clusters) {
+    ordered.insert(ordered.end(), indices.begin() + static_cast<std::ptrdiff_t>(3 * cluster.first),
+                   indices.begin() + static_cast<std::ptrdiff_t>(3 * cluster.last));
+  }
+  std::copy(ordered.begin(), ordered.end(), indices.begin());
+}
+
+void optimize_vertex_fetch(mesh &m) {
+  std::vector<std::uint32_t> remap(m.vertices.size(), no_vertex);
+  std::vector<mesh_vertex> ordered;
+  ordered.reserve(m.vertices.size());
+  for (auto &index : m.indices) {
+    if (remap[index] == no_vertex) {
+      remap[index] = static_cast<std::uint32_t>(ordered.size());
+      ordered.push_back(m.vertices[index]);
+    }
+    index = remap[index];
+  }
+  m.vertices = std::move(ordered);
+}
+
+void optimize_mesh(mesh &m, const mesh_optimize_options &options) {
+  deduplicate_vertices(m);
+  optimize_vertex_cache(m.indices, m.vertices.size(), options.cache_size);
+  optimize_overdraw(m.indices, m.vertices, options.overdraw_threshold);
+  optimize_vertex_fetch(m);
+}
+
+quantized_mesh quantize_mesh(const mesh &m) {
+  quantized_mesh q;
+  q.indices = m.indices;
+  float low[3] = {0, 0, 0};
+  float high[3] = {0, 0, 0};
+  for (std::size_t i = 0; i < m.vertices.size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      const float p = m.vertices[i].position[k];
+      low[k] = i == 0 ? p : std::min(low[k], p);
+      high[k] = i == 0 ? p : std::max(high[k], p);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    q.offset[k] = low[k];
+    q.scale[k] = high[k] - low[k];
+  }
+
+  q.vertices.resize(m.vertices.size());
+  for (std::size_t i = 0; i < m.vertices.size(); i++) {
+    for (int k = 0; k < 3; k++) {
+      const float t = q.scale[k] > 0 ? (m.vertices[i].position[k] - q.offset[k]) / q.scale[k] : 0;
+      q.vertices[i].position[k] = static_cast<std::uint16_t>(std::lround(std::max(0.0f, std::min(1.0f, t)) * 65535));
+    }
+    encode_normal(m.vertices[i].normal, q.vertices[i].normal);
+  }
+  return q;
+}
+
+void encode_normal(const float normal[3], std::int8_t encoded[2]) noexcept {
+  // Onto the octahedron |x| + |y| + |z| = 1, its lower half folded over the upper one
+  const float sum = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+  float x = sum > 0 ? normal[0] / sum : 0;
+  float y = sum > 0 ? normal[1] / sum : 0;
+  if (normal[2] < 0) {
+    const float folded_x = (1 - std::fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+    y = (1 - std::fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+    x = folded_x;
+  }
+  encoded[0] = static_cast<std::int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, x)) * 127));
+  encoded[1] = static_cast<std::int8_t>(std::lround(std::max(-1.0f, std::min(1.0f, y)) * 127));
+}
+
+void decode_normal(const std::int8_t encoded[2], float normal[3]) noexcept {
+  float x = static_cast<float>(encoded[0]) / 127;
+  float y = static_cast<float>(encoded[1]) / 127;
+  const float z = 1 - std::fabs(x) - std::fabs(y);
+  if (z < 0) {
+    const float unfolded_x = (1 - std::fabs(y)) * (x >= 0 ? 1.0f : -1.0f);
+    y = (1 - std::fabs(x)) * (y >= 0 ? 1.0f : -1.0f);
+    x = unfolded_x;
+  }
+  const float l = std::sqrt(x * x + y * y + z * z);
+  normal[0] = x / l;
+  normal[1] = y / l;
+  normal[2] = z / l;
+}
+
+void decode_position(const quantized_mesh &q, const packed_vertex &v, float position[3]) noexcept {
+  for (int k = 0; k < 3; k++) {
+    position[k] = q.offset[k] + q.scale[k] * static_cast<float>(v.position[k]) / 65535;
+  }
+}
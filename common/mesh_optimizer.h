@@ -0,0 +1,142 @@
+//
+// Startup optimisation of generated triangle meshes for the post-transform vertex cache, overdraw and size.
+// Shapes are generated the naive way, three new vertices per triangle in the order they are made, which
+// is what replacing the glutSolid calls or glBegin blocks one to one gives. optimize_mesh then
+//  - merges equal vertices,
+//  - orders the triangles with Forsyth's linear-speed vertex cache optimisation,
+//  - splits that order into clusters where a cache restart costs little and draws the clusters facing
+//    outwards first, so they hide the ones behind them (overdraw), and
+//  - renumbers the vertices in the order they are first used, so fetching them walks memory forwards.
+// quantize_mesh packs a vertex into 8 bytes instead of 24, 16 bit positions within the bounds of the mesh
+// and an octahedral normal in two signed bytes. It is decoded by the scale and offset of the positions and
+// decode_normal, which a vertex shader does the same way.
+//
+
+#ifndef COMMON_MESH_OPTIMIZER_H
+#define COMMON_MESH_OPTIMIZER_H
+
+#include "vecmath.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Vertex as the GPU would read it unpacked, 24 bytes
+ */
+struct mesh_vertex {
+  float position[3];
+  float normal[3];
+};
+
+/**
+ * Indexed triangle list
+ */
+struct mesh {
+  std::vector<mesh_vertex> vertices;
+  std::vector<std::uint32_t> indices;
+
+  std::size_t triangles() const noexcept {
+    return indices.size() / 3;
+  }
+};
+
+/**
+ * Sphere around centre like glutSolidSphere, stacks run from the south pole to the north pole
+ */
+void add_sphere(mesh &m, vec3 centre, float radius, int slices, int stacks);
+
+/**
+ * Cone like glutSolidCone, with the base around base and the tip height above it, base included
+ */
+void add_cone(mesh &m, vec3 base, float radius, float height, int slices, int stacks);
+
+/**
+ * Cube like glutSolidCube, every face split into steps by steps squares
+ */
+void add_box(mesh &m, vec3 centre, float size, int steps = 1);
+
+/**
+ * What a vertex and index buffer of a mesh cost
+ */
+struct mesh_stats {
+  std::size_t vertices = 0;
+  std::size_t triangles = 0;
+  float acmr = 0;             // vertices transformed per triangle with a FIFO cache, 0.5 to 3
+  float atvr = 0;             // vertices transformed per vertex of the mesh, 1 is the best
+  std::size_t bytes_per_vertex = 0;
+  std::size_t vertex_bytes = 0;
+  std::size_t index_bytes = 0; // 16 bit indices when the vertices fit, otherwise 32 bit
+};
+
+/**
+ * Size of the post-transform cache the statistics simulate, small like that of older GPUs
+ */
+constexpr int mesh_stats_cache_size = 16;
+
+mesh_stats measure_mesh(const std::vector<std::uint32_t> &indices, std::size_t vertices,
+                        std::size_t bytes_per_vertex);
+
+struct mesh_optimize_options {
+  int cache_size = 32;           // entries of the LRU cache Forsyth's scores model
+  float overdraw_threshold = 1.05f; // clusters may make the ACMR this much worse, 1 turns the sorting off
+};
+
+/**
+ * Merge vertices whose position and normal are the same bit for bit, -0 and 0 count as equal
+ * @return vertices left
+ */
+std::size_t deduplicate_vertices(mesh &m);
+
+/**
+ * Reorder the triangles for the vertex cache, with the scores of Forsyth's "Linear-Speed Vertex Cache
+ * Optimisation". Every triangle keeps the winding of its vertices.
+ */
+void optimize_vertex_cache(std::vector<std::uint32_t> &indices, std::size_t vertices,
+                           int cache_size = mesh_optimize_options{}.cache_size);
+
+/**
+ * Split triangles in vertex cache order into clusters and sort those by how much they face away from
+ * the centre of the mesh, outer ones first. A cluster ends where the cache would restart anyway, or
+ * where ending it keeps the ACMR of the cluster within threshold times the ACMR of the whole run.
+ */
+void optimize_overdraw(std::vector<std::uint32_t> &indices, const std::vector<mesh_vertex> &vertices,
+                       float threshold = mesh_optimize_options{}.overdraw_threshold);
+
+/**
+ * Renumber the vertices in the order the triangles first use them, unused ones are dropped
+ */
+void optimize_vertex_fetch(mesh &m);
+
+/**
+ * All of the above in order
+ */
+void optimize_mesh(mesh &m, const mesh_optimize_options &options = mesh_optimize_options{});
+
+/**
+ * Quantised vertex, 8 bytes: position = offset + scale * position / 65535 per axis
+ */
+struct packed_vertex {
+  std::uint16_t position[3];
+  std::int8_t normal[2];
+};
+
+struct quantized_mesh {
+  std::vector<packed_vertex> vertices;
+  std::vector<std::uint32_t> indices;
+  float offset[3];
+  float scale[3];
+};
+
+quantized_mesh quantize_mesh(const mesh &m);
+
+/**
+ * Octahedral encoding of a unit normal in two signed bytes
+ */
+void encode_normal(const float normal[3], std::int8_t encoded[2]) noexcept;
+
+void decode_normal(const std::int8_t encoded[2], float normal[3]) noexcept;
+
+void decode_position(const quantized_mesh &q, const packed_vertex &v, float position[3]) noexcept;
+
+#endif //COMMON_MESH_OPTIMIZER_H
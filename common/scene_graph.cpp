@@ -0,0 +1,56 @@
+//
+// Scene graph update, see scene_graph.h
+//
+
+#include "scene_graph.h"
+
+#include <algorithm>
+
+scene_graph::node scene_graph::add(node parent, const mat4 &local) {
+  const node n = size();
+  parents_.push_back(parent);
+  local_.push_back(local);
+  world_.push_back(local);
+  dirty_.push_back(1);
+  first_dirty_ = std::min(first_dirty_, n);
+  return n;
+}
+
+void scene_graph::set_local(node n, const mat4 &local) noexcept {
+  local_[n] = local;
+  dirty_[n] = 1;
+  first_dirty_ = std::min(first_dirty_, n);
+}
+
+int scene_graph::update() {
+  const node count = size();
+  int updated = 0;
+  for (node i = first_dirty_; i < count;) {
+    const node p = parents_[i];
+    if (p != no_parent && dirty_[p]) {
+      dirty_[i] = 1;
+    }
+    if (!dirty_[i]) {
+      i++;
+      continue;
+    }
+
+    // Siblings which follow each other are multiplied with their parent in one batch
+    node end = i + 1;
+    while (end < count && parents_[end] == p && (dirty_[end] || (p != no_parent && dirty_[p]))) {
+      dirty_[end] = 1;
+      end++;
+    }
+    if (p == no_parent) {
+      std::copy(local_.begin() + i, local_.begin() + end, world_.begin() + i);
+    } else {
+      concatenate(world_[p], local_.data() + i, world_.data() + i, static_cast<std::size_t>(end - i));
+    }
+    updated += end - i;
+    i = end;
+  }
+  // Parents had to stay marked until all their children were seen
+  std::fill(dirty_.begin() + std::min(first_dirty_, count), dirty_.end(), 0);
+  first_dirty_ = count;
+  return updated;
+}
@@ -0,0 +1,68 @@
+//
+// Transform hierarchy with cached world matrices.
+// Nodes live in flat arrays indexed by node number, a node always comes after its parent, so one pass
+// in order sees every parent before its children. Only nodes whose local transform changed, and their
+// descendants, get their world matrix recomputed.
+//
+
+#ifndef COMMON_SCENE_GRAPH_H
+#define COMMON_SCENE_GRAPH_H
+
+#include "vecmath.h"
+
+#include <vector>
+
+class scene_graph {
+public:
+  using node = int;
+
+  /**
+   * Parent of nodes at the top of the hierarchy
+   */
+  static constexpr node no_parent = -1;
+
+  /**
+   * @param parent an existing node or no_parent
+   * @return the new node, its world matrix is valid after the next update
+   */
+  node add(node parent, const mat4 &local = mat4{});
+
+  /**
+   * Replace the transform relative to the parent, the node and its subtree are updated next time
+   */
+  void set_local(node n, const mat4 &local) noexcept;
+
+  const mat4 &local(node n) const noexcept {
+    return local_[n];
+  }
+
+  /**
+   * @return transform to world space as of the last update
+   */
+  const mat4 &world(node n) const noexcept {
+    return world_[n];
+  }
+
+  node parent(node n) const noexcept {
+    return parents_[n];
+  }
+
+  int size() const noexcept {
+    return static_cast<int>(parents_.size());
+  }
+
+  /**
+   * Recompute the world matrices of all changed subtrees
+   * @return number of world matrices recomputed
+   */
+  int update();
+
+private:
+  std::vector<node> parents_;
+  std::vector<mat4> local_;
+  std::vector<mat4> world_;
+  std::vector<char> dirty_; // world matrix needs recomputing
+  node first_dirty_ = 0;    // no node before it is dirty
+};
+
+#endif //COMMON_SCENE_GRAPH_H
@@ -0,0 +1,33 @@
+//
+// Fixed rate simulation thread, see simulation_thread.h
+//
+
+#include "simulation_thread.h"
+
+simulation_thread::~simulation_thread() {
+  stop();
+}
+
+void simulation_thread::start(std::function<void()> tick) {
+  stop();
+  running_ = true;
+  thread_ = std::thread([this, tick] {
+    auto next = std::chrono::steady_clock::now();
+    while (running_.load(std::memory_order_relaxed)) {
+      tick();
+      next += tick_;
+      const auto now = std::chrono::steady_clock::now();
+      if (next < now) {
+        next = now;
+      }
+      std::this_thread::sleep_until(next);
+    }
+  });
+}
+
+void simulation_thread::stop() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
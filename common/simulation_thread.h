@@ -0,0 +1,40 @@
+//
+// Thread running the game simulation at a fixed rate, apart from the GLUT thread which renders.
+//
+
+#ifndef COMMON_SIMULATION_THREAD_H
+#define COMMON_SIMULATION_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+class simulation_thread {
+public:
+  explicit simulation_thread(int ticks_per_second)
+      : tick_(std::chrono::nanoseconds(1000000000 / ticks_per_second)) {}
+
+  ~simulation_thread();
+
+  simulation_thread(const simulation_thread &) = delete;
+
+  simulation_thread &operator=(const simulation_thread &) = delete;
+
+  /**
+   * Call tick once per period until stop, a tick running late is not made up for
+   */
+  void start(std::function<void()> tick);
+
+  /**
+   * Finish the running tick and join, call before exit since a running std::thread can't be destroyed
+   */
+  void stop();
+
+private:
+  std::chrono::nanoseconds tick_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+};
+
+#endif //COMMON_SIMULATION_THREAD_H
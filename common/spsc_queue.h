@@ -0,0 +1,49 @@
+//
+// Bounded lock-free queue from one producer thread to one consumer thread, for input events.
+//
+
+#ifndef COMMON_SPSC_QUEUE_H
+#define COMMON_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+template<typename T, std::size_t Capacity>
+class spsc_queue {
+public:
+  /**
+   * Producer side
+   * @return false if the queue is full and value was dropped
+   */
+  bool push(const T &value) noexcept {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    slots_[tail % Capacity] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side
+   * @return false if the queue is empty
+   */
+  bool pop(T &value) noexcept {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = slots_[head % Capacity];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  T slots_[Capacity];
+  // On their own cache lines, so the two threads don't invalidate each other's counter
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<std::size_t> tail_{0};
+};
+
+#endif //COMMON_SPSC_QUEUE_H
@@ -0,0 +1,135 @@
+//
+// Minimal fixed size thread pool, see thread_pool.h
+//
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+thread_pool::thread_pool(unsigned threads) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  workers_.reserve(threads);
+  for (unsigned i = 0; i < threads; i++) {
+    workers_.emplace_back([this] { run(); });
+  }
+}
+
+thread_pool::~thread_pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void thread_pool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (task_count_ == tasks_.size()) {
+      // Unroll the ring into a bigger one
+      std::vector<std::function<void()>> grown(std::max<std::size_t>(tasks_.size() * 2, 16));
+      for (std::size_t i = 0; i < task_count_; i++) {
+        grown[i] = std::move(tasks_[(first_task_ + i) % tasks_.size()]);
+      }
+      tasks_.swap(grown);
+      first_task_ = 0;
+    }
+    tasks_[(first_task_ + task_count_) % tasks_.size()] = std::move(task);
+    task_count_++;
+  }
+  wake_.notify_one();
+}
+
+void thread_pool::parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &body) {
+  if (end <= begin) {
+    return;
+  }
+  grain = std::max(1, grain);
+  const int chunks = (end - begin + grain - 1) / grain;
+  if (chunks == 1 || workers_.empty()) {
+    body(begin, end);
+    return;
+  }
+
+  loop *l = acquire_loop();
+  l->body = &body;
+  l->begin = begin;
+  l->end = end;
+  l->grain = grain;
+  l->chunks = chunks;
+  l->next = 0;
+  l->done = 0;
+  const int helpers = std::min(static_cast<int>(workers_.size()), chunks - 1);
+  l->users = helpers + 1;
+
+  // Helpers that start after the last chunk was claimed return without touching body
+  for (int i = 0; i < helpers; i++) {
+    submit([this, l] {
+      work(*l);
+      release_loop(l);
+    });
+  }
+  work(*l);
+
+  {
+    std::unique_lock<std::mutex> lock(l->mutex);
+    l->finished.wait(lock, [l] { return l->done.load() == l->chunks; });
+  }
+  release_loop(l);
+}
+
+thread_pool::loop *thread_pool::acquire_loop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_loops_.empty()) {
+    loops_.push_back(std::make_unique<loop>());
+    free_loops_.reserve(loops_.size());
+    return loops_.back().get();
+  }
+  loop *l = free_loops_.back();
+  free_loops_.pop_back();
+  return l;
+}
+
+void thread_pool::release_loop(loop *l) {
+  if (--l->users == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_loops_.push_back(l);
+  }
+}
+
+void thread_pool::work(loop &l) {
+  int chunk;
+  while ((chunk = l.next++) < l.chunks) {
+    const int first = l.begin + chunk * l.grain;
+    (*l.body)(first, std::min(l.end, first + l.grain));
+    if (++l.done == l.chunks) {
+      std::lock_guard<std::mutex> lock(l.mutex);
+      l.finished.notify_all();
+    }
+  }
+}
+
+void thread_pool::run() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this] { return stopping_ || task_count_ != 0; });
+      // Drain the queue before shutting down so no submitted work is lost
+      if (task_count_ == 0) {
+        return;
+      }
+      task = std::move(tasks_[first_task_]);
+      tasks_[first_task_] = nullptr;
+      first_task_ = (first_task_ + 1) % tasks_.size();
+      task_count_--;
+    }
+    task();
+  }
+}
@@ -0,0 +1,101 @@
+//
+// Minimal fixed size thread pool for CPU side work.
+//
+
+#ifndef COMMON_THREAD_POOL_H
+#define COMMON_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+public:
+  /**
+   * @param threads number of workers, 0 picks one per hardware thread
+   */
+  explicit thread_pool(unsigned threads = 0);
+
+  ~thread_pool();
+
+  thread_pool(const thread_pool &) = delete;
+
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  /**
+   * Queue a task, it runs on one of the workers at some point
+   */
+  void submit(std::function<void()> task);
+
+  /**
+   * Run body over [begin, end) in chunks of grain indices and wait for all of them.
+   * The calling thread works on chunks as well, so this may be used from inside a task.
+   * Once the pool ran as many loops at once as it ever will, a call doesn't allocate.
+   * @param body called with the half open range [first, last) of one chunk
+   */
+  void parallel_for(int begin, int end, int grain, const std::function<void(int, int)> &body);
+
+  unsigned size() const noexcept {
+    return static_cast<unsigned>(workers_.size());
+  }
+
+private:
+  /**
+   * Progress of one parallel_for, owned by the pool so helpers which start late don't outlive it.
+   * Helpers get a pointer to it, which std::function keeps without allocating.
+   */
+  struct loop {
+    const std::function<void(int, int)> *body = nullptr;
+    int begin = 0;
+    int end = 0;
+    int grain = 1;
+    int chunks = 0;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    std::atomic<int> users{0}; // the caller and helpers yet to return, the loop is free again at 0
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+
+  std::vector<std::thread> workers_;
+  // Ring of queued tasks, it only grows, so a steady stream of small tasks doesn't allocate
+  std::vector<std::function<void()>> tasks_;
+  std::size_t first_task_ = 0;
+  std::size_t task_count_ = 0;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::vector<std::unique_ptr<loop>> loops_;
+  std::vector<loop *> free_loops_; // capacity for all of loops_, so releasing doesn't allocate
+
+  void run();
+
+  loop *acquire_loop();
+
+  void release_loop(loop *l);
+
+  /**
+   * Claim and run chunks of l until there are none left
+   */
+  static void work(loop &l);
+};
+
+/**
+ * thread_pool::parallel_for on pool, or body over the whole range on the calling thread without a pool
+ */
+inline void parallel_for(thread_pool *pool, int begin, int end, int grain,
+                         const std::function<void(int, int)> &body) {
+  if (pool == nullptr) {
+    if (begin < end) {
+      body(begin, end);
+    }
+  } else {
+    pool->parallel_for(begin, end, grain, body);
+  }
+}
+
+#endif //COMMON_THREAD_POOL_H
@@ -0,0 +1,60 @@
+//
+// Lock-free triple buffer handing snapshots from one writer thread to one reader thread.
+// The writer fills the back slot and swaps it with the middle one, the reader swaps the middle slot
+// with its front slot when the middle holds something newer. Neither side ever waits for the other
+// and the reader always sees a complete snapshot, skipping those it was too slow for.
+//
+
+#ifndef COMMON_TRIPLE_BUFFER_H
+#define COMMON_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+template<typename T>
+class triple_buffer {
+public:
+  /**
+   * Slot the writer fills, only the writer may touch it until publish
+   */
+  T &back() noexcept {
+    return slots_[back_];
+  }
+
+  /**
+   * Make the back slot the newest snapshot, the writer gets the slot the reader doesn't hold in exchange.
+   * The new back slot holds an older snapshot, not an empty one, so vectors in it keep their memory.
+   */
+  void publish() noexcept {
+    back_ = middle_.exchange(back_ | fresh_bit, std::memory_order_acq_rel) & index_mask;
+  }
+
+  /**
+   * Take the newest published snapshot if there is one the reader hasn't seen
+   * @return true if front changed
+   */
+  bool update() noexcept {
+    if ((middle_.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+    return true;
+  }
+
+  /**
+   * Snapshot the reader holds, stays untouched until the next update
+   */
+  const T &front() const noexcept {
+    return slots_[front_];
+  }
+
+private:
+  static constexpr unsigned index_mask = 3;
+  static constexpr unsigned fresh_bit = 4;
+
+  T slots_[3];
+  unsigned back_ = 0;
+  std::atomic<unsigned> middle_{1};
+  unsigned front_ = 2;
+};
+
+#endif //COMMON_TRIPLE_BUFFER_H
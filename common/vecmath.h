@@ -0,0 +1,674 @@
+//
+// Header only vector, matrix and quaternion math shared by the games.
+// vec3, vec4 and quat fill one 16 byte SSE register, mat4 holds four of them as columns in the order
+// glLoadMatrixf expects. Batched transforms use AVX on two vectors at once when the CPU has it, the
+// executables themselves only assume the baseline ISA. Angles are in radians.
+//
+
+#ifndef COMMON_VECMATH_H
+#define COMMON_VECMATH_H
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define VECMATH_SSE 1
+#include <immintrin.h>
+#else
+#define VECMATH_SSE 0
+#endif
+
+#if VECMATH_SSE && (defined(__GNUC__) || defined(__clang__))
+#define VECMATH_AVX 1
+#define VECMATH_TARGET_AVX __attribute__((target("avx")))
+#else
+#define VECMATH_AVX 0
+#define VECMATH_TARGET_AVX
+#endif
+
+constexpr float vecmath_pi = 3.14159265358979f;
+
+constexpr float radians(float degrees) noexcept {
+  return degrees * (vecmath_pi / 180);
+}
+
+#if VECMATH_SSE
+
+/**
+ * Sine and cosine of four angles, Cephes' single precision polynomials after reducing to [-pi/4, pi/4].
+ * Accurate to a few ulp for |angle| below 8192.
+ */
+inline void sincos4(__m128 angle, __m128 &sin, __m128 &cos) noexcept {
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  __m128 sin_sign = _mm_and_ps(angle, sign_mask);
+  const __m128 x = _mm_andnot_ps(sign_mask, angle);
+
+  // Octant, rounded up to an even one so the remainder lies within pi/4 of it
+  __m128i octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(4 / vecmath_pi)));
+  octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+  const __m128 y = _mm_cvtepi32_ps(octant);
+
+  sin_sign = _mm_xor_ps(sin_sign, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29)));
+  const __m128 cos_sign = _mm_castsi128_ps(
+      _mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+  // Octants 2 and 6 swap the polynomials
+  const __m128 swap = _mm_castsi128_ps(
+      _mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+  // x - y * pi / 4 in three steps, pi / 4 split so the first products are exact
+  __m128 r = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+  r = _mm_sub_ps(r, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+  r = _mm_sub_ps(r, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+  const __m128 z = _mm_mul_ps(r, r);
+
+  __m128 c = _mm_set1_ps(2.443315711809948e-5f);
+  c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(-1.388731625493765e-3f));
+  c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(4.166664568298827e-2f));
+  c = _mm_mul_ps(_mm_mul_ps(c, z), z);
+  c = _mm_add_ps(_mm_sub_ps(c, _mm_mul_ps(z, _mm_set1_ps(0.5f))), _mm_set1_ps(1));
+
+  __m128 s = _mm_set1_ps(-1.9515295891e-4f);
+  s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(8.3321608736e-3f));
+  s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(-1.6666654611e-1f));
+  s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), r), r);
+
+  sin = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), sin_sign);
+  cos = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), cos_sign);
+}
+
+#endif
+
+/**
+ * Sine and cosine of one angle in one go, see sincos4
+ */
+inline void fast_sincos(float angle, float &sin, float &cos) noexcept {
+#if VECMATH_SSE
+  __m128 s;
+  __m128 c;
+  sincos4(_mm_set_ss(angle), s, c);
+  sin = _mm_cvtss_f32(s);
+  cos = _mm_cvtss_f32(c);
+#else
+  sin = std::sin(angle);
+  cos = std::cos(angle);
+#endif
+}
+
+/**
+ * @return angle moved into [-pi, pi], keeps fast_sincos accurate for angles which keep growing
+ */
+inline float wrap_angle(float angle) noexcept {
+  return angle - 2 * vecmath_pi * std::floor((angle + vecmath_pi) / (2 * vecmath_pi));
+}
+
+/**
+ * Point or direction, the fourth lane is always 0
+ */
+struct alignas(16) vec3 {
+  float x = 0;
+  float y = 0;
+  float z = 0;
+
+  constexpr vec3() = default;
+
+  constexpr vec3(float x, float y, float z) : x{x}, y{y}, z{z} {}
+
+#if VECMATH_SSE
+  explicit vec3(__m128 v) noexcept {
+    _mm_store_ps(&x, v);
+  }
+
+  __m128 simd() const noexcept {
+    return _mm_load_ps(&x);
+  }
+#endif
+
+  vec3 &operator+=(const vec3 &other) noexcept;
+
+  vec3 &operator-=(const vec3 &other) noexcept;
+
+  vec3 &operator*=(float f) noexcept;
+
+private:
+  float unused_ = 0;
+};
+
+struct alignas(16) vec4 {
+  float x = 0;
+  float y = 0;
+  float z = 0;
+  float w = 0;
+
+  constexpr vec4() = default;
+
+  constexpr vec4(float x, float y, float z, float w) : x{x}, y{y}, z{z}, w{w} {}
+
+  constexpr vec4(const vec3 &v, float w) : x{v.x}, y{v.y}, z{v.z}, w{w} {}
+
+#if VECMATH_SSE
+  explicit vec4(__m128 v) noexcept {
+    _mm_store_ps(&x, v);
+  }
+
+  __m128 simd() const noexcept {
+    return _mm_load_ps(&x);
+  }
+#endif
+
+  vec3 xyz() const noexcept {
+    return vec3{x, y, z};
+  }
+};
+
+#if VECMATH_SSE
+
+inline vec3 operator+(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{_mm_add_ps(a.simd(), b.simd())};
+}
+
+inline vec3 operator-(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{_mm_sub_ps(a.simd(), b.simd())};
+}
+
+inline vec3 operator-(const vec3 &a) noexcept {
+  return vec3{_mm_sub_ps(_mm_setzero_ps(), a.simd())};
+}
+
+inline vec3 operator*(const vec3 &a, float f) noexcept {
+  return vec3{_mm_mul_ps(a.simd(), _mm_set1_ps(f))};
+}
+
+/**
+ * Component wise product
+ */
+inline vec3 operator*(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{_mm_mul_ps(a.simd(), b.simd())};
+}
+
+inline bool operator==(const vec3 &a, const vec3 &b) noexcept {
+  return (_mm_movemask_ps(_mm_cmpeq_ps(a.simd(), b.simd())) & 0x7) == 0x7;
+}
+
+inline float dot(const vec3 &a, const vec3 &b) noexcept {
+  const __m128 p = _mm_mul_ps(a.simd(), b.simd());
+  const __m128 xy = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+  return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(p, p)));
+}
+
+inline vec3 cross(const vec3 &a, const vec3 &b) noexcept {
+  const __m128 va = a.simd();
+  const __m128 vb = b.simd();
+  const __m128 a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+  const __m128 c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+  return vec3{_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1))};
+}
+
+inline vec3 component_min(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{_mm_min_ps(a.simd(), b.simd())};
+}
+
+inline vec3 component_max(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{_mm_max_ps(a.simd(), b.simd())};
+}
+
+#else
+
+inline vec3 operator+(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+inline vec3 operator-(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+inline vec3 operator-(const vec3 &a) noexcept {
+  return vec3{-a.x, -a.y, -a.z};
+}
+
+inline vec3 operator*(const vec3 &a, float f) noexcept {
+  return vec3{a.x * f, a.y * f, a.z * f};
+}
+
+inline vec3 operator*(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.x * b.x, a.y * b.y, a.z * b.z};
+}
+
+inline bool operator==(const vec3 &a, const vec3 &b) noexcept {
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+inline float dot(const vec3 &a, const vec3 &b) noexcept {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3 cross(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+inline vec3 component_min(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z};
+}
+
+inline vec3 component_max(const vec3 &a, const vec3 &b) noexcept {
+  return vec3{a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z};
+}
+
+#endif
+
+inline vec3 operator*(float f, const vec3 &a) noexcept {
+  return a * f;
+}
+
+inline bool operator!=(const vec3 &a, const vec3 &b) noexcept {
+  return !(a == b);
+}
+
+inline vec3 &vec3::operator+=(const vec3 &other) noexcept {
+  return *this = *this + other;
+}
+
+inline vec3 &vec3::operator-=(const vec3 &other) noexcept {
+  return *this = *this - other;
+}
+
+inline vec3 &vec3::operator*=(float f) noexcept {
+  return *this = *this * f;
+}
+
+inline float length(const vec3 &a) noexcept {
+  return std::sqrt(dot(a, a));
+}
+
+/**
+ * @return a scaled to length 1, a itself if it has no length
+ */
+inline vec3 normalize(const vec3 &a) noexcept {
+  const float l = length(a);
+  return l > 0 ? a * (1 / l) : a;
+}
+
+/**
+ * Rotation, x y z is the axis times sin(angle / 2) and w is cos(angle / 2)
+ */
+struct alignas(16) quat {
+  float x = 0;
+  float y = 0;
+  float z = 0;
+  float w = 1;
+
+  constexpr quat() = default;
+
+  constexpr quat(float x, float y, float z, float w) : x{x}, y{y}, z{z}, w{w} {}
+
+  /**
+   * @param axis unit length
+   */
+  static quat from_axis_angle(const vec3 &axis, float angle) noexcept {
+    float s;
+    float c;
+    fast_sincos(angle / 2, s, c);
+    return quat{axis.x * s, axis.y * s, axis.z * s, c};
+  }
+};
+
+/**
+ * Rotation by b followed by a
+ */
+inline quat operator*(const quat &a, const quat &b) noexcept {
+  return quat{a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+              a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+              a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+              a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z};
+}
+
+inline quat normalize(const quat &q) noexcept {
+  const float l = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  return l > 0 ? quat{q.x / l, q.y / l, q.z / l, q.w / l} : quat{};
+}
+
+/**
+ * @return v rotated by the unit quaternion q
+ */
+inline vec3 rotate(const quat &q, const vec3 &v) noexcept {
+  const vec3 u{q.x, q.y, q.z};
+  const vec3 t = cross(u, v) * 2;
+  return v + t * q.w + cross(u, t);
+}
+
+/**
+ * Normalised linear interpolation along the shorter arc, close to slerp for the small steps of animations
+ */
+inline quat nlerp(const quat &a, const quat &b, float t) noexcept {
+  const float sign = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0 ? -1.0f : 1.0f;
+  const float s = 1 - t;
+  const float u = t * sign;
+  return normalize(quat{a.x * s + b.x * u, a.y * s + b.y * u, a.z * s + b.z * u, a.w * s + b.w * u});
+}
+
+/**
+ * Column major 4x4 matrix, m[column * 4 + row] as OpenGL stores it
+ */
+struct alignas(16) mat4 {
+  float m[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+  /**
+   * @return pointer for glLoadMatrixf and glMultMatrixf
+   */
+  const float *data() const noexcept {
+    return m;
+  }
+
+#if VECMATH_SSE
+  __m128 column(int i) const noexcept {
+    return _mm_load_ps(m + 4 * i);
+  }
+#endif
+
+  static mat4 identity() noexcept {
+    return mat4{};
+  }
+
+  static mat4 translation(float x, float y, float z) noexcept {
+    mat4 r;
+    r.m[12] = x;
+    r.m[13] = y;
+    r.m[14] = z;
+    return r;
+  }
+
+  static mat4 translation(const vec3 &v) noexcept {
+    return translation(v.x, v.y, v.z);
+  }
+
+  static mat4 scaling(float x, float y, float z) noexcept {
+    mat4 r;
+    r.m[0] = x;
+    r.m[5] = y;
+    r.m[10] = z;
+    return r;
+  }
+
+  static mat4 scaling(float f) noexcept {
+    return scaling(f, f, f);
+  }
+
+  static mat4 rotation(const quat &q) noexcept {
+    const float xx = q.x * q.x;
+    const float yy = q.y * q.y;
+    const float zz = q.z * q.z;
+    const float xy = q.x * q.y;
+    const float xz = q.x * q.z;
+    const float yz = q.y * q.z;
+    const float wx = q.w * q.x;
+    const float wy = q.w * q.y;
+    const float wz = q.w * q.z;
+    mat4 r;
+    r.m[0] = 1 - 2 * (yy + zz);
+    r.m[1] = 2 * (xy + wz);
+    r.m[2] = 2 * (xz - wy);
+    r.m[4] = 2 * (xy - wz);
+    r.m[5] = 1 - 2 * (xx + zz);
+    r.m[6] = 2 * (yz + wx);
+    r.m[8] = 2 * (xz + wy);
+    r.m[9] = 2 * (yz - wx);
+    r.m[10] = 1 - 2 * (xx + yy);
+    return r;
+  }
+
+  /**
+   * Same as glRotatef, but in radians
+   * @param axis unit length
+   */
+  static mat4 rotation(float angle, const vec3 &axis) noexcept {
+    return rotation(quat::from_axis_angle(axis, angle));
+  }
+
+  static mat4 rotation_x(float angle) noexcept {
+    float s;
+    float c;
+    fast_sincos(angle, s, c);
+    mat4 r;
+    r.m[5] = c;
+    r.m[6] = s;
+    r.m[9] = -s;
+    r.m[10] = c;
+    return r;
+  }
+
+  static mat4 rotation_y(float angle) noexcept {
+    float s;
+    float c;
+    fast_sincos(angle, s, c);
+    mat4 r;
+    r.m[0] = c;
+    r.m[2] = -s;
+    r.m[8] = s;
+    r.m[10] = c;
+    return r;
+  }
+
+  static mat4 rotation_z(float angle) noexcept {
+    float s;
+    float c;
+    fast_sincos(angle, s, c);
+    mat4 r;
+    r.m[0] = c;
+    r.m[1] = s;
+    r.m[4] = -s;
+    r.m[5] = c;
+    return r;
+  }
+
+  /**
+   * Same as gluPerspective, but in radians
+   */
+  static mat4 perspective(float fovy, float aspect, float near_plane, float far_plane) noexcept {
+    const float f = 1 / std::tan(fovy / 2);
+    mat4 r;
+    r.m[0] = f / aspect;
+    r.m[5] = f;
+    r.m[10] = (far_plane + near_plane) / (near_plane - far_plane);
+    r.m[11] = -1;
+    r.m[14] = 2 * far_plane * near_plane / (near_plane - far_plane);
+    r.m[15] = 0;
+    return r;
+  }
+
+  /**
+   * Same as gluLookAt
+   */
+  static mat4 look_at(const vec3 &eye, const vec3 &center, const vec3 &up) noexcept {
+    const vec3 f = normalize(center - eye);
+    const vec3 s = normalize(cross(f, up));
+    const vec3 u = cross(s, f);
+    mat4 r;
+    r.m[0] = s.x;
+    r.m[4] = s.y;
+    r.m[8] = s.z;
+    r.m[1] = u.x;
+    r.m[5] = u.y;
+    r.m[9] = u.z;
+    r.m[2] = -f.x;
+    r.m[6] = -f.y;
+    r.m[10] = -f.z;
+    r.m[12] = -dot(s, eye);
+    r.m[13] = -dot(u, eye);
+    r.m[14] = dot(f, eye);
+    return r;
+  }
+};
+
+#if VECMATH_SSE
+
+/**
+ * @return column 0 * v.x + column 1 * v.y + column 2 * v.z + column 3 * v.w
+ */
+inline __m128 combine_columns(const mat4 &a, __m128 v) noexcept {
+  __m128 r = _mm_mul_ps(a.column(0), _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+  r = _mm_add_ps(r, _mm_mul_ps(a.column(1), _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+  r = _mm_add_ps(r, _mm_mul_ps(a.column(2), _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+  return _mm_add_ps(r, _mm_mul_ps(a.column(3), _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+}
+
+inline vec4 operator*(const mat4 &a, const vec4 &v) noexcept {
+  return vec4{combine_columns(a, v.simd())};
+}
+
+/**
+ * Transform b followed by a, the same as glMultMatrixf(a) followed by glMultMatrixf(b)
+ */
+inline mat4 operator*(const mat4 &a, const mat4 &b) noexcept {
+  mat4 r;
+  for (int i = 0; i < 4; i++) {
+    _mm_store_ps(r.m + 4 * i, combine_columns(a, b.column(i)));
+  }
+  return r;
+}
+
+#else
+
+inline vec4 operator*(const mat4 &a, const vec4 &v) noexcept {
+  vec4 r;
+  float *out = &r.x;
+  for (int row = 0; row < 4; row++) {
+    out[row] = a.m[row] * v.x + a.m[4 + row] * v.y + a.m[8 + row] * v.z + a.m[12 + row] * v.w;
+  }
+  return r;
+}
+
+inline mat4 operator*(const mat4 &a, const mat4 &b) noexcept {
+  mat4 r;
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      float sum = 0;
+      for (int k = 0; k < 4; k++) {
+        sum += a.m[4 * k + row] * b.m[4 * column + k];
+      }
+      r.m[4 * column + row] = sum;
+    }
+  }
+  return r;
+}
+
+#endif
+
+/**
+ * @return point p transformed by a, ignoring the projective row
+ */
+inline vec3 transform_point(const mat4 &a, const vec3 &p) noexcept {
+  return (a * vec4{p, 1}).xyz();
+}
+
+/**
+ * @return direction v transformed by a, without the translation
+ */
+inline vec3 transform_vector(const mat4 &a, const vec3 &v) noexcept {
+  return (a * vec4{v, 0}).xyz();
+}
+
+namespace vecmath_detail {
+
+inline bool cpu_has_avx() noexcept {
+#if VECMATH_AVX
+  static const bool supported = __builtin_cpu_supports("avx");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+#if VECMATH_AVX
+
+/**
+ * Two vectors per iteration, each 128 bit lane holds one of them
+ * @param w 1 for points, 0 for directions
+ */
+VECMATH_TARGET_AVX
+inline std::size_t transform_avx(const mat4 &a, const vec3 *in, vec3 *out, std::size_t count, float w) noexcept {
+  const __m256 c0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a.m));
+  const __m256 c1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a.m + 4));
+  const __m256 c2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a.m + 8));
+  const __m256 c3 = _mm256_mul_ps(_mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a.m + 12)),
+                                  _mm256_set1_ps(w));
+  // Keeps the unused lane of the results 0
+  const __m256 lanes = _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0));
+  std::size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const __m256 v = _mm256_loadu_ps(&in[i].x);
+    __m256 r = _mm256_add_ps(c3, _mm256_mul_ps(c0, _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0))));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1))));
+    r = _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2))));
+    _mm256_storeu_ps(&out[i].x, _mm256_and_ps(r, lanes));
+  }
+  return i;
+}
+
+/**
+ * Four products per iteration, each 128 bit lane of the two accumulators holds one column of one of two
+ * results
+ */
+VECMATH_TARGET_AVX
+inline void concatenate_avx(const mat4 &parent, const mat4 *local, mat4 *world, std::size_t count) noexcept {
+  const __m256 c0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(parent.m));
+  const __m256 c1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(parent.m + 4));
+  const __m256 c2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(parent.m + 8));
+  const __m256 c3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(parent.m + 12));
+  for (std::size_t i = 0; i < count; i++) {
+    for (int half = 0; half < 16; half += 8) {
+      const __m256 v = _mm256_loadu_ps(local[i].m + half);
+      __m256 r = _mm256_mul_ps(c0, _mm256_permute_ps(v, _MM_SHUFFLE(0, 0, 0, 0)));
+      r = _mm256_add_ps(r, _mm256_mul_ps(c1, _mm256_permute_ps(v, _MM_SHUFFLE(1, 1, 1, 1))));
+      r = _mm256_add_ps(r, _mm256_mul_ps(c2, _mm256_permute_ps(v, _MM_SHUFFLE(2, 2, 2, 2))));
+      r = _mm256_add_ps(r, _mm256_mul_ps(c3, _mm256_permute_ps(v, _MM_SHUFFLE(3, 3, 3, 3))));
+      _mm256_storeu_ps(world[i].m + half, r);
+    }
+  }
+}
+
+#endif
+
+inline void transform(const mat4 &a, const vec3 *in, vec3 *out, std::size_t count, float w) noexcept {
+  std::size_t i = 0;
+#if VECMATH_AVX
+  if (cpu_has_avx()) {
+    i = transform_avx(a, in, out, count, w);
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = (a * vec4{in[i], w}).xyz();
+  }
+}
+
+} // namespace vecmath_detail
+
+/**
+ * out[i] = transform_point(a, in[i]), in and out may be the same array
+ */
+inline void transform_points(const mat4 &a, const vec3 *in, vec3 *out, std::size_t count) noexcept {
+  vecmath_detail::transform(a, in, out, count, 1);
+}
+
+/**
+ * out[i] = transform_vector(a, in[i]), in and out may be the same array
+ */
+inline void transform_vectors(const mat4 &a, const vec3 *in, vec3 *out, std::size_t count) noexcept {
+  vecmath_detail::transform(a, in, out, count, 0);
+}
+
+/**
+ * world[i] = parent * local[i], the world matrices of all children of one node
+ */
+inline void concatenate(const mat4 &parent, const mat4 *local, mat4 *world, std::size_t count) noexcept {
+#if VECMATH_AVX
+  if (vecmath_detail::cpu_has_avx()) {
+    vecmath_detail::concatenate_avx(parent, local, world, count);
+    return;
+  }
+#endif
+  for (std::size_t i = 0; i < count; i++) {
+    world[i] = parent * local[i];
+  }
+}
+
+#endif //COMMON_VECMATH_H
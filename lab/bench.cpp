@@ -0,0 +1,257 @@
+//
+// CPU paths of the lab: BMP header parsing, the BGR to RGBA swizzle, procedural textures, mip chains,
+// the image kernels, summed-area filters and fused filter chains.
+// Times are per file for the parse and per texel for the rest. The image processing runs once on the
+// calling thread (serial) and once on a pool with a thread per core (pool).
+// Usage: bench [--json path|-] [--filter text] [--samples n] [--min-sample-ms ms]
+//
+
+#include "bench.h"
+#include "bmp_image.h"
+#include "filter_pipeline.h"
+#include "image_kernels.h"
+#include "mipmap.h"
+#include "procedural.h"
+#include "summed_area.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int image_size = 512;
+constexpr int kernel_size = 1024; // of the images the kernels and filters run over
+
+void put_u16(std::vector<unsigned char> &out, std::size_t at, std::uint16_t value) {
+  out[at] = static_cast<unsigned char>(value);
+  out[at + 1] = static_cast<unsigned char>(value >> 8u);
+}
+
+void put_u32(std::vector<unsigned char> &out, std::size_t at, std::uint32_t value) {
+  for (unsigned i = 0; i < 4; i++) {
+    out[at + i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+/**
+ * Bottom-up 24 bit BMP file as it would be read from disk
+ */
+std::vector<unsigned char> bmp_file(int width, int height) {
+  constexpr std::size_t headers = 14 + 40;
+  const std::size_t stride = (static_cast<std::size_t>(width) * 3 + 3) & ~std::size_t{3};
+  std::vector<unsigned char> file(headers + stride * height);
+  file[0] = 'B';
+  file[1] = 'M';
+  put_u32(file, 2, static_cast<std::uint32_t>(file.size()));
+  put_u32(file, 10, headers);
+  put_u32(file, 14, 40);
+  put_u32(file, 18, static_cast<std::uint32_t>(width));
+  put_u32(file, 22, static_cast<std::uint32_t>(height));
+  put_u16(file, 26, 1);
+  put_u16(file, 28, 24);
+  put_u32(file, 34, static_cast<std::uint32_t>(stride * height));
+  for (std::size_t i = headers; i < file.size(); i++) {
+    file[i] = static_cast<unsigned char>(i * 31);
+  }
+  return file;
+}
+
+/**
+ * Pseudo random bytes, so neither the compiler nor the branch predictors can take shortcuts on the input
+ */
+std::vector<unsigned char> noise(std::size_t size) {
+  std::vector<unsigned char> bytes(size);
+  unsigned state = 12345;
+  for (auto &b : bytes) {
+    state = state * 1664525u + 1013904223u;
+    b = static_cast<unsigned char>(state >> 24u);
+  }
+  return bytes;
+}
+
+image_buffer buffer_of(std::vector<unsigned char> &pixels, int width, int height, pixel_format format) {
+  image_buffer img;
+  img.pixels = pixels.data();
+  img.width = width;
+  img.height = height;
+  img.stride = static_cast<std::size_t>(width) * bytes_per_pixel(format);
+  img.format = format;
+  return img;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bench_suite suite("Lab", argc, argv);
+  const double texels = static_cast<double>(image_size) * image_size;
+
+  const std::vector<unsigned char> file = bmp_file(image_size, image_size);
+  image_view view;
+  if (!parse_bmp(file.data(), file.size(), view)) {
+    std::cout << "Generated BMP was rejected" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  suite.run("parse_bmp", 1, [&] {
+    image_view parsed;
+    do_not_optimize(parse_bmp(file.data(), file.size(), parsed));
+    do_not_optimize(parsed);
+  });
+
+  std::vector<unsigned char> rgba(static_cast<std::size_t>(image_size) * image_size * 4);
+  suite.run("convert_image/bgr8_to_rgba8", texels, [&] {
+    do_not_optimize(convert_image(view, pixel_format::rgba8, view.bottom_up, rgba.data(),
+                                  static_cast<std::size_t>(image_size) * 4));
+  });
+  suite.run("convert_image/bgr8_to_rgba8_flipped", texels, [&] {
+    do_not_optimize(convert_image(view, pixel_format::rgba8, !view.bottom_up, rgba.data(),
+                                  static_cast<std::size_t>(image_size) * 4));
+  });
+
+  // Single threaded so the numbers don't depend on the machine's core count
+  procedural_options checker;
+  checker.pattern = texture_pattern::checker;
+  suite.run("generate_texture/checker", texels, [&] {
+    generate_texture(checker, rgba.data(), image_size, image_size, static_cast<std::size_t>(image_size) * 4, nullptr);
+    do_not_optimize(rgba.data());
+  });
+
+  // Everything below runs serial and on the pool
+  thread_pool pool;
+  const struct {
+    const char *name;
+    thread_pool *pool;
+  } runs[] = {{"serial", nullptr}, {"pool", &pool}};
+  const double pixels = static_cast<double>(kernel_size) * kernel_size;
+  const std::size_t gray_stride = kernel_size;
+
+  std::vector<unsigned char> generated(static_cast<std::size_t>(kernel_size) * kernel_size * 4, 0);
+  const struct {
+    texture_pattern pattern;
+    const char *name;
+  } patterns[] = {
+      {texture_pattern::gradient, "gradient"},
+      {texture_pattern::value_noise, "value_noise"},
+      {texture_pattern::perlin_noise, "perlin_noise"},
+      {texture_pattern::marble, "marble"},
+      {texture_pattern::cellular, "cellular"},
+  };
+  for (const auto &p : patterns) {
+    procedural_options options;
+    options.pattern = p.pattern;
+    for (const auto &run : runs) {
+      suite.run(std::string("generate_texture/") + p.name + "/" + run.name, pixels, [&] {
+        generate_texture(options, generated.data(), kernel_size, kernel_size,
+                         static_cast<std::size_t>(kernel_size) * 4, run.pool);
+        do_not_optimize(generated.data());
+      });
+    }
+  }
+
+  for (pixel_format format : {pixel_format::rgba8, pixel_format::rgb8}) {
+    const std::vector<unsigned char> source = noise(static_cast<std::size_t>(kernel_size) * kernel_size *
+                                                    bytes_per_pixel(format));
+    image_view src;
+    src.pixels = source.data();
+    src.width = kernel_size;
+    src.height = kernel_size;
+    src.stride = static_cast<std::size_t>(kernel_size) * bytes_per_pixel(format);
+    src.format = format;
+    for (mip_filter filter : {mip_filter::box, mip_filter::kaiser}) {
+      mip_options options;
+      options.filter = filter;
+      for (const auto &run : runs) {
+        suite.run(std::string("build_mip_chain/") + (filter == mip_filter::box ? "box/" : "kaiser/") +
+                  (format == pixel_format::rgba8 ? "rgba8/" : "rgb8/") + run.name, pixels, [&] {
+          do_not_optimize(build_mip_chain(src, options, run.pool).levels.size());
+        });
+      }
+    }
+  }
+
+  std::vector<unsigned char> magnitude(static_cast<std::size_t>(kernel_size) * kernel_size);
+  std::vector<unsigned char> direction(magnitude.size());
+  for (pixel_format format : {pixel_format::rgba8, pixel_format::bgr8}) {
+    const std::string format_name = format == pixel_format::rgba8 ? "rgba8" : "bgr8";
+    std::vector<unsigned char> working = noise(static_cast<std::size_t>(kernel_size) * kernel_size *
+                                               bytes_per_pixel(format));
+    const image_buffer img = buffer_of(working, kernel_size, kernel_size, format);
+
+    for (const auto &run : runs) {
+      const std::string suffix = "/" + format_name + "/" + run.name;
+      // The kernels work in place, on noise they keep running into the same kind of data
+      suite.run("gaussian_blur/sigma_1" + suffix, pixels, [&] { gaussian_blur(img, 1, run.pool); });
+      suite.run("gaussian_blur/sigma_4" + suffix, pixels, [&] { gaussian_blur(img, 4, run.pool); });
+      suite.run("sobel" + suffix, pixels, [&] {
+        sobel(img.view(), magnitude.data(), direction.data(), gray_stride, 0.25f, run.pool);
+        do_not_optimize(magnitude.data());
+      });
+      suite.run("invert" + suffix, pixels, [&] { invert(img, run.pool); });
+    }
+  }
+
+  // Box means through a summed-area table against direct convolution, the table is built inside the case
+  std::vector<unsigned char> rgba_source = noise(static_cast<std::size_t>(kernel_size) * kernel_size * 4);
+  std::vector<unsigned char> rgba_working = rgba_source;
+  const image_buffer rgba_img = buffer_of(rgba_working, kernel_size, kernel_size, pixel_format::rgba8);
+  const image_view rgba_src = buffer_of(rgba_source, kernel_size, kernel_size, pixel_format::rgba8).view();
+  summed_area_table table;
+  std::vector<float> variance(static_cast<std::size_t>(kernel_size) * kernel_size * 4);
+  for (const auto &run : runs) {
+    for (int radius : {1, 2, 4, 8, 16, 32, 64}) {
+      const std::string suffix = "/radius_" + std::to_string(radius) + "/" + run.name;
+      const std::vector<float> box(static_cast<std::size_t>(2 * radius + 1), 1.0f / static_cast<float>(2 * radius + 1));
+      suite.run("box_filter/direct" + suffix, pixels, [&] { separable_convolve(rgba_img, box, box, run.pool); });
+      suite.run("box_filter/summed_area" + suffix, pixels, [&] {
+        do_not_optimize(mean_filter(rgba_img, radius, table, run.pool));
+      });
+    }
+    // Building once and querying several statistics is the intended use
+    suite.run(std::string("summed_area/build_with_squares/") + run.name, pixels, [&] {
+      table.build(rgba_src, true, run.pool);
+    });
+    suite.run(std::string("summed_area/mean/") + run.name, pixels, [&] { box_mean(table, 16, rgba_img, run.pool); });
+    suite.run(std::string("summed_area/variance/") + run.name, pixels, [&] {
+      box_variance(table, 16, variance.data(), static_cast<std::size_t>(kernel_size) * 4, run.pool);
+      do_not_optimize(variance.data());
+    });
+    suite.run(std::string("summed_area/local_contrast/") + run.name, pixels, [&] {
+      local_contrast(table, rgba_src, 16, 32, rgba_img, run.pool);
+    });
+  }
+
+  // Fused filter chains against the same kernels over the whole image one after another, edges is invert, blur
+  // sigma 2, sobel and soften is blur sigma 1, invert, mean 2, invert, blur sigma 1.
+  // Both write their result to rgba_img, the separate passes start with a copy as the pipeline reads the source.
+  const filter_pipeline edges = filter_pipeline().invert().gaussian_blur(2).sobel(0.25f);
+  const filter_pipeline soften = filter_pipeline().gaussian_blur(1).invert().mean(2).invert().gaussian_blur(1);
+  const std::vector<float> box5(5, 0.2f);
+  for (const auto &run : runs) {
+    const std::string suffix = std::string("/") + run.name;
+    suite.run("filter_chain/edges/separate" + suffix, pixels, [&] {
+      std::copy(rgba_source.begin(), rgba_source.end(), rgba_working.begin());
+      invert(rgba_img, run.pool);
+      gaussian_blur(rgba_img, 2, run.pool);
+      sobel(rgba_img.view(), magnitude.data(), nullptr, gray_stride, 0.25f, run.pool);
+    });
+    suite.run("filter_chain/edges/fused" + suffix, pixels, [&] {
+      do_not_optimize(edges.run(rgba_src, rgba_img, run.pool));
+    });
+    suite.run("filter_chain/soften/separate" + suffix, pixels, [&] {
+      std::copy(rgba_source.begin(), rgba_source.end(), rgba_working.begin());
+      gaussian_blur(rgba_img, 1, run.pool);
+      invert(rgba_img, run.pool);
+      separable_convolve(rgba_img, box5, box5, run.pool);
+      invert(rgba_img, run.pool);
+      gaussian_blur(rgba_img, 1, run.pool);
+    });
+    suite.run("filter_chain/soften/fused" + suffix, pixels, [&] {
+      do_not_optimize(soften.run(rgba_src, rgba_img, run.pool));
+    });
+  }
+
+  return suite.finish();
+}
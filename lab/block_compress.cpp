@@ -0,0 +1,301 @@
+//
+// BC1/BC3 encoder, see block_compress.h
+//
+
+#include "block_compress.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr int block_pixels = 16;
+
+struct color {
+  float r, g, b;
+};
+
+inline std::uint16_t pack_565(const color &c) noexcept {
+  const auto r = static_cast<int>(std::min(std::max(c.r, 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+  const auto g = static_cast<int>(std::min(std::max(c.g, 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+  const auto b = static_cast<int>(std::min(std::max(c.b, 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+  return static_cast<std::uint16_t>(r << 11 | g << 5 | b);
+}
+
+/**
+ * Expand a 565 colour the way the hardware does
+ */
+inline void unpack_565(std::uint16_t c, int out[3]) noexcept {
+  const int r = c >> 11 & 31;
+  const int g = c >> 5 & 63;
+  const int b = c & 31;
+  out[0] = r << 3 | r >> 2;
+  out[1] = g << 2 | g >> 4;
+  out[2] = b << 3 | b >> 2;
+}
+
+/**
+ * Find the line through the block colours which explains most of their variance
+ */
+void principal_axis(const unsigned char *rgba, color &mean, color &axis) {
+  mean = {0, 0, 0};
+  for (int i = 0; i < block_pixels; i++) {
+    mean.r += rgba[4 * i];
+    mean.g += rgba[4 * i + 1];
+    mean.b += rgba[4 * i + 2];
+  }
+  mean.r /= block_pixels;
+  mean.g /= block_pixels;
+  mean.b /= block_pixels;
+
+  float cov[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+  for (int i = 0; i < block_pixels; i++) {
+    const float r = rgba[4 * i] - mean.r;
+    const float g = rgba[4 * i + 1] - mean.g;
+    const float b = rgba[4 * i + 2] - mean.b;
+    cov[0] += r * r;
+    cov[1] += r * g;
+    cov[2] += r * b;
+    cov[3] += g * g;
+    cov[4] += g * b;
+    cov[5] += b * b;
+  }
+
+  // Power iteration, converges quickly since blocks are mostly one dimensional
+  axis = {1, 1, 1};
+  for (int iteration = 0; iteration < 6; iteration++) {
+    const color next = {
+        cov[0] * axis.r + cov[1] * axis.g + cov[2] * axis.b,
+        cov[1] * axis.r + cov[3] * axis.g + cov[4] * axis.b,
+        cov[2] * axis.r + cov[4] * axis.g + cov[5] * axis.b,
+    };
+    const float length = std::max(std::fabs(next.r), std::max(std::fabs(next.g), std::fabs(next.b)));
+    if (length < 1e-6f) {
+      break;
+    }
+    axis = {next.r / length, next.g / length, next.b / length};
+  }
+}
+
+/**
+ * Choose the closest palette entry for every pixel
+ * @return 2 bit indices of all pixels
+ */
+std::uint32_t select_indices(const unsigned char *rgba, const int palette[4][3], std::uint8_t indices[block_pixels]) {
+  std::uint32_t bits = 0;
+  for (int i = 0; i < block_pixels; i++) {
+    int best = 0;
+    int best_distance = 1 << 30;
+    for (int p = 0; p < 4; p++) {
+      const int dr = rgba[4 * i] - palette[p][0];
+      const int dg = rgba[4 * i + 1] - palette[p][1];
+      const int db = rgba[4 * i + 2] - palette[p][2];
+      const int distance = dr * dr + dg * dg + db * db;
+      if (distance < best_distance) {
+        best_distance = distance;
+        best = p;
+      }
+    }
+    indices[i] = static_cast<std::uint8_t>(best);
+    bits |= static_cast<std::uint32_t>(best) << (2 * i);
+  }
+  return bits;
+}
+
+void build_palette(std::uint16_t c0, std::uint16_t c1, int palette[4][3]) {
+  unpack_565(c0, palette[0]);
+  unpack_565(c1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+}
+
+/**
+ * Least squares endpoints for fixed indices, the interpolation weights of index 0..3 are 1, 0, 2/3, 1/3
+ * @return false if the system is degenerate, e.g. all pixels use the same index
+ */
+bool refine_endpoints(const unsigned char *rgba, const std::uint8_t indices[block_pixels], color &e0, color &e1) {
+  static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+  float aa = 0, bb = 0, ab = 0;
+  color ax = {0, 0, 0}, bx = {0, 0, 0};
+  for (int i = 0; i < block_pixels; i++) {
+    const float a = weights[indices[i]];
+    const float b = 1.0f - a;
+    aa += a * a;
+    bb += b * b;
+    ab += a * b;
+    ax.r += a * rgba[4 * i];
+    ax.g += a * rgba[4 * i + 1];
+    ax.b += a * rgba[4 * i + 2];
+    bx.r += b * rgba[4 * i];
+    bx.g += b * rgba[4 * i + 1];
+    bx.b += b * rgba[4 * i + 2];
+  }
+  const float det = aa * bb - ab * ab;
+  if (std::fabs(det) < 1e-6f) {
+    return false;
+  }
+  const float inv = 1.0f / det;
+  e0 = {(ax.r * bb - bx.r * ab) * inv, (ax.g * bb - bx.g * ab) * inv, (ax.b * bb - bx.b * ab) * inv};
+  e1 = {(bx.r * aa - ax.r * ab) * inv, (bx.g * aa - ax.g * ab) * inv, (bx.b * aa - ax.b * ab) * inv};
+  return true;
+}
+
+int block_error(const unsigned char *rgba, const int palette[4][3], const std::uint8_t indices[block_pixels]) {
+  int error = 0;
+  for (int i = 0; i < block_pixels; i++) {
+    for (int c = 0; c < 3; c++) {
+      const int d = rgba[4 * i + c] - palette[indices[i]][c];
+      error += d * d;
+    }
+  }
+  return error;
+}
+
+/**
+ * Encode the colour half of a block in four colour mode
+ */
+void compress_color(const unsigned char *rgba, unsigned char *out) {
+  color mean{}, axis{};
+  principal_axis(rgba, mean, axis);
+
+  // The extreme pixels along the axis are the first guess for the endpoints
+  float lo = 1e30f, hi = -1e30f;
+  for (int i = 0; i < block_pixels; i++) {
+    const float t = (rgba[4 * i] - mean.r) * axis.r + (rgba[4 * i + 1] - mean.g) * axis.g
+                    + (rgba[4 * i + 2] - mean.b) * axis.b;
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  const float norm = axis.r * axis.r + axis.g * axis.g + axis.b * axis.b;
+  if (norm > 0) {
+    lo /= norm;
+    hi /= norm;
+  }
+  color e0 = {mean.r + axis.r * hi, mean.g + axis.g * hi, mean.b + axis.b * hi};
+  color e1 = {mean.r + axis.r * lo, mean.g + axis.g * lo, mean.b + axis.b * lo};
+
+  std::uint16_t c0 = pack_565(e0);
+  std::uint16_t c1 = pack_565(e1);
+  int palette[4][3];
+  std::uint8_t indices[block_pixels];
+  build_palette(c0, c1, palette);
+  std::uint32_t bits = select_indices(rgba, palette, indices);
+  int error = block_error(rgba, palette, indices);
+
+  // One least squares pass, kept only if it actually helps after quantisation
+  color r0{}, r1{};
+  if (refine_endpoints(rgba, indices, r0, r1)) {
+    const std::uint16_t q0 = pack_565(r0);
+    const std::uint16_t q1 = pack_565(r1);
+    int refined_palette[4][3];
+    std::uint8_t refined_indices[block_pixels];
+    build_palette(q0, q1, refined_palette);
+    const std::uint32_t refined_bits = select_indices(rgba, refined_palette, refined_indices);
+    if (block_error(rgba, refined_palette, refined_indices) < error) {
+      c0 = q0;
+      c1 = q1;
+      bits = refined_bits;
+      std::memcpy(indices, refined_indices, sizeof(indices));
+      error = 0;
+    }
+  }
+
+  // Four colour mode needs c0 > c1, swapping the endpoints swaps indices 0/1 and 2/3
+  if (c0 < c1) {
+    std::swap(c0, c1);
+    bits ^= 0x55555555u;
+  } else if (c0 == c1) {
+    bits = 0;
+  }
+
+  out[0] = static_cast<unsigned char>(c0 & 0xFF);
+  out[1] = static_cast<unsigned char>(c0 >> 8);
+  out[2] = static_cast<unsigned char>(c1 & 0xFF);
+  out[3] = static_cast<unsigned char>(c1 >> 8);
+  for (int i = 0; i < 4; i++) {
+    out[4 + i] = static_cast<unsigned char>(bits >> (8 * i) & 0xFF);
+  }
+}
+
+/**
+ * Encode alpha in eight value mode, i.e. a0 > a1 with six interpolated steps
+ */
+void compress_alpha(const unsigned char *rgba, unsigned char *out) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < block_pixels; i++) {
+    lo = std::min(lo, static_cast<int>(rgba[4 * i + 3]));
+    hi = std::max(hi, static_cast<int>(rgba[4 * i + 3]));
+  }
+  out[0] = static_cast<unsigned char>(hi);
+  out[1] = static_cast<unsigned char>(lo);
+
+  std::uint64_t bits = 0;
+  if (hi != lo) {
+    const int range = hi - lo;
+    for (int i = 0; i < block_pixels; i++) {
+      // Position between hi (0) and lo (7), then mapped to the index order of the format
+      const int step = ((hi - rgba[4 * i + 3]) * 7 + range / 2) / range;
+      const int index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+      bits |= static_cast<std::uint64_t>(index) << (3 * i);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = static_cast<unsigned char>(bits >> (8 * i) & 0xFF);
+  }
+}
+
+} // namespace
+
+void compress_block(const unsigned char *rgba, block_format format, unsigned char *out) {
+  if (format == block_format::bc3) {
+    compress_alpha(rgba, out);
+    out += 8;
+  }
+  compress_color(rgba, out);
+}
+
+std::vector<unsigned char> compress_image(const image_view &img, block_format format, thread_pool *pool) {
+  std::vector<unsigned char> blocks(compressed_size(img.width, img.height, format));
+  if (img.empty()) {
+    return blocks;
+  }
+  const int blocks_x = (img.width + 3) / 4;
+  const int blocks_y = (img.height + 3) / 4;
+  const std::size_t row_bytes = static_cast<std::size_t>(blocks_x) * block_bytes(format);
+
+  auto rows = [&](int first, int last) {
+    const std::size_t rgba_stride = static_cast<std::size_t>(img.width) * 4;
+    std::vector<unsigned char> strip(rgba_stride * 4);
+    unsigned char block[block_pixels * 4];
+
+    for (int by = first; by < last; by++) {
+      // Convert the four rows of this block row to RGBA8, in memory order
+      image_view rows_view = img;
+      rows_view.pixels = img.pixels + static_cast<std::size_t>(by) * 4 * img.stride;
+      rows_view.height = std::min(4, img.height - by * 4);
+      convert_image(rows_view, pixel_format::rgba8, img.bottom_up, strip.data(), rgba_stride);
+
+      for (int bx = 0; bx < blocks_x; bx++) {
+        for (int y = 0; y < 4; y++) {
+          const int sy = std::min(y, rows_view.height - 1);
+          for (int x = 0; x < 4; x++) {
+            const int sx = std::min(bx * 4 + x, img.width - 1);
+            std::memcpy(block + 4 * (4 * y + x), &strip[sy * rgba_stride + 4 * static_cast<std::size_t>(sx)], 4);
+          }
+        }
+        compress_block(block, format, &blocks[by * row_bytes + bx * static_cast<std::size_t>(block_bytes(format))]);
+      }
+    }
+  };
+
+  if (pool == nullptr) {
+    rows(0, blocks_y);
+  } else {
+    pool->parallel_for(0, blocks_y, std::max(1, blocks_y / static_cast<int>(4 * pool->size())), rows);
+  }
+  return blocks;
+}
@@ -0,0 +1,50 @@
+//
+// CPU encoder for the BC1 (DXT1) and BC3 (DXT5) block compressed texture formats.
+// Each 4x4 block is fitted along the principal axis of its colours, refined with a least squares step
+// and indexed by exhaustive search over its palette. Block rows are spread over a thread pool.
+//
+
+#ifndef LAB_BLOCK_COMPRESS_H
+#define LAB_BLOCK_COMPRESS_H
+
+#include "bmp_image.h"
+
+#include <vector>
+
+class thread_pool;
+
+enum class block_format {
+  bc1, // RGB, 8 bytes per block, alpha is dropped
+  bc3, // RGBA, 16 bytes per block
+};
+
+/**
+ * @return bytes of one compressed 4x4 block
+ */
+inline int block_bytes(block_format format) noexcept {
+  return format == block_format::bc1 ? 8 : 16;
+}
+
+/**
+ * @return bytes of a compressed image, partial blocks at the edges count as whole ones
+ */
+inline std::size_t compressed_size(int width, int height, block_format format) noexcept {
+  return static_cast<std::size_t>((width + 3) / 4) * static_cast<std::size_t>((height + 3) / 4)
+         * static_cast<std::size_t>(block_bytes(format));
+}
+
+/**
+ * Compress an image of any pixel_format, blocks are emitted in memory row order.
+ * Edge blocks of sizes not divisible by 4 replicate the last row/column.
+ * @param pool threads for the block rows, nullptr to stay on the calling thread
+ */
+std::vector<unsigned char> compress_image(const image_view &img, block_format format, thread_pool *pool);
+
+/**
+ * Encode a single block
+ * @param rgba 16 pixels in RGBA8 order, row by row
+ * @param out block_bytes(format) bytes
+ */
+void compress_block(const unsigned char *rgba, block_format format, unsigned char *out);
+
+#endif //LAB_BLOCK_COMPRESS_H
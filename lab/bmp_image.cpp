@@ -0,0 +1,345 @@
+//
+// Memory mapped BMP loading, see bmp_image.h
+//
+
+#include "bmp_image.h"
+#include "cpu_features.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if LAB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr std::size_t file_header_size = 14;
+constexpr std::size_t info_header_size = 40;
+
+constexpr std::uint32_t bi_rgb = 0;
+constexpr std::uint32_t bi_bitfields = 3;
+constexpr std::uint32_t bi_alphabitfields = 6;
+
+// BMP is little endian, read byte by byte so neither alignment nor host order matter
+std::uint32_t read_le32(const unsigned char *p) noexcept {
+  return static_cast<std::uint32_t>(p[0])
+         | static_cast<std::uint32_t>(p[1]) << 8u
+         | static_cast<std::uint32_t>(p[2]) << 16u
+         | static_cast<std::uint32_t>(p[3]) << 24u;
+}
+
+std::uint16_t read_le16(const unsigned char *p) noexcept {
+  return static_cast<std::uint16_t>(p[0] | p[1] << 8u);
+}
+
+/**
+ * Map the channel masks of a BI_BITFIELDS image onto one of our formats
+ */
+bool format_from_masks(std::uint32_t r, std::uint32_t g, std::uint32_t b, std::uint32_t a,
+                       pixel_format &format) noexcept {
+  if (r == 0x00FF0000u && g == 0x0000FF00u && b == 0x000000FFu) {
+    format = a == 0xFF000000u ? pixel_format::bgra8 : pixel_format::bgrx8;
+    return true;
+  }
+  if (r == 0x000000FFu && g == 0x0000FF00u && b == 0x00FF0000u && a == 0xFF000000u) {
+    format = pixel_format::rgba8;
+    return true;
+  }
+  return false;
+}
+
+using row_converter = void (*)(const unsigned char *src, unsigned char *dst, int width);
+
+/**
+ * Per pixel fallback for every supported combination
+ */
+template<pixel_format From, pixel_format To>
+void convert_row_scalar(const unsigned char *src, unsigned char *dst, int width) {
+  constexpr int src_bpp = From == pixel_format::bgr8 || From == pixel_format::rgb8 ? 3 : 4;
+  constexpr int dst_bpp = To == pixel_format::rgb8 ? 3 : 4;
+  constexpr bool src_bgr = From == pixel_format::bgr8 || From == pixel_format::bgra8 || From == pixel_format::bgrx8;
+  constexpr bool src_alpha = From == pixel_format::bgra8 || From == pixel_format::rgba8;
+  for (int x = 0; x < width; x++, src += src_bpp, dst += dst_bpp) {
+    dst[0] = src[src_bgr ? 2 : 0];
+    dst[1] = src[1];
+    dst[2] = src[src_bgr ? 0 : 2];
+    if (dst_bpp == 4) {
+      dst[3] = src_alpha ? src[3] : 255;
+    }
+  }
+}
+
+#if LAB_X86_SIMD
+
+LAB_TARGET("ssse3")
+void bgr_to_rgba_ssse3(const unsigned char *src, unsigned char *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+  const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+  int x = 0;
+  // every load reads 16 bytes but only consumes 12, stay clear of the row end
+  for (; x + 6 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * x));
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * x), v);
+  }
+  convert_row_scalar<pixel_format::bgr8, pixel_format::rgba8>(src + 3 * x, dst + 4 * x, width - x);
+}
+
+LAB_TARGET("ssse3")
+void bgr_to_rgb_ssse3(const unsigned char *src, unsigned char *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, -1, -1, -1, -1);
+  int x = 0;
+  for (; x + 6 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * x));
+    v = _mm_shuffle_epi8(v, shuffle);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 3 * x), v);
+    const int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    std::memcpy(dst + 3 * x + 8, &tail, 4);
+  }
+  convert_row_scalar<pixel_format::bgr8, pixel_format::rgb8>(src + 3 * x, dst + 3 * x, width - x);
+}
+
+template<bool Opaque>
+LAB_TARGET("ssse3")
+void bgra_to_rgba_ssse3(const unsigned char *src, unsigned char *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+  const __m128i alpha = _mm_set1_epi32(Opaque ? static_cast<int>(0xFF000000u) : 0);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * x));
+    v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * x), v);
+  }
+  if (Opaque) {
+    convert_row_scalar<pixel_format::bgrx8, pixel_format::rgba8>(src + 4 * x, dst + 4 * x, width - x);
+  } else {
+    convert_row_scalar<pixel_format::bgra8, pixel_format::rgba8>(src + 4 * x, dst + 4 * x, width - x);
+  }
+}
+
+LAB_TARGET("ssse3")
+void bgrx_to_rgb_ssse3(const unsigned char *src, unsigned char *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  int x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * x));
+    v = _mm_shuffle_epi8(v, shuffle);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 3 * x), v);
+    const int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    std::memcpy(dst + 3 * x + 8, &tail, 4);
+  }
+  convert_row_scalar<pixel_format::bgrx8, pixel_format::rgb8>(src + 4 * x, dst + 3 * x, width - x);
+}
+
+#endif
+
+/**
+ * Pick the fastest row converter for a format pair, nullptr if unsupported
+ */
+row_converter select_converter(pixel_format from, pixel_format to) {
+  const bool simd = cpu_has_ssse3();
+  if (to == pixel_format::rgba8) {
+    switch (from) {
+      case pixel_format::bgr8:
+#if LAB_X86_SIMD
+        if (simd) return bgr_to_rgba_ssse3;
+#endif
+        return convert_row_scalar<pixel_format::bgr8, pixel_format::rgba8>;
+      case pixel_format::bgra8:
+#if LAB_X86_SIMD
+        if (simd) return bgra_to_rgba_ssse3<false>;
+#endif
+        return convert_row_scalar<pixel_format::bgra8, pixel_format::rgba8>;
+      case pixel_format::bgrx8:
+#if LAB_X86_SIMD
+        if (simd) return bgra_to_rgba_ssse3<true>;
+#endif
+        return convert_row_scalar<pixel_format::bgrx8, pixel_format::rgba8>;
+      case pixel_format::rgb8:
+        return convert_row_scalar<pixel_format::rgb8, pixel_format::rgba8>;
+      case pixel_format::rgba8:
+        return nullptr; // plain copy, handled by the caller
+    }
+  }
+  if (to == pixel_format::rgb8) {
+    switch (from) {
+      case pixel_format::bgr8:
+#if LAB_X86_SIMD
+        if (simd) return bgr_to_rgb_ssse3;
+#endif
+        return convert_row_scalar<pixel_format::bgr8, pixel_format::rgb8>;
+      case pixel_format::bgra8:
+      case pixel_format::bgrx8:
+#if LAB_X86_SIMD
+        if (simd) return bgrx_to_rgb_ssse3;
+#endif
+        return convert_row_scalar<pixel_format::bgrx8, pixel_format::rgb8>;
+      case pixel_format::rgba8:
+        return convert_row_scalar<pixel_format::rgba8, pixel_format::rgb8>;
+      case pixel_format::rgb8:
+        return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+bool parse_bmp(const unsigned char *data, std::size_t size, image_view &view) {
+  if (size < file_header_size + info_header_size || data[0] != 'B' || data[1] != 'M') {
+    return false;
+  }
+
+  const std::uint32_t dib_size = read_le32(data + 14);
+  if (dib_size < info_header_size || file_header_size + dib_size > size) {
+    return false;
+  }
+
+  const auto width = static_cast<std::int32_t>(read_le32(data + 18));
+  const auto height = static_cast<std::int32_t>(read_le32(data + 22));
+  const std::uint16_t planes = read_le16(data + 26);
+  const std::uint16_t bits = read_le16(data + 28);
+  const std::uint32_t compression = read_le32(data + 30);
+  if (width <= 0 || height == 0 || height == INT32_MIN || planes != 1) {
+    return false;
+  }
+
+  pixel_format format;
+  if (bits == 24 && compression == bi_rgb) {
+    format = pixel_format::bgr8;
+  } else if (bits == 32 && compression == bi_rgb) {
+    format = pixel_format::bgrx8;
+  } else if (bits == 32 && (compression == bi_bitfields || compression == bi_alphabitfields)) {
+    // Masks follow a plain info header, or are part of the V4/V5 headers at the same offset
+    const std::size_t masks = file_header_size + info_header_size;
+    const bool has_alpha_mask = dib_size > info_header_size || compression == bi_alphabitfields;
+    if (masks + (has_alpha_mask ? 16 : 12) > size) {
+      return false;
+    }
+    if (!format_from_masks(read_le32(data + masks), read_le32(data + masks + 4), read_le32(data + masks + 8),
+                           has_alpha_mask ? read_le32(data + masks + 12) : 0, format)) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  std::uint32_t data_pos = read_le32(data + 10);
+  if (data_pos == 0) {
+    // Some BMP files are misformatted, assume the pixels follow the headers
+    data_pos = static_cast<std::uint32_t>(file_header_size + dib_size);
+  }
+
+  // Rows are padded to multiples of 4 bytes
+  const std::uint64_t rows = static_cast<std::uint64_t>(height < 0 ? -static_cast<std::int64_t>(height) : height);
+  const std::uint64_t stride = (static_cast<std::uint64_t>(width) * bits + 31) / 32 * 4;
+  const std::uint64_t needed = data_pos + stride * (rows - 1) + static_cast<std::uint64_t>(width) * bits / 8;
+  if (needed > size) {
+    return false;
+  }
+
+  view.pixels = data + data_pos;
+  view.width = width;
+  view.height = static_cast<int>(rows);
+  view.stride = static_cast<std::size_t>(stride);
+  view.format = format;
+  view.bottom_up = height > 0;
+  return true;
+}
+
+bool convert_image(const image_view &src, pixel_format format, bool bottom_up,
+                   unsigned char *dst, std::size_t dst_stride) {
+  if (src.empty()) {
+    return false;
+  }
+  const row_converter convert = src.format == format ? nullptr : select_converter(src.format, format);
+  if (src.format != format && convert == nullptr) {
+    return false;
+  }
+
+  const std::size_t row_bytes = static_cast<std::size_t>(src.width) * bytes_per_pixel(format);
+  for (int y = 0; y < src.height; y++) {
+    const int src_row = src.bottom_up == bottom_up ? y : src.height - 1 - y;
+    const unsigned char *in = src.pixels + static_cast<std::size_t>(src_row) * src.stride;
+    unsigned char *out = dst + static_cast<std::size_t>(y) * dst_stride;
+    if (convert) {
+      convert(in, out, src.width);
+    } else {
+      std::memcpy(out, in, row_bytes);
+    }
+  }
+  return true;
+}
+
+mapped_bmp::mapped_bmp(const char *path) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cout << "Image could not be opened: " << path << std::endl;
+    return;
+  }
+
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    std::cout << "Image could not be opened: " << path << std::endl;
+    close(fd);
+    return;
+  }
+
+  void *mapping = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    std::cout << "Image could not be mapped: " << path << std::endl;
+    return;
+  }
+  mapping_ = mapping;
+  mapping_size_ = static_cast<std::size_t>(st.st_size);
+
+  if (!parse_bmp(static_cast<const unsigned char *>(mapping_), mapping_size_, view_)) {
+    std::cout << "Not a correct BMP file: " << path << std::endl;
+    release();
+    return;
+  }
+  // The payload is usually read once front to back right after loading
+  madvise(mapping_, mapping_size_, MADV_WILLNEED);
+}
+
+mapped_bmp::~mapped_bmp() {
+  release();
+}
+
+mapped_bmp::mapped_bmp(mapped_bmp &&other) noexcept
+    : mapping_(other.mapping_), mapping_size_(other.mapping_size_), view_(other.view_) {
+  other.mapping_ = nullptr;
+  other.mapping_size_ = 0;
+  other.view_ = image_view{};
+}
+
+mapped_bmp &mapped_bmp::operator=(mapped_bmp &&other) noexcept {
+  if (this != &other) {
+    release();
+    mapping_ = other.mapping_;
+    mapping_size_ = other.mapping_size_;
+    view_ = other.view_;
+    other.mapping_ = nullptr;
+    other.mapping_size_ = 0;
+    other.view_ = image_view{};
+  }
+  return *this;
+}
+
+void mapped_bmp::release() noexcept {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, mapping_size_);
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  view_ = image_view{};
+}
@@ -0,0 +1,121 @@
+//
+// Memory mapped BMP loading.
+// The file is mapped read-only and the pixel payload is exposed in place, together with
+// the layout information needed to hand it to OpenGL (or any other consumer) without a copy.
+//
+
+#ifndef LAB_BMP_IMAGE_H
+#define LAB_BMP_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Byte order of a single pixel in memory
+ */
+enum class pixel_format {
+  bgr8,  // 24 bit, the usual BMP layout
+  bgra8, // 32 bit with a meaningful alpha channel
+  bgrx8, // 32 bit, fourth byte is padding
+  rgb8,
+  rgba8,
+};
+
+/**
+ * @return bytes per pixel of the given format
+ */
+inline int bytes_per_pixel(pixel_format format) noexcept {
+  return format == pixel_format::bgr8 || format == pixel_format::rgb8 ? 3 : 4;
+}
+
+/**
+ * Non-owning description of pixel rows somewhere in memory
+ */
+struct image_view {
+  const unsigned char *pixels = nullptr; // first row in memory
+  int width = 0;
+  int height = 0;
+  std::size_t stride = 0;                // bytes between the starts of two rows
+  pixel_format format = pixel_format::bgr8;
+  bool bottom_up = false;                // first row in memory is the bottom row of the image
+
+  bool empty() const noexcept {
+    return pixels == nullptr || width <= 0 || height <= 0;
+  }
+
+  /**
+   * @return size in bytes covered by the view, including row padding
+   */
+  std::size_t size() const noexcept {
+    return empty() ? 0 : stride * static_cast<std::size_t>(height - 1)
+                         + static_cast<std::size_t>(width) * bytes_per_pixel(format);
+  }
+};
+
+/**
+ * A BMP file mapped into memory.
+ * Owns the mapping, view() stays valid as long as the object lives.
+ */
+class mapped_bmp {
+public:
+  mapped_bmp() = default;
+
+  explicit mapped_bmp(const char *path);
+
+  ~mapped_bmp();
+
+  mapped_bmp(const mapped_bmp &) = delete;
+
+  mapped_bmp &operator=(const mapped_bmp &) = delete;
+
+  mapped_bmp(mapped_bmp &&other) noexcept;
+
+  mapped_bmp &operator=(mapped_bmp &&other) noexcept;
+
+  bool valid() const noexcept {
+    return !view_.empty();
+  }
+
+  const image_view &view() const noexcept {
+    return view_;
+  }
+
+private:
+  void *mapping_ = nullptr;
+  std::size_t mapping_size_ = 0;
+  image_view view_;
+
+  void release() noexcept;
+};
+
+/**
+ * Parse the headers of a BMP file held in memory.
+ * Supports uncompressed 24 and 32 bit images and 32 bit BI_BITFIELDS images in BGRA or RGBA order.
+ * @param data the whole file
+ * @param size size of the file in bytes
+ * @param view receives the pixel layout on success
+ * @return false if the data is not a supported BMP file
+ */
+bool parse_bmp(const unsigned char *data, std::size_t size, image_view &view);
+
+/**
+ * @return true if src can't be consumed as is by someone expecting format and orientation
+ */
+inline bool needs_conversion(const image_view &src, pixel_format format, bool bottom_up) noexcept {
+  return src.format != format || src.bottom_up != bottom_up;
+}
+
+/**
+ * Swizzle and/or flip an image into a caller provided buffer.
+ * Uses SSSE3 shuffles for the BGR(A/X) to RGB(A) paths when the CPU supports them.
+ * @param src image to convert
+ * @param format target format, one of rgb8, rgba8 or the source format
+ * @param bottom_up target orientation
+ * @param dst destination, stride * height bytes
+ * @param dst_stride bytes between two destination rows
+ * @return false if the conversion is not supported
+ */
+bool convert_image(const image_view &src, pixel_format format, bool bottom_up,
+                   unsigned char *dst, std::size_t dst_stride);
+
+#endif //LAB_BMP_IMAGE_H
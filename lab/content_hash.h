@@ -0,0 +1,59 @@
+//
+// Fast non-cryptographic 64 bit hashing of memory blocks, used to recognise identical image content.
+//
+
+#ifndef LAB_CONTENT_HASH_H
+#define LAB_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+class content_hash {
+public:
+  explicit content_hash(std::uint64_t seed = 0) noexcept : state_(seed ^ 0x9E3779B97F4A7C15ull) {}
+
+  /**
+   * Mix size bytes into the hash, eight at a time
+   */
+  void update(const void *data, std::size_t size) noexcept {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, bytes + i, 8);
+      mix_word(word);
+    }
+    if (i < size) {
+      std::uint64_t tail = 0;
+      std::memcpy(&tail, bytes + i, size - i);
+      mix_word(tail);
+    }
+    mix_word(size);
+  }
+
+  template<class T>
+  void update_value(const T &value) noexcept {
+    update(&value, sizeof(value));
+  }
+
+  std::uint64_t digest() const noexcept {
+    std::uint64_t h = state_;
+    h ^= h >> 33u;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33u;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33u;
+    return h;
+  }
+
+private:
+  std::uint64_t state_;
+
+  void mix_word(std::uint64_t word) noexcept {
+    state_ ^= word * 0x87C37B91114253D5ull;
+    state_ = (state_ << 31u | state_ >> 33u) * 0x4CF5AD432745937Full;
+  }
+};
+
+#endif //LAB_CONTENT_HASH_H
@@ -0,0 +1,42 @@
+//
+// Runtime detection of the x86 instruction set extensions the image code can use.
+// The executables are built for the baseline ISA, so wider kernels are compiled with
+// target attributes and only dispatched to after checking the CPU here.
+//
+
+#ifndef LAB_CPU_FEATURES_H
+#define LAB_CPU_FEATURES_H
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LAB_X86_SIMD 1
+#define LAB_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LAB_X86_SIMD 0
+#define LAB_TARGET(isa)
+#endif
+
+/**
+ * @return true if SSSE3 (pshufb) kernels may be used
+ */
+inline bool cpu_has_ssse3() noexcept {
+#if LAB_X86_SIMD
+  static const bool supported = __builtin_cpu_supports("ssse3");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @return true if AVX2 kernels may be used
+ */
+inline bool cpu_has_avx2() noexcept {
+#if LAB_X86_SIMD
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+#else
+  return false;
+#endif
+}
+
+#endif //LAB_CPU_FEATURES_H
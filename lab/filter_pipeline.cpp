@@ -0,0 +1,384 @@
+//
+// Fused filter chains, see filter_pipeline.h
+//
+
+#include "filter_pipeline.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+// Fewest rows per band when running on a pool. Each band primes the rings of all filters once, which
+// costs about as many rows as the filters together reach up and down.
+constexpr int min_band_rows = 64;
+
+// Bytes the rings of all filters together may take, within L2 of current desktop CPUs. Wider images run in
+// strips of columns.
+constexpr std::size_t ring_budget = 512 * 1024;
+constexpr int min_strip_width = 64;
+constexpr int strip_align = 16;
+
+bool has_alpha(pixel_format format) noexcept {
+  return format == pixel_format::rgba8 || format == pixel_format::bgra8;
+}
+
+/**
+ * Apply table to the colour channels of pixels, copying them from in to out, which may be the same
+ * @param inverts table is 255 - value, ::invert does that in vector registers
+ */
+void apply_lookup(const unsigned char *in, unsigned char *out, int pixels, pixel_format format,
+                  const unsigned char table[256], bool inverts) {
+  const int n = pixels * bytes_per_pixel(format);
+  if (inverts) {
+    if (in != out) {
+      std::memcpy(out, in, static_cast<std::size_t>(n));
+    }
+    image_buffer row;
+    row.pixels = out;
+    row.width = pixels;
+    row.height = 1;
+    row.stride = static_cast<std::size_t>(n);
+    row.format = format;
+    ::invert(row, nullptr);
+    return;
+  }
+  if (!has_alpha(format)) {
+    for (int i = 0; i < n; i++) {
+      out[i] = table[in[i]];
+    }
+    return;
+  }
+  for (int i = 0; i < n; i += 4) {
+    out[i] = table[in[i]];
+    out[i + 1] = table[in[i + 1]];
+    out[i + 2] = table[in[i + 2]];
+    out[i + 3] = in[i + 3];
+  }
+}
+
+} // namespace
+
+filter_pipeline &filter_pipeline::invert() {
+  unsigned char table[256];
+  for (int i = 0; i < 256; i++) {
+    table[i] = static_cast<unsigned char>(255 - i);
+  }
+  return lookup(table);
+}
+
+filter_pipeline &filter_pipeline::threshold(unsigned char level) {
+  unsigned char table[256];
+  for (int i = 0; i < 256; i++) {
+    table[i] = i >= level ? 255 : 0;
+  }
+  return lookup(table);
+}
+
+filter_pipeline &filter_pipeline::lookup(const unsigned char table[256]) {
+  if (!stages_.empty() && stages_.back().type == stage_type::lookup) {
+    // Two point filters in a row are one point filter
+    for (auto &value : stages_.back().table) {
+      value = table[value];
+    }
+  } else {
+    stage s;
+    s.type = stage_type::lookup;
+    std::memcpy(s.table, table, sizeof(s.table));
+    stages_.push_back(std::move(s));
+  }
+  stage &last = stages_.back();
+  last.inverts = true;
+  for (int i = 0; i < 256; i++) {
+    last.inverts = last.inverts && last.table[i] == 255 - i;
+  }
+  return *this;
+}
+
+filter_pipeline &filter_pipeline::convolve(std::vector<float> kernel_x, std::vector<float> kernel_y) {
+  stage s;
+  s.type = stage_type::convolve;
+  s.kernel_x = std::move(kernel_x);
+  s.kernel_y = std::move(kernel_y);
+  stages_.push_back(std::move(s));
+  return *this;
+}
+
+filter_pipeline &filter_pipeline::gaussian_blur(float sigma) {
+  if (sigma <= 0) {
+    return *this;
+  }
+  std::vector<float> kernel = gaussian_kernel(sigma);
+  return convolve(kernel, kernel);
+}
+
+filter_pipeline &filter_pipeline::mean(int radius) {
+  if (radius <= 0) {
+    return *this;
+  }
+  const int taps = 2 * radius + 1;
+  std::vector<float> kernel(static_cast<std::size_t>(taps), 1.0f / static_cast<float>(taps));
+  return convolve(kernel, kernel);
+}
+
+filter_pipeline &filter_pipeline::sobel(float scale) {
+  stage s;
+  s.type = stage_type::sobel;
+  s.scale = scale;
+  stages_.push_back(std::move(s));
+  return *this;
+}
+
+/**
+ * Rows of one strip of columns pulled through the chain. Level 0 loads source rows, every further level is
+ * a vertical convolution or Sobel and keeps the rows of the level before it in a ring. Lookups and
+ * horizontal convolutions only need the row itself and run on a level's rows as they're made.
+ */
+class filter_pipeline::row_stream {
+public:
+  /**
+   * @param x0 first column of the strip
+   * @param width columns of the strip, its ends are the image borders for the filters
+   */
+  row_stream(const filter_pipeline &pipeline, const image_view &src, int x0, int width, const stage *load_table,
+             std::size_t first, std::size_t last)
+      : src_(src), x0_(x0), width_(width), channels_(bytes_per_pixel(src.format)),
+        n_(width * bytes_per_pixel(src.format)), load_table_(load_table) {
+    levels_.emplace_back();
+    std::size_t max_taps = 1;
+    std::size_t max_kernel_x = 1;
+    for (std::size_t i = first; i < last; i++) {
+      const stage &s = pipeline.stages_[i];
+      switch (s.type) {
+        case stage_type::lookup:
+          levels_.back().row_filters.push_back(&s);
+          break;
+        case stage_type::convolve:
+          // Even kernels are skipped by separable_convolve
+          if (s.kernel_x.size() % 2 == 1) {
+            levels_.back().row_filters.push_back(&s);
+            max_kernel_x = std::max(max_kernel_x, s.kernel_x.size());
+          }
+          if (s.kernel_y.size() % 2 == 1) {
+            add_level(&s, static_cast<int>(s.kernel_y.size()) / 2, static_cast<std::size_t>(n_));
+            max_taps = std::max(max_taps, s.kernel_y.size());
+          }
+          break;
+        case stage_type::sobel:
+          add_level(&s, 1, static_cast<std::size_t>(width) + 2);
+          break;
+      }
+    }
+    for (auto &l : levels_) {
+      l.out.resize(static_cast<std::size_t>(n_));
+    }
+    scratch_.resize(std::max((2 * static_cast<std::size_t>(width) + max_kernel_x) * channels_,
+                             static_cast<std::size_t>(n_)));
+    taps_.resize(max_taps);
+    magnitude_.resize(static_cast<std::size_t>(width));
+  }
+
+  /**
+   * Row y of the last filter, the buffer stays valid until the next call.
+   * Any order works, increasing rows reuse what the rings hold.
+   */
+  const unsigned char *row(int y) {
+    return row(levels_.size() - 1, y);
+  }
+
+private:
+  struct level {
+    const stage *source = nullptr; // vertical convolution or Sobel making the rows from the level before
+    int radius = 0;
+    int window = 1;
+    std::size_t slot_size = 0;
+    std::vector<float> ring;            // slot_size floats per row of the level before
+    std::vector<unsigned char> bytes;   // Sobel keeps the fourth channel of those rows, it replaces the others
+    bool primed = false;
+    int fetched = 0;                    // last row in the ring, may be outside the image like in vertical_pass
+    std::vector<const stage *> row_filters;
+    std::vector<unsigned char> out;
+    int current = -1;                   // row in out
+  };
+
+  const image_view &src_;
+  const int x0_;
+  const int width_;
+  const int channels_;
+  const int n_;
+  const stage *load_table_;
+  std::vector<level> levels_;
+  std::vector<float> scratch_;
+  std::vector<const float *> taps_;
+  std::vector<unsigned char> magnitude_;
+
+  void add_level(const stage *source, int radius, std::size_t slot_size) {
+    levels_.emplace_back();
+    level &l = levels_.back();
+    l.source = source;
+    l.radius = radius;
+    l.window = 2 * radius + 1;
+    l.slot_size = slot_size;
+    l.ring.resize(slot_size * l.window);
+    if (source->type == stage_type::sobel && channels_ == 4) {
+      l.bytes.resize(static_cast<std::size_t>(width_) * l.window);
+    }
+  }
+
+  int slot(const level &l, int y) const noexcept {
+    return (y % l.window + l.window) % l.window;
+  }
+
+  const unsigned char *row(std::size_t k, int y) {
+    level &l = levels_[k];
+    if (l.current == y) {
+      return l.out.data();
+    }
+    if (k == 0) {
+      const unsigned char *in = src_.pixels + static_cast<std::size_t>(y) * src_.stride
+                                + static_cast<std::size_t>(x0_) * channels_;
+      if (load_table_ == nullptr && l.row_filters.empty()) {
+        return in;
+      }
+      if (load_table_ != nullptr) {
+        apply_lookup(in, l.out.data(), width_, src_.format, load_table_->table, load_table_->inverts);
+      } else {
+        std::memcpy(l.out.data(), in, static_cast<std::size_t>(n_));
+      }
+    } else {
+      // The ring holds rows fetched - window + 1 to fetched, start over if that doesn't lead up to y + radius
+      if (!l.primed || l.fetched < y - l.radius - 1 || l.fetched > y + l.radius) {
+        l.fetched = y - l.radius - 1;
+        l.primed = true;
+      }
+      const bool sobel = l.source->type == stage_type::sobel;
+      while (l.fetched < y + l.radius) {
+        l.fetched++;
+        const unsigned char *in = row(k - 1, std::min(std::max(l.fetched, 0), src_.height - 1));
+        const std::size_t s = static_cast<std::size_t>(slot(l, l.fetched));
+        if (sobel) {
+          sobel_luma_row(in, width_, src_.format, l.ring.data() + s * l.slot_size);
+          if (channels_ == 4) {
+            unsigned char *fourth = l.bytes.data() + s * width_;
+            for (int x = 0; x < width_; x++) {
+              fourth[x] = in[4 * x + 3];
+            }
+          }
+        } else {
+          widen_row(in, l.ring.data() + s * l.slot_size, n_);
+        }
+      }
+      if (sobel) {
+        const float *rows[3];
+        for (int j = 0; j < 3; j++) {
+          rows[j] = l.ring.data() + static_cast<std::size_t>(slot(l, y - 1 + j)) * l.slot_size;
+        }
+        sobel_magnitude_row(rows[0], rows[1], rows[2], width_, l.source->scale, magnitude_.data());
+        unsigned char *out = l.out.data();
+        const unsigned char *magnitude = magnitude_.data();
+        if (channels_ == 4) {
+          const unsigned char *fourth = l.bytes.data() + static_cast<std::size_t>(slot(l, y)) * width_;
+          for (int x = 0; x < width_; x++) {
+            out[4 * x] = out[4 * x + 1] = out[4 * x + 2] = magnitude[x];
+            out[4 * x + 3] = fourth[x];
+          }
+        } else {
+          for (int x = 0; x < width_; x++) {
+            out[3 * x] = out[3 * x + 1] = out[3 * x + 2] = magnitude[x];
+          }
+        }
+      } else {
+        for (int j = 0; j < l.window; j++) {
+          taps_[j] = l.ring.data() + static_cast<std::size_t>(slot(l, y - l.radius + j)) * l.slot_size;
+        }
+        convolve_rows(taps_.data(), l.source->kernel_y, n_, scratch_.data(), l.out.data());
+      }
+    }
+    for (const stage *s : l.row_filters) {
+      if (s->type == stage_type::lookup) {
+        apply_lookup(l.out.data(), l.out.data(), width_, src_.format, s->table, s->inverts);
+      } else {
+        convolve_row(l.out.data(), width_, channels_, s->kernel_x, scratch_.data());
+      }
+    }
+    l.current = y;
+    return l.out.data();
+  }
+};
+
+bool filter_pipeline::run(const image_view &src, const image_buffer &dst, thread_pool *pool) const {
+  if (src.empty() || dst.empty() || src.width != dst.width || src.height != dst.height
+      || src.format != dst.format) {
+    std::cout << "Filter pipeline needs a source and destination of the same size and format" << std::endl;
+    return false;
+  }
+  std::size_t first = 0;
+  std::size_t last = stages_.size();
+  const stage *load_table = nullptr;
+  const stage *store_table = nullptr;
+  if (first < last && stages_[first].type == stage_type::lookup) {
+    load_table = &stages_[first++];
+  }
+  if (first < last && stages_[last - 1].type == stage_type::lookup) {
+    store_table = &stages_[--last];
+  }
+
+  // Columns the filters reach sideways and bytes their rings hold per column
+  const int channels = bytes_per_pixel(src.format);
+  int halo = 0;
+  std::size_t ring_bytes = 0;
+  for (std::size_t i = first; i < last; i++) {
+    const stage &s = stages_[i];
+    if (s.type == stage_type::convolve) {
+      halo += s.kernel_x.size() % 2 == 1 ? static_cast<int>(s.kernel_x.size()) / 2 : 0;
+      ring_bytes += s.kernel_y.size() % 2 == 1 ? s.kernel_y.size() * channels * sizeof(float) : 0;
+    } else if (s.type == stage_type::sobel) {
+      halo += 1;
+      ring_bytes += 3 * (sizeof(float) + 1);
+    }
+  }
+  // Wide images are cut into strips, each recomputes the halo columns of its neighbours. Strips start and end
+  // on the 16 pixel grid the vector loops of the kernels step in, so every pixel is computed by the same
+  // instructions as over the whole image.
+  halo = (halo + strip_align - 1) / strip_align * strip_align;
+  int strip_width = src.width;
+  if (ring_bytes > 0 && ring_bytes * src.width > ring_budget) {
+    strip_width = std::max(static_cast<int>(ring_budget / ring_bytes) - 2 * halo, min_strip_width);
+    strip_width -= strip_width % strip_align;
+  }
+  const int strips = (src.width + strip_width - 1) / strip_width;
+
+  // A few bands per thread for balance, the calling thread takes part
+  const int threads = pool == nullptr ? 1 : static_cast<int>(pool->size()) + 1;
+  const int bands = pool == nullptr ? 1 : std::max(1, std::min(4 * threads, src.height / min_band_rows));
+  const int band_height = (src.height + bands - 1) / bands;
+
+  const auto body = [&](int first_task, int last_task) {
+    for (int task = first_task; task < last_task;) {
+      // Consecutive bands of a strip continue one stream, only a new strip primes the rings again
+      const int strip = task / bands;
+      const int end = std::min(last_task, (strip + 1) * bands);
+      const int x0 = strip * strip_width;
+      const int x1 = std::min(x0 + strip_width, src.width);
+      const int load_x0 = std::max(x0 - halo, 0);
+      row_stream stream(*this, src, load_x0, std::min(x1 + halo, src.width) - load_x0, load_table, first, last);
+      const int y1 = std::min((end - strip * bands) * band_height, src.height);
+      for (int y = (task - strip * bands) * band_height; y < y1; y++) {
+        const unsigned char *in = stream.row(y) + static_cast<std::size_t>(x0 - load_x0) * channels;
+        unsigned char *out = dst.pixels + static_cast<std::size_t>(y) * dst.stride
+                             + static_cast<std::size_t>(x0) * channels;
+        if (store_table != nullptr) {
+          apply_lookup(in, out, x1 - x0, src.format, store_table->table, store_table->inverts);
+        } else {
+          std::memcpy(out, in, static_cast<std::size_t>(x1 - x0) * channels);
+        }
+      }
+      task = end;
+    }
+  };
+  parallel_for(pool, 0, strips * bands, 1, body);
+  return true;
+}
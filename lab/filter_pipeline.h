@@ -0,0 +1,98 @@
+//
+// Chains of image filters that run in one pass over the image.
+// Applying the imageprocessing/ plugins one after another reads and writes the whole image per filter.
+// A pipeline instead streams rows through the chain: each neighbourhood filter keeps the few rows of its
+// input it still needs in a ring and pulls the next one from the filter before it, so every source row is
+// read once, every output row written once and nothing in between leaves the cache.
+// Consecutive point filters are merged into one lookup table, point filters at either end of the chain
+// are applied while loading or storing a row.
+//
+
+#ifndef LAB_FILTER_PIPELINE_H
+#define LAB_FILTER_PIPELINE_H
+
+#include "bmp_image.h"
+#include "image_kernels.h"
+
+#include <vector>
+
+class thread_pool;
+
+/**
+ * Results match applying the filters to the whole image one after another with the kernels of
+ * image_kernels.h. Point filters leave alpha alone, like invert, Sobel replaces the colour channels.
+ */
+class filter_pipeline {
+public:
+  /**
+   * Append 255 - value
+   */
+  filter_pipeline &invert();
+
+  /**
+   * Append 255 for values of at least level, 0 otherwise
+   */
+  filter_pipeline &threshold(unsigned char level);
+
+  /**
+   * Append an arbitrary point filter
+   * @param table new value for each of the 256 old ones
+   */
+  filter_pipeline &lookup(const unsigned char table[256]);
+
+  /**
+   * Append a separable convolution, see separable_convolve
+   */
+  filter_pipeline &convolve(std::vector<float> kernel_x, std::vector<float> kernel_y);
+
+  filter_pipeline &gaussian_blur(float sigma);
+
+  /**
+   * Append a box mean with a (2 radius + 1)^2 window
+   */
+  filter_pipeline &mean(int radius);
+
+  /**
+   * Append the Sobel gradient magnitude of the luminance, written to all colour channels
+   * @param scale see sobel
+   */
+  filter_pipeline &sobel(float scale);
+
+  /**
+   * @return filters left after merging the point filters
+   */
+  std::size_t size() const noexcept {
+    return stages_.size();
+  }
+
+  /**
+   * Run the chain
+   * @param src rows are taken in memory order
+   * @param dst same size and format as src, must not overlap it
+   * @param pool threads bands of rows are spread over, nullptr to stay on the calling thread
+   * @return false if the images don't match
+   */
+  bool run(const image_view &src, const image_buffer &dst, thread_pool *pool) const;
+
+private:
+  enum class stage_type {
+    lookup,
+    convolve,
+    sobel,
+  };
+
+  struct stage {
+    stage_type type = stage_type::lookup;
+    unsigned char table[256] = {};
+    bool inverts = false; // table is 255 - value
+    std::vector<float> kernel_x;
+    std::vector<float> kernel_y;
+    float scale = 0;
+  };
+
+  class row_stream;
+
+  std::vector<stage> stages_;
+};
+
+#endif //LAB_FILTER_PIPELINE_H
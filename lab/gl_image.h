@@ -0,0 +1,164 @@
+//
+// Helpers to hand image_view data to OpenGL.
+//
+
+#ifndef LAB_GL_IMAGE_H
+#define LAB_GL_IMAGE_H
+
+#include "GL/glew.h"
+#include "bmp_image.h"
+#include "mipmap.h"
+#include "texture_cache.h"
+
+/**
+ * Map a pixel format onto the matching OpenGL transfer and internal format.
+ * BGR(A) is a native transfer format, so BMP data never has to be swizzled for OpenGL.
+ */
+inline void gl_pixel_format(pixel_format format, GLenum &transfer, GLint &internal) noexcept {
+  switch (format) {
+    case pixel_format::bgr8:
+      transfer = GL_BGR;
+      internal = GL_RGB8;
+      break;
+    case pixel_format::bgra8:
+      transfer = GL_BGRA;
+      internal = GL_RGBA8;
+      break;
+    case pixel_format::bgrx8:
+      transfer = GL_BGRA;
+      internal = GL_RGB8;
+      break;
+    case pixel_format::rgb8:
+      transfer = GL_RGB;
+      internal = GL_RGB8;
+      break;
+    case pixel_format::rgba8:
+      transfer = GL_RGBA;
+      internal = GL_RGBA8;
+      break;
+  }
+}
+
+/**
+ * Describe the row layout of img to the unpack state instead of repacking the rows
+ */
+inline void gl_unpack_layout(const image_view &img) {
+  const auto bpp = static_cast<std::size_t>(bytes_per_pixel(img.format));
+  const std::size_t packed_row = (img.width * bpp + 3) / 4 * 4;
+  if (img.stride == packed_row) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  } else {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(img.stride / bpp));
+  }
+}
+
+/**
+ * Upload a bottom-up image as level 0 of the currently bound 2D texture.
+ * If a pixel unpack buffer is bound, img.pixels is interpreted as offset into it.
+ * @return false if the image is empty or stored top-down
+ */
+inline bool gl_upload_image(const image_view &img) {
+  if (img.width <= 0 || img.height <= 0 || !img.bottom_up) {
+    return false;
+  }
+  GLenum transfer = GL_BGR;
+  GLint internal = GL_RGB8;
+  gl_pixel_format(img.format, transfer, internal);
+
+  gl_unpack_layout(img);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal, img.width, img.height, 0, transfer, GL_UNSIGNED_BYTE, img.pixels);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  return true;
+}
+
+/**
+ * Allocate all levels of the currently bound 2D texture.
+ * Uses immutable storage where available. A texture which already is immutable keeps its storage,
+ * so later uploads into it have to match the original size.
+ */
+inline void gl_allocate_mipmapped(int width, int height, int levels, pixel_format format) {
+  GLenum transfer = GL_BGR;
+  GLint internal = GL_RGB8;
+  gl_pixel_format(format, transfer, internal);
+
+  if (GLEW_ARB_texture_storage) {
+    GLint immutable = GL_FALSE;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+    if (immutable == GL_FALSE) {
+      glTexStorage2D(GL_TEXTURE_2D, levels, static_cast<GLenum>(internal), width, height);
+    }
+  } else {
+    for (int level = 0; level < levels; level++) {
+      glTexImage2D(GL_TEXTURE_2D, level, internal, width, height, 0, transfer, GL_UNSIGNED_BYTE, nullptr);
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+/**
+ * Fill one level of storage allocated with gl_allocate_mipmapped, img has to be bottom-up
+ */
+inline void gl_upload_level(const image_view &img, int level) {
+  GLenum transfer = GL_BGR;
+  GLint internal = GL_RGB8;
+  gl_pixel_format(img.format, transfer, internal);
+
+  gl_unpack_layout(img);
+  glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, img.width, img.height, transfer, GL_UNSIGNED_BYTE, img.pixels);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+/**
+ * Upload base and its chain into the currently bound 2D texture and switch it to trilinear filtering
+ * @return false if the image is empty or stored top-down
+ */
+inline bool gl_upload_mip_chain(const image_view &base, const mip_chain &chain) {
+  if (base.width <= 0 || base.height <= 0 || !base.bottom_up) {
+    return false;
+  }
+  gl_allocate_mipmapped(base.width, base.height, static_cast<int>(chain.levels.size()) + 1, base.format);
+  gl_upload_level(base, 0);
+  for (std::size_t i = 0; i < chain.levels.size(); i++) {
+    gl_upload_level(chain.view(i), static_cast<int>(i) + 1);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  return true;
+}
+
+/**
+ * @return true if the driver can sample BC1/BC3 textures
+ */
+inline bool gl_supports_block_compression() {
+  return GLEW_EXT_texture_compression_s3tc != 0;
+}
+
+/**
+ * Upload all levels of a cooked texture into the currently bound 2D texture.
+ * Uses trilinear filtering if there's more than one level.
+ */
+inline bool gl_upload_compressed(const cooked_texture &cooked) {
+  if (!cooked.valid()) {
+    return false;
+  }
+  const GLenum internal = cooked.format() == block_format::bc1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                                                 : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  const auto &levels = cooked.levels();
+  // Storage of another format can't be respecified, so immutable textures are never created here
+  for (std::size_t i = 0; i < levels.size(); i++) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), internal, levels[i].width, levels[i].height, 0,
+                           static_cast<GLsizei>(levels[i].size), levels[i].blocks);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size()) - 1);
+  if (levels.size() > 1) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  }
+  return true;
+}
+
+#endif //LAB_GL_IMAGE_H
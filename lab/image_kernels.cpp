@@ -0,0 +1,531 @@
+//
+// Image processing kernels, see image_kernels.h
+//
+
+#include "image_kernels.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if LAB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Rows per band of the horizontal pass and of Sobel
+constexpr int band_rows = 16;
+
+// Pixels per column strip of the vertical pass, the ring of rows of a strip stays in L2
+constexpr int strip_pixels = 128;
+
+constexpr float pi = 3.14159265359f;
+
+inline unsigned char to_byte(float value) noexcept {
+  return static_cast<unsigned char>(std::min(std::max(value + 0.5f, 0.0f), 255.0f));
+}
+
+void to_float_scalar(const unsigned char *in, float *out, int n) noexcept {
+  for (int i = 0; i < n; i++) {
+    out[i] = in[i];
+  }
+}
+
+void to_bytes_scalar(const float *in, unsigned char *out, int n) noexcept {
+  for (int i = 0; i < n; i++) {
+    out[i] = to_byte(in[i]);
+  }
+}
+
+// Convolution of interleaved channels, in[i + j * step] is tap j of element i
+
+void convolve_scalar(const float *in, int step, const float *kernel, int taps, float *out, int n) noexcept {
+  for (int i = 0; i < n; i++) {
+    float sum = 0;
+    for (int j = 0; j < taps; j++) {
+      sum += kernel[j] * in[i + j * step];
+    }
+    out[i] = sum;
+  }
+}
+
+void accumulate_rows_scalar(const float *const *rows, const float *kernel, int taps, float *out, int n) noexcept {
+  for (int i = 0; i < n; i++) {
+    float sum = 0;
+    for (int j = 0; j < taps; j++) {
+      sum += kernel[j] * rows[j][i];
+    }
+    out[i] = sum;
+  }
+}
+
+#if LAB_X86_SIMD
+
+LAB_TARGET("avx2,fma")
+void to_float_avx2(const unsigned char *in, float *out, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + i));
+    _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)));
+  }
+  to_float_scalar(in + i, out + i, n - i);
+}
+
+LAB_TARGET("avx2,fma")
+void to_bytes_avx2(const float *in, unsigned char *out, int n) {
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 lo = _mm256_setzero_ps();
+  const __m256 hi = _mm256_set1_ps(255.0f);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i a = _mm256_cvttps_epi32(
+        _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(in + i), half), lo), hi));
+    const __m256i b = _mm256_cvttps_epi32(
+        _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_loadu_ps(in + i + 8), half), lo), hi));
+    // Packing works within 128 bit lanes, the permute restores the element order
+    const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xD8);
+    const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), bytes);
+  }
+  to_bytes_scalar(in + i, out + i, n - i);
+}
+
+LAB_TARGET("avx2,fma")
+void convolve_avx2(const float *in, int step, const float *kernel, int taps, float *out, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 a = _mm256_setzero_ps();
+    __m256 b = _mm256_setzero_ps();
+    for (int j = 0; j < taps; j++) {
+      const __m256 k = _mm256_broadcast_ss(kernel + j);
+      a = _mm256_fmadd_ps(k, _mm256_loadu_ps(in + i + j * step), a);
+      b = _mm256_fmadd_ps(k, _mm256_loadu_ps(in + i + 8 + j * step), b);
+    }
+    _mm256_storeu_ps(out + i, a);
+    _mm256_storeu_ps(out + i + 8, b);
+  }
+  convolve_scalar(in + i, step, kernel, taps, out + i, n - i);
+}
+
+LAB_TARGET("avx2,fma")
+void accumulate_rows_avx2(const float *const *rows, const float *kernel, int taps, float *out, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256 a = _mm256_setzero_ps();
+    __m256 b = _mm256_setzero_ps();
+    for (int j = 0; j < taps; j++) {
+      const __m256 k = _mm256_broadcast_ss(kernel + j);
+      a = _mm256_fmadd_ps(k, _mm256_loadu_ps(rows[j] + i), a);
+      b = _mm256_fmadd_ps(k, _mm256_loadu_ps(rows[j] + i + 8), b);
+    }
+    _mm256_storeu_ps(out + i, a);
+    _mm256_storeu_ps(out + i + 8, b);
+  }
+  for (; i < n; i++) {
+    float sum = 0;
+    for (int j = 0; j < taps; j++) {
+      sum += kernel[j] * rows[j][i];
+    }
+    out[i] = sum;
+  }
+}
+
+#endif
+
+void to_float(const unsigned char *in, float *out, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    to_float_avx2(in, out, n);
+    return;
+  }
+#endif
+  to_float_scalar(in, out, n);
+}
+
+void to_bytes(const float *in, unsigned char *out, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    to_bytes_avx2(in, out, n);
+    return;
+  }
+#endif
+  to_bytes_scalar(in, out, n);
+}
+
+void convolve(const float *in, int step, const float *kernel, int taps, float *out, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    convolve_avx2(in, step, kernel, taps, out, n);
+    return;
+  }
+#endif
+  convolve_scalar(in, step, kernel, taps, out, n);
+}
+
+void accumulate_rows(const float *const *rows, const float *kernel, int taps, float *out, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    accumulate_rows_avx2(rows, kernel, taps, out, n);
+    return;
+  }
+#endif
+  accumulate_rows_scalar(rows, kernel, taps, out, n);
+}
+
+/**
+ * Rows are independent, each one is widened into a padded float row, filtered and written back
+ */
+void horizontal_pass(const image_buffer &img, const std::vector<float> &kernel, thread_pool *pool) {
+  const int channels = bytes_per_pixel(img.format);
+  const int bands = (img.height + band_rows - 1) / band_rows;
+
+  parallel_for(pool, 0, bands, 1, [&](int first, int last) {
+    std::vector<float> scratch((2 * static_cast<std::size_t>(img.width) + kernel.size()) * channels);
+    for (int band = first; band < last; band++) {
+      const int y1 = std::min((band + 1) * band_rows, img.height);
+      for (int y = band * band_rows; y < y1; y++) {
+        convolve_row(img.pixels + static_cast<std::size_t>(y) * img.stride, img.width, channels, kernel,
+                     scratch.data());
+      }
+    }
+  });
+}
+
+/**
+ * Column strips are independent. Each walks down the image keeping the unfiltered rows it still needs in a ring,
+ * so rows can be overwritten right after they're filtered.
+ */
+void vertical_pass(const image_buffer &img, const std::vector<float> &kernel, thread_pool *pool) {
+  const int channels = bytes_per_pixel(img.format);
+  const int taps = static_cast<int>(kernel.size());
+  const int radius = taps / 2;
+  const int strips = (img.width + strip_pixels - 1) / strip_pixels;
+
+  parallel_for(pool, 0, strips, 1, [&](int first, int last) {
+    const int max_n = strip_pixels * channels;
+    std::vector<float> ring(static_cast<std::size_t>(taps) * max_n);
+    std::vector<float> filtered(static_cast<std::size_t>(max_n));
+    std::vector<const float *> rows(static_cast<std::size_t>(taps));
+
+    for (int strip = first; strip < last; strip++) {
+      const int offset = strip * strip_pixels * channels;
+      const int n = (std::min((strip + 1) * strip_pixels, img.width) - strip * strip_pixels) * channels;
+      // Logical row l, -radius <= l < height + radius, lives in slot (l + radius) % taps
+      auto slot = [&](int l) {
+        return ring.data() + static_cast<std::size_t>((l + radius) % taps) * max_n;
+      };
+      auto fetch = [&](int l) {
+        const int y = std::min(std::max(l, 0), img.height - 1);
+        to_float(img.pixels + static_cast<std::size_t>(y) * img.stride + offset, slot(l), n);
+      };
+
+      for (int l = -radius; l < radius; l++) {
+        fetch(l);
+      }
+      for (int y = 0; y < img.height; y++) {
+        // Still unmodified, only rows up to y - 1 have been written
+        fetch(y + radius);
+        for (int j = 0; j < taps; j++) {
+          rows[j] = slot(y - radius + j);
+        }
+        convolve_rows(rows.data(), kernel, n, filtered.data(),
+                      img.pixels + static_cast<std::size_t>(y) * img.stride + offset);
+      }
+    }
+  });
+}
+
+// Sobel helpers
+
+/**
+ * atan2 with a polynomial for the first octant, accurate to about 0.01 degrees
+ */
+inline float fast_atan2(float y, float x) noexcept {
+  const float ax = std::fabs(x);
+  const float ay = std::fabs(y);
+  const float hi = std::max(ax, ay);
+  const float a = hi > 0 ? std::min(ax, ay) / hi : 0;
+  const float s = a * a;
+  float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+  if (ay > ax) {
+    r = 0.5f * pi - r;
+  }
+  if (x < 0) {
+    r = pi - r;
+  }
+  return y < 0 ? -r : r;
+}
+
+inline unsigned char angle_to_byte(float angle) noexcept {
+  const float turns = angle * (0.5f / pi);
+  return static_cast<unsigned char>(static_cast<int>(std::floor(turns * 256.0f + 0.5f)) & 255);
+}
+
+/**
+ * Weights of the channels in memory order
+ */
+void luma_weights(pixel_format format, float weights[4]) noexcept {
+  const bool bgr = format == pixel_format::bgr8 || format == pixel_format::bgra8 || format == pixel_format::bgrx8;
+  weights[0] = bgr ? 0.114f : 0.299f;
+  weights[1] = 0.587f;
+  weights[2] = bgr ? 0.299f : 0.114f;
+  weights[3] = 0;
+}
+
+/**
+ * Luminance of one row, padded with a replicated pixel on both sides
+ */
+void luma_row(const unsigned char *row, int width, int channels, const float weights[4], float *out) noexcept {
+  for (int x = 0; x < width; x++) {
+    const unsigned char *p = row + x * channels;
+    out[x + 1] = weights[0] * p[0] + weights[1] * p[1] + weights[2] * p[2];
+  }
+  out[0] = out[1];
+  out[width + 1] = out[width];
+}
+
+void sobel_row_scalar(const float *above, const float *row, const float *below, int x0, int x1, float scale,
+                      unsigned char *magnitude, unsigned char *direction) noexcept {
+  for (int x = x0; x < x1; x++) {
+    // Rows are padded, x + 1 is the pixel itself
+    const float gx = (above[x + 2] + 2 * row[x + 2] + below[x + 2]) - (above[x] + 2 * row[x] + below[x]);
+    const float gy = (below[x] + 2 * below[x + 1] + below[x + 2]) - (above[x] + 2 * above[x + 1] + above[x + 2]);
+    if (magnitude != nullptr) {
+      magnitude[x] = to_byte(std::sqrt(gx * gx + gy * gy) * scale);
+    }
+    if (direction != nullptr) {
+      direction[x] = angle_to_byte(fast_atan2(gy, gx));
+    }
+  }
+}
+
+#if LAB_X86_SIMD
+
+LAB_TARGET("avx2,fma")
+inline __m256 fast_atan2_avx2(__m256 y, __m256 x) {
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 ax = _mm256_andnot_ps(sign, x);
+  const __m256 ay = _mm256_andnot_ps(sign, y);
+  const __m256 hi = _mm256_max_ps(ax, ay);
+  const __m256 nonzero = _mm256_cmp_ps(hi, _mm256_setzero_ps(), _CMP_GT_OQ);
+  const __m256 a = _mm256_and_ps(_mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(hi, _mm256_set1_ps(1e-30f))),
+                                 nonzero);
+  const __m256 s = _mm256_mul_ps(a, a);
+  __m256 r = _mm256_fmadd_ps(_mm256_set1_ps(-0.0464964749f), s, _mm256_set1_ps(0.15931422f));
+  r = _mm256_fmsub_ps(r, s, _mm256_set1_ps(0.327622764f));
+  r = _mm256_fmadd_ps(_mm256_mul_ps(r, s), a, a);
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(0.5f * pi), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+  r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(pi), r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+  return _mm256_xor_ps(r, _mm256_and_ps(y, sign));
+}
+
+/**
+ * Pack the low bytes of eight 32 bit lanes into 8 bytes at out
+ */
+LAB_TARGET("avx2,fma")
+inline void store_bytes(__m256i values, unsigned char *out) {
+  const __m128i lo = _mm256_castsi256_si128(values);
+  const __m128i hi = _mm256_extracti128_si256(values, 1);
+  const __m128i words = _mm_packus_epi32(lo, hi);
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(words, words));
+}
+
+LAB_TARGET("avx2,fma")
+void sobel_row_avx2(const float *above, const float *row, const float *below, int width, float scale,
+                    unsigned char *magnitude, unsigned char *direction) {
+  const __m256 two = _mm256_set1_ps(2.0f);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m256 a0 = _mm256_loadu_ps(above + x);
+    const __m256 a1 = _mm256_loadu_ps(above + x + 1);
+    const __m256 a2 = _mm256_loadu_ps(above + x + 2);
+    const __m256 b0 = _mm256_loadu_ps(below + x);
+    const __m256 b1 = _mm256_loadu_ps(below + x + 1);
+    const __m256 b2 = _mm256_loadu_ps(below + x + 2);
+    const __m256 r0 = _mm256_loadu_ps(row + x);
+    const __m256 r2 = _mm256_loadu_ps(row + x + 2);
+    const __m256 gx = _mm256_sub_ps(_mm256_add_ps(_mm256_fmadd_ps(two, r2, a2), b2),
+                                    _mm256_add_ps(_mm256_fmadd_ps(two, r0, a0), b0));
+    const __m256 gy = _mm256_sub_ps(_mm256_add_ps(_mm256_fmadd_ps(two, b1, b0), b2),
+                                    _mm256_add_ps(_mm256_fmadd_ps(two, a1, a0), a2));
+    if (magnitude != nullptr) {
+      const __m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(gx, gx, _mm256_mul_ps(gy, gy)));
+      const __m256 scaled = _mm256_fmadd_ps(length, _mm256_set1_ps(scale), _mm256_set1_ps(0.5f));
+      store_bytes(_mm256_cvttps_epi32(_mm256_min_ps(scaled, _mm256_set1_ps(255.0f))), magnitude + x);
+    }
+    if (direction != nullptr) {
+      const __m256 turns = _mm256_mul_ps(fast_atan2_avx2(gy, gx), _mm256_set1_ps(128.0f / pi));
+      const __m256i steps = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(turns, _mm256_set1_ps(0.5f))));
+      store_bytes(_mm256_and_si256(steps, _mm256_set1_epi32(255)), direction + x);
+    }
+  }
+  sobel_row_scalar(above, row, below, x, width, scale, magnitude, direction);
+}
+
+LAB_TARGET("avx2")
+void invert_row_avx2(unsigned char *row, std::size_t bytes, const unsigned char mask[32]) {
+  const __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(mask));
+  std::size_t i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    auto *p = reinterpret_cast<__m256i *>(row + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), m));
+  }
+  for (; i < bytes; i++) {
+    row[i] ^= mask[i % 32];
+  }
+}
+
+#endif
+
+void sobel_row(const float *above, const float *row, const float *below, int width, float scale,
+               unsigned char *magnitude, unsigned char *direction) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    sobel_row_avx2(above, row, below, width, scale, magnitude, direction);
+    return;
+  }
+#endif
+  sobel_row_scalar(above, row, below, 0, width, scale, magnitude, direction);
+}
+
+} // namespace
+
+void separable_convolve(const image_buffer &img, const std::vector<float> &kernel_x,
+                        const std::vector<float> &kernel_y, thread_pool *pool) {
+  if (img.empty()) {
+    return;
+  }
+  if (kernel_x.size() % 2 == 1) {
+    horizontal_pass(img, kernel_x, pool);
+  }
+  if (kernel_y.size() % 2 == 1) {
+    vertical_pass(img, kernel_y, pool);
+  }
+}
+
+std::vector<float> gaussian_kernel(float sigma) {
+  const int radius = std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+  std::vector<float> kernel(static_cast<std::size_t>(2 * radius + 1));
+  float sum = 0;
+  for (int i = -radius; i <= radius; i++) {
+    const float w = std::exp(-static_cast<float>(i * i) / (2.0f * sigma * sigma));
+    kernel[i + radius] = w;
+    sum += w;
+  }
+  for (auto &w : kernel) {
+    w /= sum;
+  }
+  return kernel;
+}
+
+void gaussian_blur(const image_buffer &img, float sigma, thread_pool *pool) {
+  if (sigma <= 0) {
+    return;
+  }
+  const std::vector<float> kernel = gaussian_kernel(sigma);
+  separable_convolve(img, kernel, kernel, pool);
+}
+
+void sobel(const image_view &src, unsigned char *magnitude, unsigned char *direction, std::size_t dst_stride,
+           float scale, thread_pool *pool) {
+  if (src.empty() || (magnitude == nullptr && direction == nullptr)) {
+    return;
+  }
+  float weights[4];
+  luma_weights(src.format, weights);
+  const int channels = bytes_per_pixel(src.format);
+  const int bands = (src.height + band_rows - 1) / band_rows;
+  const std::size_t padded = static_cast<std::size_t>(src.width) + 2;
+  const auto load_luma = [&](int y, float *out) {
+    luma_row(src.pixels + static_cast<std::size_t>(y) * src.stride, src.width, channels, weights, out);
+  };
+
+  parallel_for(pool, 0, bands, 1, [&](int first, int last) {
+    std::vector<float> luma(3 * padded);
+    for (int band = first; band < last; band++) {
+      const int y0 = band * band_rows;
+      const int y1 = std::min(y0 + band_rows, src.height);
+      // Three rolling rows of luminance, the band starts with its neighbour above
+      float *rows[3] = {luma.data(), luma.data() + padded, luma.data() + 2 * padded};
+      load_luma(std::max(y0 - 1, 0), rows[0]);
+      load_luma(y0, rows[1]);
+      for (int y = y0; y < y1; y++) {
+        load_luma(std::min(y + 1, src.height - 1), rows[2]);
+        const std::size_t offset = static_cast<std::size_t>(y) * dst_stride;
+        sobel_row(rows[0], rows[1], rows[2], src.width, scale,
+                  magnitude != nullptr ? magnitude + offset : nullptr,
+                  direction != nullptr ? direction + offset : nullptr);
+        std::rotate(rows, rows + 1, rows + 3);
+      }
+    }
+  });
+}
+
+void invert(const image_buffer &img, thread_pool *pool) {
+  if (img.empty()) {
+    return;
+  }
+  const int channels = bytes_per_pixel(img.format);
+  const bool alpha = img.format == pixel_format::rgba8 || img.format == pixel_format::bgra8;
+  // 32 bytes hold a whole number of 4 byte pixels, 3 byte pixels have no alpha to skip
+  unsigned char mask[32];
+  for (int i = 0; i < 32; i++) {
+    mask[i] = alpha && i % 4 == 3 ? 0 : 255;
+  }
+  const std::size_t row_bytes = static_cast<std::size_t>(img.width) * channels;
+  const int bands = (img.height + band_rows - 1) / band_rows;
+
+  parallel_for(pool, 0, bands, 4, [&](int first, int last) {
+    for (int y = first * band_rows; y < std::min(last * band_rows, img.height); y++) {
+      unsigned char *row = img.pixels + static_cast<std::size_t>(y) * img.stride;
+#if LAB_X86_SIMD
+      if (cpu_has_avx2()) {
+        invert_row_avx2(row, row_bytes, mask);
+        continue;
+      }
+#endif
+      for (std::size_t i = 0; i < row_bytes; i++) {
+        row[i] ^= mask[i % 32];
+      }
+    }
+  });
+}
+
+void convolve_row(unsigned char *row, int width, int channels, const std::vector<float> &kernel, float *scratch) {
+  const int radius = static_cast<int>(kernel.size()) / 2;
+  const int n = width * channels;
+  float *padded = scratch;
+  float *filtered = scratch + static_cast<std::size_t>(width + 2 * radius) * channels;
+  to_float(row, padded + radius * channels, n);
+  for (int p = 0; p < radius; p++) {
+    for (int c = 0; c < channels; c++) {
+      padded[p * channels + c] = row[c];
+      padded[(radius + width + p) * channels + c] = row[(width - 1) * channels + c];
+    }
+  }
+  convolve(padded, channels, kernel.data(), static_cast<int>(kernel.size()), filtered, n);
+  to_bytes(filtered, row, n);
+}
+
+void widen_row(const unsigned char *in, float *out, int n) {
+  to_float(in, out, n);
+}
+
+void convolve_rows(const float *const *rows, const std::vector<float> &kernel, int n, float *scratch,
+                   unsigned char *out) {
+  accumulate_rows(rows, kernel.data(), static_cast<int>(kernel.size()), scratch, n);
+  to_bytes(scratch, out, n);
+}
+
+void sobel_luma_row(const unsigned char *row, int width, pixel_format format, float *out) {
+  float weights[4];
+  luma_weights(format, weights);
+  luma_row(row, width, bytes_per_pixel(format), weights, out);
+}
+
+void sobel_magnitude_row(const float *above, const float *row, const float *below, int width, float scale,
+                         unsigned char *magnitude) {
+  sobel_row(above, row, below, width, scale, magnitude, nullptr);
+}
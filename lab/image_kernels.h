@@ -0,0 +1,111 @@
+//
+// Image processing kernels on 8 bit pixel buffers: separable convolution, Gaussian blur, Sobel and invert.
+// Native counterparts of the ImageJ filters in imageprocessing/, meant to pre-filter textures before upload.
+// Inner loops use AVX2 where available, the work is split into row bands or column strips that fit the
+// cache and spread over a thread pool. Borders are handled by replicating the edge pixels.
+//
+
+#ifndef LAB_IMAGE_KERNELS_H
+#define LAB_IMAGE_KERNELS_H
+
+#include "bmp_image.h"
+
+#include <vector>
+
+class thread_pool;
+
+/**
+ * Writable counterpart of image_view for kernels working in place.
+ * Mapped BMP files are read-only, so they are filtered after the copy into their upload or staging buffer.
+ */
+struct image_buffer {
+  unsigned char *pixels = nullptr; // first row in memory
+  int width = 0;
+  int height = 0;
+  std::size_t stride = 0;
+  pixel_format format = pixel_format::rgba8;
+
+  bool empty() const noexcept {
+    return pixels == nullptr || width <= 0 || height <= 0;
+  }
+
+  image_view view() const noexcept {
+    image_view v;
+    v.pixels = pixels;
+    v.width = width;
+    v.height = height;
+    v.stride = stride;
+    v.format = format;
+    return v;
+  }
+};
+
+/**
+ * Convolve all channels in place with kernel_x along the rows and kernel_y along the columns
+ * @param kernel_x odd number of taps, the centre tap is in the middle
+ * @param kernel_y odd number of taps, the centre tap is in the middle
+ * @param pool threads for the bands and strips, nullptr to stay on the calling thread
+ */
+void separable_convolve(const image_buffer &img, const std::vector<float> &kernel_x,
+                        const std::vector<float> &kernel_y, thread_pool *pool);
+
+/**
+ * @return normalised Gaussian taps covering +-3 sigma
+ */
+std::vector<float> gaussian_kernel(float sigma);
+
+/**
+ * Blur all channels in place
+ */
+void gaussian_blur(const image_buffer &img, float sigma, thread_pool *pool);
+
+/**
+ * Sobel operator on the luminance of src, rows are taken in memory order.
+ * Either output may be nullptr, both are width x height bytes with dst_stride bytes per row.
+ * @param magnitude gradient length times scale, clamped to 255
+ * @param direction gradient angle, 0..255 covering a full turn counterclockwise from +x
+ * @param scale 0.25 maps the strongest possible edge to about 255
+ */
+void sobel(const image_view &src, unsigned char *magnitude, unsigned char *direction, std::size_t dst_stride,
+           float scale, thread_pool *pool);
+
+/**
+ * Invert the colour channels in place, alpha is kept
+ */
+void invert(const image_buffer &img, thread_pool *pool);
+
+// Single rows of the kernels above, for streaming rows through a chain of filters (see filter_pipeline.h).
+// They give the same bytes as the whole image functions.
+
+/**
+ * Horizontal pass of separable_convolve over one row in place
+ * @param scratch (2 width + kernel.size()) * channels floats
+ */
+void convolve_row(unsigned char *row, int width, int channels, const std::vector<float> &kernel, float *scratch);
+
+/**
+ * Bytes to floats, the input of convolve_rows
+ */
+void widen_row(const unsigned char *in, float *out, int n);
+
+/**
+ * Vertical pass of separable_convolve for one row
+ * @param rows kernel.size() rows of n values from widen_row, rows[i] is weighted by kernel[i]
+ * @param scratch n floats
+ */
+void convolve_rows(const float *const *rows, const std::vector<float> &kernel, int n, float *scratch,
+                   unsigned char *out);
+
+/**
+ * Luminance of one row as sobel sees it
+ * @param out width + 2 floats, padded with a replicated pixel on both sides
+ */
+void sobel_luma_row(const unsigned char *row, int width, pixel_format format, float *out);
+
+/**
+ * Gradient magnitude of the middle of three rows from sobel_luma_row
+ */
+void sobel_magnitude_row(const float *above, const float *row, const float *below, int width, float scale,
+                         unsigned char *magnitude);
+
+#endif //LAB_IMAGE_KERNELS_H
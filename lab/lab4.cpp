@@ -4,6 +4,14 @@
 #include "GL/glew.h"
 #include "GL/freeglut.h"
 #include <iostream>
+#include <memory>
+#include <sys/stat.h>
+
+#include "procedural.h"
+#include "content_hash.h"
+#include "texture_atlas.h"
+#include "texture_manager.h"
+#include "texture_streamer.h"
 
 using namespace std;
 
@@ -13,91 +21,93 @@ using namespace std;
 #define checkImageHeight 64
 
 static GLubyte checkImage[checkImageHeight][checkImageWidth][4];
-static GLuint texName;
-
 
-// Data read from the header of the BMP file
-unsigned char header[54]; // Each BMP file begins by a 54-bytes header
-unsigned int dataPos;     // Position in the file where the actual data begins
-unsigned int imageWidth, imageHeight;
-unsigned int imageSize;   // = width*height*3
-// Actual RGB data
-unsigned char * imageData;
+// All textures of the scene share one atlas, which is composed and streamed in the background
+static std::unique_ptr<texture_streamer> streamer;
+static std::unique_ptr<texture_manager> textures;
+static texture_handle atlasTexture; // declared after the manager, so it's released first
+static texture_atlas atlas;
+static int checkerRegion, marbleRegion, smallMarbleRegion;
+static texture_stats lastFrameStats;
 
-std::string str = "marbles.bmp";
+// Resident textures are kept below this, least recently used ones are evicted beyond it
+const size_t textureBudget = 64u << 20u;
 
-char *filenameandpath = &str[0];
+const char *filenameandpath = "marbles.bmp";
+const char *smallMarblesPath = "marbles64.bmp";
+const char *cookedPath = "cooked";
 
 // GLUT Window ID
 int windowid;
 
-int loadBMP_custom(char *imagepath) {
-  FILE * file;
-  file = fopen(imagepath, "rb"); // Open the file
-  if (!file) {
-    cout << "Image could not be opened" << endl;
-    return 0;
-  }
-
-  if (fread(header, 1, 54, file) != 54) { // If not 54 bytes read : problem
-    cout << "Not a correct BMP file" << endl;
-    return 0;
-  }
-
-  if (header[0] != 'B' || header[1] != 'M') {
-    cout << "Not a correct BMP file" << endl;
-    return 0;
-  }
-
-  // Read ints from the byte array
-  dataPos = *(int*)&(header[0x0A]);
-  imageSize = *(int*)&(header[0x22]);
-  imageWidth = *(int*)&(header[0x12]);
-  imageHeight = *(int*)&(header[0x16]);
-  // Some BMP files are misformatted, guess missing information
-  // 3 : one byte for each Red, Green and Blue component
-  if (imageSize == 0)    imageSize = imageWidth * imageHeight * 3;
-  if (dataPos == 0)      dataPos = 54; // The BMP header is done that way
-  cout << "imageSize:" << imageSize <<  endl;
-  cout << "dataPos:" << dataPos << endl;
-  imageData = new unsigned char[imageSize]; // Create a buffer
-  fread(imageData, 1, imageSize, file); // Read the actual data from the file into the buffer
-
-  fclose(file); //Everything is in memory now, the file can be closed
-  return 0;
-}
-
 
 void makeCheckImage(){
-  int i, j, c;
-
-  for (i = 0; i < checkImageHeight; i++) {
-    for (j = 0; j < checkImageWidth; j++) {
-      c = ((((i & 0x8) == 0) ^ (((j & 0x8)) == 0))) * 255;
-      checkImage[i][j][0] = (GLubyte)c;
-      checkImage[i][j][1] = (GLubyte)c;
-      checkImage[i][j][2] = (GLubyte)c;
-      checkImage[i][j][3] = (GLubyte)255;
-    }
-  }
+  // Black and white squares of 8 texels
+  procedural_options checker;
+  checker.pattern = texture_pattern::checker;
+  checker.cell = 8;
+  generate_texture(checker, &checkImage[0][0][0], checkImageWidth, checkImageHeight, checkImageWidth * 4, nullptr);
 }
 
 void initTextures(){
   makeCheckImage();
 
+  image_view checker;
+  checker.pixels = &checkImage[0][0][0];
+  checker.width = checkImageWidth;
+  checker.height = checkImageHeight;
+  checker.stride = checkImageWidth * 4;
+  checker.format = pixel_format::rgba8;
+  checker.bottom_up = true;
+
+  // Only the headers are read here, the pixels are touched by the worker composing the atlas
+  auto marbles = std::make_shared<mapped_bmp>(filenameandpath);
+  auto smallMarbles = std::make_shared<mapped_bmp>(smallMarblesPath);
+
+  checkerRegion = atlas.add(checker);
+  marbleRegion = marbles->valid() ? atlas.add(marbles->view()) : checkerRegion;
+  smallMarbleRegion = smallMarbles->valid() ? atlas.add(smallMarbles->view()) : checkerRegion;
+  if (!atlas.pack()) {
+    cout << "Textures don't fit into the atlas" << endl;
+  }
+  cout << "Atlas " << atlas.width() << "x" << atlas.height() << ", "
+       << atlas.efficiency() * 100 << "% used" << endl;
+  const vector<unsigned> separate = {(unsigned) checkerRegion, (unsigned) marbleRegion, (unsigned) smallMarbleRegion};
+  const vector<unsigned> shared(separate.size(), 0);
+  cout << "Texture binds per frame: " << texture_atlas::bind_count(separate)
+       << " -> " << texture_atlas::bind_count(shared) << endl;
+
+  // Minified surfaces like the oblique quad sample the mip chain trilinearly.
+  // The atlas is opaque, so BC1 stores it in 4 bits per texel and later runs load it from the cooked cache.
+  // Sub images can't repeat, the gutters take care of the filtering at their borders.
+  texture_params params;
+  params.stream.mipmaps = true;
+  params.stream.compress = true;
+  params.stream.compression = block_format::bc1;
+  params.wrap = GL_CLAMP_TO_EDGE;
+  params.mag_filter = GL_LINEAR;
+  mkdir(cookedPath, 0755);
+  streamer.reset(new texture_streamer());
+  streamer->use_cache(cookedPath);
+  textures.reset(new texture_manager(*streamer, textureBudget));
+
+  // The files and the layout identify the content, a file that changed on disk gives a new atlas
+  content_hash atlasKey;
+  hash_file_stamp(filenameandpath, atlasKey);
+  hash_file_stamp(smallMarblesPath, atlasKey);
+  atlasKey.update_value(atlas.region(marbleRegion));
+  atlasKey.update_value(atlas.region(smallMarbleRegion));
+  if (atlas.width() > 0) {
+    // Repeatable, so the atlas can be composed again after an eviction
+    atlasTexture = textures->load(atlas.width(), atlas.height(), [marbles, smallMarbles](unsigned char *rgba, size_t) {
+      atlas.compose(rgba);
+    }, atlasKey.digest(), params);
+  }
+}
 
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-  glGenTextures(1, &texName);
-  glBindTexture(GL_TEXTURE_2D, texName);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, checkImageWidth, checkImageHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, checkImage);
-
+void atlasTexCoord(int region, float s, float t) {
+  const atlas_region &r = atlas.region(region);
+  glTexCoord2f(r.u(s), r.v(t));
 }
 
 void display(void)
@@ -106,17 +116,23 @@ void display(void)
   glEnable(GL_TEXTURE_2D);
   glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_DECAL);
 
-  glBindTexture(GL_TEXTURE_2D, texName);
+  // One bind for the whole scene
+  glBindTexture(GL_TEXTURE_2D, textures->use(atlasTexture));
   glBegin(GL_QUADS);
-  glTexCoord2f(0.0, 0.0); glVertex3f(-2.0, -1.0, 0.0);
-  glTexCoord2f(0.0, 1.0); glVertex3f(-2.0, 1.0, 0.0);
-  glTexCoord2f(1.0, 1.0); glVertex3f(0.0, 1.0, 0.0);
-  glTexCoord2f(1.0, 0.0); glVertex3f(0.0, -1.0, 0.0);
-
-  glTexCoord2f(0.0, 0.0); glVertex3f(1.0, -1.0, 0.0);
-  glTexCoord2f(0.0, 1.0); glVertex3f(1.0, 1.0, 0.0);
-  glTexCoord2f(1.0, 1.0); glVertex3f(2.41421, 1.0, -1.41421);
-  glTexCoord2f(1.0, 0.0); glVertex3f(2.41421, -1.0, -1.41421);
+  atlasTexCoord(checkerRegion, 0.0, 0.0); glVertex3f(-2.0, -1.0, 0.0);
+  atlasTexCoord(checkerRegion, 0.0, 1.0); glVertex3f(-2.0, 1.0, 0.0);
+  atlasTexCoord(checkerRegion, 1.0, 1.0); glVertex3f(0.0, 1.0, 0.0);
+  atlasTexCoord(checkerRegion, 1.0, 0.0); glVertex3f(0.0, -1.0, 0.0);
+
+  atlasTexCoord(smallMarbleRegion, 0.0, 0.0); glVertex3f(0.2, -0.3, 0.0);
+  atlasTexCoord(smallMarbleRegion, 0.0, 1.0); glVertex3f(0.2, 0.3, 0.0);
+  atlasTexCoord(smallMarbleRegion, 1.0, 1.0); glVertex3f(0.8, 0.3, 0.0);
+  atlasTexCoord(smallMarbleRegion, 1.0, 0.0); glVertex3f(0.8, -0.3, 0.0);
+
+  atlasTexCoord(marbleRegion, 0.0, 0.0); glVertex3f(1.0, -1.0, 0.0);
+  atlasTexCoord(marbleRegion, 0.0, 1.0); glVertex3f(1.0, 1.0, 0.0);
+  atlasTexCoord(marbleRegion, 1.0, 1.0); glVertex3f(2.41421, 1.0, -1.41421);
+  atlasTexCoord(marbleRegion, 1.0, 0.0); glVertex3f(2.41421, -1.0, -1.41421);
   glEnd();
 
   glFlush();
@@ -127,6 +143,7 @@ void display(void)
 
   glTranslatef(0.0, 0.0, -4.5);
   glutSwapBuffers();
+  lastFrameStats = textures->end_frame();
 }
 
 /*-[Keyboard Callback]-------------------------------------------------------*/
@@ -147,8 +164,24 @@ void keyboard(unsigned char key, int x, int y) {
     case 's': // lowercase character 's'
       cout << "You just pressed 's'" << endl;
 
+      break;
+    case 'm': // lowercase character 'm'
+      cout << "Textures last frame: " << lastFrameStats.hits << " hits, " << lastFrameStats.misses << " misses, "
+           << lastFrameStats.evictions << " evictions, " << lastFrameStats.bytes_resident / 1024 << " of "
+           << lastFrameStats.budget / 1024 << " KiB resident" << endl;
+
+      break;
+    case 'c': // lowercase character 'c'
+      if (streamer) {
+        streamer->cache().print_statistics();
+      }
+
       break;
     case 27: // Escape key
+      // Releases GL objects, so it has to happen while the context is alive
+      atlasTexture = texture_handle();
+      textures.reset();
+      streamer.reset();
       glutDestroyWindow(windowid);
       exit(0);
       break;
@@ -179,7 +212,15 @@ void reshapeFunc(int x, int y) {
 }
 
 void idleFunc(void) {
-
+  static bool initialLoadReported = false;
+  if (streamer && streamer->pump() > 0) {
+    // Once, when the textures of the start are all in, 'c' prints them again later
+    if (!initialLoadReported && streamer->pending() == 0) {
+      streamer->cache().print_statistics();
+      initialLoadReported = true;
+    }
+    glutPostRedisplay();
+  }
 }
 
 
@@ -191,6 +232,12 @@ int main(int argc, char **argv) {
   glutInitWindowSize(800, 600);	  //determines the size of the window
   windowid = glutCreateWindow("Our Fourth OpenGL Window"); // create and name window
 
+  GLenum glewStatus = glewInit();
+  if (glewStatus != GLEW_OK) {
+    cout << "GLEW could not be initialized: " << glewGetErrorString(glewStatus) << endl;
+    return 1;
+  }
+
   glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
   glEnable(GL_DEPTH_TEST);
 
@@ -0,0 +1,347 @@
+//
+// Mip chain generation, see mipmap.h
+//
+
+#include "mipmap.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if LAB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int encode_steps = 1 << 14;
+constexpr float kaiser_alpha = 4.0f;
+constexpr float kaiser_radius = 3.0f; // in destination pixels
+
+// Levels smaller than this aren't worth waking up the pool for
+constexpr int min_parallel_pixels = 128 * 128;
+
+/**
+ * Lookup tables between 8 bit values and linear light
+ */
+struct transfer_tables {
+  float srgb_decode[256];
+  float linear_decode[256];
+  unsigned char srgb_encode[encode_steps];
+  unsigned char linear_encode[encode_steps];
+
+  transfer_tables() {
+    for (int i = 0; i < 256; i++) {
+      const float c = static_cast<float>(i) / 255.0f;
+      srgb_decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      linear_decode[i] = c;
+    }
+    for (int i = 0; i < encode_steps; i++) {
+      const float l = static_cast<float>(i) / (encode_steps - 1);
+      const float s = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+      srgb_encode[i] = static_cast<unsigned char>(std::min(255.0f, s * 255.0f + 0.5f));
+      linear_encode[i] = static_cast<unsigned char>(std::min(255.0f, l * 255.0f + 0.5f));
+    }
+  }
+
+  static const transfer_tables &get() {
+    static const transfer_tables tables;
+    return tables;
+  }
+};
+
+/**
+ * Precomputed taps of a 1D resampling filter, indices are already clamped to the source
+ */
+struct axis_filter {
+  int taps = 0;
+  bool pairs = false; // plain 2:1 box, taps are 2x and 2x + 1 with equal weights
+  std::vector<int> index;
+  std::vector<float> weight;
+};
+
+axis_filter identity_axis() {
+  axis_filter f;
+  f.taps = 1;
+  f.index = {0};
+  f.weight = {1.0f};
+  return f;
+}
+
+/**
+ * Box filter, odd sizes use the 3 tap polyphase weights so every source pixel contributes equally
+ */
+axis_filter box_axis(int src, int dst) {
+  if (src == dst) {
+    return identity_axis();
+  }
+  axis_filter f;
+  if (src % 2 == 0) {
+    f.taps = 2;
+    f.pairs = true;
+    for (int x = 0; x < dst; x++) {
+      f.index.push_back(2 * x);
+      f.index.push_back(2 * x + 1);
+      f.weight.push_back(0.5f);
+      f.weight.push_back(0.5f);
+    }
+    return f;
+  }
+  f.taps = 3;
+  const auto n = static_cast<float>(dst);
+  const float norm = 1.0f / (2.0f * n + 1.0f);
+  for (int x = 0; x < dst; x++) {
+    f.index.push_back(2 * x);
+    f.index.push_back(2 * x + 1);
+    f.index.push_back(2 * x + 2);
+    f.weight.push_back((n - static_cast<float>(x)) * norm);
+    f.weight.push_back(n * norm);
+    f.weight.push_back((static_cast<float>(x) + 1.0f) * norm);
+  }
+  return f;
+}
+
+float bessel_i0(float x) {
+  float sum = 1.0f;
+  float term = 1.0f;
+  const float q = x * x / 4.0f;
+  for (int k = 1; k < 32 && term > sum * 1e-7f; k++) {
+    term *= q / static_cast<float>(k * k);
+    sum += term;
+  }
+  return sum;
+}
+
+/**
+ * Kaiser windowed sinc, edges are clamped
+ */
+axis_filter kaiser_axis(int src, int dst) {
+  if (src == dst) {
+    return identity_axis();
+  }
+  axis_filter f;
+  const float scale = static_cast<float>(src) / static_cast<float>(dst);
+  const float support = kaiser_radius * scale;
+  f.taps = static_cast<int>(std::ceil(2.0f * support)) + 1;
+  const float window_norm = 1.0f / bessel_i0(kaiser_alpha);
+  const float pi = 3.14159265358979f;
+
+  for (int x = 0; x < dst; x++) {
+    const float center = (static_cast<float>(x) + 0.5f) * scale - 0.5f;
+    const int first = static_cast<int>(std::floor(center - support)) + 1;
+    float total = 0;
+    const std::size_t offset = f.weight.size();
+    for (int t = 0; t < f.taps; t++) {
+      const int s = first + t;
+      const float d = (static_cast<float>(s) - center) / scale;
+      float w = 0;
+      if (std::fabs(d) < kaiser_radius) {
+        const float sinc = d == 0 ? 1.0f : std::sin(pi * d) / (pi * d);
+        const float r = d / kaiser_radius;
+        w = sinc * bessel_i0(kaiser_alpha * std::sqrt(1.0f - r * r)) * window_norm;
+      }
+      f.index.push_back(std::min(std::max(s, 0), src - 1));
+      f.weight.push_back(w);
+      total += w;
+    }
+    for (int t = 0; t < f.taps; t++) {
+      f.weight[offset + t] /= total;
+    }
+  }
+  return f;
+}
+
+void decode_row(const unsigned char *in, float *out, int width, int channels, const float *color, const float *alpha) {
+  if (channels == 4) {
+    for (int x = 0; x < width; x++, in += 4, out += 4) {
+      out[0] = color[in[0]];
+      out[1] = color[in[1]];
+      out[2] = color[in[2]];
+      out[3] = alpha[in[3]];
+    }
+  } else {
+    for (int i = 0; i < width * channels; i++) {
+      out[i] = color[in[i]];
+    }
+  }
+}
+
+inline unsigned char encode(float v, const unsigned char *table) {
+  const int i = static_cast<int>(v * (encode_steps - 1) + 0.5f);
+  return table[std::min(std::max(i, 0), encode_steps - 1)];
+}
+
+void encode_row(const float *in, unsigned char *out, int width, int channels,
+                const unsigned char *color, const unsigned char *alpha) {
+  for (int x = 0; x < width; x++) {
+    for (int c = 0; c < channels; c++, in++, out++) {
+      *out = encode(*in, c == 3 ? alpha : color);
+    }
+  }
+}
+
+void horizontal_generic(const float *in, float *out, int dst_width, int channels, const axis_filter &f) {
+  for (int x = 0; x < dst_width; x++) {
+    const int *index = &f.index[static_cast<std::size_t>(x) * f.taps];
+    const float *weight = &f.weight[static_cast<std::size_t>(x) * f.taps];
+    for (int c = 0; c < channels; c++) {
+      float sum = 0;
+      for (int t = 0; t < f.taps; t++) {
+        sum += in[index[t] * channels + c] * weight[t];
+      }
+      out[x * channels + c] = sum;
+    }
+  }
+}
+
+void horizontal_pairs_scalar(const float *in, float *out, int dst_width, int channels) {
+  for (int i = 0; i < dst_width; i++) {
+    for (int c = 0; c < channels; c++) {
+      out[i * channels + c] = 0.5f * (in[2 * i * channels + c] + in[(2 * i + 1) * channels + c]);
+    }
+  }
+}
+
+void accumulate_scalar(float *acc, const float *row, float weight, int n) {
+  for (int i = 0; i < n; i++) {
+    acc[i] += row[i] * weight;
+  }
+}
+
+#if LAB_X86_SIMD
+
+LAB_TARGET("avx2")
+void horizontal_pairs4_avx2(const float *in, float *out, int dst_width) {
+  const __m256 half = _mm256_set1_ps(0.5f);
+  int x = 0;
+  for (; x + 2 <= dst_width; x += 2) {
+    const __m256 a = _mm256_loadu_ps(in + 8 * x);     // pixels 2x, 2x + 1
+    const __m256 b = _mm256_loadu_ps(in + 8 * x + 8); // pixels 2x + 2, 2x + 3
+    const __m256 even = _mm256_permute2f128_ps(a, b, 0x20);
+    const __m256 odd = _mm256_permute2f128_ps(a, b, 0x31);
+    _mm256_storeu_ps(out + 4 * x, _mm256_mul_ps(_mm256_add_ps(even, odd), half));
+  }
+  horizontal_pairs_scalar(in + 8 * x, out + 4 * x, dst_width - x, 4);
+}
+
+LAB_TARGET("avx2")
+void accumulate_avx2(float *acc, const float *row, float weight, int n) {
+  const __m256 w = _mm256_set1_ps(weight);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 sum = _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(_mm256_loadu_ps(row + i), w));
+    _mm256_storeu_ps(acc + i, sum);
+  }
+  accumulate_scalar(acc + i, row + i, weight, n - i);
+}
+
+#endif
+
+void horizontal(const float *in, float *out, int dst_width, int channels, const axis_filter &f) {
+  if (!f.pairs) {
+    horizontal_generic(in, out, dst_width, channels, f);
+    return;
+  }
+#if LAB_X86_SIMD
+  if (channels == 4 && cpu_has_avx2()) {
+    horizontal_pairs4_avx2(in, out, dst_width);
+    return;
+  }
+#endif
+  horizontal_pairs_scalar(in, out, dst_width, channels);
+}
+
+void accumulate(float *acc, const float *row, float weight, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    accumulate_avx2(acc, row, weight, n);
+    return;
+  }
+#endif
+  accumulate_scalar(acc, row, weight, n);
+}
+
+/**
+ * Filter the destination rows [first, last) of one level.
+ * Every source row the band needs is decoded and filtered horizontally exactly once.
+ */
+void downsample_rows(const image_view &src, mip_level &dst, int channels, const axis_filter &fx,
+                     const axis_filter &fy, bool srgb, int first, int last) {
+  const transfer_tables &tables = transfer_tables::get();
+  const float *color_decode = srgb ? tables.srgb_decode : tables.linear_decode;
+  const unsigned char *color_encode = srgb ? tables.srgb_encode : tables.linear_encode;
+
+  const int row_min = fy.index[static_cast<std::size_t>(first) * fy.taps];
+  const int row_max = fy.index[static_cast<std::size_t>(last) * fy.taps - 1];
+  const int dst_floats = dst.width * channels;
+
+  std::vector<float> linear(static_cast<std::size_t>(src.width) * channels);
+  std::vector<float> band(static_cast<std::size_t>(row_max - row_min + 1) * dst_floats);
+  std::vector<float> sum(static_cast<std::size_t>(dst_floats));
+
+  for (int r = row_min; r <= row_max; r++) {
+    decode_row(src.pixels + static_cast<std::size_t>(r) * src.stride, linear.data(), src.width, channels,
+               color_decode, tables.linear_decode);
+    horizontal(linear.data(), &band[static_cast<std::size_t>(r - row_min) * dst_floats], dst.width, channels, fx);
+  }
+
+  for (int y = first; y < last; y++) {
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    for (int t = 0; t < fy.taps; t++) {
+      const std::size_t tap = static_cast<std::size_t>(y) * fy.taps + t;
+      accumulate(sum.data(), &band[static_cast<std::size_t>(fy.index[tap] - row_min) * dst_floats],
+                 fy.weight[tap], dst_floats);
+    }
+    encode_row(sum.data(), &dst.pixels[static_cast<std::size_t>(y) * dst_floats], dst.width, channels,
+               color_encode, tables.linear_encode);
+  }
+}
+
+} // namespace
+
+int mip_level_count(int width, int height) noexcept {
+  int levels = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    levels++;
+  }
+  return levels;
+}
+
+mip_chain build_mip_chain(const image_view &base, const mip_options &options, thread_pool *pool) {
+  mip_chain chain;
+  chain.format = base.format;
+  chain.bottom_up = base.bottom_up;
+  if (base.empty()) {
+    return chain;
+  }
+
+  const int channels = bytes_per_pixel(base.format);
+  const int count = mip_level_count(base.width, base.height) - 1;
+  chain.levels.resize(static_cast<std::size_t>(count));
+
+  image_view src = base;
+  for (int i = 0; i < count; i++) {
+    mip_level &level = chain.levels[i];
+    level.width = std::max(1, src.width / 2);
+    level.height = std::max(1, src.height / 2);
+    level.pixels.resize(static_cast<std::size_t>(level.width) * level.height * channels);
+
+    const bool kaiser = options.filter == mip_filter::kaiser;
+    const axis_filter fx = kaiser ? kaiser_axis(src.width, level.width) : box_axis(src.width, level.width);
+    const axis_filter fy = kaiser ? kaiser_axis(src.height, level.height) : box_axis(src.height, level.height);
+
+    auto rows = [&](int first, int last) {
+      downsample_rows(src, level, channels, fx, fy, options.srgb, first, last);
+    };
+    if (pool == nullptr || level.width * level.height < min_parallel_pixels) {
+      rows(0, level.height);
+    } else {
+      // A few bands per thread keeps the load balanced without recomputing too many shared rows
+      const int grain = std::max(8, level.height / static_cast<int>(4 * pool->size()));
+      pool->parallel_for(0, level.height, grain, rows);
+    }
+    src = chain.view(static_cast<std::size_t>(i));
+  }
+  return chain;
+}
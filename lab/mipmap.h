@@ -0,0 +1,73 @@
+//
+// Mip chain generation for 8 bit RGB(A) images.
+// Filtering happens in linear light on floats, vertically with AVX2 where available,
+// and is spread over the rows of each level on a thread pool.
+//
+
+#ifndef LAB_MIPMAP_H
+#define LAB_MIPMAP_H
+
+#include "bmp_image.h"
+
+#include <vector>
+
+class thread_pool;
+
+enum class mip_filter {
+  box,    // 2x2 average, 3 taps on odd dimensions
+  kaiser, // Kaiser windowed sinc, sharper but slower
+};
+
+struct mip_options {
+  mip_filter filter = mip_filter::box;
+  bool srgb = true; // colour channels are sRGB encoded, alpha is always linear
+};
+
+/**
+ * A single tightly packed level, rows are stored in the orientation of the source image
+ */
+struct mip_level {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels;
+};
+
+/**
+ * All levels below the base image, levels[0] is mip level 1
+ */
+struct mip_chain {
+  pixel_format format = pixel_format::rgba8;
+  bool bottom_up = false;
+  std::vector<mip_level> levels;
+
+  /**
+   * @return view on level i + 1 of the chain
+   */
+  image_view view(std::size_t i) const {
+    image_view v;
+    v.pixels = levels[i].pixels.data();
+    v.width = levels[i].width;
+    v.height = levels[i].height;
+    v.stride = static_cast<std::size_t>(levels[i].width) * bytes_per_pixel(format);
+    v.format = format;
+    v.bottom_up = bottom_up;
+    return v;
+  }
+};
+
+/**
+ * @return number of levels of a full chain down to 1x1, including the base level
+ */
+int mip_level_count(int width, int height) noexcept;
+
+/**
+ * Build every level below base down to 1x1.
+ * Works on all formats of pixel_format, channel order doesn't matter for filtering and is kept as is.
+ * Non power of two sizes round down, like OpenGL does.
+ * @param base the full resolution image, it isn't copied
+ * @param options filter and colour space
+ * @param pool threads to spread the rows of each level over, nullptr to stay on the calling thread
+ */
+mip_chain build_mip_chain(const image_view &base, const mip_options &options, thread_pool *pool);
+
+#endif //LAB_MIPMAP_H
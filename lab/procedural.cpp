@@ -0,0 +1,509 @@
+//
+// Procedural textures, see procedural.h
+//
+
+#include "procedural.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if LAB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// A tile row of floats stays in L1 next to the output it is shaded into
+constexpr int tile_width = 256;
+constexpr int tile_height = 32;
+
+constexpr float two_pi = 6.28318530718f;
+
+/**
+ * Everything derived from the options once per image
+ */
+struct pattern_state {
+  procedural_options options;
+  int width;
+  int height;
+  float inv_width;
+  float inv_height;
+  float gradient_x; // gradient direction, scaled so the corners map to 0 and 1
+  float gradient_y;
+  float normalisation; // 1 / sum of the octave amplitudes
+  int octaves;
+  int frequency;
+};
+
+pattern_state make_state(const procedural_options &options, int width, int height) {
+  pattern_state s{};
+  s.options = options;
+  s.width = width;
+  s.height = height;
+  s.inv_width = 1.0f / static_cast<float>(width);
+  s.inv_height = 1.0f / static_cast<float>(height);
+  const float radians = options.angle * two_pi / 360.0f;
+  const float dx = std::cos(radians);
+  const float dy = std::sin(radians);
+  const float extent = std::max(std::fabs(dx) + std::fabs(dy), 1e-6f);
+  s.gradient_x = dx / extent;
+  s.gradient_y = dy / extent;
+  s.frequency = std::max(1, options.frequency);
+  s.octaves = std::max(1, std::min(options.octaves, 16));
+  float amplitudes = 0;
+  for (int o = 0; o < s.octaves; o++) {
+    amplitudes += std::ldexp(1.0f, -o);
+  }
+  s.normalisation = 1.0f / amplitudes;
+  if (s.options.cell < 1) {
+    s.options.cell = 1;
+  }
+  return s;
+}
+
+// Scalar reference, also used for the ends of rows not filling a whole vector
+
+inline std::uint32_t hash(std::int32_t x, std::int32_t y, std::uint32_t seed) noexcept {
+  std::uint32_t h = seed ^ static_cast<std::uint32_t>(x) * 0x27D4EB2Du ^ static_cast<std::uint32_t>(y) * 0x165667B1u;
+  h ^= h >> 15u;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12u;
+  h *= 0x297A2D39u;
+  h ^= h >> 15u;
+  return h;
+}
+
+inline float to_unit(std::uint32_t h) noexcept {
+  return static_cast<float>(static_cast<std::int32_t>(h >> 8u)) * (1.0f / 16777216.0f);
+}
+
+inline int wrap(int i, int period) noexcept {
+  return i >= period ? i - period : (i < 0 ? i + period : i);
+}
+
+inline float fade(float t) noexcept {
+  return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+inline float lerp(float a, float b, float t) noexcept {
+  return a + (b - a) * t;
+}
+
+inline float gradient(std::uint32_t h, float x, float y) noexcept {
+  return ((h & 1u) ? -x : x) + ((h & 2u) ? -y : y);
+}
+
+/**
+ * Parabolic sine approximation with one refinement step, good to about 0.001
+ */
+inline float fast_sin(float x) noexcept {
+  x -= two_pi * std::nearbyint(x * (1.0f / two_pi));
+  const float y = 1.27323954f * x - 0.405284735f * x * std::fabs(x);
+  return 0.225f * (y * std::fabs(y) - y) + y;
+}
+
+float value_noise(float x, float y, int period, std::uint32_t seed) noexcept {
+  const float fx0 = std::floor(x);
+  const float fy0 = std::floor(y);
+  const int ix = wrap(static_cast<int>(fx0), period);
+  const int iy = wrap(static_cast<int>(fy0), period);
+  const int ix1 = wrap(ix + 1, period);
+  const int iy1 = wrap(iy + 1, period);
+  const float sx = fade(x - fx0);
+  const float sy = fade(y - fy0);
+  const float bottom = lerp(to_unit(hash(ix, iy, seed)), to_unit(hash(ix1, iy, seed)), sx);
+  const float top = lerp(to_unit(hash(ix, iy1, seed)), to_unit(hash(ix1, iy1, seed)), sx);
+  return lerp(bottom, top, sy);
+}
+
+float perlin_noise(float x, float y, int period, std::uint32_t seed) noexcept {
+  const float fx0 = std::floor(x);
+  const float fy0 = std::floor(y);
+  const int ix = wrap(static_cast<int>(fx0), period);
+  const int iy = wrap(static_cast<int>(fy0), period);
+  const int ix1 = wrap(ix + 1, period);
+  const int iy1 = wrap(iy + 1, period);
+  const float dx = x - fx0;
+  const float dy = y - fy0;
+  const float sx = fade(dx);
+  const float sy = fade(dy);
+  const float bottom = lerp(gradient(hash(ix, iy, seed), dx, dy), gradient(hash(ix1, iy, seed), dx - 1, dy), sx);
+  const float top = lerp(gradient(hash(ix, iy1, seed), dx, dy - 1), gradient(hash(ix1, iy1, seed), dx - 1, dy - 1), sx);
+  return 0.5f * lerp(bottom, top, sy);
+}
+
+float cellular_noise(float x, float y, int period, std::uint32_t seed) noexcept {
+  const float fx0 = std::floor(x);
+  const float fy0 = std::floor(y);
+  float nearest = 8.0f;
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      const float cx = fx0 + static_cast<float>(dx);
+      const float cy = fy0 + static_cast<float>(dy);
+      const std::uint32_t h = hash(wrap(static_cast<int>(cx), period), wrap(static_cast<int>(cy), period), seed);
+      const float px = cx + to_unit(h) - x;
+      const float py = cy + to_unit(h * 0x9E3779B1u) - y;
+      nearest = std::min(nearest, px * px + py * py);
+    }
+  }
+  return std::sqrt(nearest);
+}
+
+// Noise functions summed up by fractal(), the AVX2 overloads are added further down
+
+struct value_basis {
+  float operator()(float x, float y, int period, std::uint32_t seed) const noexcept {
+    return value_noise(x, y, period, seed);
+  }
+#if LAB_X86_SIMD
+  inline __m256 operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const;
+#endif
+};
+
+struct perlin_basis {
+  float operator()(float x, float y, int period, std::uint32_t seed) const noexcept {
+    return perlin_noise(x, y, period, seed);
+  }
+#if LAB_X86_SIMD
+  inline __m256 operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const;
+#endif
+};
+
+struct turbulence_basis {
+  float operator()(float x, float y, int period, std::uint32_t seed) const noexcept {
+    return std::fabs(perlin_noise(x, y, period, seed));
+  }
+#if LAB_X86_SIMD
+  inline __m256 operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const;
+#endif
+};
+
+template<class Noise>
+float fractal(const pattern_state &s, float u, float v, Noise noise) noexcept {
+  float sum = 0;
+  for (int o = 0; o < s.octaves; o++) {
+    const int period = s.frequency << o;
+    sum += std::ldexp(noise(u * static_cast<float>(period), v * static_cast<float>(period), period,
+                            s.options.seed + static_cast<std::uint32_t>(o)), -o);
+  }
+  return sum * s.normalisation;
+}
+
+inline float clamp_unit(float t) noexcept {
+  return t < 0 ? 0 : (t > 1 ? 1 : t);
+}
+
+float evaluate(const pattern_state &s, int x, int y) noexcept {
+  const float u = (static_cast<float>(x) + 0.5f) * s.inv_width;
+  const float v = (static_cast<float>(y) + 0.5f) * s.inv_height;
+  switch (s.options.pattern) {
+    case texture_pattern::checker:
+      return static_cast<float>((x / s.options.cell ^ y / s.options.cell) & 1);
+    case texture_pattern::gradient:
+      return clamp_unit(0.5f + (u - 0.5f) * s.gradient_x + (v - 0.5f) * s.gradient_y);
+    case texture_pattern::value_noise:
+      return clamp_unit(fractal(s, u, v, value_basis{}));
+    case texture_pattern::perlin_noise:
+      return clamp_unit(0.5f + 0.5f * fractal(s, u, v, perlin_basis{}));
+    case texture_pattern::marble: {
+      const float turbulence = fractal(s, u, v, turbulence_basis{});
+      const float veins = static_cast<float>(std::max(1, s.frequency / 2));
+      return clamp_unit(0.5f + 0.5f * fast_sin(two_pi * veins * u + s.options.turbulence * turbulence));
+    }
+    case texture_pattern::cellular:
+      return clamp_unit(cellular_noise(u * static_cast<float>(s.frequency), v * static_cast<float>(s.frequency),
+                                       s.frequency, s.options.seed));
+  }
+  return 0;
+}
+
+void shade(const pattern_state &s, float t, unsigned char *out) noexcept {
+  for (int c = 0; c < 4; c++) {
+    const float a = s.options.color0[c];
+    const float b = s.options.color1[c];
+    out[c] = static_cast<unsigned char>(a + (b - a) * t + 0.5f);
+  }
+}
+
+void span_scalar(const pattern_state &s, int y, int x0, int x1, unsigned char *out) {
+  for (int x = x0; x < x1; x++, out += 4) {
+    shade(s, evaluate(s, x, y), out);
+  }
+}
+
+#if LAB_X86_SIMD
+
+// The same functions eight texels at a time
+
+LAB_TARGET("avx2,fma")
+inline __m256i hash8(__m256i x, __m256i y, __m256i seed) {
+  __m256i h = _mm256_xor_si256(seed, _mm256_xor_si256(_mm256_mullo_epi32(x, _mm256_set1_epi32(0x27D4EB2D)),
+                                                      _mm256_mullo_epi32(y, _mm256_set1_epi32(0x165667B1))));
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+  h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x2C1B3C6D));
+  h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 12));
+  h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x297A2D39));
+  return _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 to_unit8(__m256i h) {
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256i wrap8(__m256i i, __m256i period) {
+  const __m256i over = _mm256_cmpgt_epi32(period, i);
+  i = _mm256_blendv_epi8(_mm256_sub_epi32(i, period), i, over);
+  const __m256i under = _mm256_cmpgt_epi32(_mm256_setzero_si256(), i);
+  return _mm256_blendv_epi8(i, _mm256_add_epi32(i, period), under);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 fade8(__m256 t) {
+  const __m256 inner = _mm256_fmadd_ps(t, _mm256_fmsub_ps(t, _mm256_set1_ps(6.0f), _mm256_set1_ps(15.0f)),
+                                       _mm256_set1_ps(10.0f));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+  return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 gradient8(__m256i h, __m256 x, __m256 y) {
+  // Bits 0 and 1 of the hash flip the signs of x and y
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256 flip_x = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, one), 31));
+  const __m256 flip_y = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(h, 1), one), 31));
+  return _mm256_add_ps(_mm256_xor_ps(x, flip_x), _mm256_xor_ps(y, flip_y));
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 abs8(__m256 x) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 fast_sin8(__m256 x) {
+  const __m256 turns = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.0f / two_pi)),
+                                       _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  x = _mm256_fnmadd_ps(turns, _mm256_set1_ps(two_pi), x);
+  const __m256 y = _mm256_fmsub_ps(_mm256_set1_ps(1.27323954f), x,
+                                   _mm256_mul_ps(_mm256_set1_ps(0.405284735f), _mm256_mul_ps(x, abs8(x))));
+  return _mm256_fmadd_ps(_mm256_set1_ps(0.225f), _mm256_sub_ps(_mm256_mul_ps(y, abs8(y)), y), y);
+}
+
+/**
+ * Lattice cell of every lane plus the position inside it
+ */
+struct lattice8 {
+  __m256i ix, iy, ix1, iy1;
+  __m256 dx, dy;
+};
+
+LAB_TARGET("avx2,fma")
+inline lattice8 locate8(__m256 x, __m256 y, __m256i period) {
+  lattice8 l;
+  const __m256 fx0 = _mm256_floor_ps(x);
+  const __m256 fy0 = _mm256_floor_ps(y);
+  const __m256i one = _mm256_set1_epi32(1);
+  l.ix = wrap8(_mm256_cvttps_epi32(fx0), period);
+  l.iy = wrap8(_mm256_cvttps_epi32(fy0), period);
+  l.ix1 = wrap8(_mm256_add_epi32(l.ix, one), period);
+  l.iy1 = wrap8(_mm256_add_epi32(l.iy, one), period);
+  l.dx = _mm256_sub_ps(x, fx0);
+  l.dy = _mm256_sub_ps(y, fy0);
+  return l;
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 value_noise8(__m256 x, __m256 y, __m256i period, __m256i seed) {
+  const lattice8 l = locate8(x, y, period);
+  const __m256 sx = fade8(l.dx);
+  const __m256 sy = fade8(l.dy);
+  const __m256 bottom = lerp8(to_unit8(hash8(l.ix, l.iy, seed)), to_unit8(hash8(l.ix1, l.iy, seed)), sx);
+  const __m256 top = lerp8(to_unit8(hash8(l.ix, l.iy1, seed)), to_unit8(hash8(l.ix1, l.iy1, seed)), sx);
+  return lerp8(bottom, top, sy);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 perlin_noise8(__m256 x, __m256 y, __m256i period, __m256i seed) {
+  const lattice8 l = locate8(x, y, period);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 dx1 = _mm256_sub_ps(l.dx, one);
+  const __m256 dy1 = _mm256_sub_ps(l.dy, one);
+  const __m256 sx = fade8(l.dx);
+  const __m256 sy = fade8(l.dy);
+  const __m256 bottom = lerp8(gradient8(hash8(l.ix, l.iy, seed), l.dx, l.dy),
+                              gradient8(hash8(l.ix1, l.iy, seed), dx1, l.dy), sx);
+  const __m256 top = lerp8(gradient8(hash8(l.ix, l.iy1, seed), l.dx, dy1),
+                           gradient8(hash8(l.ix1, l.iy1, seed), dx1, dy1), sx);
+  return _mm256_mul_ps(_mm256_set1_ps(0.5f), lerp8(bottom, top, sy));
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 cellular_noise8(__m256 x, __m256 y, __m256i period, __m256i seed) {
+  const __m256 fx0 = _mm256_floor_ps(x);
+  const __m256 fy0 = _mm256_floor_ps(y);
+  __m256 nearest = _mm256_set1_ps(8.0f);
+  for (int dy = -1; dy <= 1; dy++) {
+    const __m256 cy = _mm256_add_ps(fy0, _mm256_set1_ps(static_cast<float>(dy)));
+    const __m256i iy = wrap8(_mm256_cvttps_epi32(cy), period);
+    for (int dx = -1; dx <= 1; dx++) {
+      const __m256 cx = _mm256_add_ps(fx0, _mm256_set1_ps(static_cast<float>(dx)));
+      const __m256i h = hash8(wrap8(_mm256_cvttps_epi32(cx), period), iy, seed);
+      const __m256 px = _mm256_sub_ps(_mm256_add_ps(cx, to_unit8(h)), x);
+      const __m256 py = _mm256_sub_ps(
+          _mm256_add_ps(cy, to_unit8(_mm256_mullo_epi32(h, _mm256_set1_epi32(static_cast<int>(0x9E3779B1u))))), y);
+      nearest = _mm256_min_ps(nearest, _mm256_fmadd_ps(px, px, _mm256_mul_ps(py, py)));
+    }
+  }
+  return _mm256_sqrt_ps(nearest);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 value_basis::operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const {
+  return value_noise8(x, y, period, seed);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 perlin_basis::operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const {
+  return perlin_noise8(x, y, period, seed);
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 turbulence_basis::operator()(__m256 x, __m256 y, __m256i period, __m256i seed) const {
+  return abs8(perlin_noise8(x, y, period, seed));
+}
+
+template<class Noise>
+LAB_TARGET("avx2,fma")
+inline __m256 fractal8(const pattern_state &s, __m256 u, __m256 v, Noise noise) {
+  __m256 sum = _mm256_setzero_ps();
+  for (int o = 0; o < s.octaves; o++) {
+    const int period = s.frequency << o;
+    const __m256 scale = _mm256_set1_ps(static_cast<float>(period));
+    const __m256 n = noise(_mm256_mul_ps(u, scale), _mm256_mul_ps(v, scale), _mm256_set1_epi32(period),
+                           _mm256_set1_epi32(static_cast<int>(s.options.seed + static_cast<std::uint32_t>(o))));
+    sum = _mm256_fmadd_ps(n, _mm256_set1_ps(std::ldexp(1.0f, -o)), sum);
+  }
+  return _mm256_mul_ps(sum, _mm256_set1_ps(s.normalisation));
+}
+
+LAB_TARGET("avx2,fma")
+inline __m256 clamp_unit8(__m256 t) {
+  return _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+
+LAB_TARGET("avx2,fma")
+__m256 evaluate8(const pattern_state &s, int x, int y) {
+  const __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(xs), _mm256_set1_ps(0.5f)),
+                                 _mm256_set1_ps(s.inv_width));
+  const __m256 v = _mm256_set1_ps((static_cast<float>(y) + 0.5f) * s.inv_height);
+  const __m256 half = _mm256_set1_ps(0.5f);
+
+  switch (s.options.pattern) {
+    case texture_pattern::checker: {
+      // Texel centres are never a multiple of the cell size, so the rounded reciprocal can't hit the wrong square
+      const __m256 squares = _mm256_floor_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(xs), half),
+                                                           _mm256_set1_ps(1.0f / static_cast<float>(s.options.cell))));
+      const __m256i parity = _mm256_and_si256(
+          _mm256_xor_si256(_mm256_cvttps_epi32(squares), _mm256_set1_epi32(y / s.options.cell)), _mm256_set1_epi32(1));
+      return _mm256_cvtepi32_ps(parity);
+    }
+    case texture_pattern::gradient:
+      return clamp_unit8(_mm256_fmadd_ps(_mm256_sub_ps(u, half), _mm256_set1_ps(s.gradient_x),
+                                         _mm256_fmadd_ps(_mm256_sub_ps(v, half), _mm256_set1_ps(s.gradient_y), half)));
+    case texture_pattern::value_noise:
+      return clamp_unit8(fractal8(s, u, v, value_basis{}));
+    case texture_pattern::perlin_noise:
+      return clamp_unit8(_mm256_fmadd_ps(half, fractal8(s, u, v, perlin_basis{}), half));
+    case texture_pattern::marble: {
+      const __m256 turbulence = fractal8(s, u, v, turbulence_basis{});
+      const float veins = static_cast<float>(std::max(1, s.frequency / 2));
+      const __m256 phase = _mm256_fmadd_ps(_mm256_set1_ps(two_pi * veins), u,
+                                           _mm256_mul_ps(_mm256_set1_ps(s.options.turbulence), turbulence));
+      return clamp_unit8(_mm256_fmadd_ps(half, fast_sin8(phase), half));
+    }
+    case texture_pattern::cellular: {
+      const __m256 scale = _mm256_set1_ps(static_cast<float>(s.frequency));
+      return clamp_unit8(cellular_noise8(_mm256_mul_ps(u, scale), _mm256_mul_ps(v, scale),
+                                         _mm256_set1_epi32(s.frequency),
+                                         _mm256_set1_epi32(static_cast<int>(s.options.seed))));
+    }
+  }
+  return _mm256_setzero_ps();
+}
+
+/**
+ * Blend the colours of eight texels and store them with one 32 byte write
+ */
+LAB_TARGET("avx2,fma")
+void shade8(const pattern_state &s, __m256 t, unsigned char *out) {
+  __m256i packed = _mm256_setzero_si256();
+  for (int c = 0; c < 4; c++) {
+    const float a = s.options.color0[c];
+    const float b = s.options.color1[c];
+    const __m256 value = _mm256_fmadd_ps(t, _mm256_set1_ps(b - a), _mm256_set1_ps(a + 0.5f));
+    packed = _mm256_or_si256(packed, _mm256_slli_epi32(_mm256_cvttps_epi32(value), 8 * c));
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), packed);
+}
+
+LAB_TARGET("avx2,fma")
+void span_avx2(const pattern_state &s, int y, int x0, int x1, unsigned char *out) {
+  int x = x0;
+  for (; x + 8 <= x1; x += 8, out += 32) {
+    shade8(s, evaluate8(s, x, y), out);
+  }
+  span_scalar(s, y, x, x1, out);
+}
+
+#endif
+
+void span(const pattern_state &s, int y, int x0, int x1, unsigned char *out) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    span_avx2(s, y, x0, x1, out);
+    return;
+  }
+#endif
+  span_scalar(s, y, x0, x1, out);
+}
+
+} // namespace
+
+void generate_texture(const procedural_options &options, unsigned char *dst, int width, int height,
+                      std::size_t stride, thread_pool *pool) {
+  if (dst == nullptr || width <= 0 || height <= 0) {
+    return;
+  }
+  const pattern_state state = make_state(options, width, height);
+  const int tiles_x = (width + tile_width - 1) / tile_width;
+  const int tiles_y = (height + tile_height - 1) / tile_height;
+
+  auto tiles = [&](int first, int last) {
+    for (int tile = first; tile < last; tile++) {
+      const int x0 = tile % tiles_x * tile_width;
+      const int y0 = tile / tiles_x * tile_height;
+      const int x1 = std::min(x0 + tile_width, width);
+      const int y1 = std::min(y0 + tile_height, height);
+      for (int y = y0; y < y1; y++) {
+        span(state, y, x0, x1, dst + static_cast<std::size_t>(y) * stride + static_cast<std::size_t>(x0) * 4);
+      }
+    }
+  };
+
+  const int count = tiles_x * tiles_y;
+  if (pool == nullptr) {
+    tiles(0, count);
+  } else {
+    pool->parallel_for(0, count, std::max(1, count / static_cast<int>(8 * pool->size())), tiles);
+  }
+}
@@ -0,0 +1,46 @@
+//
+// Procedural textures.
+// Every pattern evaluates a scalar per texel which blends between two colours. Rows are evaluated
+// eight texels at a time with AVX2 where available and the image is split into tiles spread over a thread pool.
+// Noise based patterns wrap around at the image borders, so the textures tile seamlessly.
+//
+
+#ifndef LAB_PROCEDURAL_H
+#define LAB_PROCEDURAL_H
+
+#include <cstddef>
+#include <cstdint>
+
+class thread_pool;
+
+enum class texture_pattern {
+  checker,      // squares of cell texels
+  gradient,     // linear ramp across the image at angle degrees
+  value_noise,  // fractal sum of smoothly interpolated random lattice values
+  perlin_noise, // fractal sum of gradient noise
+  marble,       // sine veins distorted by turbulence
+  cellular,     // distance to the nearest of randomly placed feature points, a single octave
+};
+
+struct procedural_options {
+  texture_pattern pattern = texture_pattern::checker;
+  int cell = 8;                                 // checker square size in texels
+  float angle = 0;                              // gradient direction in degrees, 0 runs left to right
+  int frequency = 8;                            // lattice cells across the image for the noise patterns
+  int octaves = 4;                              // noise layers of doubling frequency and halving amplitude
+  float turbulence = 4;                         // marble distortion strength
+  std::uint32_t seed = 1;
+  unsigned char color0[4] = {0, 0, 0, 255};     // RGBA at 0
+  unsigned char color1[4] = {255, 255, 255, 255}; // RGBA at 1
+};
+
+/**
+ * Fill an RGBA8 image, row 0 is the first row in memory.
+ * Every texel is written exactly once and dst is never read, so it may be write combined upload memory.
+ * @param dst height rows of stride bytes each
+ * @param pool threads to spread the tiles over, nullptr to stay on the calling thread
+ */
+void generate_texture(const procedural_options &options, unsigned char *dst, int width, int height,
+                      std::size_t stride, thread_pool *pool);
+
+#endif //LAB_PROCEDURAL_H
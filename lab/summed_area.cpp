@@ -0,0 +1,572 @@
+//
+// Summed-area tables, see summed_area.h
+//
+
+#include "summed_area.h"
+#include "cpu_features.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#if LAB_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Rows per band of the row pass and of the filters
+constexpr int band_rows = 16;
+
+// Added to the variance before dividing by the deviation, keeps the quantisation noise of flat areas down
+constexpr float contrast_floor = 4.0f;
+
+inline unsigned char to_byte(float value) noexcept {
+  return static_cast<unsigned char>(std::min(std::max(value + 0.5f, 0.0f), 255.0f));
+}
+
+/**
+ * Table row of one pixel row, its prefix sums added to the table row above.
+ * Elements 0 to channels - 1 are the zero column.
+ */
+template<int channels>
+void sum_row_scalar(const unsigned char *in, int width, const std::uint32_t *above, std::uint32_t *out) noexcept {
+  std::uint32_t sum[channels] = {};
+  for (int c = 0; c < channels; c++) {
+    out[c] = 0;
+  }
+  for (int x = 0; x < width; x++) {
+    for (int c = 0; c < channels; c++) {
+      const int i = (x + 1) * channels + c;
+      sum[c] += in[x * channels + c];
+      out[i] = above[i] + sum[c];
+    }
+  }
+}
+
+template<int channels>
+void square_row_scalar(const unsigned char *in, int width, const std::uint64_t *above,
+                       std::uint64_t *out) noexcept {
+  std::uint64_t sum[channels] = {};
+  for (int c = 0; c < channels; c++) {
+    out[c] = 0;
+  }
+  for (int x = 0; x < width; x++) {
+    for (int c = 0; c < channels; c++) {
+      const int i = (x + 1) * channels + c;
+      const std::uint32_t value = in[x * channels + c];
+      sum[c] += value * value;
+      out[i] = above[i] + sum[c];
+    }
+  }
+}
+
+template<typename T>
+void add_row_scalar(const T *above, T *row, int n) noexcept {
+  for (int i = 0; i < n; i++) {
+    row[i] += above[i];
+  }
+}
+
+/**
+ * Pixel columns [x0, x1) whose windows are clipped, written one at a time
+ */
+void mean_border(const std::uint32_t *top, const std::uint32_t *bottom, int rows, int width, int channels,
+                 int radius, int x0, int x1, unsigned char *out) noexcept {
+  for (int x = x0; x < x1; x++) {
+    const int left = std::max(x - radius, 0);
+    const int right = std::min(x + radius + 1, width);
+    const float inv_area = 1.0f / static_cast<float>((right - left) * rows);
+    for (int c = 0; c < channels; c++) {
+      const std::size_t l = static_cast<std::size_t>(left) * channels + c;
+      const std::size_t r = static_cast<std::size_t>(right) * channels + c;
+      const std::uint32_t sum = bottom[r] - top[r] - bottom[l] + top[l];
+      out[x * channels + c] = to_byte(static_cast<float>(sum) * inv_area);
+    }
+  }
+}
+
+void moments_border(const std::uint32_t *top, const std::uint32_t *bottom, const std::uint64_t *top_sq,
+                    const std::uint64_t *bottom_sq, int rows, int width, int channels, int radius, int x0, int x1,
+                    float *mean, float *variance) noexcept {
+  for (int x = x0; x < x1; x++) {
+    const int left = std::max(x - radius, 0);
+    const int right = std::min(x + radius + 1, width);
+    const double inv_area = 1.0 / static_cast<double>((right - left) * rows);
+    for (int c = 0; c < channels; c++) {
+      const std::size_t l = static_cast<std::size_t>(left) * channels + c;
+      const std::size_t r = static_cast<std::size_t>(right) * channels + c;
+      const std::uint32_t sum = bottom[r] - top[r] - bottom[l] + top[l];
+      const std::uint64_t sum_sq = bottom_sq[r] - top_sq[r] - bottom_sq[l] + top_sq[l];
+      const double m = static_cast<double>(sum) * inv_area;
+      const double v = static_cast<double>(sum_sq) * inv_area - m * m;
+      mean[x * channels + c] = static_cast<float>(m);
+      variance[x * channels + c] = static_cast<float>(std::max(v, 0.0));
+    }
+  }
+}
+
+// Unclipped windows: element i sums [i - behind, i + ahead) of the difference of the two table rows
+
+void mean_interior_scalar(const std::uint32_t *top, const std::uint32_t *bottom, std::size_t behind,
+                          std::size_t ahead, float inv_area, std::size_t i0, std::size_t i1,
+                          unsigned char *out) noexcept {
+  for (std::size_t i = i0; i < i1; i++) {
+    const std::uint32_t sum = bottom[i + ahead] - top[i + ahead] - bottom[i - behind] + top[i - behind];
+    out[i] = to_byte(static_cast<float>(sum) * inv_area);
+  }
+}
+
+void moments_interior_scalar(const std::uint32_t *top, const std::uint32_t *bottom, const std::uint64_t *top_sq,
+                             const std::uint64_t *bottom_sq, std::size_t behind, std::size_t ahead,
+                             double inv_area, std::size_t i0, std::size_t i1, float *mean,
+                             float *variance) noexcept {
+  for (std::size_t i = i0; i < i1; i++) {
+    const std::uint32_t sum = bottom[i + ahead] - top[i + ahead] - bottom[i - behind] + top[i - behind];
+    const std::uint64_t sum_sq = bottom_sq[i + ahead] - top_sq[i + ahead] - bottom_sq[i - behind]
+                                 + top_sq[i - behind];
+    const double m = static_cast<double>(sum) * inv_area;
+    const double v = static_cast<double>(sum_sq) * inv_area - m * m;
+    mean[i] = static_cast<float>(m);
+    variance[i] = static_cast<float>(std::max(v, 0.0));
+  }
+}
+
+#if LAB_X86_SIMD
+
+/**
+ * sum_row_scalar for four channels, two pixels at a time.
+ * The second pixel gets the first one added, then both get the running sums of the pixels before.
+ */
+LAB_TARGET("avx2,fma")
+void sum_row_rgba_avx2(const unsigned char *in, int width, const std::uint32_t *above, std::uint32_t *out) {
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_setzero_si128());
+  __m256i carry = _mm256_setzero_si256(); // sums up to the previous pixel in both halves
+  int x = 0;
+  for (; x + 2 <= width; x += 2) {
+    __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + x * 4)));
+    v = _mm256_add_epi32(v, _mm256_permute2x128_si256(v, v, 0x08));
+    v = _mm256_add_epi32(v, carry);
+    carry = _mm256_permute2x128_si256(v, v, 0x11);
+    std::uint32_t *o = out + (x + 1) * 4;
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(above + (x + 1) * 4));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(o), _mm256_add_epi32(v, a));
+  }
+  if (x < width) {
+    alignas(32) std::uint32_t sum[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(sum), carry);
+    for (int c = 0; c < 4; c++) {
+      const int i = (x + 1) * 4 + c;
+      out[i] = above[i] + sum[c] + in[x * 4 + c];
+    }
+  }
+}
+
+LAB_TARGET("avx2,fma")
+void square_row_rgba_avx2(const unsigned char *in, int width, const std::uint64_t *above, std::uint64_t *out) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_setzero_si256());
+  __m256i sum = _mm256_setzero_si256();
+  for (int x = 0; x < width; x++) {
+    std::uint32_t pixel;
+    std::memcpy(&pixel, in + x * 4, sizeof(pixel));
+    const __m256i v = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(static_cast<int>(pixel)));
+    sum = _mm256_add_epi64(sum, _mm256_mul_epu32(v, v));
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(above + (x + 1) * 4));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + (x + 1) * 4), _mm256_add_epi64(sum, a));
+  }
+}
+
+LAB_TARGET("avx2,fma")
+void add_row_avx2(const std::uint32_t *above, std::uint32_t *row, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(above + i));
+    const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + i), _mm256_add_epi32(a, r));
+  }
+  add_row_scalar(above + i, row + i, n - i);
+}
+
+LAB_TARGET("avx2,fma")
+void add_row_avx2(const std::uint64_t *above, std::uint64_t *row, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(above + i));
+    const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + i), _mm256_add_epi64(a, r));
+  }
+  add_row_scalar(above + i, row + i, n - i);
+}
+
+/**
+ * @return sums over the window rows left of the eight elements starting at i
+ */
+LAB_TARGET("avx2,fma")
+inline __m256i window_prefix8(const std::uint32_t *top, const std::uint32_t *bottom, std::size_t i) {
+  return _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bottom + i)),
+                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(top + i)));
+}
+
+/**
+ * @return squared sums over the window rows left of the four elements starting at i
+ */
+LAB_TARGET("avx2,fma")
+inline __m256i window_prefix4(const std::uint64_t *top, const std::uint64_t *bottom, std::size_t i) {
+  return _mm256_sub_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(bottom + i)),
+                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(top + i)));
+}
+
+/**
+ * Box sums are below 2^32 but may be above 2^31, which the signed conversion can't take as is.
+ * Both 16 bit halves convert exactly, so only the final addition rounds.
+ */
+LAB_TARGET("avx2,fma")
+inline __m256 unsigned_to_float(__m256i value) {
+  const __m256 high = _mm256_cvtepi32_ps(_mm256_srli_epi32(value, 16));
+  const __m256 low = _mm256_cvtepi32_ps(_mm256_and_si256(value, _mm256_set1_epi32(0xFFFF)));
+  return _mm256_fmadd_ps(high, _mm256_set1_ps(65536.0f), low);
+}
+
+/**
+ * Values below 2^52 put into the mantissa of 2^52 give the double exactly once 2^52 is subtracted
+ */
+LAB_TARGET("avx2,fma")
+inline __m256d small_to_double(__m256i value) {
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+  return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(value, _mm256_castpd_si256(magic))), magic);
+}
+
+LAB_TARGET("avx2,fma")
+void mean_interior_avx2(const std::uint32_t *top, const std::uint32_t *bottom, std::size_t behind,
+                        std::size_t ahead, float inv_area, std::size_t i0, std::size_t i1, unsigned char *out) {
+  const __m256 scale = _mm256_set1_ps(inv_area);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 hi = _mm256_set1_ps(255.0f);
+  std::size_t i = i0;
+  for (; i + 16 <= i1; i += 16) {
+    const __m256i a = _mm256_sub_epi32(window_prefix8(top, bottom, i + ahead), window_prefix8(top, bottom, i - behind));
+    const __m256i b = _mm256_sub_epi32(window_prefix8(top, bottom, i + 8 + ahead),
+                                       window_prefix8(top, bottom, i + 8 - behind));
+    // Means never exceed 255, only rounding has to be clamped
+    const __m256i qa = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_fmadd_ps(unsigned_to_float(a), scale, half), hi));
+    const __m256i qb = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_fmadd_ps(unsigned_to_float(b), scale, half), hi));
+    // Packing works within 128 bit lanes, the permute restores the element order
+    const __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(qa, qb), 0xD8);
+    const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), bytes);
+  }
+  mean_interior_scalar(top, bottom, behind, ahead, inv_area, i, i1, out);
+}
+
+LAB_TARGET("avx2,fma")
+void moments_interior_avx2(const std::uint32_t *top, const std::uint32_t *bottom, const std::uint64_t *top_sq,
+                           const std::uint64_t *bottom_sq, std::size_t behind, std::size_t ahead,
+                           double inv_area, std::size_t i0, std::size_t i1, float *mean, float *variance) {
+  const __m256d scale = _mm256_set1_pd(inv_area);
+  const __m256 zero = _mm256_setzero_ps();
+  std::size_t i = i0;
+  for (; i + 8 <= i1; i += 8) {
+    const __m256i sums = _mm256_sub_epi32(window_prefix8(top, bottom, i + ahead),
+                                          window_prefix8(top, bottom, i - behind));
+    const __m256 m = _mm256_mul_ps(unsigned_to_float(sums), _mm256_set1_ps(static_cast<float>(inv_area)));
+
+    __m128 squares[2];
+    for (int half = 0; half < 2; half++) {
+      const std::size_t j = i + static_cast<std::size_t>(half) * 4;
+      const __m256i ahead_sq = window_prefix4(top_sq, bottom_sq, j + ahead);
+      const __m256i behind_sq = window_prefix4(top_sq, bottom_sq, j - behind);
+      squares[half] = _mm256_cvtpd_ps(_mm256_mul_pd(small_to_double(_mm256_sub_epi64(ahead_sq, behind_sq)), scale));
+    }
+    const __m256 mean_sq = _mm256_insertf128_ps(_mm256_castps128_ps256(squares[0]), squares[1], 1);
+
+    _mm256_storeu_ps(mean + i, m);
+    _mm256_storeu_ps(variance + i, _mm256_max_ps(_mm256_fnmadd_ps(m, m, mean_sq), zero));
+  }
+  moments_interior_scalar(top, bottom, top_sq, bottom_sq, behind, ahead, inv_area, i, i1, mean, variance);
+}
+
+#endif
+
+template<typename T>
+void add_row(const T *above, T *row, int n) {
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    add_row_avx2(above, row, n);
+    return;
+  }
+#endif
+  add_row_scalar(above, row, n);
+}
+
+void sum_pixel_row(const unsigned char *in, int width, int channels, const std::uint32_t *above,
+                   std::uint32_t *out) {
+  if (channels == 3) {
+    sum_row_scalar<3>(in, width, above, out);
+    return;
+  }
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    sum_row_rgba_avx2(in, width, above, out);
+    return;
+  }
+#endif
+  sum_row_scalar<4>(in, width, above, out);
+}
+
+void square_pixel_row(const unsigned char *in, int width, int channels, const std::uint64_t *above,
+                      std::uint64_t *out) {
+  if (channels == 3) {
+    square_row_scalar<3>(in, width, above, out);
+    return;
+  }
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    square_row_rgba_avx2(in, width, above, out);
+    return;
+  }
+#endif
+  square_row_scalar<4>(in, width, above, out);
+}
+
+/**
+ * Table rows bounding the clipped window of output row y
+ */
+struct window {
+  int y0;
+  int y1;
+
+  window(int y, int radius, int height) noexcept
+      : y0(std::max(y - radius, 0)), y1(std::min(y + radius + 1, height)) {}
+
+  int rows() const noexcept {
+    return y1 - y0;
+  }
+};
+
+/**
+ * Output columns [interior_begin, interior_end) have unclipped windows
+ */
+struct columns {
+  int interior_begin;
+  int interior_end;
+  std::size_t behind;
+  std::size_t ahead;
+
+  columns(int width, int channels, int radius) noexcept
+      : interior_begin(std::min(radius, width)), interior_end(std::max(interior_begin, width - radius)),
+        behind(static_cast<std::size_t>(radius) * channels),
+        ahead(static_cast<std::size_t>(radius + 1) * channels) {}
+};
+
+void mean_row(const summed_area_table &table, int y, int radius, unsigned char *out) {
+  const int width = table.width();
+  const int channels = table.channels();
+  const window w(y, radius, table.height());
+  const columns cols(width, channels, radius);
+  const std::uint32_t *top = table.sum_row(w.y0);
+  const std::uint32_t *bottom = table.sum_row(w.y1);
+
+  mean_border(top, bottom, w.rows(), width, channels, radius, 0, cols.interior_begin, out);
+  const float inv_area = 1.0f / static_cast<float>((2 * radius + 1) * w.rows());
+  const std::size_t i0 = static_cast<std::size_t>(cols.interior_begin) * channels;
+  const std::size_t i1 = static_cast<std::size_t>(cols.interior_end) * channels;
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    mean_interior_avx2(top, bottom, cols.behind, cols.ahead, inv_area, i0, i1, out);
+  } else
+#endif
+  {
+    mean_interior_scalar(top, bottom, cols.behind, cols.ahead, inv_area, i0, i1, out);
+  }
+  mean_border(top, bottom, w.rows(), width, channels, radius, cols.interior_end, width, out);
+}
+
+void moments_row(const summed_area_table &table, int y, int radius, float *mean, float *variance) {
+  const int width = table.width();
+  const int channels = table.channels();
+  const window w(y, radius, table.height());
+  const columns cols(width, channels, radius);
+  const std::uint32_t *top = table.sum_row(w.y0);
+  const std::uint32_t *bottom = table.sum_row(w.y1);
+  const std::uint64_t *top_sq = table.squares_row(w.y0);
+  const std::uint64_t *bottom_sq = table.squares_row(w.y1);
+
+  moments_border(top, bottom, top_sq, bottom_sq, w.rows(), width, channels, radius, 0, cols.interior_begin,
+                 mean, variance);
+  const double inv_area = 1.0 / static_cast<double>((2 * radius + 1) * w.rows());
+  const std::size_t i0 = static_cast<std::size_t>(cols.interior_begin) * channels;
+  const std::size_t i1 = static_cast<std::size_t>(cols.interior_end) * channels;
+#if LAB_X86_SIMD
+  if (cpu_has_avx2()) {
+    moments_interior_avx2(top, bottom, top_sq, bottom_sq, cols.behind, cols.ahead, inv_area, i0, i1, mean,
+                          variance);
+  } else
+#endif
+  {
+    moments_interior_scalar(top, bottom, top_sq, bottom_sq, cols.behind, cols.ahead, inv_area, i0, i1, mean,
+                            variance);
+  }
+  moments_border(top, bottom, top_sq, bottom_sq, w.rows(), width, channels, radius, cols.interior_end, width,
+                 mean, variance);
+}
+
+/**
+ * Call row(y) for all rows of the table in parallel bands
+ */
+void for_rows(const summed_area_table &table, thread_pool *pool, const std::function<void(int, int)> &rows) {
+  const int bands = (table.height() + band_rows - 1) / band_rows;
+  parallel_for(pool, 0, bands, 1, [&](int first, int last) {
+    rows(first * band_rows, std::min(last * band_rows, table.height()));
+  });
+}
+
+} // namespace
+
+bool summed_area_table::build(const image_view &src, bool squares, thread_pool *pool) {
+  if (src.empty()) {
+    std::cout << "Can't sum an empty image" << std::endl;
+    return false;
+  }
+  if (static_cast<std::uint64_t>(src.width) * static_cast<std::uint64_t>(src.height) > 0xFFFFFFFFu / 255u) {
+    std::cout << "Image of " << src.width << "x" << src.height << " is too large for a summed-area table"
+              << std::endl;
+    return false;
+  }
+  width_ = src.width;
+  height_ = src.height;
+  channels_ = bytes_per_pixel(src.format);
+  row_ = static_cast<std::size_t>(width_ + 1) * channels_;
+  // Every row but the first one is overwritten completely
+  const std::size_t size = row_ * (height_ + 1);
+  if (sums_capacity_ < size) {
+    sums_.reset(new std::uint32_t[size]);
+    sums_capacity_ = size;
+  }
+  std::fill(sums_.get(), sums_.get() + row_, 0u);
+  with_squares_ = squares;
+  if (squares) {
+    if (squares_capacity_ < size) {
+      squares_.reset(new std::uint64_t[size]);
+      squares_capacity_ = size;
+    }
+    std::fill(squares_.get(), squares_.get() + row_, 0u);
+  }
+  const auto table_row = [this](int y) { return sums_.get() + static_cast<std::size_t>(y) * row_; };
+  const auto squares_table_row = [this](int y) { return squares_.get() + static_cast<std::size_t>(y) * row_; };
+
+  // Every thread sums a chunk of rows as if it was the whole image, each row is added to the one above while
+  // that is still in cache. The chunks are then shifted by the last row of the chunks above them.
+  const int threads = pool == nullptr ? 1 : static_cast<int>(std::max(pool->size(), 1u));
+  const int chunk_rows = (height_ + threads - 1) / threads;
+  const int chunks = (height_ + chunk_rows - 1) / chunk_rows;
+  parallel_for(pool, 0, chunks, 1, [&](int first, int last) {
+    for (int chunk = first; chunk < last; chunk++) {
+      const int y0 = chunk * chunk_rows;
+      for (int y = y0; y < std::min(y0 + chunk_rows, height_); y++) {
+        const unsigned char *in = src.pixels + static_cast<std::size_t>(y) * src.stride;
+        const int above = y == y0 ? 0 : y;
+        sum_pixel_row(in, width_, channels_, table_row(above), table_row(y + 1));
+        if (squares) {
+          square_pixel_row(in, width_, channels_, squares_table_row(above), squares_table_row(y + 1));
+        }
+      }
+    }
+  });
+  if (chunks == 1) {
+    return true;
+  }
+
+  const int n = static_cast<int>(row_);
+  for (int chunk = 1; chunk < chunks; chunk++) {
+    const int last = std::min((chunk + 1) * chunk_rows, height_);
+    add_row(table_row(chunk * chunk_rows), table_row(last), n);
+    if (squares) {
+      add_row(squares_table_row(chunk * chunk_rows), squares_table_row(last), n);
+    }
+  }
+  const int bands = (height_ - chunk_rows + band_rows - 1) / band_rows;
+  parallel_for(pool, 0, bands, 1, [&](int first, int last) {
+    const int y0 = chunk_rows + first * band_rows;
+    const int y1 = std::min(chunk_rows + last * band_rows, height_);
+    for (int y = y0; y < y1; y++) {
+      const int carry = y / chunk_rows * chunk_rows;
+      if ((y + 1) % chunk_rows == 0 || y + 1 == height_) {
+        continue; // last row of a chunk, already shifted
+      }
+      add_row(table_row(carry), table_row(y + 1), n);
+      if (squares) {
+        add_row(squares_table_row(carry), squares_table_row(y + 1), n);
+      }
+    }
+  });
+  return true;
+}
+
+void box_mean(const summed_area_table &table, int radius, const image_buffer &dst, thread_pool *pool) {
+  if (dst.empty() || dst.width != table.width() || dst.height != table.height()
+      || bytes_per_pixel(dst.format) != table.channels()) {
+    return;
+  }
+  radius = std::max(radius, 0);
+  for_rows(table, pool, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+      mean_row(table, y, radius, dst.pixels + static_cast<std::size_t>(y) * dst.stride);
+    }
+  });
+}
+
+void box_variance(const summed_area_table &table, int radius, float *dst, std::size_t dst_stride,
+                  thread_pool *pool) {
+  if (dst == nullptr || !table.has_squares()) {
+    return;
+  }
+  radius = std::max(radius, 0);
+  const std::size_t n = static_cast<std::size_t>(table.width()) * table.channels();
+  for_rows(table, pool, [&](int y0, int y1) {
+    std::vector<float> mean(n);
+    for (int y = y0; y < y1; y++) {
+      moments_row(table, y, radius, mean.data(), dst + static_cast<std::size_t>(y) * dst_stride);
+    }
+  });
+}
+
+void local_contrast(const summed_area_table &table, const image_view &src, int radius, float gain,
+                    const image_buffer &dst, thread_pool *pool) {
+  if (!table.has_squares() || src.empty() || dst.empty() || src.width != table.width()
+      || src.height != table.height() || src.format != dst.format || dst.width != src.width
+      || dst.height != src.height || bytes_per_pixel(src.format) != table.channels()) {
+    return;
+  }
+  radius = std::max(radius, 0);
+  const int channels = table.channels();
+  const bool alpha = src.format == pixel_format::rgba8 || src.format == pixel_format::bgra8;
+  const std::size_t n = static_cast<std::size_t>(src.width) * channels;
+
+  for_rows(table, pool, [&](int y0, int y1) {
+    std::vector<float> mean(n);
+    std::vector<float> variance(n);
+    for (int y = y0; y < y1; y++) {
+      moments_row(table, y, radius, mean.data(), variance.data());
+      const unsigned char *in = src.pixels + static_cast<std::size_t>(y) * src.stride;
+      unsigned char *out = dst.pixels + static_cast<std::size_t>(y) * dst.stride;
+      for (std::size_t i = 0; i < n; i++) {
+        if (alpha && i % 4 == 3) {
+          out[i] = in[i];
+        } else {
+          const float deviation = std::sqrt(variance[i] + contrast_floor);
+          out[i] = to_byte(128.0f + gain * (static_cast<float>(in[i]) - mean[i]) / deviation);
+        }
+      }
+    }
+  });
+}
+
+bool mean_filter(const image_buffer &img, int radius, summed_area_table &table, thread_pool *pool) {
+  if (!table.build(img.view(), false, pool)) {
+    return false;
+  }
+  box_mean(table, radius, img, pool);
+  return true;
+}
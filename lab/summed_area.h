@@ -0,0 +1,128 @@
+//
+// Summed-area tables (integral images) of 8 bit pixel buffers.
+// Once built, the sum over any rectangle takes four lookups, so box mean, variance and local contrast
+// cost the same for every radius, unlike the direct mean mask of MeanUserRadius_ in imageprocessing/.
+// Windows are clipped at the borders and normalised by the pixels they actually cover, like
+// ConvolutionFilter.convolveDoubleNorm.
+//
+
+#ifndef LAB_SUMMED_AREA_H
+#define LAB_SUMMED_AREA_H
+
+#include "bmp_image.h"
+#include "image_kernels.h"
+
+#include <cstdint>
+#include <memory>
+
+class thread_pool;
+
+class summed_area_table {
+public:
+  /**
+   * Build the tables of src, every channel is summed on its own and rows are taken in memory order.
+   * Sums are kept in 32 bits and may wrap, differences of them are still exact as long as no
+   * rectangle sums to 2^32 or more, which holds for images up to 2^32 / 255 pixels.
+   * @param squares also sum the squared values, needed for variance and contrast
+   * @param pool threads for the row and column passes, nullptr to stay on the calling thread
+   * @return false if the image is empty or too large
+   */
+  bool build(const image_view &src, bool squares, thread_pool *pool);
+
+  int width() const noexcept {
+    return width_;
+  }
+
+  int height() const noexcept {
+    return height_;
+  }
+
+  int channels() const noexcept {
+    return channels_;
+  }
+
+  bool has_squares() const noexcept {
+    return with_squares_;
+  }
+
+  /**
+   * @return sum of channel over the columns [x0, x1) and rows [y0, y1)
+   */
+  std::uint32_t sum(int x0, int y0, int x1, int y1, int channel) const noexcept {
+    const std::uint32_t *top = sum_row(y0);
+    const std::uint32_t *bottom = sum_row(y1);
+    const std::size_t left = static_cast<std::size_t>(x0) * channels_ + channel;
+    const std::size_t right = static_cast<std::size_t>(x1) * channels_ + channel;
+    return bottom[right] - top[right] - bottom[left] + top[left];
+  }
+
+  /**
+   * @return sum of the squared values of channel over the columns [x0, x1) and rows [y0, y1)
+   */
+  std::uint64_t sum_squares(int x0, int y0, int x1, int y1, int channel) const noexcept {
+    const std::uint64_t *top = squares_row(y0);
+    const std::uint64_t *bottom = squares_row(y1);
+    const std::size_t left = static_cast<std::size_t>(x0) * channels_ + channel;
+    const std::size_t right = static_cast<std::size_t>(x1) * channels_ + channel;
+    return bottom[right] - top[right] - bottom[left] + top[left];
+  }
+
+  /**
+   * @return row y of the sums, element x * channels + c holds the sum of channel c over [0, x) x [0, y)
+   */
+  const std::uint32_t *sum_row(int y) const noexcept {
+    return sums_.get() + static_cast<std::size_t>(y) * row_;
+  }
+
+  /**
+   * @return row y of the squared sums, laid out like sum_row
+   */
+  const std::uint64_t *squares_row(int y) const noexcept {
+    return squares_.get() + static_cast<std::size_t>(y) * row_;
+  }
+
+private:
+  int width_ = 0;
+  int height_ = 0;
+  int channels_ = 0;
+  std::size_t row_ = 0;                // elements per table row, one column of zeros in front
+  bool with_squares_ = false;
+  // Left uninitialised, a vector would zero the whole table only to have it overwritten
+  std::unique_ptr<std::uint32_t[]> sums_;    // height + 1 rows, the first one is zero
+  std::unique_ptr<std::uint64_t[]> squares_; // same layout, only filled if requested
+  std::size_t sums_capacity_ = 0;
+  std::size_t squares_capacity_ = 0;
+};
+
+/**
+ * Box mean of all channels with a (2 radius + 1)^2 window
+ * @param dst same size and channel count as the table, may be the buffer the table was built from
+ */
+void box_mean(const summed_area_table &table, int radius, const image_buffer &dst, thread_pool *pool);
+
+/**
+ * Box variance of all channels, needs the squared sums
+ * @param dst width x height x channels floats, interleaved like the source pixels
+ * @param dst_stride floats between the starts of two rows
+ */
+void box_variance(const summed_area_table &table, int radius, float *dst, std::size_t dst_stride,
+                  thread_pool *pool);
+
+/**
+ * Local contrast normalisation: every colour value becomes 128 + gain * (value - mean) / deviation
+ * of its window, which evens out lighting while keeping detail. Alpha is copied. Needs the squared sums.
+ * @param src pixels the table was built from
+ * @param dst same size and format as src, may be src itself
+ * @param gain 32 maps one standard deviation to a quarter of the range
+ */
+void local_contrast(const summed_area_table &table, const image_view &src, int radius, float gain,
+                    const image_buffer &dst, thread_pool *pool);
+
+/**
+ * Mean filter in place, the counterpart of MeanUserRadius_ for texture buffers
+ * @param table rebuilt from img, keeping it between calls saves faulting in a fresh table every time
+ * @return false if the image can't be summed
+ */
+bool mean_filter(const image_buffer &img, int radius, summed_area_table &table, thread_pool *pool);
+
+#endif //LAB_SUMMED_AREA_H
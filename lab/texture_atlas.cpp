@@ -0,0 +1,204 @@
+//
+// Texture atlas packing, see texture_atlas.h
+//
+
+#include "texture_atlas.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+// Atlas sides are multiples of this, which keeps the first few mip levels exact
+constexpr int size_granularity = 64;
+
+// Padded rectangles start on multiples of this, keeps them apart in the first mip levels as well
+constexpr int placement_alignment = 4;
+
+int align(int value) noexcept {
+  return (value + placement_alignment - 1) / placement_alignment * placement_alignment;
+}
+
+int align_size(int value) noexcept {
+  return std::max(1, (value + size_granularity - 1) / size_granularity) * size_granularity;
+}
+
+} // namespace
+
+int texture_atlas::add(const image_view &img) {
+  images_.push_back(img);
+  regions_.emplace_back();
+  width_ = 0;
+  height_ = 0;
+  return static_cast<int>(images_.size()) - 1;
+}
+
+bool texture_atlas::pack() {
+  int widest = 0;
+  int tallest = 0;
+  for (const auto &img : images_) {
+    widest = std::max(widest, align(img.width + 2 * gutter_));
+    tallest = std::max(tallest, align(img.height + 2 * gutter_));
+  }
+
+  // Try every width and keep the one whose packing needs the least area
+  int best_width = 0;
+  int best_height = 0;
+  long long best_area = LLONG_MAX;
+  for (int width = align_size(widest); width <= max_size_; width += size_granularity) {
+    if (static_cast<long long>(width) * tallest >= best_area) {
+      break;
+    }
+    int used = 0;
+    if (!pack_into(width, max_size_, used)) {
+      continue;
+    }
+    const int height = align_size(used);
+    if (height <= max_size_ && static_cast<long long>(width) * height < best_area) {
+      best_width = width;
+      best_height = height;
+      best_area = static_cast<long long>(width) * height;
+    }
+  }
+
+  int used = 0;
+  if (best_width == 0 || !pack_into(best_width, best_height, used)) {
+    width_ = 0;
+    height_ = 0;
+    return false;
+  }
+  width_ = best_width;
+  height_ = best_height;
+  return true;
+}
+
+bool texture_atlas::pack_into(int width, int height, int &used_height) {
+  std::vector<skyline_node> skyline{{0, 0, width}};
+
+  // Tallest first keeps the skyline flat
+  std::vector<int> order(images_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](int a, int b) {
+    if (images_[a].height != images_[b].height) {
+      return images_[a].height > images_[b].height;
+    }
+    return images_[a].width > images_[b].width;
+  });
+
+  used_height = 0;
+  for (int handle : order) {
+    const int w = align(images_[handle].width + 2 * gutter_);
+    const int h = align(images_[handle].height + 2 * gutter_);
+
+    // Bottom left rule: lowest position wins, ties go to the narrowest segment
+    int best = -1;
+    int best_y = INT_MAX;
+    int best_segment = INT_MAX;
+    for (std::size_t i = 0; i < skyline.size(); i++) {
+      if (skyline[i].x + w > width) {
+        break;
+      }
+      int y = 0;
+      int remaining = w;
+      for (std::size_t j = i; remaining > 0; j++) {
+        y = std::max(y, skyline[j].y);
+        remaining -= skyline[j].width;
+      }
+      if (y + h <= height && (y < best_y || (y == best_y && skyline[i].width < best_segment))) {
+        best = static_cast<int>(i);
+        best_y = y;
+        best_segment = skyline[i].width;
+      }
+    }
+    if (best < 0) {
+      return false;
+    }
+
+    const int x = skyline[best].x;
+    used_height = std::max(used_height, best_y + h);
+    atlas_region &r = regions_[handle];
+    r.x = x + gutter_;
+    r.y = best_y + gutter_;
+    r.width = images_[handle].width;
+    r.height = images_[handle].height;
+    r.u0 = static_cast<float>(r.x) / static_cast<float>(width);
+    r.v0 = static_cast<float>(r.y) / static_cast<float>(height);
+    r.u1 = static_cast<float>(r.x + r.width) / static_cast<float>(width);
+    r.v1 = static_cast<float>(r.y + r.height) / static_cast<float>(height);
+
+    // Raise the skyline over the new rectangle and cut away what it covers
+    skyline.insert(skyline.begin() + best, skyline_node{x, best_y + h, w});
+    for (std::size_t j = best + 1; j < skyline.size();) {
+      const skyline_node &prev = skyline[j - 1];
+      skyline_node &node = skyline[j];
+      const int overlap = prev.x + prev.width - node.x;
+      if (overlap <= 0) {
+        break;
+      }
+      node.x += overlap;
+      node.width -= overlap;
+      if (node.width > 0) {
+        break;
+      }
+      skyline.erase(skyline.begin() + j);
+    }
+    for (std::size_t j = 0; j + 1 < skyline.size();) {
+      if (skyline[j].y == skyline[j + 1].y) {
+        skyline[j].width += skyline[j + 1].width;
+        skyline.erase(skyline.begin() + j + 1);
+      } else {
+        j++;
+      }
+    }
+  }
+  return true;
+}
+
+void texture_atlas::compose(unsigned char *rgba) const {
+  const std::size_t row_bytes = static_cast<std::size_t>(width_) * 4;
+  std::memset(rgba, 0, row_bytes * height_);
+
+  for (std::size_t i = 0; i < images_.size(); i++) {
+    const atlas_region &r = regions_[i];
+    auto texel = [&](int x, int y) {
+      return rgba + static_cast<std::size_t>(y) * row_bytes + static_cast<std::size_t>(x) * 4;
+    };
+    convert_image(images_[i], pixel_format::rgba8, true, texel(r.x, r.y), row_bytes);
+
+    // Replicate the edges into the gutter, columns first so the corners are covered by the rows
+    for (int y = r.y; y < r.y + r.height; y++) {
+      for (int g = 1; g <= gutter_; g++) {
+        std::memcpy(texel(r.x - g, y), texel(r.x, y), 4);
+        std::memcpy(texel(r.x + r.width - 1 + g, y), texel(r.x + r.width - 1, y), 4);
+      }
+    }
+    const std::size_t span = static_cast<std::size_t>(r.width + 2 * gutter_) * 4;
+    for (int g = 1; g <= gutter_; g++) {
+      std::memcpy(texel(r.x - gutter_, r.y - g), texel(r.x - gutter_, r.y), span);
+      std::memcpy(texel(r.x - gutter_, r.y + r.height - 1 + g), texel(r.x - gutter_, r.y + r.height - 1), span);
+    }
+  }
+}
+
+float texture_atlas::efficiency() const noexcept {
+  if (width_ == 0 || height_ == 0) {
+    return 0;
+  }
+  long long used = 0;
+  for (const auto &img : images_) {
+    used += static_cast<long long>(img.width) * img.height;
+  }
+  return static_cast<float>(used) / (static_cast<float>(width_) * static_cast<float>(height_));
+}
+
+int texture_atlas::bind_count(const std::vector<unsigned> &textures) {
+  int binds = 0;
+  for (std::size_t i = 0; i < textures.size(); i++) {
+    if (i == 0 || textures[i] != textures[i - 1]) {
+      binds++;
+    }
+  }
+  return binds;
+}
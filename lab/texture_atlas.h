@@ -0,0 +1,106 @@
+//
+// Texture atlas packing.
+// Several images are packed into one texture with a skyline packer, each surrounded by a gutter of
+// replicated edge texels so that linear filtering and the smaller mip levels don't bleed between neighbours.
+//
+
+#ifndef LAB_TEXTURE_ATLAS_H
+#define LAB_TEXTURE_ATLAS_H
+
+#include "bmp_image.h"
+
+#include <vector>
+
+/**
+ * Where an image ended up inside the atlas
+ */
+struct atlas_region {
+  int x = 0;      // texel position of the image itself, without gutter, from the bottom left
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  float u0 = 0, v0 = 0, u1 = 0, v1 = 0;
+
+  /**
+   * Map a texture coordinate in [0, 1] of the original image into the atlas.
+   * Coordinates outside [0, 1] can't wrap inside an atlas and are clamped.
+   */
+  float u(float s) const noexcept {
+    return u0 + clamp(s) * (u1 - u0);
+  }
+
+  float v(float t) const noexcept {
+    return v0 + clamp(t) * (v1 - v0);
+  }
+
+private:
+  static float clamp(float c) noexcept {
+    return c < 0 ? 0 : (c > 1 ? 1 : c);
+  }
+};
+
+class texture_atlas {
+public:
+  /**
+   * @param gutter texels of replicated border around every image, 2^n survives n mip levels
+   * @param max_size largest width or height the atlas may grow to
+   */
+  explicit texture_atlas(int gutter = 4, int max_size = 4096) : gutter_(gutter), max_size_(max_size) {}
+
+  /**
+   * Register an image, the pixels have to stay valid until compose() is done.
+   * @return handle of the image, used to look up its region after packing
+   */
+  int add(const image_view &img);
+
+  /**
+   * Place all registered images, picking the atlas size (in multiples of 64) that wastes the least area.
+   * The regions are only valid after this.
+   * @return false if they don't fit into max_size x max_size
+   */
+  bool pack();
+
+  /**
+   * Copy all images into an RGBA8 bottom-up buffer of width() * height() texels and fill the gutters
+   */
+  void compose(unsigned char *rgba) const;
+
+  const atlas_region &region(int handle) const {
+    return regions_[handle];
+  }
+
+  int width() const noexcept {
+    return width_;
+  }
+
+  int height() const noexcept {
+    return height_;
+  }
+
+  /**
+   * @return fraction of the atlas covered by image texels, gutters count as waste
+   */
+  float efficiency() const noexcept;
+
+  /**
+   * Count texture binds of a draw sequence, a bind is needed whenever the texture changes
+   * @param textures texture (or atlas handle) used by each draw, in order
+   */
+  static int bind_count(const std::vector<unsigned> &textures);
+
+private:
+  struct skyline_node {
+    int x, y, width;
+  };
+
+  int gutter_;
+  int max_size_;
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<image_view> images_;
+  std::vector<atlas_region> regions_;
+
+  bool pack_into(int width, int height, int &used_height);
+};
+
+#endif //LAB_TEXTURE_ATLAS_H
@@ -0,0 +1,271 @@
+//
+// Cooked texture cache, see texture_cache.h
+//
+
+#include "texture_cache.h"
+#include "content_hash.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Bump whenever the encoder or the file layout changes, old files are then simply ignored
+constexpr std::uint32_t cooked_version = 1;
+
+// Keeps the temporary files of threads cooking the same content apart
+std::atomic<unsigned> temporary_counter{0};
+
+// The files are a local cache, so they are written in native byte order
+struct file_header {
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t format;
+  std::uint32_t levels;
+  std::uint64_t key;
+};
+
+struct level_header {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint64_t offset;
+  std::uint64_t size;
+};
+
+std::uint64_t microseconds_since(std::chrono::steady_clock::time_point start) {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+std::uint64_t content_key(const image_view &src, block_format format, const mip_options *mipmaps) {
+  content_hash hash;
+  hash.update_value(cooked_version);
+  hash.update_value(src.width);
+  hash.update_value(src.height);
+  hash.update_value(static_cast<int>(src.format));
+  hash.update_value(src.bottom_up);
+  hash.update_value(static_cast<int>(format));
+  hash.update_value(mipmaps != nullptr);
+  if (mipmaps != nullptr) {
+    hash.update_value(static_cast<int>(mipmaps->filter));
+    hash.update_value(mipmaps->srgb);
+  }
+  // Row by row, the padding between rows isn't part of the content
+  const std::size_t row_bytes = static_cast<std::size_t>(src.width) * bytes_per_pixel(src.format);
+  for (int y = 0; y < src.height; y++) {
+    hash.update(src.pixels + static_cast<std::size_t>(y) * src.stride, row_bytes);
+  }
+  return hash.digest();
+}
+
+} // namespace
+
+cooked_texture::~cooked_texture() {
+  release();
+}
+
+cooked_texture::cooked_texture(cooked_texture &&other) noexcept
+    : format_(other.format_), levels_(std::move(other.levels_)), encoded_(std::move(other.encoded_)),
+      mapping_(other.mapping_), mapping_size_(other.mapping_size_) {
+  other.levels_.clear();
+  other.mapping_ = nullptr;
+  other.mapping_size_ = 0;
+}
+
+cooked_texture &cooked_texture::operator=(cooked_texture &&other) noexcept {
+  if (this != &other) {
+    release();
+    format_ = other.format_;
+    levels_ = std::move(other.levels_);
+    encoded_ = std::move(other.encoded_);
+    mapping_ = other.mapping_;
+    mapping_size_ = other.mapping_size_;
+    other.levels_.clear();
+    other.mapping_ = nullptr;
+    other.mapping_size_ = 0;
+  }
+  return *this;
+}
+
+std::size_t cooked_texture::bytes() const noexcept {
+  std::size_t total = 0;
+  for (const auto &level : levels_) {
+    total += level.size;
+  }
+  return total;
+}
+
+void cooked_texture::release() noexcept {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, mapping_size_);
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  levels_.clear();
+  encoded_.clear();
+}
+
+cooked_texture texture_cache::cook(const image_view &src, block_format format, const mip_options *mipmaps,
+                                   thread_pool *pool) {
+  cooked_texture cooked;
+  if (src.empty()) {
+    return cooked;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const std::uint64_t key = content_key(src, format, mipmaps);
+  const std::string file = path(key);
+
+  if (!directory_.empty() && load(file, key, format, cooked)) {
+    hits_++;
+  } else {
+    // OpenGL wants bottom-up blocks, so the base is flipped first and the chain inherits its orientation
+    std::vector<unsigned char> flipped;
+    image_view base = src;
+    if (!src.bottom_up) {
+      flipped.resize(src.stride * src.height);
+      convert_image(src, src.format, true, flipped.data(), src.stride);
+      base.pixels = flipped.data();
+      base.bottom_up = true;
+    }
+    mip_chain mips;
+    if (mipmaps != nullptr) {
+      mips = build_mip_chain(base, *mipmaps, pool);
+    }
+
+    cooked.format_ = format;
+    cooked.encoded_.push_back(compress_image(base, format, pool));
+    for (std::size_t i = 0; i < mips.levels.size(); i++) {
+      cooked.encoded_.push_back(compress_image(mips.view(i), format, pool));
+    }
+    int width = src.width;
+    int height = src.height;
+    for (const auto &blocks : cooked.encoded_) {
+      cooked.levels_.push_back(compressed_level{width, height, blocks.data(), blocks.size()});
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+    if (!directory_.empty()) {
+      store(file, key, cooked);
+    }
+    misses_++;
+  }
+
+  std::uint64_t uncompressed = 0;
+  for (const auto &level : cooked.levels_) {
+    uncompressed += static_cast<std::uint64_t>(level.width) * static_cast<std::uint64_t>(level.height) * 4u;
+  }
+  uncompressed_bytes_ += uncompressed;
+  compressed_bytes_ += cooked.bytes();
+
+  cook_microseconds_ += microseconds_since(start);
+  return cooked;
+}
+
+void texture_cache::print_statistics() const {
+  const std::uint64_t uncompressed = uncompressed_bytes_.load();
+  const std::uint64_t compressed = compressed_bytes_.load();
+  std::cout << "Texture cache: " << hits_.load() << " hits, " << misses_.load() << " misses, "
+            << uncompressed / 1024 << " KiB as RGBA8 -> " << compressed / 1024 << " KiB compressed";
+  if (compressed > 0) {
+    std::cout << " (" << static_cast<double>(uncompressed) / static_cast<double>(compressed) << "x smaller)";
+  }
+  std::cout << ", " << static_cast<double>(cook_microseconds_.load()) / 1000 << " ms loading and cooking";
+  std::cout << std::endl;
+}
+
+std::string texture_cache::path(std::uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.ctex", static_cast<unsigned long long>(key));
+  return directory_ + "/" + name;
+}
+
+bool texture_cache::load(const std::string &file, std::uint64_t key, block_format format,
+                         cooked_texture &cooked) const {
+  const int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // Not cooked yet
+    return false;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(file_header)) {
+    close(fd);
+    return false;
+  }
+  const auto size = static_cast<std::size_t>(st.st_size);
+  void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  cooked.mapping_ = mapping;
+  cooked.mapping_size_ = size;
+  cooked.format_ = format;
+
+  const auto *data = static_cast<const unsigned char *>(mapping);
+  file_header header{};
+  std::memcpy(&header, data, sizeof(header));
+  const std::size_t table_end = sizeof(file_header) + header.levels * sizeof(level_header);
+  if (std::memcmp(header.magic, "CTEX", 4) != 0 || header.version != cooked_version || header.key != key
+      || header.format != static_cast<std::uint32_t>(format) || header.levels == 0 || table_end > size) {
+    std::cout << "Ignoring stale cooked texture " << file << std::endl;
+    cooked.release();
+    return false;
+  }
+
+  for (std::uint32_t i = 0; i < header.levels; i++) {
+    level_header level{};
+    std::memcpy(&level, data + sizeof(file_header) + i * sizeof(level_header), sizeof(level));
+    if (level.offset > size || level.size > size - level.offset
+        || level.size != compressed_size(static_cast<int>(level.width), static_cast<int>(level.height), format)) {
+      std::cout << "Ignoring truncated cooked texture " << file << std::endl;
+      cooked.release();
+      return false;
+    }
+    cooked.levels_.push_back(compressed_level{static_cast<int>(level.width), static_cast<int>(level.height),
+                                              data + level.offset, static_cast<std::size_t>(level.size)});
+  }
+  return true;
+}
+
+void texture_cache::store(const std::string &file, std::uint64_t key, const cooked_texture &cooked) const {
+  file_header header{};
+  std::memcpy(header.magic, "CTEX", 4);
+  header.version = cooked_version;
+  header.format = static_cast<std::uint32_t>(cooked.format_);
+  header.levels = static_cast<std::uint32_t>(cooked.levels_.size());
+  header.key = key;
+
+  std::vector<level_header> table;
+  std::uint64_t offset = sizeof(file_header) + cooked.levels_.size() * sizeof(level_header);
+  for (const auto &level : cooked.levels_) {
+    table.push_back(level_header{static_cast<std::uint32_t>(level.width), static_cast<std::uint32_t>(level.height),
+                                 offset, level.size});
+    offset += level.size;
+  }
+
+  // Written next to the target and renamed, so a concurrent or crashed run never sees half a file
+  const std::string temporary = file + "." + std::to_string(getpid()) + "."
+                                + std::to_string(temporary_counter++) + ".tmp";
+  FILE *out = std::fopen(temporary.c_str(), "wb");
+  if (out == nullptr) {
+    std::cout << "Cooked texture could not be written: " << temporary << std::endl;
+    return;
+  }
+  bool written = std::fwrite(&header, sizeof(header), 1, out) == 1
+                 && std::fwrite(table.data(), sizeof(level_header), table.size(), out) == table.size();
+  for (const auto &level : cooked.levels_) {
+    written = written && std::fwrite(level.blocks, 1, level.size, out) == level.size;
+  }
+  written = std::fclose(out) == 0 && written;
+  if (!written || std::rename(temporary.c_str(), file.c_str()) != 0) {
+    std::cout << "Cooked texture could not be written: " << file << std::endl;
+    std::remove(temporary.c_str());
+  }
+}
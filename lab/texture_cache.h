@@ -0,0 +1,117 @@
+//
+// On-disk cache of block compressed textures.
+// A source image is compressed together with its mip chain once and stored under a hash of its content,
+// later runs map the cooked file and hand the blocks to OpenGL without decoding or encoding anything.
+//
+
+#ifndef LAB_TEXTURE_CACHE_H
+#define LAB_TEXTURE_CACHE_H
+
+#include "block_compress.h"
+#include "mipmap.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+class thread_pool;
+
+/**
+ * One compressed level, blocks are stored bottom-up like OpenGL expects them
+ */
+struct compressed_level {
+  int width = 0;
+  int height = 0;
+  const unsigned char *blocks = nullptr;
+  std::size_t size = 0;
+};
+
+/**
+ * A compressed texture with all its levels, either mapped from the cache or freshly encoded.
+ * Owns the memory behind the levels and can be moved between threads.
+ */
+class cooked_texture {
+public:
+  cooked_texture() = default;
+
+  ~cooked_texture();
+
+  cooked_texture(const cooked_texture &) = delete;
+
+  cooked_texture &operator=(const cooked_texture &) = delete;
+
+  cooked_texture(cooked_texture &&other) noexcept;
+
+  cooked_texture &operator=(cooked_texture &&other) noexcept;
+
+  bool valid() const noexcept {
+    return !levels_.empty();
+  }
+
+  block_format format() const noexcept {
+    return format_;
+  }
+
+  /**
+   * @return level 0 is the base image
+   */
+  const std::vector<compressed_level> &levels() const noexcept {
+    return levels_;
+  }
+
+  /**
+   * @return bytes of all levels together
+   */
+  std::size_t bytes() const noexcept;
+
+private:
+  friend class texture_cache;
+
+  block_format format_ = block_format::bc1;
+  std::vector<compressed_level> levels_;
+  std::vector<std::vector<unsigned char>> encoded_; // backing store of freshly encoded levels
+  void *mapping_ = nullptr;                         // or the mapped cache file
+  std::size_t mapping_size_ = 0;
+
+  void release() noexcept;
+};
+
+class texture_cache {
+public:
+  /**
+   * @param directory where cooked files live, has to exist. Empty disables the disk and always encodes.
+   */
+  explicit texture_cache(std::string directory = "") : directory_(std::move(directory)) {}
+
+  /**
+   * Load the cooked version of src, or compress it and store the result for the next run.
+   * Safe to call from several threads at once.
+   * @param src image in any pixel_format and orientation
+   * @param mipmaps if set, the chain is built with these options and compressed as well
+   * @param pool threads for encoding, nullptr to stay on the calling thread
+   */
+  cooked_texture cook(const image_view &src, block_format format, const mip_options *mipmaps, thread_pool *pool);
+
+  /**
+   * Print hits, misses, the memory saved against RGBA8 and the time spent in cook so far
+   */
+  void print_statistics() const;
+
+private:
+  std::string directory_;
+  std::atomic<int> hits_{0};
+  std::atomic<int> misses_{0};
+  std::atomic<std::uint64_t> uncompressed_bytes_{0};
+  std::atomic<std::uint64_t> compressed_bytes_{0};
+  std::atomic<std::uint64_t> cook_microseconds_{0};
+
+  std::string path(std::uint64_t key) const;
+
+  bool load(const std::string &file, std::uint64_t key, block_format format, cooked_texture &cooked) const;
+
+  void store(const std::string &file, std::uint64_t key, const cooked_texture &cooked) const;
+};
+
+#endif //LAB_TEXTURE_CACHE_H
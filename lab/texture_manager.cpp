@@ -0,0 +1,386 @@
+//
+// Texture residency management, see texture_manager.h
+//
+
+#include "texture_manager.h"
+#include "content_hash.h"
+#include "gl_image.h"
+
+#include <iostream>
+#include <utility>
+
+#include <sys/stat.h>
+
+namespace {
+
+/**
+ * @return bytes the texture will take in video memory, RGB is assumed to be padded to four bytes
+ */
+std::size_t estimate_bytes(int width, int height, const stream_options &options) {
+  const bool compressed = options.compress && gl_supports_block_compression();
+  const int levels = options.mipmaps ? mip_level_count(width, height) : 1;
+  std::size_t total = 0;
+  for (int level = 0; level < levels; level++) {
+    total += compressed ? compressed_size(width, height, options.compression)
+                        : static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * 4u;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+  return total;
+}
+
+/**
+ * Textures with the same content but different settings can't be shared
+ */
+void hash_params(content_hash &hash, const texture_params &params) {
+  hash.update_value(params.stream.mipmaps);
+  hash.update_value(static_cast<int>(params.stream.mips.filter));
+  hash.update_value(params.stream.mips.srgb);
+  hash.update_value(params.stream.compress);
+  hash.update_value(static_cast<int>(params.stream.compression));
+  hash.update_value(params.wrap);
+  hash.update_value(params.mag_filter);
+}
+
+} // namespace
+
+bool hash_file_stamp(const std::string &path, content_hash &hash) {
+  struct stat info{};
+  if (stat(path.c_str(), &info) != 0) {
+    return false;
+  }
+  hash.update(path.data(), path.size());
+  hash.update_value(static_cast<std::int64_t>(info.st_size));
+  hash.update_value(static_cast<std::int64_t>(info.st_mtim.tv_sec));
+  hash.update_value(static_cast<std::int64_t>(info.st_mtim.tv_nsec));
+  return true;
+}
+
+texture_handle::~texture_handle() {
+  if (manager_ != nullptr) {
+    manager_->release(id_);
+  }
+}
+
+texture_handle::texture_handle(const texture_handle &other) : manager_(other.manager_), id_(other.id_) {
+  if (manager_ != nullptr) {
+    manager_->acquire(id_);
+  }
+}
+
+texture_handle &texture_handle::operator=(const texture_handle &other) {
+  if (this != &other) {
+    texture_handle copy(other);
+    std::swap(manager_, copy.manager_);
+    std::swap(id_, copy.id_);
+  }
+  return *this;
+}
+
+texture_handle::texture_handle(texture_handle &&other) noexcept : manager_(other.manager_), id_(other.id_) {
+  other.manager_ = nullptr;
+  other.id_ = -1;
+}
+
+texture_handle &texture_handle::operator=(texture_handle &&other) noexcept {
+  std::swap(manager_, other.manager_);
+  std::swap(id_, other.id_);
+  return *this;
+}
+
+texture_manager::texture_manager(texture_streamer &streamer, std::size_t budget)
+    : streamer_(streamer), budget_(budget) {
+  stats_.budget = budget;
+}
+
+texture_manager::~texture_manager() {
+  for (auto &e : entries_) {
+    if (e.texture != 0) {
+      delete_texture(e.texture);
+    }
+  }
+  for (auto &orphan : orphans_) {
+    delete_texture(orphan.first);
+  }
+}
+
+texture_handle texture_manager::load(const std::string &path, const texture_params &params) {
+  content_hash stamp;
+  if (!hash_file_stamp(path, stamp)) {
+    std::cout << "Can't read " << path << std::endl;
+    return texture_handle{};
+  }
+  hash_params(stamp, params);
+  const std::uint64_t file_key = stamp.digest();
+  const auto found = by_file_.find(file_key);
+  if (found != by_file_.end()) {
+    return share(found->second);
+  }
+
+  const int id = allocate();
+  entry &e = entries_[id];
+  e.file_key = file_key;
+  e.path = path;
+  e.params = params;
+  e.hashing = true;
+  by_file_[file_key] = id;
+  create_placeholder(e);
+
+  // Hashing touches every page of the file, so it happens on a worker, which maps the file by itself
+  const std::uint64_t serial = e.serial;
+  const std::shared_ptr<hash_results> results = hashed_;
+  streamer_.run([results, path, params, id, serial] {
+    hashed_file done{id, serial, false, 0, 0, 0};
+    mapped_bmp bmp(path.c_str());
+    if (bmp.valid()) {
+      const image_view &img = bmp.view();
+      content_hash hash;
+      hash.update_value(img.width);
+      hash.update_value(img.height);
+      hash.update_value(static_cast<int>(img.format));
+      hash.update_value(img.bottom_up);
+      const std::size_t row_bytes = static_cast<std::size_t>(img.width) * bytes_per_pixel(img.format);
+      for (int y = 0; y < img.height; y++) {
+        hash.update(img.pixels + static_cast<std::size_t>(y) * img.stride, row_bytes);
+      }
+      hash_params(hash, params);
+      done = hashed_file{id, serial, true, hash.digest(), img.width, img.height};
+    }
+    std::lock_guard<std::mutex> lock(results->mutex);
+    results->done.push_back(done);
+  });
+  return texture_handle(this, id);
+}
+
+texture_handle texture_manager::load(int width, int height, texture_streamer::writer write, std::uint64_t key,
+                                     const texture_params &params) {
+  if (width <= 0 || height <= 0) {
+    return texture_handle{};
+  }
+  content_hash hash(key);
+  hash.update_value(width);
+  hash.update_value(height);
+  hash_params(hash, params);
+  key = hash.digest();
+
+  const auto found = by_key_.find(key);
+  if (found != by_key_.end()) {
+    return share(found->second);
+  }
+  const int id = allocate();
+  entry &e = entries_[id];
+  e.key = key;
+  e.write = std::move(write);
+  e.width = width;
+  e.height = height;
+  e.params = params;
+  e.bytes = estimate_bytes(width, height, params.stream);
+  by_key_[key] = id;
+  make_resident(e);
+  return texture_handle(this, id);
+}
+
+GLuint texture_manager::use(const texture_handle &handle) {
+  if (handle.manager_ != this) {
+    return 0;
+  }
+  entry &e = entries_[resolve(handle.id_)];
+  e.last_used = frame_;
+  if (e.hashing) {
+    stats_.misses++;
+  } else if (e.texture == 0) {
+    stats_.misses++;
+    make_resident(e);
+  } else if (streamer_.resident(e.texture)) {
+    stats_.hits++;
+  } else {
+    stats_.misses++;
+  }
+  return e.texture;
+}
+
+bool texture_manager::resident(const texture_handle &handle) const {
+  if (handle.manager_ != this) {
+    return false;
+  }
+  const entry &e = entries_[resolve(handle.id_)];
+  return !e.hashing && e.texture != 0 && streamer_.resident(e.texture);
+}
+
+void texture_manager::set_budget(std::size_t budget) {
+  budget_ = budget;
+  stats_.budget = budget;
+  make_room(0);
+}
+
+texture_stats texture_manager::end_frame() {
+  finish_hashes();
+
+  // Released textures which were still streaming can go once their upload is done
+  for (std::size_t i = 0; i < orphans_.size();) {
+    if (streamer_.resident(orphans_[i].first)) {
+      delete_texture(orphans_[i].first);
+      bytes_resident_ -= orphans_[i].second;
+      orphans_.erase(orphans_.begin() + static_cast<std::ptrdiff_t>(i));
+    } else {
+      i++;
+    }
+  }
+
+  texture_stats finished = stats_;
+  finished.bytes_resident = bytes_resident_;
+  stats_ = texture_stats{};
+  stats_.budget = budget_;
+  frame_++;
+  return finished;
+}
+
+texture_handle texture_manager::share(int id) {
+  acquire(id);
+  stats_.deduplicated++;
+  return texture_handle(this, id);
+}
+
+int texture_manager::allocate() {
+  int id;
+  if (free_entries_.empty()) {
+    id = static_cast<int>(entries_.size());
+    entries_.emplace_back();
+  } else {
+    id = free_entries_.back();
+    free_entries_.pop_back();
+    entries_[id] = entry{};
+  }
+  entries_[id].serial = next_serial_++;
+  entries_[id].refs = 1;
+  entries_[id].last_used = frame_;
+  return id;
+}
+
+void texture_manager::finish_hashes() {
+  {
+    std::lock_guard<std::mutex> lock(hashed_->mutex);
+    finished_hashes_.swap(hashed_->done);
+  }
+  for (const hashed_file &done : finished_hashes_) {
+    entry &e = entries_[done.id];
+    if (e.serial != done.serial || !e.hashing) {
+      // Released while it was hashed
+      continue;
+    }
+    e.hashing = false;
+    if (!done.valid) {
+      std::cout << "Can't load " << e.path << std::endl;
+      continue;
+    }
+    const auto found = by_key_.find(done.key);
+    if (found != by_key_.end()) {
+      // Same pixels as a texture already loaded, nothing was streamed for this one yet
+      e.alias = found->second;
+      acquire(e.alias);
+      delete_texture(e.texture);
+      e.texture = 0;
+      stats_.deduplicated++;
+      continue;
+    }
+    e.key = done.key;
+    e.width = done.width;
+    e.height = done.height;
+    e.bytes = estimate_bytes(done.width, done.height, e.params.stream);
+    by_key_[done.key] = done.id;
+    make_room(e.bytes);
+    streamer_.request(e.path, e.texture, e.params.stream);
+    bytes_resident_ += e.bytes;
+  }
+  finished_hashes_.clear();
+}
+
+void texture_manager::acquire(int id) noexcept {
+  entries_[id].refs++;
+}
+
+void texture_manager::release(int id) {
+  entry &e = entries_[id];
+  if (--e.refs > 0) {
+    return;
+  }
+  const int alias = e.alias;
+  if (e.hashing) {
+    delete_texture(e.texture);
+  } else if (e.texture != 0) {
+    if (streamer_.resident(e.texture)) {
+      delete_texture(e.texture);
+      bytes_resident_ -= e.bytes;
+    } else {
+      // The streamer would bind the deleted name for its upload and silently create a new texture
+      orphans_.emplace_back(e.texture, e.bytes);
+    }
+  }
+  if (e.key != 0 && alias < 0) {
+    by_key_.erase(e.key);
+  }
+  if (e.file_key != 0) {
+    by_file_.erase(e.file_key);
+  }
+  e = entry{};
+  free_entries_.push_back(id);
+  if (alias >= 0) {
+    release(alias);
+  }
+}
+
+void texture_manager::make_resident(entry &e) {
+  make_room(e.bytes);
+  create_placeholder(e);
+  if (e.path.empty()) {
+    streamer_.request(e.width, e.height, e.write, e.texture, e.params.stream);
+  } else {
+    streamer_.request(e.path, e.texture, e.params.stream);
+  }
+  bytes_resident_ += e.bytes;
+}
+
+void texture_manager::create_placeholder(entry &e) {
+  GLint previous = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+  glGenTextures(1, &e.texture);
+  glBindTexture(GL_TEXTURE_2D, e.texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, e.params.wrap);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, e.params.wrap);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, e.params.mag_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  // Neutral grey until the content arrives
+  const GLubyte placeholder[4] = {128, 128, 128, 255};
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+  glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous));
+}
+
+void texture_manager::evict(entry &e) {
+  // Deleting instead of shrinking, immutable storage can't be respecified
+  delete_texture(e.texture);
+  e.texture = 0;
+  bytes_resident_ -= e.bytes;
+  stats_.evictions++;
+}
+
+void texture_manager::make_room(std::size_t bytes) {
+  while (bytes_resident_ + bytes > budget_) {
+    // Textures used in this frame or still streaming stay, the budget may be exceeded then
+    entry *oldest = nullptr;
+    for (auto &e : entries_) {
+      if (e.texture != 0 && e.last_used < frame_ && streamer_.resident(e.texture)
+          && (oldest == nullptr || e.last_used < oldest->last_used)) {
+        oldest = &e;
+      }
+    }
+    if (oldest == nullptr) {
+      return;
+    }
+    evict(*oldest);
+  }
+}
+
+void texture_manager::delete_texture(GLuint texture) {
+  streamer_.forget(texture);
+  glDeleteTextures(1, &texture);
+}
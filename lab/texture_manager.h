@@ -0,0 +1,225 @@
+//
+// Texture residency management.
+// Textures are shared through reference counted handles and deduplicated by a hash of their content.
+// Files are recognised by their path, size and modification time right away, their content is hashed
+// on a worker, and a file whose pixels turn out to match an existing texture is merged into that one.
+// Their estimated memory is kept below a budget by evicting the least recently used ones,
+// which are streamed back in when they're used again.
+//
+
+#ifndef LAB_TEXTURE_MANAGER_H
+#define LAB_TEXTURE_MANAGER_H
+
+#include "GL/glew.h"
+#include "content_hash.h"
+#include "texture_streamer.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class texture_manager;
+
+/**
+ * Mix path, size and modification time of a file into hash, cheap enough for the GL thread
+ * @return false if the file doesn't exist
+ */
+bool hash_file_stamp(const std::string &path, content_hash &hash);
+
+/**
+ * How a managed texture is loaded and sampled, applied again whenever it's reloaded
+ */
+struct texture_params {
+  stream_options stream;
+  GLint wrap = GL_REPEAT;
+  GLint mag_filter = GL_LINEAR;
+};
+
+/**
+ * Counters of a single frame
+ */
+struct texture_stats {
+  int hits = 0;              // uses of resident textures
+  int misses = 0;            // uses of textures which are still loading or had to be reloaded
+  int evictions = 0;
+  int deduplicated = 0;      // loads served by a texture with the same content
+  std::size_t bytes_resident = 0;
+  std::size_t budget = 0;
+};
+
+/**
+ * Shared ownership of a managed texture, the texture is deleted with the last handle.
+ * Handles have to be used and destroyed on the GL thread.
+ */
+class texture_handle {
+public:
+  texture_handle() = default;
+
+  ~texture_handle();
+
+  texture_handle(const texture_handle &other);
+
+  texture_handle &operator=(const texture_handle &other);
+
+  texture_handle(texture_handle &&other) noexcept;
+
+  texture_handle &operator=(texture_handle &&other) noexcept;
+
+  bool valid() const noexcept {
+    return manager_ != nullptr;
+  }
+
+private:
+  friend class texture_manager;
+
+  texture_manager *manager_ = nullptr;
+  int id_ = -1;
+
+  texture_handle(texture_manager *manager, int id) noexcept : manager_(manager), id_(id) {}
+};
+
+class texture_manager {
+public:
+  /**
+   * @param streamer loads the textures, has to outlive the manager
+   * @param budget bytes the resident textures may occupy
+   */
+  texture_manager(texture_streamer &streamer, std::size_t budget);
+
+  /**
+   * Deletes all textures, the handles must not be used afterwards
+   */
+  ~texture_manager();
+
+  texture_manager(const texture_manager &) = delete;
+
+  texture_manager &operator=(const texture_manager &) = delete;
+
+  /**
+   * Load a BMP file, or share the texture of an already loaded file with the same pixels.
+   * The handle is valid right away, its texture shows a placeholder while the file is hashed and
+   * streamed. A file which can't be read keeps the placeholder.
+   */
+  texture_handle load(const std::string &path, const texture_params &params = texture_params{});
+
+  /**
+   * Load a generated texture. It may be regenerated after an eviction, so write has to be repeatable.
+   * @param key identifies the content, e.g. a hash of the generator settings
+   */
+  texture_handle load(int width, int height, texture_streamer::writer write, std::uint64_t key,
+                      const texture_params &params = texture_params{});
+
+  /**
+   * Mark a texture as used in this frame and start reloading it if it was evicted.
+   * The name may change after an eviction, so it should be fetched every frame.
+   * @return texture name to bind, shows a placeholder until the content is resident
+   */
+  GLuint use(const texture_handle &handle);
+
+  /**
+   * @return true once the texture behind handle is resident
+   */
+  bool resident(const texture_handle &handle) const;
+
+  void set_budget(std::size_t budget);
+
+  /**
+   * Close the current frame
+   * @return counters of the frame that just ended
+   */
+  texture_stats end_frame();
+
+private:
+  friend class texture_handle;
+
+  struct entry {
+    std::uint64_t key = 0;             // content, 0 while a file is being hashed
+    std::uint64_t file_key = 0;        // path, size and modification time of a file
+    std::uint64_t serial = 0;          // tells a hash result from one of an earlier user of the entry
+    int alias = -1;                    // entry with the same content this one was merged into
+    bool hashing = false;
+    std::string path;                  // source file, or empty for generated textures
+    texture_streamer::writer write;
+    int width = 0;
+    int height = 0;
+    texture_params params;
+    GLuint texture = 0;                // 0 while evicted
+    std::size_t bytes = 0;             // estimated memory once resident
+    int refs = 0;
+    long long last_used = -1;
+  };
+
+  texture_streamer &streamer_;
+  std::size_t budget_;
+  std::size_t bytes_resident_ = 0;
+  long long frame_ = 0;
+  texture_stats stats_;
+  std::vector<entry> entries_;
+  std::vector<int> free_entries_;
+  std::unordered_map<std::uint64_t, int> by_key_;
+  std::unordered_map<std::uint64_t, int> by_file_;
+  std::uint64_t next_serial_ = 0;
+
+  /**
+   * Content of a file hashed on a worker
+   */
+  struct hashed_file {
+    int id;
+    std::uint64_t serial;
+    bool valid;
+    std::uint64_t key;
+    int width;
+    int height;
+  };
+
+  /**
+   * Shared with the hashing tasks, so they may finish after the manager is gone
+   */
+  struct hash_results {
+    std::mutex mutex;
+    std::vector<hashed_file> done;
+  };
+
+  std::shared_ptr<hash_results> hashed_ = std::make_shared<hash_results>();
+  std::vector<hashed_file> finished_hashes_; // swapped with the shared list, so draining allocates nothing
+  std::vector<std::pair<GLuint, std::size_t>> orphans_; // released while streaming, deleted once uploaded
+
+  texture_handle share(int id);
+
+  int allocate();
+
+  /**
+   * @return entry whose texture stands for id, the one id was merged into if it was
+   */
+  int resolve(int id) const noexcept {
+    return entries_[id].alias >= 0 ? entries_[id].alias : id;
+  }
+
+  /**
+   * Merge or start streaming the files whose hashes are done
+   */
+  void finish_hashes();
+
+  void create_placeholder(entry &e);
+
+  void acquire(int id) noexcept;
+
+  void release(int id);
+
+  void make_resident(entry &e);
+
+  void evict(entry &e);
+
+  /**
+   * Delete a texture name, the streamer forgets it first
+   */
+  void delete_texture(GLuint texture);
+
+  void make_room(std::size_t bytes);
+};
+
+#endif //LAB_TEXTURE_MANAGER_H
@@ -0,0 +1,354 @@
+//
+// Asynchronous texture streaming, see texture_streamer.h
+//
+
+#include "texture_streamer.h"
+#include "gl_image.h"
+
+#include <iostream>
+#include <utility>
+
+texture_streamer::texture_streamer(unsigned decode_threads, std::size_t slot_bytes, int slot_count)
+    : slot_bytes_((slot_bytes + 255u) / 256u * 256u), slots_(static_cast<std::size_t>(slot_count)) {
+  const auto ring_bytes = static_cast<GLsizeiptr>(slot_bytes_ * slots_.size());
+  unsigned char *ring = nullptr;
+
+  if (GLEW_ARB_buffer_storage) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, ring_bytes, nullptr, flags);
+    ring = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, ring_bytes, flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (ring == nullptr) {
+      glDeleteBuffers(1, &buffer_);
+      buffer_ = 0;
+    }
+  }
+  if (ring == nullptr) {
+    std::cout << "Persistent buffer mapping unavailable, streaming through client memory" << std::endl;
+  }
+
+  for (std::size_t i = 0; i < slots_.size(); i++) {
+    slot &s = slots_[i];
+    s.offset = i * slot_bytes_;
+    if (ring != nullptr) {
+      s.memory = ring + s.offset;
+    } else {
+      s.fallback.resize(slot_bytes_);
+      s.memory = s.fallback.data();
+    }
+  }
+
+  block_compression_ = gl_supports_block_compression();
+  cache_.reset(new texture_cache());
+  decoders_.reset(new thread_pool(decode_threads));
+}
+
+texture_streamer::~texture_streamer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  slot_freed_.notify_all();
+  decoders_.reset();
+
+  for (auto &s : slots_) {
+    if (s.fence != nullptr) {
+      glDeleteSync(s.fence);
+    }
+  }
+  if (buffer_ != 0) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer_);
+  }
+}
+
+stream_options texture_streamer::supported(const stream_options &options) const {
+  stream_options effective = options;
+  if (effective.compress && !block_compression_) {
+    std::cout << "Block compressed textures unsupported, uploading uncompressed" << std::endl;
+    effective.compress = false;
+  }
+  return effective;
+}
+
+void texture_streamer::request(const std::string &path, GLuint texture, const stream_options &options) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resident_.erase(texture);
+  }
+  pending_++;
+  const stream_options effective = supported(options);
+  decoders_->submit([this, path, texture, effective] { decode(path, texture, effective); });
+}
+
+void texture_streamer::request(producer produce, GLuint texture, const stream_options &options) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resident_.erase(texture);
+  }
+  pending_++;
+  const stream_options effective = supported(options);
+  decoders_->submit([this, produce, texture, effective] { generate(produce, texture, effective); });
+}
+
+void texture_streamer::request(int width, int height, writer write, GLuint texture, const stream_options &options) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resident_.erase(texture);
+  }
+  pending_++;
+  const stream_options effective = supported(options);
+  decoders_->submit([this, width, height, write, texture, effective] {
+    fill(width, height, write, texture, effective);
+  });
+}
+
+bool texture_streamer::resident(GLuint texture) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return resident_.count(texture) != 0;
+}
+
+void texture_streamer::forget(GLuint texture) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  resident_.erase(texture);
+}
+
+int texture_streamer::acquire_slot() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (stopping_) {
+      return -1;
+    }
+    for (std::size_t i = 0; i < slots_.size(); i++) {
+      if (slots_[i].state == slot_state::free) {
+        slots_[i].state = slot_state::writing;
+        return static_cast<int>(i);
+      }
+    }
+    slot_freed_.wait(lock);
+  }
+}
+
+void texture_streamer::decode(const std::string &path, GLuint texture, const stream_options &options) {
+  mapped_bmp bmp(path.c_str());
+  if (!bmp.valid()) {
+    // The placeholder stays
+    pending_--;
+    return;
+  }
+  stage(bmp.view(), texture, options);
+}
+
+void texture_streamer::generate(const producer &produce, GLuint texture, const stream_options &options) {
+  std::vector<unsigned char> pixels;
+  image_view layout;
+  if (!produce(pixels, layout) || layout.empty()) {
+    pending_--;
+    return;
+  }
+  stage(layout, texture, options);
+}
+
+void texture_streamer::fill(int width, int height, const writer &write, GLuint texture,
+                            const stream_options &options) {
+  if (width <= 0 || height <= 0) {
+    pending_--;
+    return;
+  }
+  image_view layout;
+  layout.width = width;
+  layout.height = height;
+  layout.stride = static_cast<std::size_t>(width) * 4;
+  layout.format = pixel_format::rgba8;
+  layout.bottom_up = true;
+  const std::size_t bytes = layout.stride * static_cast<std::size_t>(height);
+
+  // Mip filtering and compression read the pixels back, which mustn't happen on write combined memory
+  if (options.mipmaps || options.compress || bytes > slot_bytes_) {
+    std::vector<unsigned char> pixels(bytes);
+    write(pixels.data(), layout.stride);
+    layout.pixels = pixels.data();
+    stage(layout, texture, options);
+    return;
+  }
+
+  const int index = acquire_slot();
+  if (index < 0) {
+    return;
+  }
+  slot &s = slots_[index];
+  write(s.memory, layout.stride);
+  s.texture = texture;
+  s.layout = layout;
+  s.mips = mip_chain{};
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  s.state = slot_state::ready;
+  ready_.push_back(index);
+}
+
+void texture_streamer::stage(const image_view &src, GLuint texture, const stream_options &options) {
+  if (options.compress) {
+    // Blocks are a fraction of the source size and come from client memory or the cooked file mapping.
+    // Stage runs on a decoder thread. Nesting on its pool is safe, parallel_for has the caller work too.
+    compressed_upload compressed{texture, cache_->cook(src, options.compression,
+                                                       options.mipmaps ? &options.mips : nullptr,
+                                                       decoders_.get())};
+    if (!compressed.cooked.valid()) {
+      pending_--;
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    compressed_.push_back(std::move(compressed));
+    return;
+  }
+
+  // OpenGL wants bottom-up rows, everything else can be uploaded as stored
+  image_view layout = src;
+  layout.bottom_up = true;
+  const std::size_t bytes = src.stride * src.height;
+
+  // The ring memory is write combined, so the chain is filtered from the file mapping or a flipped copy
+  mip_chain mips;
+  if (options.mipmaps) {
+    std::vector<unsigned char> flipped;
+    image_view base = src;
+    if (!src.bottom_up) {
+      flipped.resize(bytes);
+      convert_image(src, src.format, true, flipped.data(), src.stride);
+      base.pixels = flipped.data();
+      base.bottom_up = true;
+    }
+    mips = build_mip_chain(base, options.mips, decoders_.get());
+  }
+
+  if (bytes > slot_bytes_) {
+    oversized_upload big{texture, layout, std::vector<unsigned char>(bytes), std::move(mips)};
+    convert_image(src, src.format, true, big.pixels.data(), src.stride);
+    std::lock_guard<std::mutex> lock(mutex_);
+    oversized_.push_back(std::move(big));
+    return;
+  }
+
+  const int index = acquire_slot();
+  if (index < 0) {
+    return;
+  }
+  slot &s = slots_[index];
+  // Touches the file pages on this thread, the render thread never waits for the disk
+  convert_image(src, src.format, true, s.memory, src.stride);
+  s.texture = texture;
+  s.layout = layout;
+  s.mips = std::move(mips);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  s.state = slot_state::ready;
+  ready_.push_back(index);
+}
+
+void texture_streamer::upload(GLuint texture, image_view layout, const mip_chain &mips, bool from_buffer) {
+  GLint previous = 0;
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  if (from_buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+  }
+  if (mips.levels.empty()) {
+    gl_upload_image(layout);
+  } else {
+    gl_allocate_mipmapped(layout.width, layout.height, static_cast<int>(mips.levels.size()) + 1, layout.format);
+    gl_upload_level(layout, 0);
+  }
+  if (from_buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  // The smaller levels come from client memory, OpenGL copies them before returning
+  for (std::size_t i = 0; i < mips.levels.size(); i++) {
+    gl_upload_level(mips.view(i), static_cast<int>(i) + 1);
+  }
+  if (!mips.levels.empty()) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous));
+}
+
+int texture_streamer::pump() {
+  int finished = 0;
+  std::vector<int> ready;
+  std::vector<oversized_upload> oversized;
+  std::vector<compressed_upload> compressed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready.swap(ready_);
+    oversized.swap(oversized_);
+    compressed.swap(compressed_);
+  }
+
+  // Retire uploads the GPU is done with, without ever blocking on a fence
+  bool freed = false;
+  for (auto &s : slots_) {
+    if (s.state != slot_state::in_flight) {
+      continue;
+    }
+    if (s.fence != nullptr) {
+      const GLenum status = glClientWaitSync(s.fence, 0, 0);
+      if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        continue;
+      }
+      glDeleteSync(s.fence);
+      s.fence = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.state = slot_state::free;
+    resident_.insert(s.texture);
+    freed = true;
+    finished++;
+    pending_--;
+  }
+  if (freed) {
+    slot_freed_.notify_all();
+  }
+
+  for (int index : ready) {
+    slot &s = slots_[index];
+    image_view layout = s.layout;
+    layout.pixels = buffer_ != 0 ? reinterpret_cast<const unsigned char *>(s.offset) : s.memory;
+    upload(s.texture, layout, s.mips, buffer_ != 0);
+    if (buffer_ != 0) {
+      s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    s.mips = mip_chain{};
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.state = slot_state::in_flight;
+  }
+
+  for (auto &big : oversized) {
+    big.layout.pixels = big.pixels.data();
+    upload(big.texture, big.layout, big.mips, false);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    resident_.insert(big.texture);
+    finished++;
+    pending_--;
+  }
+
+  for (auto &upload : compressed) {
+    GLint previous = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    glBindTexture(GL_TEXTURE_2D, upload.texture);
+    gl_upload_compressed(upload.cooked);
+    glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    resident_.insert(upload.texture);
+    finished++;
+    pending_--;
+  }
+  return finished;
+}
@@ -0,0 +1,194 @@
+//
+// Asynchronous texture streaming.
+// Images are decoded on worker threads straight into a ring of persistently mapped pixel buffer objects,
+// the render thread only issues the buffer to texture copies and polls fences to recycle the ring slots.
+//
+
+#ifndef LAB_TEXTURE_STREAMER_H
+#define LAB_TEXTURE_STREAMER_H
+
+#include "GL/glew.h"
+#include "bmp_image.h"
+#include "mipmap.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * How a requested image is prepared on the worker before it's uploaded
+ */
+struct stream_options {
+  bool mipmaps = false;       // build the mip chain as well and sample the texture trilinearly
+  mip_options mips;
+  bool compress = false;      // block compress through the texture cache, ignored if the driver can't sample it
+  block_format compression = block_format::bc1;
+};
+
+class texture_streamer {
+public:
+  /**
+   * Has to be constructed on the GL thread with a current context.
+   * @param decode_threads number of worker threads decoding images
+   * @param slot_bytes size of one ring slot, larger images bypass the ring
+   * @param slot_count number of ring slots, i.e. uploads that may be in flight at once
+   */
+  explicit texture_streamer(unsigned decode_threads = 2,
+                            std::size_t slot_bytes = 4u << 20u,
+                            int slot_count = 4);
+
+  /**
+   * Stops the workers and releases the ring, the GL context has to be current.
+   */
+  ~texture_streamer();
+
+  texture_streamer(const texture_streamer &) = delete;
+
+  texture_streamer &operator=(const texture_streamer &) = delete;
+
+  /**
+   * Load an image in the background and replace the content of texture once it's done.
+   * Until then the texture keeps whatever placeholder it currently holds.
+   */
+  void request(const std::string &path, GLuint texture, const stream_options &options = stream_options{});
+
+  /**
+   * Fills pixels on a worker thread and describes them in layout, returns false if there's nothing to upload
+   */
+  using producer = std::function<bool(std::vector<unsigned char> &pixels, image_view &layout)>;
+
+  /**
+   * Like the file based request, but the image is generated by produce on a worker, e.g. an atlas being composed
+   */
+  void request(producer produce, GLuint texture, const stream_options &options = stream_options{});
+
+  /**
+   * Writes a bottom-up RGBA8 image on a worker thread, rows are stride bytes apart
+   */
+  using writer = std::function<void(unsigned char *rgba, std::size_t stride)>;
+
+  /**
+   * Like the producer based request for images of known size, e.g. procedural textures.
+   * Without mipmaps and compression write fills the mapped upload buffer directly, without any copy.
+   */
+  void request(int width, int height, writer write, GLuint texture, const stream_options &options = stream_options{});
+
+  /**
+   * Run task on one of the decode workers, for work which belongs to loading, like hashing a file
+   */
+  void run(std::function<void()> task) {
+    decoders_->submit(std::move(task));
+  }
+
+  /**
+   * Keep compressed textures in directory across runs, has to be called before the first request
+   */
+  void use_cache(const std::string &directory) {
+    cache_.reset(new texture_cache(directory));
+  }
+
+  const texture_cache &cache() const noexcept {
+    return *cache_;
+  }
+
+  /**
+   * Issue pending uploads and retire finished ones, has to be called regularly on the GL thread.
+   * @return number of textures which became resident during this call
+   */
+  int pump();
+
+  /**
+   * @return true once the requested image is fully uploaded into texture
+   */
+  bool resident(GLuint texture) const;
+
+  /**
+   * Drop texture from the resident ones before its name is deleted, GL hands deleted names out again
+   * and a new texture under the name mustn't count as uploaded
+   */
+  void forget(GLuint texture);
+
+  /**
+   * @return number of requests which aren't resident yet
+   */
+  int pending() const noexcept {
+    return pending_.load();
+  }
+
+  /**
+   * @return true if uploads go through persistently mapped buffers
+   */
+  bool persistent() const noexcept {
+    return buffer_ != 0;
+  }
+
+private:
+  enum class slot_state {
+    free, writing, ready, in_flight
+  };
+
+  struct slot {
+    unsigned char *memory = nullptr;       // mapped PBO range, or client memory without buffer storage
+    std::size_t offset = 0;                // offset of memory inside the PBO
+    std::vector<unsigned char> fallback;   // backing store if buffers can't be mapped persistently
+    slot_state state = slot_state::free;
+    GLsync fence = nullptr;
+    GLuint texture = 0;
+    image_view layout;                     // pixels relative to memory
+    mip_chain mips;                        // levels below the base, empty without mipmapping
+  };
+
+  // Images that didn't fit into a slot, uploaded from client memory
+  struct oversized_upload {
+    GLuint texture;
+    image_view layout;
+    std::vector<unsigned char> pixels;
+    mip_chain mips;
+  };
+
+  struct compressed_upload {
+    GLuint texture;
+    cooked_texture cooked;
+  };
+
+  std::size_t slot_bytes_;
+  std::vector<slot> slots_;
+  GLuint buffer_ = 0;
+  bool block_compression_ = false;
+  std::unique_ptr<texture_cache> cache_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable slot_freed_;
+  std::vector<int> ready_;
+  std::vector<oversized_upload> oversized_;
+  std::vector<compressed_upload> compressed_;
+  std::set<GLuint> resident_;
+  std::atomic<int> pending_{0};
+  bool stopping_ = false;
+
+  // Declared last, so the workers are joined before the state they use is destroyed
+  std::unique_ptr<thread_pool> decoders_;
+
+  stream_options supported(const stream_options &options) const;
+
+  void decode(const std::string &path, GLuint texture, const stream_options &options);
+
+  void generate(const producer &produce, GLuint texture, const stream_options &options);
+
+  void fill(int width, int height, const writer &write, GLuint texture, const stream_options &options);
+
+  void stage(const image_view &src, GLuint texture, const stream_options &options);
+
+  int acquire_slot();
+
+  void upload(GLuint texture, image_view layout, const mip_chain &mips, bool from_buffer);
+};
+
+#endif //LAB_TEXTURE_STREAMER_H
@@ -2,6 +2,8 @@
 // Created by florian weingartshofer on 31.03.21.
 // Stundenaufwand: 21.5h
 
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <cmath>
 #include <iostream>
@@ -10,226 +12,25 @@
 #include "GL/glew.h"
 #include "GL/freeglut.h"
 
-/**
- * Classes and structs
- */
-
-/**
- * Enum for movement for the x and z axis
- */
-enum class movement_direction {
-  left = 'a',
-  right = 'd',
-  forward = 'w',
-  backward = 's',
-  rotate_clockwise = 'e',
-  rotate_counterclockwise = 'q',
-  jump = 32, // Keycode for spacebar
-};
-
-/**
- * Enum for movement on the y axis
- */
-enum class vertical_motion {
-  standing, jumping, falling
-};
-
-/**
- * Define coordinates for glu
- */
-struct coord3d {
-  float x;
-  float y;
-  float z;
-
-  explicit coord3d(float x = 0, float y = 0, float z = 0) : x{x}, y{y}, z{z} {}
-
-  friend bool operator!=(const coord3d &left, const coord3d &right) {
-    return left.x != right.x || left.y != right.y || left.y != right.y;
-  }
-
-  /**
-   * Operator to increment the x,y and z values.
-   * @param other, the coordinate by which this one should be incremented
-   */
-  coord3d &operator+=(const coord3d &other) {
-    this->x += other.x;
-    this->y += other.y;
-    this->z += other.z;
-    return *this;
-  }
-};
-
-/**
- * Context for the labyrinth, with camera position
- */
-class context {
-public:
-
-  context() {
-    this->camera_position_.y = ground_level_;
-  }
-
-  [[nodiscard]] coord3d &cam() noexcept {
-    return this->camera_position_;
-  }
-
-  float lx() const noexcept {
-    return std::sin(this->horizontal_angle_);
-  }
-
-  float lz() const noexcept {
-    return -std::cos(this->horizontal_angle_);
-  }
-
-  float x() const noexcept {
-    return this->lx() * movement_speed_;
-  }
-
-  float z() const noexcept {
-    return this->lz() * movement_speed_;
-  }
-
-  /**
-   * Convenience function to increase horizontal angle
-   */
-  void inc_horizontal_angle() noexcept {
-    inc_horizontal_angle_by(turn_factor_);
-  }
-
-  /**
- * Convenience function to decrease horizontal angle
- */
-  void dec_horizontal_angle() noexcept {
-    inc_horizontal_angle_by(-turn_factor_);
-  }
-
-  /**
-   * increase horizontal angle
-   */
-  void inc_horizontal_angle_by(const float inc) noexcept {
-    this->horizontal_angle_ += inc;
-  }
-
-  void inc_vertical_angle_by(const float inc) noexcept {
-    this->vertical_angle_ += inc;
-  }
-
-  float vertical_angle() const noexcept {
-    return this->vertical_angle_;
-  }
-
-  void start_jump() noexcept {
-    if (this->jp_state_ == vertical_motion::standing) {
-      this->jp_state_ = vertical_motion::jumping;
-    }
-  }
-
-  /**
-   * Simulate the motion of jumping for the cam
-   * Does nothing if cam is standing
-   * If called when currently jumping it will increase the height of a keep_jumping,
-   * until a certain height is reached then it will start to fall
-   * If called when currently falling the height of the keep_jumping decreases, until ground level is reached,
-   * then the jumping state will again be standing
-   */
-  void keep_jumping() noexcept {
-    switch (this->jp_state_) {
-      case vertical_motion::jumping:
-        if (this->camera_position_.y >= max_jumping_level_) {
-          this->jp_state_ = vertical_motion::falling;
-        } else {
-          this->camera_position_.y += jumping_speed_;
-        }
-        break;
-      case vertical_motion::falling:
-        if (this->camera_position_.y <= ground_level_) {
-          this->jp_state_ = vertical_motion::standing;
-          // Since sometimes a float isn't that precise ;)
-          this->camera_position_.y = ground_level_;
-        } else {
-          this->camera_position_.y -= jumping_speed_;
-        }
-        break;
-      case vertical_motion::standing:
-        break;
-    }
-  }
-
-private:
-  coord3d camera_position_;
-  float horizontal_angle_ = 0;
-  float vertical_angle_ = 0;
-  vertical_motion jp_state_ = vertical_motion::standing;
-
-  static const float turn_factor_;
-  static const float movement_speed_;
-  static const float jumping_speed_;
-  static const float ground_level_;
-  static const float max_jumping_level_;
-};
-
-/**
- * Represents an item, which can be picked up
- */
-class portable_object {
-public:
-  explicit portable_object(coord3d coord) : location_(coord) {}
-
-  void render(context &ctx) {
-    move_closer_to_camera(ctx);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    glColor3d(1, 0, 0);
-    glPushMatrix();
-    glTranslatef(location_.x, location_.y, location_.z);
-    this-> angle_ = this->angle_ % 360;
-    glRotatef(this->angle_++, 0, 1, 0);
-    glRotatef(45, 1, 0, 0);
-
-    glutSolidCube(0.25);
-    glPopMatrix();
-  }
-
-  void pick() {
-    this->follow_cam_ = true;
-  }
-
-  bool is_following() const {
-    return follow_cam_;
-  }
-
-  coord3d location() {
-    return location_;
-  }
-
-private:
-  coord3d location_;
-  bool follow_cam_ = false;
-  int angle_ = 0;
-  static const float ball_speed_;
-
-  void move_closer_to_camera(context &ctx) {
-    if (follow_cam_) {
-      location_.x += ctx.cam().x < location_.x ? -ball_speed_ : ball_speed_;
-      location_.z += ctx.cam().z < location_.z ? -ball_speed_ : ball_speed_;
-    }
-  }
-};
+#include "alloc_tracker.h"
+#include "dynamic_resolution.h"
+#include "frame_capture.h"
+#include "game_logic.h"
+#include "maze_grid.h"
+#include "maze_import.h"
+#include "maze_minimap.h"
+#include "maze_regions.h"
+#include "scene_graph.h"
+#include "simulation_thread.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
+#include "triple_buffer.h"
+#include "vecmath.h"
 
 /**
  * Statics
  */
 
-// These should only be available to the context class
-const float context::turn_factor_ = 0.05;
-const float context::movement_speed_ = 0.3;
-const float context::jumping_speed_ = 0.004;
-const float context::ground_level_ = 1.5;
-const float context::max_jumping_level_ = context::ground_level_ + 1;
-
-const float portable_object::ball_speed_ = 0.005;
-
-constexpr float field_size = 5.0f;
 constexpr float lookaround_speed = 0.001;
 constexpr float vertical_camera_top_limit = 0.7;
 constexpr float vertical_camera_bot_limit = -1;
@@ -238,16 +39,17 @@ constexpr int labyrinth_width = 11;
 
 constexpr int escape_key = 27;
 
+constexpr int simulation_rate = 60; // ticks per second
+
 
 /**
  * Global variables
  */
 
-context ctx;
 int windowid;
-std::vector<portable_object> portable_objects;
 
-bool labyrinth[labyrinth_width][labyrinth_width] = {
+// Layout used when no maze image is given, true is a path
+const bool default_labyrinth[labyrinth_width][labyrinth_width] = {
     {false, false, false, false, false, false, false, false, false, false, false},
     {true,  true,  true,  true,  true,  true,  true,  true,  false, true,  false},
     {false, false, false, false, false, false, false, true,  false, true,  false},
@@ -261,55 +63,125 @@ bool labyrinth[labyrinth_width][labyrinth_width] = {
     {false, false, false, false, false, false, false, false, false, false, false},
 };
 
+maze_grid labyrinth;
+maze_regions labyrinth_regions;
+maze_minimap minimap;
+
+/**
+ * Nodes of the furniture in the room, none of them moves so their world matrices are computed once
+ */
+struct room_furniture {
+  scene_graph::node table_base = 0;
+  scene_graph::node table_plate = 0;
+  scene_graph::node hourglass_base = 0;
+  scene_graph::node hourglass_top = 0;
+  scene_graph::node balloon = 0;
+  scene_graph::node balloon_string = 0;
+};
+
+scene_graph scene;
+room_furniture furniture;
+
+/**
+ * Input from the GLUT callbacks for the simulation
+ */
+struct input_event {
+  enum class kind {
+    key, look
+  } type;
+  unsigned char key;
+  float horizontal; // angles to look around by
+  float vertical;
+};
+
+/**
+ * What the renderer needs of one simulation tick
+ */
+struct frame_snapshot {
+  mat4 view;
+  std::vector<mat4> objects; // world matrices of the portable objects
+  int field_x;               // field the camera is on
+  int field_z;
+};
+
+/**
+ * State of the game, only the simulation thread touches it once that runs
+ */
+struct simulation_state {
+  context ctx;
+  std::vector<portable_object> portable_objects;
+  scene_graph scene; // nodes of the portable objects
+};
+
+simulation_state sim;
+spsc_queue<input_event, 256> inputs;
+triple_buffer<frame_snapshot> snapshots;
+simulation_thread simulation(simulation_rate);
+frame_alloc_monitor alloc_monitor("ueb01");
+resolution_controller resolution;
+scaled_render_target scaled_target;
+frame_capture capture;
+
 /**
  * Helper functions
  */
 
-void position_view() {
-  auto cam = ctx.cam();
-  gluLookAt(cam.x, cam.y, cam.z,
-            cam.x + ctx.lx(), cam.y + ctx.vertical_angle(), cam.z + ctx.lz(),
-            0.0f, cam.y, 0.0f);
+void position_view(const frame_snapshot &frame) {
+  glLoadMatrixf(frame.view.data());
 }
 
 /**
- * Move the camera according to the movement direction
- * @param mv which direction to move
+ * Hand the state of the simulation to the renderer
  */
-void movement(movement_direction mv) {
-  coord3d old_cam = ctx.cam();
-  switch (mv) {
-    case movement_direction::left:
-      ctx.cam() += coord3d{ctx.z(), 0, -ctx.x()};
-      break;
-    case movement_direction::right:
-      ctx.cam() += coord3d{-ctx.z(), 0, ctx.x()};
-      break;
-    case movement_direction::forward:
-      ctx.cam() += coord3d{ctx.x(), 0, ctx.z()};
-      break;
-    case movement_direction::backward:
-      ctx.cam() += coord3d{-ctx.x(), 0, -ctx.z()};
-      break;
-    case movement_direction::rotate_clockwise:
-      ctx.inc_horizontal_angle();
-      break;
-    case movement_direction::rotate_counterclockwise:
-      ctx.dec_horizontal_angle();
+void publish_snapshot() {
+  frame_snapshot &frame = snapshots.back();
+  frame.view = sim.ctx.view();
+  frame.field_x = static_cast<int>(std::floor(sim.ctx.cam().x / field_size));
+  frame.field_z = static_cast<int>(std::floor(sim.ctx.cam().z / field_size));
+  frame.objects.clear();
+  for (const auto &po : sim.portable_objects) {
+    frame.objects.push_back(sim.scene.world(po.node()));
+  }
+  snapshots.publish();
+}
+
+void apply_input(const input_event &in) {
+  switch (in.type) {
+    case input_event::kind::key:
+      if (in.key == 'f') {
+        pick_objects(sim.ctx, sim.portable_objects);
+      } else {
+        movement(sim.ctx, labyrinth, static_cast<movement_direction>(in.key));
+      }
       break;
-    case movement_direction::jump:
-      ctx.start_jump();
+    case input_event::kind::look: {
+      sim.ctx.inc_horizontal_angle_by(in.horizontal);
+      float new_vertical_angle = in.vertical + sim.ctx.vertical_angle();
+      // Limit vertical camera movement
+      if (new_vertical_angle < vertical_camera_top_limit
+          && new_vertical_angle >= vertical_camera_bot_limit) {
+        sim.ctx.inc_vertical_angle_by(in.vertical);
+      }
       break;
+    }
   }
+}
 
-  // Easy hitbox
-  int x_axis_pos = (int) (ctx.cam().x) / (int) field_size;
-  int z_axis_pos = (int) (ctx.cam().z) / (int) field_size;
-  if (!labyrinth[z_axis_pos][x_axis_pos]
-      || ctx.cam().x < 0
-      || ctx.cam().z < 0) {
-    ctx.cam() = old_cam;
+/**
+ * One step of the simulation thread: the input since the last tick, jumping and the portable objects
+ */
+void simulate() {
+  input_event in{};
+  while (inputs.pop(in)) {
+    apply_input(in);
   }
+  sim.ctx.keep_jumping();
+  for (auto &po : sim.portable_objects) {
+    po.animate(sim.ctx, sim.scene);
+  }
+  sim.scene.update();
+  remove_arrived_objects(sim.ctx, sim.portable_objects);
+  publish_snapshot();
 }
 
 /**
@@ -320,14 +192,29 @@ void reshapeFunc(int x, int y) {
   if (y == 0 || x == 0) return;  //Nothing is visible then, so return
 
   glMatrixMode(GL_PROJECTION); //Set a new projection matrix
-  glLoadIdentity();
   //Angle of view: 40 degrees
   //Near clipping plane distance: 0.5
   //Far clipping plane distance: 20.0
 
-  gluPerspective(40.0, (GLdouble) x / (GLdouble) y, 0.5, 40.0);
+  glLoadMatrixf(mat4::perspective(radians(40), (float) x / (float) y, 0.5, 40).data());
   glViewport(0, 0, x, y);  //Use the whole window for rendering
+  scaled_target.resize(x, y);
+}
 
+/**
+ * Show the resolution in the title, twice a second is enough to read it
+ */
+void show_resolution() {
+  static auto shown = std::chrono::steady_clock::now();
+  const auto now = std::chrono::steady_clock::now();
+  if (now - shown < std::chrono::milliseconds(500)) {
+    return;
+  }
+  shown = now;
+  char title[64];
+  std::snprintf(title, sizeof(title), "Labyrinth - %d %% resolution%s", static_cast<int>(resolution.scale() * 100 + 0.5f),
+                resolution.fixed() ? " (fixed)" : "");
+  glutSetWindowTitle(title);
 }
 
 void keyboard(unsigned char key, int x, int y) {
@@ -340,24 +227,15 @@ void keyboard(unsigned char key, int x, int y) {
     case 'w':
     case 's':
     case static_cast<unsigned char>(movement_direction::jump):
-      movement(static_cast<movement_direction>(key));
+    case 'f':
+      inputs.push({input_event::kind::key, key, 0, 0});
       break;
     case escape_key: // Escape key
+      simulation.stop();
+      capture.stop();
       glutDestroyWindow(windowid);
       exit(0);
       break; // Unreachable code
-    case 'f': {
-      int x_axis_pos = (int) (ctx.cam().x) / (int) field_size;
-      int z_axis_pos = (int) (ctx.cam().z) / (int) field_size;
-      for (auto &po : portable_objects) {
-        int po_x = (int) (po.location().x) / (int) field_size;
-        int po_z = (int) (po.location().z) / (int) field_size;
-        if (x_axis_pos == po_x && z_axis_pos == po_z) {
-          po.pick();
-        }
-      }
-      break;
-    }
     default:
       break;
   }
@@ -369,17 +247,10 @@ void mouse_motion(int x, int y) {
   int vertical_center = glutGet(GLUT_WINDOW_HEIGHT) / 2;
   int horizontal_center = glutGet(GLUT_WINDOW_WIDTH) / 2;
 
-  // horizontal horizontal_angle
-  ctx.inc_horizontal_angle_by(static_cast<float>(x - horizontal_center) * lookaround_speed);
-  // vertical horizontal_angle
-  float diff = -((float) y - (float) vertical_center) * lookaround_speed;
-  float new_vertical_angle = diff + ctx.vertical_angle();
-
-  // Limit vertical camera movement
-  if (new_vertical_angle < vertical_camera_top_limit
-      && new_vertical_angle >= vertical_camera_bot_limit) {
-    ctx.inc_vertical_angle_by(diff);
-  }
+  // horizontal and vertical angle, the simulation limits the vertical one
+  inputs.push({input_event::kind::look, 0,
+               static_cast<float>(x - horizontal_center) * lookaround_speed,
+               -((float) y - (float) vertical_center) * lookaround_speed});
 
   // Have to check for an area,
   // since the glutWarpPointer function will fire mouse_motion again
@@ -401,27 +272,27 @@ void render_labyrinth() {
   glColor3d(0.67, 0.67, 0.67); // Gray
   glBegin(GL_QUADS);
 
-  float total_labyrinth_width = labyrinth_width * field_size;
+  float total_labyrinth_width = static_cast<float>(labyrinth.width()) * field_size;
+  float total_labyrinth_depth = static_cast<float>(labyrinth.height()) * field_size;
 
   glVertex3d(0, 0, 0);
   glVertex3d(total_labyrinth_width, 0, 0);
-  glVertex3d(total_labyrinth_width, 0, total_labyrinth_width);
-  glVertex3d(0, 0, total_labyrinth_width);
+  glVertex3d(total_labyrinth_width, 0, total_labyrinth_depth);
+  glVertex3d(0, 0, total_labyrinth_depth);
   glEnd();
   glPopMatrix();
   // render walls
-  int z = 0;
-  for (int i = 0; i < labyrinth_width; i++) {
-    for (int j = 0; j < labyrinth_width; j++) {
-      if (!labyrinth[i][j]) {
+  for (int i = 0; i < labyrinth.height(); i++) {
+    for (int j = 0; j < labyrinth.width(); j++) {
+      if (!labyrinth.passable(j, i)) {
         glPushMatrix();
 
         // Without the offset the center and not the edge of the cube will be where I want it
         // It would be off about half the field size
         const float offset = field_size / 2;
-        glTranslatef(static_cast<float>(j) * field_size + offset,
-                     0,
-                     static_cast<float>(i) * field_size + offset);
+        glMultMatrixf(mat4::translation(static_cast<float>(j) * field_size + offset,
+                                        0,
+                                        static_cast<float>(i) * field_size + offset).data());
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
         glColor3d(0.0, 0.9, 0.0); // green
         glutSolidCube(field_size);
@@ -494,15 +365,13 @@ void render_room_table() {
   glColor3d(0.545, 0.271, 0.075); // Brown
   // Base
   glPushMatrix();
-  glTranslatef(0.5, 0.25, field_size + 0.5);
-  glRotatef(90, 1, 0, 0);
+  glMultMatrixf(scene.world(furniture.table_base).data());
   glutSolidCylinder(0.05, 0.6, 100, 100);
   glPopMatrix();
 
   // Plate
   glPushMatrix();
-  glTranslatef(0.5, 0.4, field_size + 0.5);
-  glRotatef(90, 1, 0, 0);
+  glMultMatrixf(scene.world(furniture.table_plate).data());
   glutSolidCylinder(0.4, 0.1, 100, 100);
   glPopMatrix();
 }
@@ -511,16 +380,14 @@ void render_room_hourglass() {
   // Base
   glColor3d(0.855, 0.647, 0.125);
   glPushMatrix();
-  glTranslatef(0.55, 0.4, field_size + 0.5);
-  glRotatef(-90, 1, 0, 0);
+  glMultMatrixf(scene.world(furniture.hourglass_base).data());
   glutSolidCone(0.1, 0.2, 100, 100);
   glPopMatrix();
 
   // Top
   glColor3d(0.529, 0.808, 0.980);
   glPushMatrix();
-  glTranslatef(0.55, 0.7, field_size + 0.5);
-  glRotatef(90, 1, 0, 0);
+  glMultMatrixf(scene.world(furniture.hourglass_top).data());
   glutSolidCone(0.1, 0.2, 100, 100);
   glPopMatrix();
 }
@@ -528,15 +395,14 @@ void render_room_hourglass() {
 void render_room_balloon() {
   glPushMatrix();
   glColor3d(1, 0, 0); // Red
-  glTranslatef(4, 1.5, field_size + 0.7);
-  glScalef(1, 1.2, 1);
+  glMultMatrixf(scene.world(furniture.balloon).data());
   glutSolidSphere(0.2, 100, 100);
   glPopMatrix();
 
   // String
   glPushMatrix();
   glColor3d(1, 1, 1); // White
-  glTranslatef(4, 0.4, field_size + 0.7);
+  glMultMatrixf(scene.world(furniture.balloon_string).data());
   glBegin(GL_QUAD_STRIP);
   // Wobbly line
   for (int i = 0; i < 10; i++) {
@@ -569,20 +435,20 @@ void render_room() {
 
 }
 
-void render_portable_objects() {
-  std::vector<portable_object> new_objects;
-  for (auto &po : portable_objects) {
-    po.render(ctx);
-    if (!po.is_following() ||
-        (po.location().x - ctx.cam().x >= 0.1
-         || po.location().z - ctx.cam().z >= 0.1)) {
-      new_objects.push_back(po);
-    }
+void render_portable_objects(const frame_snapshot &frame) {
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glColor3d(1, 0, 0);
+  for (const auto &world : frame.objects) {
+    glPushMatrix();
+    glMultMatrixf(world.data());
+    glutSolidCube(0.25);
+    glPopMatrix();
   }
-  portable_objects = new_objects;
 }
 
 void renderScene() {
+  alloc_monitor.begin_frame();
+  scaled_target.begin(resolution.next_frame());
   glMatrixMode(GL_MODELVIEW);
   glClear(GL_DEPTH_BUFFER_BIT);
   glClear(GL_COLOR_BUFFER_BIT);
@@ -593,42 +459,146 @@ void renderScene() {
   glDepthRange(0.0f, 1.0f);
   glClearDepth(1.0f);
 
-  ctx.keep_jumping();
-
-  glLoadIdentity();
+  // The newest tick the simulation finished, or the last one again if there is none
+  snapshots.update();
+  const frame_snapshot &frame = snapshots.front();
 
-  position_view();
+  position_view(frame);
 
   render_room();
   render_labyrinth();
-  render_portable_objects();
+  render_portable_objects(frame);
+  scaled_target.end();
+  // At the window resolution, the map stays sharp however low the scale goes
+  minimap.set_player(frame.field_x, frame.field_z);
+  minimap.draw(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+  capture.capture(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
   glutSwapBuffers();
+  show_resolution();
+  alloc_monitor.end_frame();
 }
 
+/**
+ * Place the furniture, the hourglass stands on the table
+ */
+void init_room() {
+  const auto table = scene.add(scene_graph::no_parent, mat4::translation(0.5, 0, field_size + 0.5));
+  furniture.table_base = scene.add(table, mat4::translation(0, 0.25, 0) * mat4::rotation_x(radians(90)));
+  furniture.table_plate = scene.add(table, mat4::translation(0, 0.4, 0) * mat4::rotation_x(radians(90)));
+
+  const auto hourglass = scene.add(table, mat4::translation(0.05, 0, 0));
+  furniture.hourglass_base = scene.add(hourglass, mat4::translation(0, 0.4, 0) * mat4::rotation_x(radians(-90)));
+  furniture.hourglass_top = scene.add(hourglass, mat4::translation(0, 0.7, 0) * mat4::rotation_x(radians(90)));
+
+  const auto balloon = scene.add(scene_graph::no_parent, mat4::translation(4, 0, field_size + 0.7));
+  furniture.balloon = scene.add(balloon, mat4::translation(0, 1.5, 0) * mat4::scaling(1, 1.2, 1));
+  furniture.balloon_string = scene.add(balloon, mat4::translation(0, 0.4, 0));
+  scene.update();
+}
+
+/**
+ * Scatter objects over the fields which can be reached from the camera
+ */
 void init_portable_objects() {
-  for (int i = 0; i < labyrinth_width; i++) {
-    for (int j = 0; j < labyrinth_width; j++) {
-      if (rand() % 5 == 0 && labyrinth[j, i]) {
-        portable_objects.emplace_back(coord3d{(float) j * field_size + field_size / 2,
-                                              1,
-                                              (float) i * field_size + field_size / 2});
+  const int reachable = labyrinth_regions.label_at((int) std::floor(sim.ctx.cam().x / field_size),
+                                                   (int) std::floor(sim.ctx.cam().z / field_size));
+  for (int i = 0; i < labyrinth.height(); i++) {
+    for (int j = 0; j < labyrinth.width(); j++) {
+      if (rand() % 5 == 0 && reachable >= 0 && labyrinth_regions.label_at(j, i) == reachable) {
+        sim.portable_objects.emplace_back(vec3{(float) j * field_size + field_size / 2,
+                                               1,
+                                               (float) i * field_size + field_size / 2},
+                                          sim.scene.add(scene_graph::no_parent));
+      }
+    }
+  }
+}
+
+/**
+ * Fill labyrinth from the maze image at path, or from the built in layout if path is null
+ * @param cell_size pixels of the image per field
+ * @return false if the image can't be used
+ */
+bool init_labyrinth(const char *path, int cell_size) {
+  if (path == nullptr) {
+    labyrinth = maze_grid(labyrinth_width, labyrinth_width);
+    for (int i = 0; i < labyrinth_width; i++) {
+      for (int j = 0; j < labyrinth_width; j++) {
+        labyrinth.set_passable(j, i, default_labyrinth[i][j]);
       }
     }
+    return true;
+  }
+
+  maze_import_options options;
+  options.cell_size = cell_size;
+  const auto start = std::chrono::steady_clock::now();
+  if (!import_maze(path, options, labyrinth)) {
+    return false;
   }
+  const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+  std::cout << "Imported " << path << " as " << labyrinth.width() << "x" << labyrinth.height()
+            << " fields in " << took.count() << " ms" << std::endl;
+  return true;
 }
 
+/**
+ * Place the camera in the middle of the first field of the largest region, so it isn't trapped in
+ * a pocket of the maze
+ */
+void spawn_in_labyrinth() {
+  int x;
+  int z;
+  if (labyrinth_regions.first_field(labyrinth_regions.largest(), x, z)) {
+    sim.ctx.cam().x = static_cast<float>(x) * field_size + field_size / 2;
+    sim.ctx.cam().z = static_cast<float>(z) * field_size + field_size / 2;
+  }
+}
+
+/**
+ * Usage: ueb01 [maze image [pixels per field]]
+ */
 int main(int argc, char **argv) {
   glutInit(&argc, argv);
+  if (!resolution.parse_args(argc, argv) || !capture.parse_args(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+  if (!init_labyrinth(argc > 1 ? argv[1] : nullptr, argc > 2 ? std::atoi(argv[2]) : 1)) {
+    return EXIT_FAILURE;
+  }
   glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
   srand(time(nullptr));
   glutInitWindowPosition(500, 500);
   glutInitWindowSize(800, 600);
   windowid = glutCreateWindow("Labyrinth");
+  GLenum glewStatus = glewInit();
+  if (glewStatus != GLEW_OK) {
+    std::cout << "GLEW could not be initialized: " << glewGetErrorString(glewStatus) << std::endl;
+    return EXIT_FAILURE;
+  }
+  scaled_target.init();
+  if (!capture.init()) {
+    return EXIT_FAILURE;
+  }
   glutSetCursor(GLUT_CURSOR_NONE);
 
-  ctx.cam().x = field_size / 2;
-  ctx.cam().z = field_size + field_size / 2;
+  {
+    // Only the labelling at startup is worth threads
+    thread_pool pool;
+    labyrinth_regions.label(labyrinth, &pool);
+  }
+  minimap.init(labyrinth);
+  // Inside the room, unless it lies in a pocket cut off from most of the labyrinth
+  sim.ctx.cam().x = field_size / 2;
+  sim.ctx.cam().z = field_size + field_size / 2;
+  if (labyrinth_regions.label_at(0, 1) != labyrinth_regions.largest()) {
+    spawn_in_labyrinth();
+  }
+  init_room();
   init_portable_objects();
+  // The renderer has a frame before the first tick, the thread start orders this before the ticks
+  simulate();
+  simulation.start(simulate);
 
   glutReshapeFunc(reshapeFunc);
   glutPassiveMotionFunc(mouse_motion);
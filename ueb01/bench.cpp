@@ -0,0 +1,127 @@
+//
+// CPU paths of the labyrinth: camera movement with wall collision, picking up objects and dropping
+// the ones which arrived. Times are per move or per object.
+// Usage: bench [--json path|-] [--filter text] [--samples n] [--min-sample-ms ms]
+//
+
+#include "bench.h"
+#include "game_logic.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int maze_size = 256;
+constexpr int moves_per_call = 1024;
+constexpr int object_count = 4096;
+
+/**
+ * Border of walls around fields which are open with the given probability
+ */
+maze_grid random_maze(std::mt19937 &random, double open) {
+  maze_grid grid(maze_size, maze_size);
+  std::bernoulli_distribution is_open(open);
+  for (int z = 1; z < maze_size - 1; z++) {
+    for (int x = 1; x < maze_size - 1; x++) {
+      grid.set_passable(x, z, is_open(random));
+    }
+  }
+  return grid;
+}
+
+/**
+ * Camera in the middle of the maze, on a free field
+ */
+context centred_context(maze_grid &grid) {
+  context ctx;
+  const int middle = maze_size / 2;
+  grid.set_passable(middle, middle, true);
+  ctx.cam().x = (static_cast<float>(middle) + 0.5f) * field_size;
+  ctx.cam().z = (static_cast<float>(middle) + 0.5f) * field_size;
+  return ctx;
+}
+
+std::vector<movement_direction> random_moves(std::mt19937 &random) {
+  static const movement_direction directions[] = {
+      movement_direction::forward, movement_direction::forward, movement_direction::backward,
+      movement_direction::left, movement_direction::right,
+      movement_direction::rotate_clockwise, movement_direction::rotate_counterclockwise,
+  };
+  std::uniform_int_distribution<int> pick(0, sizeof(directions) / sizeof(directions[0]) - 1);
+  std::vector<movement_direction> moves(moves_per_call);
+  for (auto &mv : moves) {
+    mv = directions[pick(random)];
+  }
+  return moves;
+}
+
+/**
+ * Objects scattered over the fields around the camera, a few on its own field
+ */
+std::vector<portable_object> scattered_objects(std::mt19937 &random, vec3 centre, scene_graph &scene) {
+  std::uniform_real_distribution<float> offset(-4 * field_size, 4 * field_size);
+  std::vector<portable_object> objects;
+  for (int i = 0; i < object_count; i++) {
+    objects.emplace_back(centre + vec3{offset(random), 0, offset(random)}, scene.add(scene_graph::no_parent));
+  }
+  return objects;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bench_suite suite("ueb01", argc, argv);
+  std::mt19937 random(1910307103);
+
+  maze_grid open_maze = random_maze(random, 0.9);
+  maze_grid dense_maze = random_maze(random, 0.5);
+  const std::vector<movement_direction> moves = random_moves(random);
+  for (auto *grid : {&open_maze, &dense_maze}) {
+    context ctx = centred_context(*grid);
+    const context start = ctx;
+    suite.run(grid == &open_maze ? "movement/open_maze" : "movement/dense_maze", moves_per_call, [&] {
+      ctx = start;
+      for (auto mv : moves) {
+        movement(ctx, *grid, mv);
+      }
+      do_not_optimize(ctx.cam());
+    });
+  }
+
+  scene_graph scene;
+  context ctx = centred_context(open_maze);
+  const std::vector<portable_object> objects = scattered_objects(random, ctx.cam(), scene);
+  // Every call starts from a copy of the objects, the copy is part of the times
+  std::vector<portable_object> working;
+  working.reserve(objects.size());
+
+  suite.run("pick_objects", object_count, [&] {
+    working = objects;
+    pick_objects(ctx, working);
+    do_not_optimize(working.data());
+  });
+
+  // Half of the objects followed the camera onto it, they are dropped and the rest is compacted
+  std::vector<portable_object> arriving = objects;
+  for (std::size_t i = 0; i < arriving.size(); i += 2) {
+    arriving[i] = portable_object(ctx.cam(), arriving[i].node());
+    arriving[i].pick();
+  }
+  suite.run("remove_arrived_objects", object_count, [&] {
+    working = arriving;
+    remove_arrived_objects(ctx, working);
+    do_not_optimize(working.data());
+  });
+
+  // Animation of the objects with the scene graph update they cause every frame
+  suite.run("animate_objects", object_count, [&] {
+    working = objects;
+    for (auto &po : working) {
+      po.animate(ctx, scene);
+    }
+    do_not_optimize(scene.update());
+  });
+
+  return suite.finish();
+}
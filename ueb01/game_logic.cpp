@@ -0,0 +1,71 @@
+//
+// Camera movement and portable objects, see game_logic.h
+//
+
+#include "game_logic.h"
+
+#include <algorithm>
+#include <cmath>
+
+// These should only be available to the context class
+const float context::turn_factor_ = 0.05;
+const float context::movement_speed_ = 0.3;
+const float context::jumping_speed_ = 0.004;
+const float context::ground_level_ = 1.5;
+const float context::max_jumping_level_ = context::ground_level_ + 1;
+
+const float portable_object::ball_speed_ = 0.005;
+
+void movement(context &ctx, const maze_grid &labyrinth, movement_direction mv) {
+  vec3 old_cam = ctx.cam();
+  const vec3 step = ctx.step();
+  switch (mv) {
+    case movement_direction::left:
+      ctx.cam() += vec3{step.z, 0, -step.x};
+      break;
+    case movement_direction::right:
+      ctx.cam() += vec3{-step.z, 0, step.x};
+      break;
+    case movement_direction::forward:
+      ctx.cam() += step;
+      break;
+    case movement_direction::backward:
+      ctx.cam() -= step;
+      break;
+    case movement_direction::rotate_clockwise:
+      ctx.inc_horizontal_angle();
+      break;
+    case movement_direction::rotate_counterclockwise:
+      ctx.dec_horizontal_angle();
+      break;
+    case movement_direction::jump:
+      ctx.start_jump();
+      break;
+  }
+
+  // Easy hitbox
+  int x_axis_pos = (int) std::floor(ctx.cam().x / field_size);
+  int z_axis_pos = (int) std::floor(ctx.cam().z / field_size);
+  if (!labyrinth.passable(x_axis_pos, z_axis_pos)) {
+    ctx.cam() = old_cam;
+  }
+}
+
+void pick_objects(context &ctx, std::vector<portable_object> &objects) {
+  int x_axis_pos = (int) (ctx.cam().x) / (int) field_size;
+  int z_axis_pos = (int) (ctx.cam().z) / (int) field_size;
+  for (auto &po : objects) {
+    int po_x = (int) (po.location().x) / (int) field_size;
+    int po_z = (int) (po.location().z) / (int) field_size;
+    if (x_axis_pos == po_x && z_axis_pos == po_z) {
+      po.pick();
+    }
+  }
+}
+
+void remove_arrived_objects(context &ctx, std::vector<portable_object> &objects) {
+  const vec3 cam = ctx.cam();
+  objects.erase(std::remove_if(objects.begin(), objects.end(), [&](const portable_object &po) {
+    return po.is_following() && po.location().x - cam.x < 0.1 && po.location().z - cam.z < 0.1;
+  }), objects.end());
+}
@@ -0,0 +1,218 @@
+//
+// Game logic of the labyrinth which doesn't touch OpenGL: the camera moving through the maze and the
+// objects it picks up. Kept apart from the rendering so it can be benchmarked without a window.
+//
+
+#ifndef UEB01_GAME_LOGIC_H
+#define UEB01_GAME_LOGIC_H
+
+#include "maze_grid.h"
+#include "scene_graph.h"
+#include "vecmath.h"
+
+#include <vector>
+
+constexpr float field_size = 5.0f;
+
+/**
+ * Enum for movement for the x and z axis
+ */
+enum class movement_direction {
+  left = 'a',
+  right = 'd',
+  forward = 'w',
+  backward = 's',
+  rotate_clockwise = 'e',
+  rotate_counterclockwise = 'q',
+  jump = 32, // Keycode for spacebar
+};
+
+/**
+ * Enum for movement on the y axis
+ */
+enum class vertical_motion {
+  standing, jumping, falling
+};
+
+/**
+ * Context for the labyrinth, with camera position
+ */
+class context {
+public:
+
+  context() {
+    this->camera_position_.y = ground_level_;
+  }
+
+  [[nodiscard]] vec3 &cam() noexcept {
+    return this->camera_position_;
+  }
+
+  /**
+   * One step along the view direction on the ground
+   */
+  vec3 step() const noexcept {
+    return this->direction_ * movement_speed_;
+  }
+
+  /**
+   * Camera matrix for the current position and angles
+   */
+  mat4 view() const noexcept {
+    const vec3 target = camera_position_ + vec3{direction_.x, vertical_angle_, direction_.z};
+    return mat4::look_at(camera_position_, target, vec3{0, 1, 0});
+  }
+
+  /**
+   * Convenience function to increase horizontal angle
+   */
+  void inc_horizontal_angle() noexcept {
+    inc_horizontal_angle_by(turn_factor_);
+  }
+
+  /**
+ * Convenience function to decrease horizontal angle
+ */
+  void dec_horizontal_angle() noexcept {
+    inc_horizontal_angle_by(-turn_factor_);
+  }
+
+  /**
+   * increase horizontal angle, the view direction only changes here so sine and cosine are taken once
+   */
+  void inc_horizontal_angle_by(const float inc) noexcept {
+    this->horizontal_angle_ = wrap_angle(this->horizontal_angle_ + inc);
+    float sin;
+    float cos;
+    fast_sincos(this->horizontal_angle_, sin, cos);
+    this->direction_ = vec3{sin, 0, -cos};
+  }
+
+  void inc_vertical_angle_by(const float inc) noexcept {
+    this->vertical_angle_ += inc;
+  }
+
+  float vertical_angle() const noexcept {
+    return this->vertical_angle_;
+  }
+
+  void start_jump() noexcept {
+    if (this->jp_state_ == vertical_motion::standing) {
+      this->jp_state_ = vertical_motion::jumping;
+    }
+  }
+
+  /**
+   * Simulate the motion of jumping for the cam
+   * Does nothing if cam is standing
+   * If called when currently jumping it will increase the height of a keep_jumping,
+   * until a certain height is reached then it will start to fall
+   * If called when currently falling the height of the keep_jumping decreases, until ground level is reached,
+   * then the jumping state will again be standing
+   */
+  void keep_jumping() noexcept {
+    switch (this->jp_state_) {
+      case vertical_motion::jumping:
+        if (this->camera_position_.y >= max_jumping_level_) {
+          this->jp_state_ = vertical_motion::falling;
+        } else {
+          this->camera_position_.y += jumping_speed_;
+        }
+        break;
+      case vertical_motion::falling:
+        if (this->camera_position_.y <= ground_level_) {
+          this->jp_state_ = vertical_motion::standing;
+          // Since sometimes a float isn't that precise ;)
+          this->camera_position_.y = ground_level_;
+        } else {
+          this->camera_position_.y -= jumping_speed_;
+        }
+        break;
+      case vertical_motion::standing:
+        break;
+    }
+  }
+
+private:
+  vec3 camera_position_;
+  vec3 direction_{0, 0, -1};
+  float horizontal_angle_ = 0;
+  float vertical_angle_ = 0;
+  vertical_motion jp_state_ = vertical_motion::standing;
+
+  static const float turn_factor_;
+  static const float movement_speed_;
+  static const float jumping_speed_;
+  static const float ground_level_;
+  static const float max_jumping_level_;
+};
+
+/**
+ * Represents an item, which can be picked up
+ */
+class portable_object {
+public:
+  /**
+   * @param node scene graph node the object moves
+   */
+  portable_object(vec3 coord, scene_graph::node node) : location_(coord), node_(node) {}
+
+  /**
+   * Spin and follow the camera, sets the local transform of the node for this frame
+   */
+  void animate(context &ctx, scene_graph &scene) {
+    move_closer_to_camera(ctx);
+    this-> angle_ = this->angle_ % 360;
+    scene.set_local(node_, mat4::translation(location_)
+                           * mat4::rotation_y(radians(static_cast<float>(this->angle_++)))
+                           * mat4::rotation_x(radians(45)));
+  }
+
+  void pick() {
+    this->follow_cam_ = true;
+  }
+
+  bool is_following() const {
+    return follow_cam_;
+  }
+
+  vec3 location() const {
+    return location_;
+  }
+
+  scene_graph::node node() const {
+    return node_;
+  }
+
+private:
+  vec3 location_;
+  scene_graph::node node_;
+  bool follow_cam_ = false;
+  int angle_ = 0;
+  static const float ball_speed_;
+
+  void move_closer_to_camera(context &ctx) {
+    if (follow_cam_) {
+      location_.x += ctx.cam().x < location_.x ? -ball_speed_ : ball_speed_;
+      location_.z += ctx.cam().z < location_.z ? -ball_speed_ : ball_speed_;
+    }
+  }
+};
+
+/**
+ * Move the camera according to the movement direction, it stays put if it would end up in a wall
+ * @param mv which direction to move
+ */
+void movement(context &ctx, const maze_grid &labyrinth, movement_direction mv);
+
+/**
+ * Pick up all objects on the field of the camera, they follow it from then on
+ */
+void pick_objects(context &ctx, std::vector<portable_object> &objects);
+
+/**
+ * Drop the objects which followed the camera all the way to it
+ */
+void remove_arrived_objects(context &ctx, std::vector<portable_object> &objects);
+
+#endif //UEB01_GAME_LOGIC_H
@@ -0,0 +1,77 @@
+//
+// Bit-packed walkability grid of a labyrinth, one bit per field.
+// Rows are padded to whole 64 bit words so a row can be scanned a word at a time.
+//
+
+#ifndef UEB01_MAZE_GRID_H
+#define UEB01_MAZE_GRID_H
+
+#include <cstdint>
+#include <vector>
+
+class maze_grid {
+public:
+  maze_grid() = default;
+
+  /**
+   * Grid with all fields being walls
+   */
+  maze_grid(int width, int height)
+      : width_(width > 0 ? width : 0), height_(height > 0 ? height : 0),
+        words_per_row_((width_ + 63) / 64),
+        bits_(static_cast<std::size_t>(words_per_row_) * static_cast<std::size_t>(height_), 0) {}
+
+  int width() const noexcept {
+    return width_;
+  }
+
+  int height() const noexcept {
+    return height_;
+  }
+
+  bool empty() const noexcept {
+    return width_ == 0 || height_ == 0;
+  }
+
+  /**
+   * @return true if the field can be walked on, everything outside the grid is a wall
+   */
+  bool passable(int x, int z) const noexcept {
+    if (x < 0 || z < 0 || x >= width_ || z >= height_) {
+      return false;
+    }
+    return (row(z)[x / 64] >> static_cast<unsigned>(x % 64) & 1u) != 0;
+  }
+
+  void set_passable(int x, int z, bool passable) noexcept {
+    if (x < 0 || z < 0 || x >= width_ || z >= height_) {
+      return;
+    }
+    const std::uint64_t bit = std::uint64_t{1} << static_cast<unsigned>(x % 64);
+    std::uint64_t &word = bits_[static_cast<std::size_t>(z) * words_per_row_ + x / 64];
+    word = passable ? word | bit : word & ~bit;
+  }
+
+  /**
+   * @return words of row z, bit x % 64 of word x / 64 is field x, the padding bits are 0
+   */
+  const std::uint64_t *row(int z) const noexcept {
+    return bits_.data() + static_cast<std::size_t>(z) * words_per_row_;
+  }
+
+  std::uint64_t *row(int z) noexcept {
+    return bits_.data() + static_cast<std::size_t>(z) * words_per_row_;
+  }
+
+  int words_per_row() const noexcept {
+    return words_per_row_;
+  }
+
+private:
+  int width_ = 0;
+  int height_ = 0;
+  int words_per_row_ = 0;
+  std::vector<std::uint64_t> bits_;
+};
+
+#endif //UEB01_MAZE_GRID_H
@@ -0,0 +1,470 @@
+//
+// Maze image import, see maze_import.h
+//
+
+#include "maze_import.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/**
+ * Bounds checked little or big endian reads of a file in memory
+ */
+class byte_reader {
+public:
+  byte_reader(const std::vector<unsigned char> &data, bool big_endian) : data_(data), big_endian_(big_endian) {}
+
+  bool has(std::size_t offset, std::size_t size) const noexcept {
+    return offset <= data_.size() && size <= data_.size() - offset;
+  }
+
+  std::uint32_t u8(std::size_t offset) const noexcept {
+    return has(offset, 1) ? data_[offset] : 0;
+  }
+
+  std::uint32_t u16(std::size_t offset) const noexcept {
+    if (!has(offset, 2)) {
+      return 0;
+    }
+    const std::uint32_t a = data_[offset];
+    const std::uint32_t b = data_[offset + 1];
+    return big_endian_ ? a << 8u | b : b << 8u | a;
+  }
+
+  std::uint32_t u32(std::size_t offset) const noexcept {
+    const std::uint32_t a = u16(offset);
+    const std::uint32_t b = u16(offset + 2);
+    return big_endian_ ? a << 16u | b : b << 16u | a;
+  }
+
+private:
+  const std::vector<unsigned char> &data_;
+  bool big_endian_;
+};
+
+inline unsigned char luma(unsigned r, unsigned g, unsigned b) noexcept {
+  return static_cast<unsigned char>((77u * r + 150u * g + 29u * b + 128u) >> 8u);
+}
+
+bool read_file(const std::string &path, std::vector<unsigned char> &data) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::cout << "Can't open " << path << std::endl;
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+}
+
+bool load_bmp(const std::vector<unsigned char> &data, gray_image &image) {
+  const byte_reader in(data, false);
+  const std::size_t pixel_offset = in.u32(10);
+  const std::size_t header_size = in.u32(14);
+  const auto width = static_cast<std::int32_t>(in.u32(18));
+  const auto height = static_cast<std::int32_t>(in.u32(22));
+  const std::uint32_t bits = in.u16(28);
+  const std::uint32_t compression = in.u32(30);
+  // Bit fields of 32 bit images are assumed to be the usual BGRA order
+  if (width <= 0 || height == 0 || (compression != 0 && !(compression == 3 && bits == 32))
+      || (bits != 1 && bits != 8 && bits != 24 && bits != 32)) {
+    std::cout << "Unsupported BMP: " << bits << " bit, compression " << compression << std::endl;
+    return false;
+  }
+  const bool bottom_up = height > 0;
+  const int rows = bottom_up ? height : -height;
+  const std::size_t stride = (static_cast<std::size_t>(width) * bits + 31) / 32 * 4;
+  if (!in.has(pixel_offset, stride * rows)) {
+    std::cout << "BMP is truncated" << std::endl;
+    return false;
+  }
+
+  // Palette entries are BGR plus a reserved byte
+  unsigned char palette[256] = {};
+  if (bits <= 8) {
+    const std::size_t colors = in.u32(46) != 0 ? std::min<std::size_t>(in.u32(46), 256) : 1u << bits;
+    for (std::size_t i = 0; i < colors; i++) {
+      const std::size_t entry = 14 + header_size + i * 4;
+      palette[i] = luma(in.u8(entry + 2), in.u8(entry + 1), in.u8(entry));
+    }
+  }
+
+  image.width = width;
+  image.height = rows;
+  image.pixels.resize(static_cast<std::size_t>(width) * rows);
+  for (int y = 0; y < rows; y++) {
+    const unsigned char *src = data.data() + pixel_offset + stride * (bottom_up ? rows - 1 - y : y);
+    unsigned char *dst = image.pixels.data() + static_cast<std::size_t>(y) * width;
+    for (int x = 0; x < width; x++) {
+      switch (bits) {
+        case 1:
+          dst[x] = palette[src[x / 8] >> (7 - x % 8) & 1];
+          break;
+        case 8:
+          dst[x] = palette[src[x]];
+          break;
+        default: {
+          const unsigned char *p = src + x * (bits / 8);
+          dst[x] = luma(p[2], p[1], p[0]);
+          break;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Skip whitespace and comments in a PGM header
+ */
+std::size_t skip_pgm_space(const std::vector<unsigned char> &data, std::size_t pos) {
+  while (pos < data.size()) {
+    if (data[pos] == '#') {
+      while (pos < data.size() && data[pos] != '\n') {
+        pos++;
+      }
+    } else if (std::isspace(data[pos])) {
+      pos++;
+    } else {
+      break;
+    }
+  }
+  return pos;
+}
+
+bool read_pgm_number(const std::vector<unsigned char> &data, std::size_t &pos, int &value) {
+  pos = skip_pgm_space(data, pos);
+  if (pos >= data.size() || !std::isdigit(data[pos])) {
+    return false;
+  }
+  value = 0;
+  while (pos < data.size() && std::isdigit(data[pos]) && value < 1000000) {
+    value = value * 10 + (data[pos++] - '0');
+  }
+  return true;
+}
+
+bool load_pgm(const std::vector<unsigned char> &data, gray_image &image) {
+  const bool ascii = data[1] == '2';
+  std::size_t pos = 2;
+  int width;
+  int height;
+  int max_value;
+  if (!read_pgm_number(data, pos, width) || !read_pgm_number(data, pos, height)
+      || !read_pgm_number(data, pos, max_value) || width <= 0 || height <= 0 || max_value <= 0
+      || max_value > 65535) {
+    std::cout << "Invalid PGM header" << std::endl;
+    return false;
+  }
+  const std::size_t count = static_cast<std::size_t>(width) * height;
+  image.width = width;
+  image.height = height;
+  image.pixels.resize(count);
+
+  if (ascii) {
+    for (std::size_t i = 0; i < count; i++) {
+      int value;
+      if (!read_pgm_number(data, pos, value)) {
+        std::cout << "PGM is truncated" << std::endl;
+        return false;
+      }
+      image.pixels[i] = static_cast<unsigned char>(std::min(value, max_value) * 255 / max_value);
+    }
+    return true;
+  }
+
+  // A single whitespace separates the header from the samples, 16 bit samples are big endian
+  pos++;
+  const std::size_t sample_size = max_value > 255 ? 2 : 1;
+  if (pos > data.size() || data.size() - pos < count * sample_size) {
+    std::cout << "PGM is truncated" << std::endl;
+    return false;
+  }
+  for (std::size_t i = 0; i < count; i++) {
+    const unsigned value = sample_size == 2 ? data[pos + 2 * i] << 8u | data[pos + 2 * i + 1] : data[pos + i];
+    image.pixels[i] = static_cast<unsigned char>(std::min<unsigned>(value, max_value) * 255u / max_value);
+  }
+  return true;
+}
+
+/**
+ * First image of an uncompressed TIFF in chunky pixel order
+ */
+bool load_tiff(const std::vector<unsigned char> &data, gray_image &image) {
+  const byte_reader in(data, data[0] == 'M');
+  const std::size_t ifd = in.u32(4);
+  const std::uint32_t entries = in.u16(ifd);
+  if (!in.has(ifd + 2, entries * 12u)) {
+    std::cout << "TIFF directory is truncated" << std::endl;
+    return false;
+  }
+
+  // Values fit into the entry if they take up to four bytes, else the entry holds their offset
+  const auto value = [&](std::size_t entry, std::uint32_t index) -> std::uint32_t {
+    const std::uint32_t type = in.u16(entry + 2);
+    const std::uint32_t count = in.u32(entry + 4);
+    const std::uint32_t size = type == 3 ? 2 : type == 4 ? 4 : 1;
+    if (index >= count) {
+      return 0;
+    }
+    const std::size_t base = count * size <= 4 ? entry + 8 : in.u32(entry + 8);
+    return size == 2 ? in.u16(base + index * 2) : size == 4 ? in.u32(base + index * 4) : in.u8(base + index);
+  };
+
+  std::uint32_t width = 0;
+  std::uint32_t height = 0;
+  std::uint32_t bits = 1;
+  std::uint32_t compression = 1;
+  std::uint32_t photometric = 1;
+  std::uint32_t samples = 1;
+  std::uint32_t rows_per_strip = 0xFFFFFFFFu;
+  std::uint32_t planar = 1;
+  std::size_t offsets_entry = 0;
+  std::uint32_t strips = 0;
+  for (std::uint32_t i = 0; i < entries; i++) {
+    const std::size_t entry = ifd + 2 + i * 12;
+    switch (in.u16(entry)) {
+      case 256: width = value(entry, 0); break;
+      case 257: height = value(entry, 0); break;
+      case 258: bits = value(entry, 0); break;
+      case 259: compression = value(entry, 0); break;
+      case 262: photometric = value(entry, 0); break;
+      case 273:
+        offsets_entry = entry;
+        strips = in.u32(entry + 4);
+        break;
+      case 277: samples = value(entry, 0); break;
+      case 278: rows_per_strip = value(entry, 0); break;
+      case 284: planar = value(entry, 0); break;
+      default: break;
+    }
+  }
+  const bool gray = photometric <= 1 && samples == 1 && (bits == 1 || bits == 8);
+  const bool rgb = photometric == 2 && (samples == 3 || samples == 4) && bits == 8 && planar == 1;
+  if (width == 0 || height == 0 || width > 65536 || height > 65536 || compression != 1 || (!gray && !rgb)
+      || strips == 0) {
+    std::cout << "Unsupported TIFF: " << bits << " bit, " << samples << " samples, compression " << compression
+              << ", photometric " << photometric << std::endl;
+    return false;
+  }
+
+  const std::size_t stride = (static_cast<std::size_t>(width) * bits * samples + 7) / 8;
+  // Zero is out of spec, also from a count of zero, and read as one strip like the missing tag
+  rows_per_strip = rows_per_strip == 0 ? height : std::min(rows_per_strip, height);
+  image.width = static_cast<int>(width);
+  image.height = static_cast<int>(height);
+  image.pixels.resize(static_cast<std::size_t>(width) * height);
+  for (std::uint32_t y = 0; y < height; y++) {
+    const std::uint32_t strip = y / rows_per_strip;
+    if (strip >= strips) {
+      std::cout << "TIFF has too few strips" << std::endl;
+      return false;
+    }
+    const std::size_t offset = value(offsets_entry, strip) + (y % rows_per_strip) * stride;
+    if (!in.has(offset, stride)) {
+      std::cout << "TIFF is truncated" << std::endl;
+      return false;
+    }
+    const unsigned char *src = data.data() + offset;
+    unsigned char *dst = image.pixels.data() + static_cast<std::size_t>(y) * width;
+    for (std::uint32_t x = 0; x < width; x++) {
+      if (rgb) {
+        const unsigned char *p = src + x * samples;
+        dst[x] = luma(p[0], p[1], p[2]);
+      } else if (bits == 1) {
+        dst[x] = (src[x / 8] >> (7 - x % 8) & 1u) != 0 ? 255 : 0;
+      } else {
+        dst[x] = src[x];
+      }
+      if (photometric == 0) {
+        dst[x] = static_cast<unsigned char>(255 - dst[x]); // white is zero
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Set bit x of words for every pixel of row that is dark, i.e. at most threshold
+ */
+void dark_bits(const unsigned char *row, int width, unsigned char threshold, std::uint64_t *words) {
+  int x = 0;
+#if defined(__SSE2__)
+  // Sixteen pixels per compare, their byte mask packs straight into bits
+  const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold));
+  for (; x + 64 <= width; x += 64) {
+    std::uint64_t word = 0;
+    for (int i = 0; i < 4; i++) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x + i * 16));
+      // Unsigned v <= limit is max(v, limit) == limit
+      const __m128i dark = _mm_cmpeq_epi8(_mm_max_epu8(v, limit), limit);
+      word |= static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm_movemask_epi8(dark))) << (i * 16);
+    }
+    words[x / 64] = word;
+  }
+#endif
+  for (; x < width; x += 64) {
+    std::uint64_t word = 0;
+    for (int i = 0; i < 64 && x + i < width; i++) {
+      word |= static_cast<std::uint64_t>(row[x + i] <= threshold) << i;
+    }
+    words[x / 64] = word;
+  }
+}
+
+/**
+ * @return number of set bits in [begin, end) of words
+ */
+int count_bits(const std::uint64_t *words, int begin, int end) noexcept {
+  int count = 0;
+  const int first = begin / 64;
+  const int last = (end - 1) / 64;
+  for (int w = first; w <= last; w++) {
+    std::uint64_t word = words[w];
+    if (w == first) {
+      word &= ~std::uint64_t{0} << static_cast<unsigned>(begin % 64);
+    }
+    if (w == last && end % 64 != 0) {
+      word &= (std::uint64_t{1} << static_cast<unsigned>(end % 64)) - 1;
+    }
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
+
+} // namespace
+
+bool load_gray_image(const std::string &path, gray_image &image) {
+  std::vector<unsigned char> data;
+  if (!read_file(path, data)) {
+    return false;
+  }
+  if (data.size() >= 54 && data[0] == 'B' && data[1] == 'M') {
+    return load_bmp(data, image);
+  }
+  if (data.size() >= 3 && data[0] == 'P' && (data[1] == '2' || data[1] == '5')) {
+    return load_pgm(data, image);
+  }
+  if (data.size() >= 8 && ((data[0] == 'I' && data[1] == 'I' && data[2] == 42 && data[3] == 0)
+                           || (data[0] == 'M' && data[1] == 'M' && data[2] == 0 && data[3] == 42))) {
+    return load_tiff(data, image);
+  }
+  std::cout << path << " is neither a BMP, PGM nor TIFF file" << std::endl;
+  return false;
+}
+
+int otsu_threshold(const gray_image &image) {
+  // Four histograms, so consecutive equal pixels don't wait on each other's increment
+  std::uint32_t histograms[4][256] = {};
+  const std::size_t count = image.pixels.size();
+  const unsigned char *p = image.pixels.data();
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    histograms[0][p[i]]++;
+    histograms[1][p[i + 1]]++;
+    histograms[2][p[i + 2]]++;
+    histograms[3][p[i + 3]]++;
+  }
+  for (; i < count; i++) {
+    histograms[0][p[i]]++;
+  }
+
+  double total_sum = 0;
+  double histogram[256];
+  for (int level = 0; level < 256; level++) {
+    histogram[level] = histograms[0][level] + histograms[1][level] + histograms[2][level] + histograms[3][level];
+    total_sum += level * histogram[level];
+  }
+
+  // Maximise the variance between the classes [0, t] and (t, 255]
+  const double total = static_cast<double>(count);
+  double dark_count = 0;
+  double dark_sum = 0;
+  double best_variance = -1;
+  int best = 127;
+  for (int t = 0; t < 255; t++) {
+    dark_count += histogram[t];
+    dark_sum += t * histogram[t];
+    const double light_count = total - dark_count;
+    if (dark_count == 0 || light_count == 0) {
+      continue;
+    }
+    const double difference = dark_sum / dark_count - (total_sum - dark_sum) / light_count;
+    const double variance = dark_count * light_count * difference * difference;
+    if (variance > best_variance) {
+      best_variance = variance;
+      best = t;
+    }
+  }
+  return best;
+}
+
+bool import_maze(const gray_image &image, const maze_import_options &options, maze_grid &grid) {
+  if (image.width <= 0 || image.height <= 0) {
+    std::cout << "Can't build a labyrinth from an empty image" << std::endl;
+    return false;
+  }
+  const int threshold = options.threshold >= 0 ? std::min(options.threshold, 255) : otsu_threshold(image);
+  const int cell = std::max(options.cell_size, 1);
+  const int words = (image.width + 63) / 64;
+  const std::uint64_t last_word_mask = image.width % 64 == 0 ? ~std::uint64_t{0}
+                                                             : (std::uint64_t{1} << (image.width % 64u)) - 1;
+
+  // One bit per pixel which belongs to a wall
+  std::vector<std::uint64_t> walls(static_cast<std::size_t>(words) * image.height);
+  for (int y = 0; y < image.height; y++) {
+    std::uint64_t *row = walls.data() + static_cast<std::size_t>(y) * words;
+    dark_bits(image.pixels.data() + static_cast<std::size_t>(y) * image.width, image.width,
+              static_cast<unsigned char>(threshold), row);
+    if (!options.dark_walls) {
+      for (int w = 0; w < words; w++) {
+        row[w] = ~row[w];
+      }
+      row[words - 1] &= last_word_mask;
+    }
+  }
+
+  grid = maze_grid((image.width + cell - 1) / cell, (image.height + cell - 1) / cell);
+  if (cell == 1) {
+    // Fields are pixels, paths are the inverted wall bits
+    for (int z = 0; z < grid.height(); z++) {
+      const std::uint64_t *src = walls.data() + static_cast<std::size_t>(z) * words;
+      std::uint64_t *dst = grid.row(z);
+      for (int w = 0; w < words; w++) {
+        dst[w] = ~src[w];
+      }
+      dst[words - 1] &= last_word_mask;
+    }
+    return true;
+  }
+
+  for (int z = 0; z < grid.height(); z++) {
+    const int y0 = z * cell;
+    const int y1 = std::min(y0 + cell, image.height);
+    for (int x = 0; x < grid.width(); x++) {
+      const int x0 = x * cell;
+      const int x1 = std::min(x0 + cell, image.width);
+      int wall_pixels = 0;
+      for (int y = y0; y < y1; y++) {
+        wall_pixels += count_bits(walls.data() + static_cast<std::size_t>(y) * words, x0, x1);
+      }
+      const float area = static_cast<float>((x1 - x0) * (y1 - y0));
+      grid.set_passable(x, z, static_cast<float>(wall_pixels) <= options.wall_coverage * area);
+    }
+  }
+  return true;
+}
+
+bool import_maze(const std::string &path, const maze_import_options &options, maze_grid &grid) {
+  gray_image image;
+  return load_gray_image(path, image) && import_maze(image, options, grid);
+}
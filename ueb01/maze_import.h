@@ -0,0 +1,55 @@
+//
+// Import of labyrinths from maze images like the ones in imageprocessing/cgb4_imageJ/cgb4/img.
+// The image is converted to grey, split into walls and paths by a fixed or Otsu threshold and
+// reduced to one field per block of pixels.
+//
+
+#ifndef UEB01_MAZE_IMPORT_H
+#define UEB01_MAZE_IMPORT_H
+
+#include "maze_grid.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * 8 bit grey image, rows top to bottom without padding
+ */
+struct gray_image {
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels;
+};
+
+/**
+ * Load an uncompressed BMP (1, 8, 24 or 32 bit), a binary or ASCII PGM or an uncompressed TIFF
+ * (1 or 8 bit grey, 8 bit RGB), the format is told by the first bytes of the file
+ * @return false if the file can't be read or has an unsupported format
+ */
+bool load_gray_image(const std::string &path, gray_image &image);
+
+/**
+ * @return grey level which separates the histogram of image best into two classes (Otsu),
+ *         levels up to and including it form the dark class
+ */
+int otsu_threshold(const gray_image &image);
+
+struct maze_import_options {
+  int threshold = -1;        // grey levels up to this one are dark, -1 picks one with Otsu's method
+  bool dark_walls = true;    // walls are the dark pixels, false for light walls on a dark background
+  int cell_size = 1;         // pixels per field along each axis
+  float wall_coverage = 0;   // a field becomes a wall once more than this fraction of its pixels are walls
+};
+
+/**
+ * Build a labyrinth from image, rows of the image become rows along z
+ * @return false if the image is empty
+ */
+bool import_maze(const gray_image &image, const maze_import_options &options, maze_grid &grid);
+
+/**
+ * Load and import a maze image
+ */
+bool import_maze(const std::string &path, const maze_import_options &options, maze_grid &grid);
+
+#endif //UEB01_MAZE_IMPORT_H
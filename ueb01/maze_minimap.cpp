@@ -0,0 +1,205 @@
+//
+// Overview map texture of a labyrinth, see maze_minimap.h
+//
+
+#include "maze_minimap.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// RGBA, packed for GL_UNSIGNED_INT_8_8_8_8 so the byte order doesn't matter
+constexpr GLuint wall_colour = 0x303848ffu;
+constexpr GLuint floor_colour = 0xd8d0b8ffu;
+constexpr GLfloat player_colour[] = {0.88f, 0.125f, 0.125f};
+
+constexpr float map_fraction = 0.3f; // of the smaller side of the window
+constexpr float map_margin = 10;      // pixels
+constexpr float player_min_size = 5;  // pixels, the marker is bigger where fields are
+
+inline int level_size(int size, int level) noexcept {
+  return std::max(size >> level, 1);
+}
+
+/**
+ * Texels [first, last) of the level below which texel i of a level with size texels covers, the last one
+ * takes the odd texel below as well
+ */
+inline void children(int i, int size, int below, int &first, int &last) noexcept {
+  first = 2 * i;
+  last = i == size - 1 ? below : first + 2;
+}
+
+} // namespace
+
+maze_minimap::~maze_minimap() {
+  if (texture_ != 0) {
+    glDeleteTextures(1, &texture_);
+  }
+}
+
+bool maze_minimap::init(const maze_grid &grid) {
+  grid_ = &grid;
+  player_x_ = -1;
+  player_z_ = -1;
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  if (grid.empty() || grid.width() > max_size || grid.height() > max_size) {
+    std::cout << "No minimap for a labyrinth of " << grid.width() << "x" << grid.height() << " fields" << std::endl;
+    grid_ = nullptr;
+    return false;
+  }
+
+  // Row z of the texture is row z of the grid, a word of the grid at a time
+  const int width = grid.width();
+  const int height = grid.height();
+  int levels = 1;
+  while (level_size(width, levels - 1) > 1 || level_size(height, levels - 1) > 1) {
+    levels++;
+  }
+  levels_.resize(static_cast<std::size_t>(levels));
+  levels_[0].resize(static_cast<std::size_t>(width) * static_cast<std::size_t>(height));
+  for (int z = 0; z < height; z++) {
+    const std::uint64_t *words = grid.row(z);
+    GLuint *row = levels_[0].data() + static_cast<std::size_t>(z) * static_cast<std::size_t>(width);
+    for (int x = 0; x < width; x++) {
+      row[x] = (words[x / 64] >> static_cast<unsigned>(x % 64) & 1u) != 0 ? floor_colour : wall_colour;
+    }
+  }
+  for (int level = 1; level < levels; level++) {
+    const int w = level_size(width, level);
+    const int h = level_size(height, level);
+    levels_[level].resize(static_cast<std::size_t>(w) * static_cast<std::size_t>(h));
+    for (int z = 0; z < h; z++) {
+      for (int x = 0; x < w; x++) {
+        reduce(level, x, z);
+      }
+    }
+  }
+
+  if (texture_ == 0) {
+    glGenTextures(1, &texture_);
+  }
+  glBindTexture(GL_TEXTURE_2D, texture_);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  for (int level = 0; level < levels; level++) {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, level_size(width, level), level_size(height, level), 0, GL_RGBA,
+                 GL_UNSIGNED_INT_8_8_8_8, levels_[level].data());
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return true;
+}
+
+void maze_minimap::update_field(int x, int z) {
+  if (grid_ == nullptr || x < 0 || z < 0 || x >= grid_->width() || z >= grid_->height()) {
+    return;
+  }
+  levels_[0][static_cast<std::size_t>(z) * static_cast<std::size_t>(grid_->width()) + x] =
+      grid_->passable(x, z) ? floor_colour : wall_colour;
+  glBindTexture(GL_TEXTURE_2D, texture_);
+  for (int level = 0; level < static_cast<int>(levels_.size()); level++) {
+    const int width = level_size(grid_->width(), level);
+    if (level > 0) {
+      x = std::min(x / 2, width - 1);
+      z = std::min(z / 2, level_size(grid_->height(), level) - 1);
+      reduce(level, x, z);
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, level, x, z, 1, 1, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
+                    &levels_[level][static_cast<std::size_t>(z) * static_cast<std::size_t>(width) + x]);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void maze_minimap::reduce(int level, int x, int z) {
+  const int width = level_size(grid_->width(), level);
+  const int below_width = level_size(grid_->width(), level - 1);
+  int x0;
+  int x1;
+  int z0;
+  int z1;
+  children(x, width, below_width, x0, x1);
+  children(z, level_size(grid_->height(), level), level_size(grid_->height(), level - 1), z0, z1);
+  const std::vector<GLuint> &below = levels_[level - 1];
+  unsigned sums[4] = {};
+  for (int cz = z0; cz < z1; cz++) {
+    for (int cx = x0; cx < x1; cx++) {
+      const GLuint texel = below[static_cast<std::size_t>(cz) * static_cast<std::size_t>(below_width) + cx];
+      for (unsigned c = 0; c < 4; c++) {
+        sums[c] += texel >> (24u - 8u * c) & 0xffu;
+      }
+    }
+  }
+  const auto count = static_cast<unsigned>((x1 - x0) * (z1 - z0));
+  GLuint texel = 0;
+  for (unsigned c = 0; c < 4; c++) {
+    texel |= (sums[c] + count / 2) / count << (24u - 8u * c);
+  }
+  levels_[level][static_cast<std::size_t>(z) * static_cast<std::size_t>(width) + x] = texel;
+}
+
+void maze_minimap::draw(int window_width, int window_height) const {
+  if (grid_ == nullptr) {
+    return;
+  }
+  // The longer side of the labyrinth gets the whole size, fields stay square
+  const float size = map_fraction * static_cast<float>(std::min(window_width, window_height));
+  const float longer = static_cast<float>(std::max(grid_->width(), grid_->height()));
+  const float width = size * static_cast<float>(grid_->width()) / longer;
+  const float height = size * static_cast<float>(grid_->height()) / longer;
+  const float right = static_cast<float>(window_width) - map_margin;
+  const float top = static_cast<float>(window_height) - map_margin;
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_FOG);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_BLEND);
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, texture_);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, window_width, 0, window_height, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  // Row 0 of the labyrinth at the top
+  glBegin(GL_QUADS);
+  glTexCoord2f(0, 1);
+  glVertex2f(right - width, top - height);
+  glTexCoord2f(1, 1);
+  glVertex2f(right, top - height);
+  glTexCoord2f(1, 0);
+  glVertex2f(right, top);
+  glTexCoord2f(0, 0);
+  glVertex2f(right - width, top);
+  glEnd();
+
+  // The player's field, centred on it
+  if (player_x_ >= 0 && player_z_ >= 0 && player_x_ < grid_->width() && player_z_ < grid_->height()) {
+    const float field = width / static_cast<float>(grid_->width());
+    const float half = std::max(field, player_min_size) / 2;
+    const float x = right - width + (static_cast<float>(player_x_) + 0.5f) * field;
+    const float y = top - (static_cast<float>(player_z_) + 0.5f) * field;
+    glDisable(GL_TEXTURE_2D);
+    glColor3fv(player_colour);
+    glRectf(x - half, y - half, x + half, y + half);
+  }
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPopAttrib();
+}
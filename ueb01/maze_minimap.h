@@ -0,0 +1,66 @@
+//
+// Overview map of a labyrinth in a corner of the window.
+// The map is a texture with one texel per field, filled once from the grid. Below it is a mip chain of
+// 2x2 averages, so a labyrinth with more fields than the map has pixels shows thin corridors as lighter
+// lines instead of dropping them and flickering while the window is resized. Afterwards only a field
+// whose wall is built or torn down is uploaded again, with the one texel above it on every level.
+// The player is a quad of its own over the map, at least a few pixels big. Drawing is those two quads,
+// so a frame costs the same however big the labyrinth is.
+//
+
+#ifndef UEB01_MAZE_MINIMAP_H
+#define UEB01_MAZE_MINIMAP_H
+
+#include "GL/glew.h"
+#include "maze_grid.h"
+
+#include <vector>
+
+class maze_minimap {
+public:
+  maze_minimap() = default;
+
+  ~maze_minimap();
+
+  maze_minimap(const maze_minimap &) = delete;
+
+  maze_minimap &operator=(const maze_minimap &) = delete;
+
+  /**
+   * Fill the map from the grid, needs the GL context
+   * @return false if the labyrinth is too big for a texture, there is no map then
+   */
+  bool init(const maze_grid &grid);
+
+  /**
+   * Mark the field the player stands on, outside the grid there is no marker
+   */
+  void set_player(int x, int z) noexcept {
+    player_x_ = x;
+    player_z_ = z;
+  }
+
+  /**
+   * Upload a field again after its wall changed in the grid
+   */
+  void update_field(int x, int z);
+
+  /**
+   * Draw the map into the upper right corner, keeps the GL state
+   */
+  void draw(int window_width, int window_height) const;
+
+private:
+  const maze_grid *grid_ = nullptr;
+  GLuint texture_ = 0;
+  int player_x_ = -1;
+  int player_z_ = -1;
+  std::vector<std::vector<GLuint>> levels_; // RGBA texels of the mip levels, level 0 is the grid
+
+  /**
+   * Average the texel of level from the ones below it
+   */
+  void reduce(int level, int x, int z);
+};
+
+#endif //UEB01_MAZE_MINIMAP_H
@@ -0,0 +1,252 @@
+//
+// Union-find labelling of labyrinth regions, see maze_regions.h
+//
+
+#include "maze_regions.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+
+// Fewer rows per band aren't worth a thread
+constexpr int min_band_rows = 64;
+
+/**
+ * Horizontal stretch [x0, x1) of walkable fields in one row
+ */
+struct field_run {
+  int x0;
+  int x1;
+  int parent; // union-find parent among the runs of the band
+  int root;   // number of the band root, only set at roots
+};
+
+/**
+ * Runs of a band of rows, labelled on their own
+ */
+struct band_runs {
+  std::vector<field_run> runs;
+  std::vector<int> row_begin;  // first run of each row, plus the end of the last row
+  std::vector<int> root_sizes; // fields per band root
+};
+
+/**
+ * @return first x >= from whose bit equals set, width if there is none
+ */
+inline int next_bit(const std::uint64_t *row, int width, int from, bool set) noexcept {
+  if (from >= width) {
+    return width;
+  }
+  const std::uint64_t flip = set ? 0 : ~std::uint64_t{0};
+  const int words = (width + 63) / 64;
+  int w = from / 64;
+  std::uint64_t word = (row[w] ^ flip) & ~std::uint64_t{0} << static_cast<unsigned>(from % 64);
+  while (word == 0) {
+    if (++w == words) {
+      return width;
+    }
+    word = row[w] ^ flip;
+  }
+  return std::min(w * 64 + __builtin_ctzll(word), width);
+}
+
+/**
+ * @return root of the tree of i, halving the path on the way
+ */
+template<typename Parent>
+int find(Parent parent, int i) noexcept {
+  while (parent(i) != i) {
+    parent(i) = parent(parent(i));
+    i = parent(i);
+  }
+  return i;
+}
+
+/**
+ * Join the trees of a and b, the smaller index becomes the root so every root is the first element of
+ * its tree
+ */
+template<typename Parent>
+void unite(Parent parent, int a, int b) noexcept {
+  a = find(parent, a);
+  b = find(parent, b);
+  if (a < b) {
+    parent(b) = a;
+  } else if (b < a) {
+    parent(a) = b;
+  }
+}
+
+/**
+ * Call join(a, b) for every pair of runs from the sorted lists [a, a_end) and [b, b_end) which
+ * share a column
+ */
+template<typename Join>
+void join_overlapping(const field_run *runs, int a, int a_end, int b, int b_end, Join join) {
+  for (; b < b_end; b++) {
+    while (a < a_end && runs[a].x1 <= runs[b].x0) {
+      a++;
+    }
+    // The last overlapping run may reach under the next run of b as well, so a stays on it
+    for (int i = a; i < a_end && runs[i].x0 < runs[b].x1; i++) {
+      join(i, b);
+    }
+  }
+}
+
+/**
+ * Collect the runs of rows [first, last) and label them.
+ * Afterwards every run points straight to its band root, roots are numbered in order.
+ */
+void label_band(const maze_grid &grid, int first, int last, band_runs &band) {
+  const int width = grid.width();
+  auto &runs = band.runs;
+  const auto parent = [&](int i) -> int & {
+    return runs[i].parent;
+  };
+
+  for (int z = first; z < last; z++) {
+    const int begin = static_cast<int>(runs.size());
+    band.row_begin.push_back(begin);
+    const std::uint64_t *row = grid.row(z);
+    for (int x = next_bit(row, width, 0, true); x < width;) {
+      const int end = next_bit(row, width, x, false);
+      runs.push_back(field_run{x, end, static_cast<int>(runs.size()), -1});
+      x = next_bit(row, width, end, true);
+    }
+    if (z > first) {
+      const int above = band.row_begin[band.row_begin.size() - 2];
+      join_overlapping(runs.data(), above, begin, begin, static_cast<int>(runs.size()), [&](int a, int b) {
+        unite(parent, a, b);
+      });
+    }
+  }
+  band.row_begin.push_back(static_cast<int>(runs.size()));
+
+  // A root precedes the other runs of its tree
+  for (int i = 0; i < static_cast<int>(runs.size()); i++) {
+    const int root = find(parent, i);
+    runs[i].parent = root;
+    if (root == i) {
+      runs[i].root = static_cast<int>(band.root_sizes.size());
+      band.root_sizes.push_back(0);
+    }
+    band.root_sizes[runs[root].root] += runs[i].x1 - runs[i].x0;
+  }
+}
+
+} // namespace
+
+void maze_regions::label(const maze_grid &grid, thread_pool *pool) {
+  width_ = grid.width();
+  height_ = grid.height();
+  labels_.resize(static_cast<std::size_t>(width_) * height_);
+  sizes_.clear();
+  if (labels_.empty()) {
+    return;
+  }
+
+  // Every band adds a border to merge, so there are no more than the workers and the calling thread
+  const int threads = pool == nullptr ? 1 : static_cast<int>(pool->size()) + 1;
+  const int bands = std::max(std::min(threads, height_ / min_band_rows), 1);
+  const auto band_begin = [&](int band) {
+    return static_cast<int>(static_cast<long long>(height_) * band / bands);
+  };
+  const auto run = [&](const auto &body) {
+    parallel_for(pool, 0, bands, 1, [&](int first, int last) {
+      for (int band = first; band < last; band++) {
+        body(band);
+      }
+    });
+  };
+
+  std::vector<band_runs> band_data(static_cast<std::size_t>(bands));
+  run([&](int band) {
+    label_band(grid, band_begin(band), band_begin(band + 1), band_data[band]);
+  });
+
+  // One forest over the band roots of all bands, numbered band by band so again the smallest number
+  // of a tree belongs to its first field
+  std::vector<int> root_offsets(static_cast<std::size_t>(bands) + 1, 0);
+  for (int band = 0; band < bands; band++) {
+    root_offsets[band + 1] = root_offsets[band] + static_cast<int>(band_data[band].root_sizes.size());
+  }
+  std::vector<int> roots(static_cast<std::size_t>(root_offsets[bands]));
+  for (int i = 0; i < root_offsets[bands]; i++) {
+    roots[i] = i;
+  }
+  const auto root_parent = [&](int i) -> int & {
+    return roots[i];
+  };
+  const auto root_of = [&](int band, int i) {
+    const auto &runs = band_data[band].runs;
+    return root_offsets[band] + runs[runs[i].parent].root;
+  };
+
+  // Join the trees across the band borders, the number of unions is bounded by the width times the
+  // number of bands
+  for (int band = 1; band < bands; band++) {
+    const band_runs &upper = band_data[band - 1];
+    const band_runs &lower = band_data[band];
+    const int upper_first = upper.row_begin[upper.row_begin.size() - 2];
+    std::vector<field_run> border(upper.runs.begin() + upper_first, upper.runs.end());
+    const int upper_count = static_cast<int>(border.size());
+    border.insert(border.end(), lower.runs.begin(), lower.runs.begin() + lower.row_begin[1]);
+    join_overlapping(border.data(), 0, upper_count, upper_count, static_cast<int>(border.size()),
+                     [&](int a, int b) {
+                       unite(root_parent, root_of(band - 1, upper_first + a), root_of(band, b - upper_count));
+                     });
+  }
+
+  // Number the regions by their first field. Parents have smaller numbers, so one pass in order points
+  // every band root straight to its global root, which carries its label by then.
+  std::vector<int> root_labels(roots.size());
+  for (int band = 0; band < bands; band++) {
+    const std::vector<int> &root_sizes = band_data[band].root_sizes;
+    for (int i = 0; i < static_cast<int>(root_sizes.size()); i++) {
+      const int root = root_offsets[band] + i;
+      roots[root] = roots[roots[root]];
+      if (roots[root] == root) {
+        root_labels[root] = count();
+        sizes_.push_back(root_sizes[i]);
+      } else {
+        root_labels[root] = root_labels[roots[root]];
+        sizes_[root_labels[root]] += root_sizes[i];
+      }
+    }
+  }
+
+  // Write the label of every run to its fields and -1 between the runs
+  run([&](int band) {
+    const band_runs &data = band_data[band];
+    const int first = band_begin(band);
+    for (int z = first; z < band_begin(band + 1); z++) {
+      int *row = labels_.data() + static_cast<std::size_t>(z) * width_;
+      int wall = 0;
+      for (int i = data.row_begin[z - first]; i < data.row_begin[z - first + 1]; i++) {
+        const field_run &r = data.runs[i];
+        std::fill(row + wall, row + r.x0, -1);
+        std::fill(row + r.x0, row + r.x1, root_labels[root_of(band, i)]);
+        wall = r.x1;
+      }
+      std::fill(row + wall, row + width_, -1);
+    }
+  });
+}
+
+int maze_regions::largest() const noexcept {
+  const auto it = std::max_element(sizes_.begin(), sizes_.end());
+  return it == sizes_.end() ? -1 : static_cast<int>(it - sizes_.begin());
+}
+
+bool maze_regions::first_field(int label, int &x, int &z) const noexcept {
+  if (label < 0 || label >= count()) {
+    return false;
+  }
+  const auto it = std::find(labels_.begin(), labels_.end(), label);
+  const auto i = static_cast<int>(it - labels_.begin());
+  x = i % width_;
+  z = i / width_;
+  return true;
+}
@@ -0,0 +1,83 @@
+//
+// Connected regions of walkable fields in a labyrinth.
+// Fields are connected through their four edge neighbours, as the camera can't squeeze between two
+// walls which only touch at a corner. Labelling runs union-find over the runs of walkable fields in
+// bands of rows, one band per thread of a pool, followed by a merge of the band borders.
+//
+
+#ifndef UEB01_MAZE_REGIONS_H
+#define UEB01_MAZE_REGIONS_H
+
+#include "maze_grid.h"
+
+#include <vector>
+
+class thread_pool;
+
+class maze_regions {
+public:
+  /**
+   * Label all walkable fields of grid, replaces the previous labels
+   * @param pool threads the bands of rows are spread over, nullptr labels the grid as one band
+   */
+  void label(const maze_grid &grid, thread_pool *pool = nullptr);
+
+  int width() const noexcept {
+    return width_;
+  }
+
+  int height() const noexcept {
+    return height_;
+  }
+
+  /**
+   * @return number of regions, labels are 0 to count - 1 in the order of their first field row by row
+   */
+  int count() const noexcept {
+    return static_cast<int>(sizes_.size());
+  }
+
+  /**
+   * @return region of the field, -1 for walls and fields outside the grid
+   */
+  int label_at(int x, int z) const noexcept {
+    if (x < 0 || z < 0 || x >= width_ || z >= height_) {
+      return -1;
+    }
+    return labels_[static_cast<std::size_t>(z) * width_ + x];
+  }
+
+  /**
+   * @return number of fields in region label
+   */
+  int size(int label) const noexcept {
+    return label >= 0 && label < count() ? sizes_[label] : 0;
+  }
+
+  /**
+   * @return region with the most fields, -1 if there are none
+   */
+  int largest() const noexcept;
+
+  /**
+   * @return true if both fields are walkable and a path leads from one to the other
+   */
+  bool connected(int x0, int z0, int x1, int z1) const noexcept {
+    const int label = label_at(x0, z0);
+    return label >= 0 && label == label_at(x1, z1);
+  }
+
+  /**
+   * Find the first field of a region row by row
+   * @return false if label isn't a region
+   */
+  bool first_field(int label, int &x, int &z) const noexcept;
+
+private:
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<int> labels_;
+  std::vector<int> sizes_;
+};
+
+#endif //UEB01_MAZE_REGIONS_H
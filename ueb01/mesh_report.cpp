@@ -0,0 +1,125 @@
+//
+// Vertex cache efficiency and size of the generated meshes before and after optimising them.
+// The shapes stand in for the glutSolid calls of the games, the labyrinth is one cube per wall field like
+// render_labyrinth draws it. ACMR counts the vertices a 16 entry FIFO cache transforms per triangle.
+// Usage: mesh_report [maze image [pixels per field]]
+//
+
+#include "game_logic.h"
+#include "maze_grid.h"
+#include "maze_import.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+constexpr int random_maze_size = 64;
+
+/**
+ * Border of walls around fields which are open with the given probability
+ */
+maze_grid random_maze(double open) {
+  std::mt19937 random(1910307103);
+  std::bernoulli_distribution is_open(open);
+  maze_grid grid(random_maze_size, random_maze_size);
+  for (int z = 1; z < random_maze_size - 1; z++) {
+    for (int x = 1; x < random_maze_size - 1; x++) {
+      grid.set_passable(x, z, is_open(random));
+    }
+  }
+  return grid;
+}
+
+mesh labyrinth_walls(const maze_grid &grid) {
+  mesh m;
+  for (int z = 0; z < grid.height(); z++) {
+    for (int x = 0; x < grid.width(); x++) {
+      if (!grid.passable(x, z)) {
+        add_box(m, vec3{(static_cast<float>(x) + 0.5f) * field_size, field_size / 2,
+                        (static_cast<float>(z) + 0.5f) * field_size}, field_size);
+      }
+    }
+  }
+  return m;
+}
+
+void print_stats(const char *stage, const mesh_stats &s) {
+  std::printf("  %-10s %9zu %9zu %7.3f %7.3f %6zu %11zu %11zu\n", stage, s.vertices, s.triangles, s.acmr, s.atvr,
+              s.bytes_per_vertex, s.vertex_bytes, s.index_bytes);
+}
+
+/**
+ * Largest distance of a decoded position and largest angle of a decoded normal from the originals
+ */
+void quantization_error(const mesh &m, const quantized_mesh &q, float &position, float &degrees) {
+  position = 0;
+  degrees = 0;
+  for (std::size_t i = 0; i < m.vertices.size(); i++) {
+    float p[3];
+    float n[3];
+    decode_position(q, q.vertices[i], p);
+    decode_normal(q.vertices[i].normal, n);
+    float cosine = 0;
+    for (int k = 0; k < 3; k++) {
+      position = std::max(position, std::fabs(p[k] - m.vertices[i].position[k]));
+      cosine += n[k] * m.vertices[i].normal[k];
+    }
+    degrees = std::max(degrees, std::acos(std::min(1.0f, cosine)) * 180 / vecmath_pi);
+  }
+}
+
+void report(const std::string &name, mesh m) {
+  std::cout << name << std::endl;
+  print_stats("naive", measure_mesh(m.indices, m.vertices.size(), sizeof(mesh_vertex)));
+
+  const auto start = std::chrono::steady_clock::now();
+  optimize_mesh(m);
+  const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+  print_stats("optimised", measure_mesh(m.indices, m.vertices.size(), sizeof(mesh_vertex)));
+
+  const quantized_mesh q = quantize_mesh(m);
+  print_stats("quantised", measure_mesh(q.indices, q.vertices.size(), sizeof(packed_vertex)));
+  float position;
+  float degrees;
+  quantization_error(m, q, position, degrees);
+  std::printf("  optimised in %.2f ms, quantised positions within %.2g, normals within %.2f degrees\n",
+              took.count(), position, degrees);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  maze_grid grid;
+  if (argc > 1) {
+    maze_import_options options;
+    options.cell_size = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 1;
+    if (!import_maze(argv[1], options, grid)) {
+      std::cout << "Can't import " << argv[1] << std::endl;
+      return EXIT_FAILURE;
+    }
+  } else {
+    grid = random_maze(0.6);
+  }
+
+  std::printf("  %-10s %9s %9s %7s %7s %6s %11s %11s\n", "", "vertices", "triangles", "acmr", "atvr", "bytes",
+              "vertex B", "index B");
+  mesh sphere;
+  add_sphere(sphere, vec3{}, 0.5f, 32, 16);
+  report("sphere 32x16", std::move(sphere));
+  mesh cone;
+  add_cone(cone, vec3{}, 0.5f, 1, 32, 8);
+  report("cone 32x8", std::move(cone));
+  mesh box;
+  add_box(box, vec3{}, 1, 8);
+  report("cube 8x8 per face", std::move(box));
+  report("labyrinth " + std::to_string(grid.width()) + "x" + std::to_string(grid.height()), labyrinth_walls(grid));
+  return EXIT_SUCCESS;
+}
@@ -11,30 +11,56 @@
  * e: rotate spotlight right
  * x: increase ambient light
  * y: dim ambient light
+ * l: toggle baked light of the point lights on the room, off evaluates them per vertex everywhere
+ * p: toggle the overlay with the GPU time of the render passes
+ * t: write the pass times of the last frames to ueb02_trace.json
  */
 
 #include "GL/glew.h"
 #include "GL/freeglut.h"
+#include <chrono>
 #include <cmath>
+#include <cstdio>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
 #include <utility>
 #include <vector>
 #include <memory>
 
+#include "alloc_tracker.h"
+#include "command_buffer.h"
+#include "crowd.h"
+#include "dynamic_resolution.h"
+#include "frame_arena.h"
+#include "frame_capture.h"
+#include "gl_replay.h"
+#include "gpu_timer.h"
+#include "guest_motion.h"
+#include "lightmap.h"
+#include "scene_graph.h"
+#include "shape_cache.h"
+#include "simulation_thread.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
+#include "triple_buffer.h"
+#include "vecmath.h"
+
 constexpr float room_level = -2;
 constexpr float room_size = 10;
 
 constexpr float pink[] = {1.000f, 0.753f, 0.796f, 1.0f};
 constexpr float gray[] = {.67f, .67f, .67f, 1.0f};
-constexpr float green[] = {0.0f, 0.9f, 0.4f};
+constexpr float green[] = {0.0f, 0.9f, 0.4f, 1.0f};
 constexpr float red[] = {1, 0.0f, 0.0f, 1};
 constexpr float blue[] = {0.0f, 0.0f, 1.0f, 1.0f};
 constexpr float purple[] = {0.5f, 0.0f, 0.5f, 1};
 constexpr float red_purple[] = {1, 0.0f, 0.5f, 1};
 constexpr float white[] = {1.0f, 1.0f, 1.0f, 1.0f};
 
-constexpr float zero[] = {0, 0, 0};
-constexpr float half[] = {0.5, 0.5, 0.5};
-constexpr float one[] = {1, 1, 1};
+constexpr float zero[] = {0, 0, 0, 1};
+constexpr float half[] = {0.5, 0.5, 0.5, 1};
+constexpr float one[] = {1, 1, 1, 1};
 constexpr float shininess_none = 0;
 constexpr float shininess_low = 0.1;
 constexpr float shininess_mid = 0.5;
@@ -46,36 +72,12 @@ constexpr float lookaround_speed = 0.0001;
 constexpr float max_angel = 0.5f;
 
 constexpr float spot_light_step = 0.05f;
+
+constexpr int simulation_rate = 60; // ticks per second
 constexpr float light_intensity_step = 0.01f;
 
 /* Classes */
 
-/**
- * Representation of a 3d Coordinate
- */
-struct position {
-  float x;
-  float y;
-  float z;
-
-  explicit position(float x = 0, float y = 0, float z = 0) : x{x}, y{y}, z{z} {}
-
-  friend bool operator!=(const position &left, const position &right) {
-    return left.x != right.x || left.y != right.y || left.z != right.z;
-  }
-
-  /**
-    * Operator to increment the x,y and z values.
-    * @param other, the coordinate by which this one should be incremented
-    */
-  position &operator+=(const position &other) {
-    this->x += other.x;
-    this->y += other.y;
-    this->z += other.z;
-    return *this;
-  }
-};
-
 /**
  * Settings for lights and fog
  */
@@ -86,30 +88,221 @@ struct light_settings {
   bool point_light_right_enabled = true;
   bool spotlight_enabled = true;
   bool fog_enabled = false;
+  bool lightmap_enabled = true;
   float ambient_light_intensity = default_light_intensity_;
 
 private:
   constexpr static const float default_light_intensity_ = 0.5f;
 };
 
+/**
+ * What the renderer needs of one simulation tick
+ */
+struct frame_snapshot {
+  mat4 view;
+  light_settings settings;
+  std::vector<mat4> world; // world matrix of every scene graph node
+};
+
 /**
  * A game object represents a figure which can be rendered
  */
 class game_object {
 public:
-  explicit game_object(position pos) : pos_(pos) {}
+  explicit game_object(vec3 pos) : pos_(pos) {}
+
+  /**
+   * Add the nodes of the object to the scene graph and take its shapes, called once when the object
+   * joins the game
+   */
+  void attach(scene_graph &graph, shape_cache &shapes) {
+    graph_ = &graph;
+    shapes_ = &shapes;
+    add_nodes();
+  }
+
+  /**
+   * Move the object for the next tick, runs on the simulation thread before the world matrices are updated
+   */
+  virtual void animate() {}
 
-  virtual void render() = 0;
+  /**
+   * Bring GL resources up to date with a snapshot, runs on the GL thread before the frame is recorded
+   */
+  virtual void prepare(const frame_snapshot & /*frame*/) {}
+
+  /**
+   * Record how the object is drawn in a snapshot, may run on any thread and in parallel with other objects.
+   * The simulation moves on meanwhile, so only the snapshot and what never changes may be read.
+   */
+  virtual void record(command_buffer &cmd, const frame_snapshot &frame) const = 0;
 
 protected:
-  position pos_;
+  vec3 pos_;
+  scene_graph *graph_ = nullptr;
+  shape_cache *shapes_ = nullptr;
+
+  virtual void add_nodes() = 0;
+
+  /**
+   * Draw in the space of a node from here on, with its world matrix of the snapshot
+   */
+  static void load_world(command_buffer &cmd, const frame_snapshot &frame, scene_graph::node n) {
+    cmd.transform(frame.world[static_cast<std::size_t>(n)]);
+  }
+
+  virtual void material(command_buffer &cmd) const {
+    cmd.material(material_param::ambient, half);
+    cmd.material(material_param::diffuse, one);
+    cmd.material(material_param::specular, one);
+    cmd.material(material_param::emission, zero);
+    cmd.shininess(0);
+  }
+};
+
+/**
+ * Static surfaces of the disco, each one a chart of the lightmap
+ */
+enum class static_surface {
+  floor, wall_north, wall_east, wall_west, booth_floor, booth_console
+};
+
+/**
+ * Light of the two point lights on the static surfaces, baked once at start up.
+ * The lightmap holds the light the surfaces reflect, the texture is added to what the fixed function
+ * pipeline computes for the remaining lights, ambient light and emission.
+ */
+class baked_lighting {
+public:
+  /**
+   * Bake the lightmap and upload it, needs the GL context
+   * @param settings lights to upload the lightmap for
+   * @param pool threads to bake on
+   */
+  void bake(const light_settings &settings, thread_pool *pool) {
+    const vec3 purple_albedo{purple[0], purple[1], purple[2]};
+    const vec3 gray_albedo{gray[0], gray[1], gray[2]};
+    const vec3 half_albedo{half[0], half[1], half[2]};
+    // Same order as static_surface, edges chosen so u x v points into the room
+    baker_.add_chart({{-room_size, room_level, room_size / 2}, {2 * room_size, 0, 0}, {0, 0, -2 * room_size},
+                      purple_albedo});
+    const float wall_back = -room_size - room_size / 5;
+    const float wall_front = room_size - room_size / 5;
+    baker_.add_chart({{-room_size / 2, room_level, wall_back}, {room_size, 0, 0}, {0, wall_height, 0},
+                      gray_albedo});
+    baker_.add_chart({{room_size / 2, room_level, wall_back}, {0, 0, 2 * room_size}, {0, wall_height, 0},
+                      gray_albedo});
+    baker_.add_chart({{-room_size / 2, room_level, wall_front}, {0, 0, -2 * room_size}, {0, wall_height, 0},
+                      gray_albedo});
+    baker_.add_chart({{-booth_size / 2, booth_level, booth_size / 2}, {booth_size, 0, 0}, {0, 0, -booth_size},
+                      half_albedo});
+    baker_.add_chart({{booth_size / 2, booth_level, -booth_size / 2}, {0, 0, booth_size}, {0, booth_size, 0},
+                      half_albedo});
+
+    // The point lights of game_state
+    lightmap_light light;
+    light.quadratic_attenuation = 0.15f;
+    light.position = {-room_size / 2 + 1, 3, -room_size / 2};
+    light.colour = {red[0], red[1], red[2]};
+    baker_.add_light(light);
+    light.position = {room_size / 2 - 1, 3, -room_size / 2};
+    light.colour = {blue[0], blue[1], blue[2]};
+    baker_.add_light(light);
+
+    const auto start = std::chrono::steady_clock::now();
+    baker_.bake(pool);
+    const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+    std::cout << "Baked " << baker_.atlas_width() << "x" << baker_.atlas_height() << " lightmap in "
+              << took.count() << " ms" << std::endl;
+
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    upload(settings);
+  }
+
+  /**
+   * Upload the lightmap again if the baked lights were switched, before the frame is recorded
+   */
+  void update(const light_settings &settings) {
+    if (texture_ != 0 && (settings.point_light_left_enabled != left_baked_
+                          || settings.point_light_right_enabled != right_baked_)) {
+      upload(settings);
+    }
+  }
+
+  /**
+   * Start drawing static surfaces, the baked lights are switched off meanwhile
+   */
+  void begin(command_buffer &cmd, const light_settings &settings) const {
+    cmd.push_attributes();
+    if (!settings.lightmap_enabled || texture_ == 0) {
+      return;
+    }
+    cmd.disable(capability::light0);
+    cmd.disable(capability::light1);
+    cmd.enable(capability::texture_2d);
+    cmd.bind_texture(texture_);
+    cmd.texture_add();
+  }
+
+  void end(command_buffer &cmd) const {
+    cmd.pop_attributes();
+  }
+
+  /**
+   * Texture coordinate of the point (s, t) of a surface, see the charts in bake
+   */
+  void tex_coord(command_buffer &cmd, static_surface surface, float s, float t) const {
+    float u;
+    float v;
+    baker_.atlas_coord(static_cast<int>(surface), s, t, u, v);
+    cmd.tex_coord(u, v);
+  }
+
+  /**
+   * Generate texture coordinates from object coordinates, for the solids of the shape cache
+   * @param s_plane, t_plane planes which give the point (s, t) of the surface in object coordinates
+   */
+  void tex_gen(command_buffer &cmd, static_surface surface, const float s_plane[4], const float t_plane[4]) const {
+    float u0;
+    float v0;
+    float u1;
+    float v1;
+    baker_.atlas_coord(static_cast<int>(surface), 0, 0, u0, v0);
+    baker_.atlas_coord(static_cast<int>(surface), 1, 1, u1, v1);
+    const float u_plane[] = {s_plane[0] * (u1 - u0), s_plane[1] * (u1 - u0), s_plane[2] * (u1 - u0),
+                             s_plane[3] * (u1 - u0) + u0};
+    const float v_plane[] = {t_plane[0] * (v1 - v0), t_plane[1] * (v1 - v0), t_plane[2] * (v1 - v0),
+                             t_plane[3] * (v1 - v0) + v0};
+    cmd.tex_gen(u_plane, v_plane);
+  }
+
+  constexpr static const float wall_height = 5;
+  constexpr static const float booth_size = 4;
+  constexpr static const float booth_level = -1;
+
+private:
+  lightmap_baker baker_;
+  GLuint texture_ = 0;
+  bool left_baked_ = false;
+  bool right_baked_ = false;
+  std::vector<unsigned char> pixels_;
 
-  virtual void material() {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, half);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, one);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, one);
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
-    glMaterialf(GL_FRONT, GL_SHININESS, 0);
+  /**
+   * Compose the layers of the lights which are on and upload them
+   */
+  void upload(const light_settings &settings) {
+    left_baked_ = settings.point_light_left_enabled;
+    right_baked_ = settings.point_light_right_enabled;
+    baker_.compose({left_baked_, right_baked_}, pixels_);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, baker_.atlas_width(), baker_.atlas_height(), 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, pixels_.data());
   }
 };
 
@@ -118,70 +311,106 @@ protected:
  */
 class disco_room : public game_object {
 public:
-  disco_room() : game_object(position{room_size / 2, room_level, -room_size / 5}) {}
+  explicit disco_room(std::shared_ptr<baked_lighting> lighting) :
+      game_object(vec3{room_size / 2, room_level, -room_size / 5}),
+      lighting_(std::move(lighting)) {}
 
-  void render() override {
-    glPushMatrix();
-    material();
+  void prepare(const frame_snapshot &frame) override {
+    lighting_->update(frame.settings);
+  }
+
+  void record(command_buffer &cmd, const frame_snapshot &frame) const override {
+    lighting_->begin(cmd, frame.settings);
+    material(cmd);
     // floor
-    glTranslatef(0, pos_.y, -room_size / 2);
-    glScaled(room_size, 0.01, room_size);
+    load_world(cmd, frame, floor_);
+    // The sphere spans [-1, 1] in x and z, the floor chart runs along x and against z
+    const float s_plane[] = {0.5f, 0, 0, 0.5f};
+    const float t_plane[] = {0, 0, -0.5f, 0.5f};
+    lighting_->tex_gen(cmd, static_surface::floor, s_plane, t_plane);
     // Have to use a sphere, otherwise the spotlight won't work
-    glutSolidSphere(1, 100, 100);
-    glPopMatrix();
+    cmd.triangles(*floor_sphere_);
+    cmd.disable(capability::texture_gen_s);
+    cmd.disable(capability::texture_gen_t);
 
-    glPushMatrix();
-    glTranslatef(pos_.x, pos_.y, pos_.z);
+    load_world(cmd, frame, walls_);
 
-    wall_material();
+    wall_material(cmd);
     // wall north
-    glBegin(GL_QUADS);
-    glVertex3d(0, 0, -room_size);
-    glVertex3d(0, height_, -room_size);
-    glVertex3d(-room_size, height_, -room_size);
-    glVertex3d(-room_size, 0, -room_size);
-    glEnd();
+    cmd.begin(primitive::quads);
+    cmd.normal(0, 0, 1);
+    lighting_->tex_coord(cmd, static_surface::wall_north, 1, 0);
+    cmd.vertex(0, 0, -room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_north, 1, 1);
+    cmd.vertex(0, height_, -room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_north, 0, 1);
+    cmd.vertex(-room_size, height_, -room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_north, 0, 0);
+    cmd.vertex(-room_size, 0, -room_size);
+    cmd.end();
 
     // wall east
-    glBegin(GL_QUADS);
-    glVertex3d(0, 0, room_size);
-    glVertex3d(0, height_, room_size);
-    glVertex3d(0, height_, -room_size);
-    glVertex3d(0, 0, -room_size);
-    glEnd();
+    cmd.begin(primitive::quads);
+    cmd.normal(-1, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::wall_east, 1, 0);
+    cmd.vertex(0, 0, room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_east, 1, 1);
+    cmd.vertex(0, height_, room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_east, 0, 1);
+    cmd.vertex(0, height_, -room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_east, 0, 0);
+    cmd.vertex(0, 0, -room_size);
+    cmd.end();
 
     // wall west
-    glBegin(GL_QUADS);
-    glVertex3d(-room_size, 0, room_size);
-    glVertex3d(-room_size, height_, room_size);
-    glVertex3d(-room_size, height_, -room_size);
-    glVertex3d(-room_size, 0, -room_size);
-    glEnd();
-    glPopMatrix();
+    cmd.begin(primitive::quads);
+    cmd.normal(1, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::wall_west, 0, 0);
+    cmd.vertex(-room_size, 0, room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_west, 0, 1);
+    cmd.vertex(-room_size, height_, room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_west, 1, 1);
+    cmd.vertex(-room_size, height_, -room_size);
+    lighting_->tex_coord(cmd, static_surface::wall_west, 1, 0);
+    cmd.vertex(-room_size, 0, -room_size);
+    cmd.end();
+    lighting_->end(cmd);
+  }
+
+protected:
+  void add_nodes() override {
+    floor_ = graph_->add(scene_graph::no_parent, mat4::translation(0, pos_.y, -room_size / 2)
+                                                 * mat4::scaling(room_size, 0.01, room_size));
+    walls_ = graph_->add(scene_graph::no_parent, mat4::translation(pos_));
+    floor_sphere_ = &shapes_->sphere(1, 100, 100);
   }
 
 private:
-  constexpr static const float height_ = 5;
+  std::shared_ptr<baked_lighting> lighting_;
+  scene_graph::node floor_ = 0;
+  scene_graph::node walls_ = 0;
+  const mesh *floor_sphere_ = nullptr;
+  constexpr static const float height_ = baked_lighting::wall_height;
 
   /**
    * Dedicated material for the walls
    */
-  static void wall_material() {
+  static void wall_material(command_buffer &cmd) {
     GLfloat emission[] = {0.0f, 0.0f, 0.0f, 0.0f};
-    glMaterialfv(GL_FRONT, GL_AMBIENT, gray);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, gray);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, gray);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
-    glMaterialfv(GL_FRONT, GL_EMISSION, emission);
+    cmd.material(material_param::ambient, gray);
+    cmd.material(material_param::diffuse, gray);
+    cmd.material(material_param::specular, gray);
+    cmd.shininess(shininess_high);
+    cmd.material(material_param::emission, emission);
   }
 
 protected:
-  void material() override {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, purple);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, purple);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, purple);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_mid);
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
+  void material(command_buffer &cmd) const override {
+    cmd.material(material_param::ambient, purple);
+    cmd.material(material_param::diffuse, purple);
+    cmd.material(material_param::specular, purple);
+    cmd.shininess(shininess_mid);
+    cmd.material(material_param::emission, zero);
   }
 };
 
@@ -191,33 +420,49 @@ protected:
 class light_cone : public game_object {
 public:
   explicit light_cone(std::shared_ptr<light_settings> sett) :
-      game_object(position(0, 2, -room_size / 2)),
+      game_object(vec3{0, 2, -room_size / 2}),
       sett_(std::move(sett)) {}
 
-  void render() override {
-    glPushMatrix();
-    material();
-    glTranslatef(pos_.x, pos_.y, pos_.z);
-    glRotatef(-90, 1, 0, 0);
-    glRotatef(sett_->spot_light_angel * start_angel, 0, 1, 0);
-    glutSolidCone(cone_base_, cone_height_, 100, 100);
-    glPopMatrix();
+  void animate() override {
+    if (sett_->spot_light_angel != angle_) {
+      angle_ = sett_->spot_light_angel;
+      graph_->set_local(node_, model());
+    }
+  }
+
+  void record(command_buffer &cmd, const frame_snapshot &frame) const override {
+    material(cmd);
+    load_world(cmd, frame, node_);
+    cmd.triangles(*cone_);
   }
 
 protected:
-  void material() override {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, green);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, green);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
-    glMaterialfv(GL_FRONT, GL_EMISSION, green);
+  void add_nodes() override {
+    angle_ = sett_->spot_light_angel;
+    node_ = graph_->add(scene_graph::no_parent, model());
+    cone_ = &shapes_->cone(cone_base_, cone_height_, 100, 100);
+  }
+
+  void material(command_buffer &cmd) const override {
+    cmd.material(material_param::ambient, green);
+    cmd.material(material_param::diffuse, green);
+    cmd.material(material_param::specular, half);
+    cmd.shininess(shininess_high);
+    cmd.material(material_param::emission, green);
   }
 
 private:
   std::shared_ptr<light_settings> sett_;
+  scene_graph::node node_ = 0;
+  float angle_ = 0; // spotlight angle of the local transform
+  const mesh *cone_ = nullptr;
   constexpr static const float cone_base_ = 0.1f;
   constexpr static const float cone_height_ = 0.3f;
   constexpr static const float start_angel = -60.0f;
+
+  mat4 model() const noexcept {
+    return mat4::translation(pos_) * mat4::rotation_x(radians(-90)) * mat4::rotation_y(radians(angle_ * start_angel));
+  }
 };
 
 /**
@@ -225,31 +470,39 @@ private:
  */
 class disco_ball : public game_object {
 public:
-  explicit disco_ball(float x, const float *color) : game_object(position(x, ball_height_, -room_size / 2)), color_(color) {}
+  explicit disco_ball(float x, const float *color) : game_object(vec3{x, ball_height_, -room_size / 2}), color_(color) {}
 
-  void render() override {
-    glPushMatrix();
-    glShadeModel(GL_FLAT);
-    material();
-    glTranslatef(pos_.x, pos_.y, pos_.z);
+  void animate() override {
     angel = (angel + 1) % 360;
-    glRotatef((float) angel, 0, 1, 0);
-    glutSolidSphere(ball_radius_, 10, 10);
-    glShadeModel(GL_SMOOTH);
-    glPopMatrix();
+    graph_->set_local(node_, mat4::translation(pos_) * mat4::rotation_y(radians((float) angel)));
+  }
+
+  void record(command_buffer &cmd, const frame_snapshot &frame) const override {
+    cmd.flat_shading(true);
+    material(cmd);
+    load_world(cmd, frame, node_);
+    cmd.triangles(*ball_);
+    cmd.flat_shading(false);
   }
 
 protected:
-  void material() override {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, color_);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, color_);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
+  void material(command_buffer &cmd) const override {
+    cmd.material(material_param::ambient, color_);
+    cmd.material(material_param::diffuse, color_);
+    cmd.material(material_param::specular, half);
+    cmd.material(material_param::emission, zero);
+    cmd.shininess(shininess_high);
+  }
+
+  void add_nodes() override {
+    node_ = graph_->add(scene_graph::no_parent, mat4::translation(pos_));
+    ball_ = &shapes_->sphere(ball_radius_, 10, 10);
   }
 
 private:
   const float *color_;
+  scene_graph::node node_ = 0;
+  const mesh *ball_ = nullptr;
   int angel = 0;
   constexpr static const float ball_height_ = 1.5f;
   constexpr static const float ball_radius_ = 0.3f;
@@ -260,316 +513,275 @@ private:
  */
 class dj_booth : public game_object {
 public:
-  explicit dj_booth(std::shared_ptr<light_settings> sett) :
-      game_object(position{size_ / 2, booth_level_, size_ / 2}),
-      sett_(std::move(sett)) {}
-
-  void render() override {
-    glPushMatrix();
-    material();
+  dj_booth(std::shared_ptr<light_settings> sett, std::shared_ptr<baked_lighting> lighting) :
+      game_object(vec3{size_ / 2, booth_level_, size_ / 2}),
+      sett_(std::move(sett)),
+      lighting_(std::move(lighting)) {}
+
+  void record(command_buffer &cmd, const frame_snapshot &frame) const override {
+    lighting_->begin(cmd, frame.settings);
+    material(cmd);
     // floor
-    glTranslatef(pos_.x, pos_.y, pos_.z);
-    glBegin(GL_QUADS);
-    glVertex3d(0, 0, 0);
-    glVertex3d(-size_, 0, 0);
-    glVertex3d(-size_, 0, -size_);
-    glVertex3d(0, 0, -size_);
-    glEnd();
+    load_world(cmd, frame, booth_);
+    cmd.begin(primitive::quads);
+    cmd.normal(0, 1, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_floor, 1, 0);
+    cmd.vertex(0, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_floor, 0, 0);
+    cmd.vertex(-size_, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_floor, 0, 1);
+    cmd.vertex(-size_, 0, -size_);
+    lighting_->tex_coord(cmd, static_surface::booth_floor, 1, 1);
+    cmd.vertex(0, 0, -size_);
+    cmd.end();
 
     // console for lights etc
-    glBegin(GL_QUADS);
-    glVertex3d(0, 0, 0);
-    glVertex3d(0, size_, 0);
-    glVertex3d(0, size_, -size_);
-    glVertex3d(0, 0, -size_);
-    glEnd();
-    glPopMatrix();
-
-    // ambient light
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 2, -1);
-    glScalef(text_scale_, text_scale_, text_scale_); // Have to scale down, since text is huge
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'a');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, sett_->ambient_light_enabled ? green : red);
-    glTranslatef(pos_.x, pos_.y + 2.05f, -0.7);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // point light left
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 1.7f, -1);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 's');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, sett_->point_light_left_enabled ? green : red);
-    glTranslatef(pos_.x, pos_.y + 1.75f, -0.7);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // point light right
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 1.4f, -1);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'd');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, sett_->point_light_right_enabled ? green : red);
-    glTranslatef(pos_.x, pos_.y + 1.45f, -0.7);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // fog
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 1.1f, -1);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'f');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, sett_->fog_enabled ? green : red);
-    glTranslatef(pos_.x, pos_.y + 1.15f, -0.7);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // spotlight
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 0.8f, -1);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'g');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, sett_->spotlight_enabled ? green : red);
-    glTranslatef(pos_.x, pos_.y + 0.85f, -0.7);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // dim ambient light
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 2, -0.4);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'y');
-    glPopMatrix();
-
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 2, 0.9f);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'x');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, blue);
-    glTranslatef(pos_.x, pos_.y + 2.05f, -0.1f + sett_->ambient_light_intensity);
-    glutSolidCube(0.1);
-    glPopMatrix();
-
-    // rotate spotlight
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 1.7f, -0.4);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'q');
-    glPopMatrix();
-
-    glPushMatrix();
-    text_material();
-    glTranslatef(pos_.x - 0.1f, pos_.y + 1.7f, 0.9f);
-    glScalef(text_scale_, text_scale_, text_scale_);
-    glRotatef(-90, 0, 1, 0);
-    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, 'e');
-    glPopMatrix();
-
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, blue);
-    glTranslatef(pos_.x, pos_.y + 1.75f, 0.4f + sett_->spot_light_angel);
-    glutSolidCube(0.1);
-    glPopMatrix();
+    cmd.begin(primitive::quads);
+    cmd.normal(-1, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_console, 1, 0);
+    cmd.vertex(0, 0, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_console, 1, 1);
+    cmd.vertex(0, size_, 0);
+    lighting_->tex_coord(cmd, static_surface::booth_console, 0, 1);
+    cmd.vertex(0, size_, -size_);
+    lighting_->tex_coord(cmd, static_surface::booth_console, 0, 0);
+    cmd.vertex(0, 0, -size_);
+    cmd.end();
+    lighting_->end(cmd);
+
+    // keys of the controls
+    text_material(cmd);
+    for (const auto &label : labels_) {
+      load_world(cmd, frame, label.second);
+      cmd.lines(shapes_->font().lines[static_cast<unsigned char>(label.first) % 128]);
+    }
+
+    // lights and fog, green when on
+    const light_settings &sett = frame.settings;
+    const bool enabled[] = {sett.ambient_light_enabled, sett.point_light_left_enabled,
+                            sett.point_light_right_enabled, sett.fog_enabled, sett.spotlight_enabled};
+    for (int i = 0; i < toggle_count_; i++) {
+      cmd.material(material_param::emission, enabled[i] ? green : red);
+      load_world(cmd, frame, toggles_[i]);
+      cmd.triangles(*indicator_);
+    }
+
+    // ambient light intensity and spotlight rotation
+    cmd.material(material_param::emission, blue);
+    for (const auto slider : {ambient_slider_, spot_slider_}) {
+      load_world(cmd, frame, slider);
+      cmd.triangles(*indicator_);
+    }
+  }
+
+  void animate() override {
+    if (sett_->ambient_light_intensity != ambient_intensity_ || sett_->spot_light_angel != spot_angle_) {
+      ambient_intensity_ = sett_->ambient_light_intensity;
+      spot_angle_ = sett_->spot_light_angel;
+      graph_->set_local(ambient_slider_, indicator_matrix(2.05f, -0.1f + ambient_intensity_));
+      graph_->set_local(spot_slider_, indicator_matrix(1.75f, 0.4f + spot_angle_));
+    }
   }
 
 protected:
-  void material() override {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, half);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, half);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, one);
-    glMaterialfv(GL_FRONT, GL_EMISSION, half);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
+  void material(command_buffer &cmd) const override {
+    cmd.material(material_param::ambient, half);
+    cmd.material(material_param::diffuse, half);
+    cmd.material(material_param::specular, one);
+    cmd.material(material_param::emission, half);
+    cmd.shininess(shininess_high);
+  }
+
+  void add_nodes() override {
+    booth_ = graph_->add(scene_graph::no_parent, mat4::translation(pos_));
+    indicator_ = &shapes_->cube(0.1f);
+
+    struct console_key {
+      char key;
+      float height;
+      float z;
+    };
+    const console_key keys[] = {
+        {'a', 2, -1}, {'s', 1.7f, -1}, {'d', 1.4f, -1}, {'f', 1.1f, -1}, {'g', 0.8f, -1},
+        {'y', 2, -0.4f}, {'x', 2, 0.9f}, {'q', 1.7f, -0.4f}, {'e', 1.7f, 0.9f},
+    };
+    for (const auto &key : keys) {
+      labels_.emplace_back(key.key, graph_->add(booth_, label_matrix(key.height, key.z)));
+    }
+
+    const float toggle_heights[toggle_count_] = {2.05f, 1.75f, 1.45f, 1.15f, 0.85f};
+    for (int i = 0; i < toggle_count_; i++) {
+      toggles_[i] = graph_->add(booth_, indicator_matrix(toggle_heights[i], -0.7f));
+    }
+
+    ambient_intensity_ = sett_->ambient_light_intensity;
+    spot_angle_ = sett_->spot_light_angel;
+    ambient_slider_ = graph_->add(booth_, indicator_matrix(2.05f, -0.1f + ambient_intensity_));
+    spot_slider_ = graph_->add(booth_, indicator_matrix(1.75f, 0.4f + spot_angle_));
+  }
+
+  /**
+   * Place a label on the console relative to the booth, the text faces the room
+   * @param z world coordinate
+   */
+  mat4 label_matrix(float height, float z) const noexcept {
+    // Have to scale down, since text is huge
+    return mat4::translation(-0.1f, height, z - pos_.z)
+           * mat4::scaling(text_scale_)
+           * mat4::rotation_y(radians(-90));
+  }
+
+  /**
+   * Place an indicator light on the console relative to the booth
+   * @param z world coordinate
+   */
+  mat4 indicator_matrix(float height, float z) const noexcept {
+    return mat4::translation(0, height, z - pos_.z);
   }
 
-  static void text_material() {
-    glMaterialfv(GL_FRONT, GL_AMBIENT, zero);
-    glMaterialfv(GL_FRONT, GL_DIFFUSE, zero);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, zero);
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_none);
+  static void text_material(command_buffer &cmd) {
+    cmd.material(material_param::ambient, zero);
+    cmd.material(material_param::diffuse, zero);
+    cmd.material(material_param::specular, zero);
+    cmd.material(material_param::emission, zero);
+    cmd.shininess(shininess_none);
   }
 
 private:
   std::shared_ptr<light_settings> sett_;
-  constexpr static const float size_ = 4;
-  constexpr static const float booth_level_ = -1;
+  std::shared_ptr<baked_lighting> lighting_;
+  constexpr static const float size_ = baked_lighting::booth_size;
+  constexpr static const float booth_level_ = baked_lighting::booth_level;
   constexpr static float text_scale_ = 0.002f;
-
+  constexpr static int toggle_count_ = 5;
+
+  scene_graph::node booth_ = 0;
+  const mesh *indicator_ = nullptr; // cube of the toggles and sliders
+  std::vector<std::pair<char, scene_graph::node>> labels_;
+  scene_graph::node toggles_[toggle_count_] = {};
+  scene_graph::node ambient_slider_ = 0;
+  scene_graph::node spot_slider_ = 0;
+  float ambient_intensity_ = 0; // settings the sliders are placed for
+  float spot_angle_ = 0;
 };
 
 /**
- * How the guests should move
+ * The guests as one crowd, they keep apart from each other and stay out of the dj booth.
+ * Guests move their own position, the crowd pushes them apart once all of them moved.
  */
-enum class movement {
-  jump = 0,
-  left_right = 1,
-  front_back = 2,
-  jump_and_left_right = 3,
-};
-
-class guest : public game_object {
+class disco_crowd {
 public:
-  guest(float x, float z) : game_object(position(x, 0, z)) {
-    movement_ = (movement) (rand() % 4);
-  }
-
-  void render() override {
-    move();
-    glPushMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
-    glMaterialfv(GL_FRONT, GL_AMBIENT, pink);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, one);
-    glMaterialf(GL_FRONT, GL_SHININESS, shininess_low);
-    glTranslatef(pos_.x, pos_.y, pos_.z);
-    glutSolidSphere(0.2, 30, 30);
-    glPopMatrix();
-    glPushMatrix();
-    material();
-
-    glTranslatef(pos_.x, pos_.y - 1, pos_.z);
-    glRotated(-90, 1, 0, 0);
-    glutSolidCone(0.3, 1, 30, 30);
-    glPopMatrix();
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
+  explicit disco_crowd(thread_pool *workers) : workers_(workers) {
+    const float booth = baked_lighting::booth_size / 2;
+    separation_.add_obstacle({-booth, -booth, booth, booth});
   }
 
-private:
-  bool up_ = true;
-  bool left_ = true;
-  float counter = 0;
-  movement movement_;
-  float movement_speed_ = 0.001f * ((rand() % 5) + 1);
-  int material_ = rand() % 5;
-
+  /**
+   * @param node placed where the guest ends up every step
+   * @return member index of the guest
+   */
+  std::size_t join(const vec3 &pos, scene_graph::node node) {
+    positions_.push_back(pos);
+    nodes_.push_back(node);
+    return positions_.size() - 1;
+  }
 
-  void move() {
-    switch (movement_) {
-      case movement::left_right:
-        left_right();
-        break;
-      case movement::front_back:
-        front_back();
-        break;
-      case movement::jump_and_left_right:
-        left_right();
-      case movement::jump:
-        jump();
-        break;
-    }
+  vec3 &position(std::size_t member) noexcept {
+    return positions_[member];
   }
 
-  void left_right() {
-    if (left_) {
-      pos_.x -= movement_speed_;
-      counter++;
-      left_ = counter <= 200;
-    } else {
-      pos_.x += movement_speed_;
-      counter--;
-      left_ = counter < -200;
+  void step(scene_graph &graph) {
+    separation_.step(positions_, workers_);
+    for (std::size_t i = 0; i < positions_.size(); i++) {
+      graph.set_local(nodes_[i], mat4::translation(positions_[i]));
     }
   }
 
-  void front_back() {
-    if (left_) {
-      pos_.z -= movement_speed_;
-      counter++;
-      left_ = counter <= 700;
-    } else {
-      pos_.z += movement_speed_;
-      counter--;
-      left_ = counter < -700;
-    }
+private:
+  thread_pool *workers_;
+  crowd_separation separation_;
+  std::vector<vec3> positions_;
+  std::vector<scene_graph::node> nodes_;
+};
+
+class guest : public game_object {
+public:
+  guest(float x, float z, std::shared_ptr<disco_crowd> crowd) : game_object(vec3{x, 0, z}), crowd_(std::move(crowd)) {}
+
+  void animate() override {
+    motion_.step(crowd_->position(member_));
   }
 
-  void jump() {
-    if (up_) {
-      pos_.y += movement_speed_;
-      if (pos_.y > 0.5) {
-        up_ = false;
-      }
-    } else {
-      pos_.y -= movement_speed_;
-      if (pos_.y <= 0) {
-        up_ = true;
-      }
-    }
+  void record(command_buffer &cmd, const frame_snapshot &frame) const override {
+    cmd.material(material_param::emission, zero);
+    cmd.material(material_param::ambient, pink);
+    cmd.material(material_param::specular, one);
+    cmd.shininess(shininess_low);
+    load_world(cmd, frame, node_);
+    cmd.triangles(*head_);
+    material(cmd);
+
+    load_world(cmd, frame, body_);
+    cmd.triangles(*body_mesh_);
+    cmd.material(material_param::emission, zero);
   }
 
+private:
+  std::shared_ptr<disco_crowd> crowd_;
+  std::size_t member_ = 0;
+  scene_graph::node node_ = 0;
+  scene_graph::node body_ = 0;
+  const mesh *head_ = nullptr;
+  const mesh *body_mesh_ = nullptr;
+  guest_motion motion_{(movement) (rand() % 4), 0.001f * ((rand() % 5) + 1)};
+  int material_ = rand() % 5;
+
 protected:
+  void add_nodes() override {
+    node_ = graph_->add(scene_graph::no_parent, mat4::translation(pos_));
+    body_ = graph_->add(node_, mat4::translation(0, -1, 0) * mat4::rotation_x(radians(-90)));
+    member_ = crowd_->join(pos_, node_);
+    head_ = &shapes_->sphere(0.2f, 30, 30);
+    body_mesh_ = &shapes_->cone(0.3f, 1, 30, 30);
+  }
 
   /**
    * Different Materials for the guests
    */
-  void material() override {
-    glMaterialfv(GL_FRONT, GL_EMISSION, zero);
+  void material(command_buffer &cmd) const override {
+    cmd.material(material_param::emission, zero);
     switch (material_) {
       case 0:
-        glMaterialfv(GL_FRONT, GL_AMBIENT, pink);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, pink);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, one);
-        glMaterialf(GL_FRONT, GL_SHININESS, shininess_mid);
+        cmd.material(material_param::ambient, pink);
+        cmd.material(material_param::diffuse, pink);
+        cmd.material(material_param::specular, one);
+        cmd.shininess(shininess_mid);
         break;
       case 1:
-        glMaterialfv(GL_FRONT, GL_AMBIENT, green);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, green);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-        glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
-        glMaterialfv(GL_FRONT, GL_EMISSION, green);
+        cmd.material(material_param::ambient, green);
+        cmd.material(material_param::diffuse, green);
+        cmd.material(material_param::specular, half);
+        cmd.shininess(shininess_high);
+        cmd.material(material_param::emission, green);
         break;
       case 2:
-        glMaterialfv(GL_FRONT, GL_AMBIENT, red);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, red);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-        glMaterialf(GL_FRONT, GL_SHININESS, shininess_high);
+        cmd.material(material_param::ambient, red);
+        cmd.material(material_param::diffuse, red);
+        cmd.material(material_param::specular, half);
+        cmd.shininess(shininess_high);
         break;
       case 3:
-        glMaterialfv(GL_FRONT, GL_AMBIENT, purple);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, purple);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-        glMaterialf(GL_FRONT, GL_SHININESS, shininess_mid);
+        cmd.material(material_param::ambient, purple);
+        cmd.material(material_param::diffuse, purple);
+        cmd.material(material_param::specular, half);
+        cmd.shininess(shininess_mid);
         break;
       case 4:
-        glMaterialfv(GL_FRONT, GL_AMBIENT, red_purple);
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, red_purple);
-        glMaterialfv(GL_FRONT, GL_SPECULAR, half);
-        glMaterialfv(GL_FRONT, GL_EMISSION, zero);
-        glMaterialf(GL_FRONT, GL_SHININESS, shininess_low);
+        cmd.material(material_param::ambient, red_purple);
+        cmd.material(material_param::diffuse, red_purple);
+        cmd.material(material_param::specular, half);
+        cmd.material(material_param::emission, zero);
+        cmd.shininess(shininess_low);
         break;
     }
   }
@@ -595,12 +807,26 @@ public:
     this->windowid_ = id;
   }
 
-  std::shared_ptr<light_settings> setting() {
+  /**
+   * Crowd of the guests, stepped after all game objects moved
+   */
+  void crowd(std::shared_ptr<disco_crowd> crowd) {
+    crowd_ = std::move(crowd);
+  }
+
+  const std::shared_ptr<light_settings> &setting() const noexcept {
     return sett_;
   }
 
+  /**
+   * The view direction only changes here, so sine and cosine are taken once
+   */
   void inc_horizontal_angle_by(const float inc) noexcept {
-    this->horizontal_angle_ += inc;
+    this->horizontal_angle_ = wrap_angle(this->horizontal_angle_ + inc);
+    float sin;
+    float cos;
+    fast_sincos(this->horizontal_angle_, sin, cos);
+    this->direction_ = vec3{sin, 0, -cos};
   }
 
   void inc_vertical_angle_by(const float inc) noexcept {
@@ -611,64 +837,120 @@ public:
     return this->vertical_angle_;
   }
 
-  float lx() const noexcept {
-    return std::sin(this->horizontal_angle_);
+  /**
+   * Apply the input since the last tick, move all game objects and hand the result to the renderer
+   */
+  void simulate(frame_snapshot &frame) {
+    for (const auto &go: game_objects) {
+      go->animate();
+    }
+    if (crowd_) {
+      crowd_->step(graph_);
+    }
+    graph_.update();
+    frame.view = view_matrix();
+    frame.settings = *sett_;
+    frame.world.resize(static_cast<std::size_t>(graph_.size()));
+    for (scene_graph::node n = 0; n < graph_.size(); n++) {
+      frame.world[static_cast<std::size_t>(n)] = graph_.world(n);
+    }
   }
 
-  float lz() const noexcept {
-    return -std::cos(this->horizontal_angle_);
+  static void position_view(const frame_snapshot &frame) {
+    glLoadMatrixf(frame.view.data());
   }
 
-  void position_view() const {
-    gluLookAt(camera_position_.x, camera_position_.y, camera_position_.z,
-              camera_position_.x + lx(), camera_position_.y + vertical_angle(), camera_position_.z + lz(),
-              0.0f, camera_position_.y, 0.0f);
+  /**
+   * Take the stroke font from GLUT for the text of the game objects, needs the GL context
+   */
+  void load_font() {
+    if (!capture_stroke_font(shapes_.font())) {
+      std::cout << "The stroke font is incomplete, some text may be missing" << std::endl;
+    }
   }
 
-  void add_game_object(const game_object_ptr &go) {
+  /**
+   * @param pass render pass of the timer the object is drawn in, objects following each other
+   * in the same pass are recorded together
+   */
+  void add_game_object(const game_object_ptr &go, int pass) {
+    go->attach(graph_, shapes_);
+    if (batches_.empty() || batches_.back().pass != pass) {
+      batches_.push_back({pass, game_objects.size(), game_objects.size()});
+    }
     game_objects.push_back(go);
+    batches_.back().last = game_objects.size();
   }
 
   /**
-   * Render all game objects
+   * Render all game objects as they are in a snapshot.
+   * Every batch is recorded on a worker, this thread replays the batches in order as they become
+   * ready and times each as its pass, so it makes nothing but driver calls.
    */
-  void render() {
+  void render(const frame_snapshot &frame, gpu_pass_timer &timer, thread_pool &workers) {
     for (const auto &go: game_objects) {
-      go->render();
+      go->prepare(frame);
+    }
+
+    buffers_.resize(batches_.size());
+    recorded_.assign(batches_.size(), 0);
+    // Tasks small enough for std::function to hold them without allocating
+    frame_ = &frame;
+    for (std::size_t b = 0; b < batches_.size(); b++) {
+      workers.submit([this, b] {
+        command_buffer &cmd = buffers_[b];
+        cmd.reset(frame_->view);
+        for (std::size_t i = batches_[b].first; i < batches_[b].last; i++) {
+          game_objects[i]->record(cmd, *frame_);
+        }
+        std::lock_guard<std::mutex> lock(record_mutex_);
+        recorded_[b] = 1;
+        record_done_.notify_one();
+      });
+    }
+
+    for (std::size_t b = 0; b < batches_.size(); b++) {
+      {
+        std::unique_lock<std::mutex> lock(record_mutex_);
+        record_done_.wait(lock, [this, b] { return recorded_[b] != 0; });
+      }
+      timer.begin(batches_[b].pass);
+      replay(buffers_[b]);
+      timer.end();
     }
+    // Leave the camera on the stack like drawing with push and pop did
+    position_view(frame);
   }
 
-  void render_lights() {
-    ambient_light();
-    point_light_left();
-    point_light_right();
-    spotlight();
-    fog();
+  /**
+   * Set up the lights and fog of a snapshot, relative to the camera on the modelview stack
+   */
+  static void render_lights(const light_settings &sett) {
+    ambient_light(sett);
+    point_light_left(sett);
+    point_light_right(sett);
+    spotlight(sett);
+    fog(sett);
   }
 
   void toggle_ambient_light() {
     sett_->ambient_light_enabled = !sett_->ambient_light_enabled;
-    ambient_light();
   }
 
   void toggle_point_light_left() {
     sett_->point_light_left_enabled = !sett_->point_light_left_enabled;
-    point_light_left();
   }
 
   void toggle_point_light_right() {
     sett_->point_light_right_enabled = !sett_->point_light_right_enabled;
-    point_light_right();
   }
 
   void toggle_spotlight() {
     sett_->spotlight_enabled = !sett_->spotlight_enabled;
-    spotlight();
   }
 
   void toggle_fog() {
     sett_->fog_enabled = !sett_->fog_enabled;
-    fog();
   }
 
 private:
@@ -676,52 +958,76 @@ private:
   int windowid_ = -1;
   float horizontal_angle_ = 0;
   float vertical_angle_ = 0;
-  position camera_position_{0, 0.7, 0};
+  vec3 camera_position_{0, 0.7, 0};
+  vec3 direction_{0, 0, -1};
   std::vector<game_object_ptr> game_objects;
+  scene_graph graph_;
+  shape_cache shapes_; // meshes and text of all game objects
+
+  /**
+   * Game objects [first, last) drawn in one timer pass
+   */
+  struct batch {
+    int pass;
+    std::size_t first;
+    std::size_t last;
+  };
+  std::vector<batch> batches_;
+  std::vector<command_buffer> buffers_; // one per batch, reused every frame
+  std::vector<char> recorded_;          // buffer of the batch is ready for replay
+  const frame_snapshot *frame_ = nullptr; // snapshot being recorded
+  std::mutex record_mutex_;
+  std::condition_variable record_done_;
 
   std::shared_ptr<light_settings> sett_;
+  std::shared_ptr<disco_crowd> crowd_;
 
   constexpr static const float fog_density = 0.2;
 
-  void ambient_light() const {
-    float intensity = sett_->ambient_light_intensity;
-    if (!sett_->ambient_light_enabled) {
+  mat4 view_matrix() const noexcept {
+    const vec3 target = camera_position_ + vec3{direction_.x, vertical_angle_, direction_.z};
+    return mat4::look_at(camera_position_, target, vec3{0, 1, 0});
+  }
+
+  static void ambient_light(const light_settings &sett) {
+    float intensity = sett.ambient_light_intensity;
+    if (!sett.ambient_light_enabled) {
       intensity = 0.0f;
     }
     GLfloat lmodel_ambient[] = {intensity, intensity, intensity, 1.0f};
     glLightModelfv(GL_LIGHT_MODEL_AMBIENT, lmodel_ambient);
   }
 
-  void point_light_left() const {
+  static void point_light_left(const light_settings &sett) {
     GLfloat light_pos[] = {-room_size / 2 + 1, 3, -room_size / 2, 1.0f}; // Left side of the room
     glLightfv(GL_LIGHT0, GL_DIFFUSE, red);
     glLightfv(GL_LIGHT0, GL_SPECULAR, red);
     glLightfv(GL_LIGHT0, GL_POSITION, light_pos);
     glLightf(GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.15f);
-    if (sett_->point_light_left_enabled) {
+    if (sett.point_light_left_enabled) {
       glEnable(GL_LIGHT0);
     } else {
       glDisable(GL_LIGHT0);
     }
   }
 
-  void point_light_right() const {
+  static void point_light_right(const light_settings &sett) {
     GLfloat light_pos[] = {room_size / 2 - 1, 3, -room_size / 2, 1.0f}; // Right side of the room
     glLightfv(GL_LIGHT1, GL_DIFFUSE, blue);
     glLightfv(GL_LIGHT1, GL_SPECULAR, blue);
     glLightfv(GL_LIGHT1, GL_POSITION, light_pos);
     glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.15f);
-    if (sett_->point_light_right_enabled) {
+    if (sett.point_light_right_enabled) {
       glEnable(GL_LIGHT1);
     } else {
       glDisable(GL_LIGHT1);
     }
   }
 
-  void spotlight() {
+  static void spotlight(const light_settings &sett) {
     GLfloat light_pos[] = {0.0f, 4.0f, -room_size / 2, 1.0f};
 
-    GLfloat spot_direction[] = {sett_->spot_light_angel, -1.0f, 0.0f};
+    GLfloat spot_direction[] = {sett.spot_light_angel, -1.0f, 0.0f};
 
     glLightfv(GL_LIGHT2, GL_POSITION, light_pos);
     glLightfv(GL_LIGHT2, GL_SPOT_DIRECTION, spot_direction);
@@ -729,21 +1035,21 @@ private:
     glLightfv(GL_LIGHT2, GL_DIFFUSE, white);
     glLightf(GL_LIGHT2, GL_SPOT_CUTOFF, 20.0f);
     glLightf(GL_LIGHT2, GL_SPOT_EXPONENT, 0.03f);
-    if (sett_->spotlight_enabled) {
+    if (sett.spotlight_enabled) {
       glEnable(GL_LIGHT2);
     } else {
       glDisable(GL_LIGHT2);
     }
   }
 
-  void fog() const {
+  static void fog(const light_settings &sett) {
     glFogi(GL_FOG_MODE, GL_EXP);
     glFogfv(GL_FOG_COLOR, gray);
     glFogf(GL_FOG_DENSITY, fog_density);
     glHint(GL_FOG_HINT, GL_DONT_CARE);
     glFogf(GL_FOG_START, 2.0f);
     glFogf(GL_FOG_END, 4.0f);
-    if (sett_->fog_enabled) {
+    if (sett.fog_enabled) {
       glEnable(GL_FOG);
     } else {
       glDisable(GL_FOG);
@@ -753,10 +1059,34 @@ private:
 
 
 /* Game State */
-game_state state;
+game_state state{std::make_shared<light_settings>()};
 
-/*-[Keyboard Callback]-------------------------------------------------------*/
-void keyboard(unsigned char key, int x, int y) {
+gpu_pass_timer pass_timer;
+thread_pool workers; // bake the lightmap, record for the GL thread and step the crowd for the simulation
+bool show_pass_times = false;
+frame_alloc_monitor alloc_monitor("ueb02");
+frame_arena frame_memory(16 * 1024); // transient data of the frame being rendered
+resolution_controller resolution;
+scaled_render_target scaled_target;
+frame_capture capture;
+
+/**
+ * Input from the GLUT callbacks for the simulation
+ */
+struct input_event {
+  enum class kind {
+    key, look
+  } type;
+  unsigned char key;
+  float horizontal; // angles to look around by
+  float vertical;
+};
+
+spsc_queue<input_event, 256> inputs;
+triple_buffer<frame_snapshot> snapshots;
+simulation_thread simulation(simulation_rate);
+
+void apply_key(unsigned char key) {
   switch (key) {
     case 'a':
       state.toggle_ambient_light();
@@ -773,35 +1103,90 @@ void keyboard(unsigned char key, int x, int y) {
     case 'g':
       state.toggle_spotlight();
       break;
+    case 'l': {
+      light_settings &sett = *state.setting();
+      sett.lightmap_enabled = !sett.lightmap_enabled;
+      break;
+    }
     case 'q': {
-      auto sett = state.setting();
-      if (sett->spot_light_angel > -max_angel)
-        sett->spot_light_angel -= spot_light_step;
+      light_settings &sett = *state.setting();
+      if (sett.spot_light_angel > -max_angel)
+        sett.spot_light_angel -= spot_light_step;
       break;
     }
     case 'e': {
-      auto sett = state.setting();
-      if (sett->spot_light_angel < max_angel)
-        sett->spot_light_angel += spot_light_step;
+      light_settings &sett = *state.setting();
+      if (sett.spot_light_angel < max_angel)
+        sett.spot_light_angel += spot_light_step;
       break;
     }
     case 'x': {
-      auto sett = state.setting();
-      if (sett->ambient_light_intensity < 1)
-        sett->ambient_light_intensity += light_intensity_step;
+      light_settings &sett = *state.setting();
+      if (sett.ambient_light_intensity < 1)
+        sett.ambient_light_intensity += light_intensity_step;
       break;
     }
     case 'y': {
-      auto sett = state.setting();
-      if (sett->ambient_light_intensity > 0)
-        sett->ambient_light_intensity -= light_intensity_step;
+      light_settings &sett = *state.setting();
+      if (sett.ambient_light_intensity > 0)
+        sett.ambient_light_intensity -= light_intensity_step;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void apply_input(const input_event &in) {
+  switch (in.type) {
+    case input_event::kind::key:
+      apply_key(in.key);
+      break;
+    case input_event::kind::look: {
+      state.inc_horizontal_angle_by(in.horizontal);
+      float new_vertical_angle = in.vertical + state.vertical_angle();
+      // Limit vertical camera movement
+      if (new_vertical_angle < vertical_camera_top_limit
+          && new_vertical_angle >= vertical_camera_bot_limit) {
+        state.inc_vertical_angle_by(in.vertical);
+      }
       break;
     }
+  }
+}
+
+/**
+ * One step of the simulation thread: the input since the last tick, then everything moves
+ */
+void simulate() {
+  input_event in{};
+  while (inputs.pop(in)) {
+    apply_input(in);
+  }
+  state.simulate(snapshots.back());
+  snapshots.publish();
+}
+
+/*-[Keyboard Callback]-------------------------------------------------------*/
+void keyboard(unsigned char key, int x, int y) {
+  switch (key) {
+    case 'p':
+      show_pass_times = !show_pass_times;
+      break;
+    case 't':
+      if (pass_timer.write_trace("ueb02_trace.json")) {
+        std::cout << "Wrote ueb02_trace.json" << std::endl;
+      }
+      break;
     case 27: // Escape key
+      simulation.stop();
+      capture.stop();
       glutDestroyWindow(state.windowid());
       exit(0);
       break;
     default:
+      // Everything else changes the disco, which is up to the simulation
+      inputs.push({input_event::kind::key, key, 0, 0});
       break;
   }
   glutPostRedisplay();
@@ -812,17 +1197,10 @@ void mouse_motion(int x, int y) {
   int vertical_center = glutGet(GLUT_WINDOW_HEIGHT) / 2;
   int horizontal_center = glutGet(GLUT_WINDOW_WIDTH) / 2;
 
-  // horizontal horizontal_angle
-  state.inc_horizontal_angle_by(static_cast<float>(x - horizontal_center) * lookaround_speed);
-  // vertical horizontal_angle
-  float diff = -((float) y - (float) vertical_center) * lookaround_speed;
-  float new_vertical_angle = diff + state.vertical_angle();
-
-  // Limit vertical camera movement
-  if (new_vertical_angle < vertical_camera_top_limit
-      && new_vertical_angle >= vertical_camera_bot_limit) {
-    state.inc_vertical_angle_by(diff);
-  }
+  // horizontal and vertical angle, the simulation limits the vertical one
+  inputs.push({input_event::kind::look, 0,
+               static_cast<float>(x - horizontal_center) * lookaround_speed,
+               -((float) y - (float) vertical_center) * lookaround_speed});
 
   // Have to check for an area,
   // since the glutWarpPointer function will fire mouse_motion again
@@ -843,16 +1221,42 @@ void reshapeFunc(int x, int y) {
   if (y == 0 || x == 0) return;  //Nothing is visible then, so return
 
   glMatrixMode(GL_PROJECTION); //Set a new projection matrix
-  glLoadIdentity();
   //Angle of view: 40 degrees
   //Near clipping plane distance: 0.5
   //Far clipping plane distance: 20.0
 
-  gluPerspective(40.0, (GLdouble) x / (GLdouble) y, 0.5, 40.0);
+  glLoadMatrixf(mat4::perspective(radians(40), (float) x / (float) y, 0.5, 40).data());
   glViewport(0, 0, x, y);  //Use the whole window for rendering
+  scaled_target.resize(x, y);
+}
+
+/**
+ * Show the resolution in the title, twice a second is enough to read it
+ */
+void show_resolution() {
+  static auto shown = std::chrono::steady_clock::now();
+  const auto now = std::chrono::steady_clock::now();
+  if (now - shown < std::chrono::milliseconds(500)) {
+    return;
+  }
+  shown = now;
+  char title[64];
+  std::snprintf(title, sizeof(title), "Disco - %d %% resolution%s", static_cast<int>(resolution.scale() * 100 + 0.5f),
+                resolution.fixed() ? " (fixed)" : "");
+  glutSetWindowTitle(title);
 }
 
 void render_scene() {
+  static const int clear_pass = pass_timer.pass("clear");
+  static const int upscale_pass = pass_timer.pass("upscale");
+  static const int overlay_pass = pass_timer.pass("overlay");
+  static const int capture_pass = pass_timer.pass("capture");
+  frame_memory.reset();
+  alloc_monitor.begin_frame();
+  const float scale = resolution.next_frame();
+  pass_timer.begin_frame();
+  pass_timer.begin(clear_pass);
+  scaled_target.begin(scale);
   glMatrixMode(GL_MODELVIEW);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   // For overlapping objects
@@ -864,27 +1268,56 @@ void render_scene() {
 
   glClearColor(0.0, 0.0, 0.0, 0.0); // Original Black
 
-  glLoadIdentity();
-  state.position_view();
-  state.render_lights();
-  state.render();
+  pass_timer.end();
+
+  // The newest tick the simulation finished, or the last one again if there is none
+  snapshots.update();
+  const frame_snapshot &frame = snapshots.front();
+  game_state::position_view(frame);
+  game_state::render_lights(frame.settings);
+  state.render(frame, pass_timer, workers);
+  pass_timer.begin(upscale_pass);
+  scaled_target.end();
+  pass_timer.end();
+  if (show_pass_times) {
+    pass_timer.begin(overlay_pass);
+    pass_timer.draw_overlay(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT), frame_memory);
+    pass_timer.end();
+  }
+  if (capture.active()) {
+    pass_timer.begin(capture_pass);
+    capture.capture(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+    pass_timer.end();
+  }
+  pass_timer.end_frame();
   glutSwapBuffers();
+  show_resolution();
+  alloc_monitor.end_frame();
 }
 
 /**
  * Fill the disco with guests and equipment
  */
 void init_disco() {
-  state.add_game_object(std::make_shared<disco_room>());
-  state.add_game_object(std::make_shared<dj_booth>(state.setting()));
-  state.add_game_object(std::make_shared<light_cone>(state.setting()));
-  state.add_game_object(std::make_shared<disco_ball>(-room_size / 2 + 1, white));
-  state.add_game_object(std::make_shared<disco_ball>(room_size / 2 - 1, white));
+  state.load_font();
+  auto lighting = std::make_shared<baked_lighting>();
+  lighting->bake(*state.setting(), &workers);
+  // Almost all of the room is the floor sphere
+  state.add_game_object(std::make_shared<disco_room>(lighting), pass_timer.pass("room"));
+  state.add_game_object(std::make_shared<dj_booth>(state.setting(), lighting), pass_timer.pass("dj booth"));
+  state.add_game_object(std::make_shared<light_cone>(state.setting()), pass_timer.pass("light cone"));
+  const int disco_balls = pass_timer.pass("disco balls");
+  state.add_game_object(std::make_shared<disco_ball>(-room_size / 2 + 1, white), disco_balls);
+  state.add_game_object(std::make_shared<disco_ball>(room_size / 2 - 1, white), disco_balls);
+  const int guests = pass_timer.pass("guests");
+  auto crowd = std::make_shared<disco_crowd>(&workers);
+  state.crowd(crowd);
   for (int i = 0; i < 5; i++) {
     state.add_game_object(std::make_shared<guest>(
         (float) i - room_size / 4,
-        -room_size / 2 + (i % 2 == 0 ? 1.0 : -1.0)
-    ));
+        -room_size / 2 + (i % 2 == 0 ? 1.0 : -1.0),
+        crowd
+    ), guests);
   }
 }
 
@@ -892,7 +1325,7 @@ void init_disco() {
  * Initialize lights
  */
 void init_light_sources() {
-  state.render_lights();
+  game_state::render_lights(*state.setting());
   glEnable(GL_LIGHTING);
   glEnable(GL_DEPTH_TEST);
 }
@@ -900,21 +1333,35 @@ void init_light_sources() {
 int main(int argc, char **argv) {
   srand(time(nullptr));
 
-  auto sett = std::make_shared<light_settings>();
-  state = game_state(sett);
-
   glutInit(&argc, argv);
+  if (!resolution.parse_args(argc, argv) || !capture.parse_args(argc, argv)) {
+    return 1;
+  }
   glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
   glutInitWindowPosition(500, 500); //determines the initial position of the window
   glutInitWindowSize(800, 600);    //determines the size of the window
 
   state.windowid(glutCreateWindow("Disco"));
 
+  GLenum glewStatus = glewInit();
+  if (glewStatus != GLEW_OK) {
+    std::cout << "GLEW could not be initialized: " << glewGetErrorString(glewStatus) << std::endl;
+    return 1;
+  }
+  pass_timer.init();
+  scaled_target.init();
+  if (!capture.init()) {
+    return 1;
+  }
+
   glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
   glutSetCursor(GLUT_CURSOR_NONE);
   init_light_sources();
 
   init_disco();
+  // The renderer has a frame before the first tick, the thread start orders this before the ticks
+  simulate();
+  simulation.start(simulate);
 
   // register callbacks
   glutKeyboardFunc(keyboard);
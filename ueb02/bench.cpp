@@ -0,0 +1,149 @@
+//
+// CPU paths of the disco: guests moving, the scene graph update their movement causes, and keeping
+// a large crowd apart, spread out evenly and packed into a few dense clusters. Times are per guest and frame.
+// Usage: bench [--json path|-] [--filter text] [--samples n] [--min-sample-ms ms]
+//
+
+#include "bench.h"
+#include "crowd.h"
+#include "crowd_grid.h"
+#include "guest_motion.h"
+#include "scene_graph.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int guest_count = 4096;
+constexpr int crowd_size = 131072;
+
+struct bench_guest {
+  vec3 pos;
+  guest_motion motion;
+  scene_graph::node node;
+};
+
+/**
+ * Guests with all kinds of movement, each with a body below it like in the game
+ */
+std::vector<bench_guest> crowd(std::mt19937 &random, scene_graph &graph) {
+  std::uniform_int_distribution<int> kind(0, 3);
+  std::uniform_int_distribution<int> speed(1, 5);
+  std::uniform_real_distribution<float> place(-5, 5);
+  std::vector<bench_guest> guests;
+  for (int i = 0; i < guest_count; i++) {
+    const vec3 pos{place(random), 0, place(random)};
+    const scene_graph::node node = graph.add(scene_graph::no_parent, mat4::translation(pos));
+    graph.add(node, mat4::translation(0, -1, 0) * mat4::rotation_x(radians(-90)));
+    guests.push_back({pos, guest_motion{static_cast<movement>(kind(random)), 0.001f * speed(random)}, node});
+  }
+  return guests;
+}
+
+/**
+ * Guests spread over a floor with about one guest per personal space
+ */
+std::vector<vec3> even_crowd(std::mt19937 &random, float radius) {
+  const float edge = std::sqrt(static_cast<float>(crowd_size)) * 2 * radius;
+  std::uniform_real_distribution<float> place(-edge / 2, edge / 2);
+  std::vector<vec3> positions(crowd_size);
+  for (auto &p : positions) {
+    p = vec3{place(random), 0, place(random)};
+  }
+  return positions;
+}
+
+/**
+ * Guests crowding around a few spots, hundreds of them to a cell
+ */
+std::vector<vec3> clustered_crowd(std::mt19937 &random, float radius) {
+  std::uniform_real_distribution<float> spot(-100, 100);
+  std::normal_distribution<float> around(0, 4 * radius);
+  vec3 spots[8];
+  for (auto &s : spots) {
+    s = vec3{spot(random), 0, spot(random)};
+  }
+  std::vector<vec3> positions(crowd_size);
+  for (std::size_t i = 0; i < positions.size(); i++) {
+    const vec3 &s = spots[i % 8];
+    positions[i] = vec3{s.x + around(random), 0, s.z + around(random)};
+  }
+  return positions;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bench_suite suite("ueb02", argc, argv);
+  std::mt19937 random(1910307103);
+
+  scene_graph graph;
+  std::vector<bench_guest> guests = crowd(random, graph);
+  graph.update();
+
+  suite.run("guest_motion/step", guest_count, [&] {
+    for (auto &g : guests) {
+      g.motion.step(g.pos);
+    }
+    do_not_optimize(guests.data());
+  });
+
+  // What animate does for every guest each frame, followed by the update before rendering
+  suite.run("guest_motion/step_and_update", guest_count, [&] {
+    for (auto &g : guests) {
+      g.motion.step(g.pos);
+      graph.set_local(g.node, mat4::translation(g.pos));
+    }
+    do_not_optimize(graph.update());
+  });
+
+  thread_pool pool;
+  const crowd_params params;
+  const std::vector<vec3> even = even_crowd(random, params.radius);
+  const std::vector<vec3> clustered = clustered_crowd(random, params.radius);
+  for (const auto *positions : {&even, &clustered}) {
+    const std::string layout = positions == &even ? "/even" : "/clustered";
+    for (thread_pool *p : {static_cast<thread_pool *>(nullptr), &pool}) {
+      const std::string threads = p == nullptr ? "/serial" : "/pool";
+      crowd_grid grid(2 * params.radius);
+      suite.run("crowd_grid/build" + layout + threads, crowd_size, [&] {
+        grid.build(*positions, p);
+        do_not_optimize(grid.size());
+      });
+    }
+
+    // What a separation step asks of the grid, every guest in bucket order looks for its nearest few
+    crowd_grid grid(2 * params.radius);
+    grid.build(*positions);
+    suite.run("crowd_grid/query" + layout, crowd_size, [&] {
+      int found = 0;
+      for (std::size_t s = 0; s < grid.size(); s++) {
+        const vec3 &pos = (*positions)[static_cast<std::size_t>(grid.sorted_guest(s))];
+        int neighbours = 0;
+        grid.for_each_near(pos.x, pos.z, grid.cell_size(), [&neighbours, &params](int, float, float, float) {
+          return ++neighbours < params.max_neighbours;
+        });
+        found += neighbours;
+      }
+      do_not_optimize(found);
+    });
+
+    for (thread_pool *p : {static_cast<thread_pool *>(nullptr), &pool}) {
+      const std::string threads = p == nullptr ? "/serial" : "/pool";
+      // Every call starts from the same crowd, the copy is part of the times
+      crowd_separation separation(params);
+      std::vector<vec3> working;
+      suite.run("crowd_separation/step" + layout + threads, crowd_size, [&] {
+        working = *positions;
+        separation.step(working, p);
+        do_not_optimize(working.data());
+      });
+    }
+  }
+
+  return suite.finish();
+}
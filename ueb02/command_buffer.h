@@ -0,0 +1,246 @@
+//
+// Recorded draw commands, independent of the graphics API.
+// Game objects record what they draw into a command buffer on any thread, only replaying the buffer
+// talks to the driver, see gl_replay.h. Commands are packed into one byte stream, an opcode followed by
+// its arguments, so recording is appending bytes and a cleared buffer keeps its memory for the next frame.
+// Solids are recorded as meshes which outlive the buffer, text as the vertices of its strokes, so
+// replaying doesn't have to build any geometry.
+//
+
+#ifndef UEB02_COMMAND_BUFFER_H
+#define UEB02_COMMAND_BUFFER_H
+
+#include "vecmath.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum class command : std::uint8_t {
+  transform,        // mat4 modelview
+  material,         // material_param, float[4]
+  shininess,        // float
+  flat_shading,     // bool
+  enable,           // capability
+  disable,          // capability
+  push_attributes,
+  pop_attributes,
+  bind_texture,     // unsigned
+  texture_add,
+  tex_gen,          // float[4] s plane, float[4] t plane
+  begin,            // primitive
+  end,
+  normal,           // float[3]
+  tex_coord,        // float[2]
+  vertex,           // float[3]
+  triangles,        // const mesh *
+  lines,            // std::uint32_t vertices, float[3] per vertex
+};
+
+struct mesh;
+
+enum class material_param : std::uint8_t {
+  ambient, diffuse, specular, emission
+};
+
+enum class capability : std::uint8_t {
+  light0, light1, texture_2d, texture_gen_s, texture_gen_t
+};
+
+enum class primitive : std::uint8_t {
+  quads
+};
+
+class command_buffer {
+public:
+  /**
+   * Drop the commands and start recording for a camera, the memory is kept
+   * @param view camera matrix the object transforms are multiplied onto
+   */
+  void reset(const mat4 &view) {
+    bytes_.clear();
+    view_ = view;
+  }
+
+  const unsigned char *data() const noexcept {
+    return bytes_.data();
+  }
+
+  std::size_t size() const noexcept {
+    return bytes_.size();
+  }
+
+  /**
+   * Draw in object space of the given world matrix from here on
+   */
+  void transform(const mat4 &world) {
+    op(command::transform);
+    put(view_ * world);
+  }
+
+  /**
+   * Material of front faces
+   */
+  void material(material_param param, const float colour[4]) {
+    op(command::material);
+    put(param);
+    put_floats(colour, 4);
+  }
+
+  void shininess(float shininess) {
+    op(command::shininess);
+    put(shininess);
+  }
+
+  void flat_shading(bool flat) {
+    op(command::flat_shading);
+    put(flat);
+  }
+
+  void enable(capability cap) {
+    op(command::enable);
+    put(cap);
+  }
+
+  void disable(capability cap) {
+    op(command::disable);
+    put(cap);
+  }
+
+  /**
+   * Save which capabilities are enabled and the texture state, until pop_attributes
+   */
+  void push_attributes() {
+    op(command::push_attributes);
+  }
+
+  void pop_attributes() {
+    op(command::pop_attributes);
+  }
+
+  void bind_texture(unsigned texture) {
+    op(command::bind_texture);
+    put(texture);
+  }
+
+  /**
+   * Add the texture to the lit colour
+   */
+  void texture_add() {
+    op(command::texture_add);
+  }
+
+  /**
+   * Generate texture coordinates from object coordinates with the given planes, and enable that
+   */
+  void tex_gen(const float s_plane[4], const float t_plane[4]) {
+    op(command::tex_gen);
+    put_floats(s_plane, 4);
+    put_floats(t_plane, 4);
+  }
+
+  void begin(primitive p) {
+    op(command::begin);
+    put(p);
+  }
+
+  void end() {
+    op(command::end);
+  }
+
+  void normal(float x, float y, float z) {
+    op(command::normal);
+    const float n[] = {x, y, z};
+    put_floats(n, 3);
+  }
+
+  void tex_coord(float u, float v) {
+    op(command::tex_coord);
+    const float uv[] = {u, v};
+    put_floats(uv, 2);
+  }
+
+  void vertex(float x, float y, float z) {
+    op(command::vertex);
+    const float v[] = {x, y, z};
+    put_floats(v, 3);
+  }
+
+  /**
+   * Draw the triangles of a mesh with its normals, the mesh has to live until the buffer was replayed
+   */
+  void triangles(const mesh &m) {
+    op(command::triangles);
+    put(&m);
+  }
+
+  /**
+   * Draw line segments, a pair of vertices each
+   * @param xyz three floats per vertex
+   */
+  void lines(const std::vector<float> &xyz) {
+    op(command::lines);
+    put(static_cast<std::uint32_t>(xyz.size() / 3));
+    put_floats(xyz.data(), xyz.size() / 3 * 3);
+  }
+
+private:
+  std::vector<unsigned char> bytes_;
+  mat4 view_;
+
+  void op(command c) {
+    bytes_.push_back(static_cast<unsigned char>(c));
+  }
+
+  template<typename T>
+  void put(const T &value) {
+    const std::size_t at = bytes_.size();
+    bytes_.resize(at + sizeof(T));
+    std::memcpy(bytes_.data() + at, &value, sizeof(T));
+  }
+
+  void put_floats(const float *values, std::size_t count) {
+    const std::size_t at = bytes_.size();
+    bytes_.resize(at + count * sizeof(float));
+    std::memcpy(bytes_.data() + at, values, count * sizeof(float));
+  }
+};
+
+/**
+ * Walks the commands of a buffer, for the replay of a backend
+ */
+class command_reader {
+public:
+  explicit command_reader(const command_buffer &buffer) noexcept
+      : at_(buffer.data()), end_(buffer.data() + buffer.size()) {}
+
+  bool done() const noexcept {
+    return at_ == end_;
+  }
+
+  command op() noexcept {
+    return static_cast<command>(*at_++);
+  }
+
+  template<typename T>
+  T get() noexcept {
+    T value;
+    std::memcpy(&value, at_, sizeof(T));
+    at_ += sizeof(T);
+    return value;
+  }
+
+  /**
+   * Copy count floats out of the buffer, which has no alignment to point into
+   */
+  void get_floats(float *values, std::size_t count) noexcept {
+    std::memcpy(values, at_, count * sizeof(float));
+    at_ += count * sizeof(float);
+  }
+
+private:
+  const unsigned char *at_;
+  const unsigned char *end_;
+};
+
+#endif //UEB02_COMMAND_BUFFER_H
@@ -0,0 +1,91 @@
+//
+// Separation of the guests, see crowd.h
+//
+
+#include "crowd.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int grain = 1024;
+constexpr float golden_angle = 2.39996323f;
+
+} // namespace
+
+void crowd_separation::step(std::vector<vec3> &positions, thread_pool *pool) {
+  const int n = static_cast<int>(positions.size());
+  grid_.build(positions, pool);
+  pushes_.resize(positions.size());
+
+  // All pushes are taken from the old positions before any guest moves, so the order doesn't matter
+  if (pool != nullptr && n >= parallel_threshold) {
+    pool->parallel_for(0, n, grain, [this, &positions](int first, int last) { push_range(positions, first, last); });
+    pool->parallel_for(0, n, grain, [this, &positions](int first, int last) { move_range(positions, first, last); });
+  } else {
+    push_range(positions, 0, n);
+    move_range(positions, 0, n);
+  }
+}
+
+void crowd_separation::push_range(const std::vector<vec3> &positions, int first, int last) {
+  const float distance = 2 * params_.radius;
+  const float share = 0.5f * params_.stiffness; // each of the two guests moves half of the way
+  // In bucket order the neighbours of one guest are mostly in cache from the guest before
+  for (int s = first; s < last; s++) {
+    const int i = grid_.sorted_guest(static_cast<std::size_t>(s));
+    const vec3 &p = positions[static_cast<std::size_t>(i)];
+    float push_x = 0;
+    float push_z = 0;
+    int neighbours = 0;
+    grid_.for_each_near(p.x, p.z, distance, [&](int j, float dx, float dz, float distance_squared) {
+      if (j == i) {
+        return true;
+      }
+      const float d = std::sqrt(distance_squared);
+      const float overlap = (distance - d) * share;
+      if (d > 1e-6f) {
+        push_x -= dx / d * overlap;
+        push_z -= dz / d * overlap;
+      } else {
+        // Guests on the same spot part in directions a golden angle apart, so a whole stack spreads out
+        const float angle = golden_angle * static_cast<float>(i);
+        push_x += std::cos(angle) * overlap;
+        push_z += std::sin(angle) * overlap;
+      }
+      return ++neighbours < params_.max_neighbours;
+    });
+    pushes_[static_cast<std::size_t>(i)] = vec3{push_x, 0, push_z};
+  }
+}
+
+void crowd_separation::move_range(std::vector<vec3> &positions, int first, int last) const {
+  const float r = params_.radius;
+  for (int i = first; i < last; i++) {
+    vec3 &p = positions[static_cast<std::size_t>(i)];
+    const vec3 &push = pushes_[static_cast<std::size_t>(i)];
+    p.x += push.x;
+    p.z += push.z;
+    for (const auto &o : obstacles_) {
+      // Out through the nearest side of the footprint grown by the radius
+      const float left = p.x - (o.min_x - r);
+      const float right = (o.max_x + r) - p.x;
+      const float front = p.z - (o.min_z - r);
+      const float back = (o.max_z + r) - p.z;
+      if (left <= 0 || right <= 0 || front <= 0 || back <= 0) {
+        continue;
+      }
+      const float nearest = std::min(std::min(left, right), std::min(front, back));
+      if (nearest == left) {
+        p.x -= left;
+      } else if (nearest == right) {
+        p.x += right;
+      } else if (nearest == front) {
+        p.z -= front;
+      } else {
+        p.z += back;
+      }
+    }
+  }
+}
@@ -0,0 +1,71 @@
+//
+// Guests of the disco keeping their distance: guests closer than two radii are pushed apart, and guests
+// are pushed out of the footprint of obstacles like the dj booth. Neighbours are found with a
+// crowd_grid and only a limited number of them is looked at, so a step stays linear in the number
+// of guests even when they pack together, the push apart spreads them out over the next steps.
+//
+
+#ifndef UEB02_CROWD_H
+#define UEB02_CROWD_H
+
+#include "crowd_grid.h"
+#include "thread_pool.h"
+#include "vecmath.h"
+
+#include <vector>
+
+struct crowd_params {
+  float radius = 0.3f;     // personal space of a guest
+  float stiffness = 0.5f;  // share of an overlap resolved in one step
+  int max_neighbours = 12; // neighbours pushing a guest in one step
+};
+
+/**
+ * Footprint of an obstacle on the floor
+ */
+struct crowd_obstacle {
+  float min_x;
+  float min_z;
+  float max_x;
+  float max_z;
+};
+
+class crowd_separation {
+public:
+  /**
+   * Fewer guests than this are pushed on the calling thread
+   */
+  static constexpr int parallel_threshold = 4096;
+
+  explicit crowd_separation(crowd_params params = crowd_params{}) noexcept
+      : params_(params), grid_(2 * params.radius) {}
+
+  void add_obstacle(const crowd_obstacle &obstacle) {
+    obstacles_.push_back(obstacle);
+  }
+
+  /**
+   * Push the guests apart and out of the obstacles, only x and z change
+   * @param pool shares out the work if given
+   */
+  void step(std::vector<vec3> &positions, thread_pool *pool = nullptr);
+
+  /**
+   * Grid of the positions before the last step
+   */
+  const crowd_grid &grid() const noexcept {
+    return grid_;
+  }
+
+private:
+  crowd_params params_;
+  crowd_grid grid_;
+  std::vector<crowd_obstacle> obstacles_;
+  std::vector<vec3> pushes_; // of every guest in the current step
+
+  void push_range(const std::vector<vec3> &positions, int first, int last);
+
+  void move_range(std::vector<vec3> &positions, int first, int last) const;
+};
+
+#endif //UEB02_CROWD_H
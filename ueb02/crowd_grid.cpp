@@ -0,0 +1,128 @@
+//
+// Counting sort of the guests into grid buckets, see crowd_grid.h
+//
+
+#include "crowd_grid.h"
+
+#include <algorithm>
+
+namespace {
+
+std::uint32_t power_of_two_at_least(std::size_t n) noexcept {
+  std::uint32_t p = 64;
+  while (p < n) {
+    p *= 2;
+  }
+  return p;
+}
+
+/**
+ * [first, last) of part index of count things split into parts
+ */
+void part_range(std::size_t count, int parts, int index, std::size_t &first, std::size_t &last) noexcept {
+  const std::size_t length = (count + static_cast<std::size_t>(parts) - 1) / static_cast<std::size_t>(parts);
+  first = std::min(count, length * static_cast<std::size_t>(index));
+  last = std::min(count, first + length);
+}
+
+} // namespace
+
+constexpr int crowd_grid::parallel_threshold;
+constexpr int crowd_grid::max_chunks;
+
+void crowd_grid::build(const std::vector<vec3> &positions, thread_pool *pool) {
+  const std::size_t n = positions.size();
+  // About one guest per bucket, so collisions stay rare
+  const std::uint32_t buckets = power_of_two_at_least(n);
+  bucket_mask_ = buckets - 1;
+  chunks_ = pool != nullptr && n >= static_cast<std::size_t>(parallel_threshold)
+            ? std::min(static_cast<int>(pool->size()) + 1, max_chunks) : 1;
+
+  buckets_.resize(n);
+  keys_.resize(n);
+  offsets_.resize(static_cast<std::size_t>(chunks_) * buckets);
+  bucket_start_.resize(static_cast<std::size_t>(buckets) + 1);
+  block_start_.resize(static_cast<std::size_t>(chunks_) + 1);
+  order_.resize(n);
+  sorted_keys_.resize(n);
+  sorted_x_.resize(n);
+  sorted_z_.resize(n);
+
+  for_each_chunk(pool, [this, &positions](int chunk) { count(positions, chunk); });
+
+  // Exclusive prefix sum over the buckets, blocks of buckets are summed in parallel and then offset
+  const int blocks = chunks_;
+  for_each_chunk(pool, [this, blocks](int block) { sum_buckets(block, blocks); });
+  block_start_[0] = 0;
+  for (int b = 0; b < blocks; b++) {
+    block_start_[static_cast<std::size_t>(b) + 1] += block_start_[static_cast<std::size_t>(b)];
+  }
+  for_each_chunk(pool, [this, blocks](int block) { assign_offsets(block, blocks); });
+  bucket_start_[buckets] = static_cast<std::uint32_t>(n);
+
+  for_each_chunk(pool, [this, &positions](int chunk) { scatter(positions, chunk); });
+}
+
+void crowd_grid::count(const std::vector<vec3> &positions, int chunk) {
+  const std::size_t buckets = bucket_mask_ + std::size_t{1};
+  std::uint32_t *counts = offsets_.data() + static_cast<std::size_t>(chunk) * buckets;
+  std::fill(counts, counts + buckets, 0);
+  std::size_t first;
+  std::size_t last;
+  part_range(positions.size(), chunks_, chunk, first, last);
+  for (std::size_t i = first; i < last; i++) {
+    const int cx = cell(positions[i].x);
+    const int cz = cell(positions[i].z);
+    keys_[i] = cell_key(cx, cz);
+    buckets_[i] = bucket(cx, cz);
+    counts[buckets_[i]]++;
+  }
+}
+
+void crowd_grid::sum_buckets(int block, int blocks) {
+  const std::size_t buckets = bucket_mask_ + std::size_t{1};
+  std::size_t first;
+  std::size_t last;
+  part_range(buckets, blocks, block, first, last);
+  std::uint32_t sum = 0;
+  for (int c = 0; c < chunks_; c++) {
+    const std::uint32_t *counts = offsets_.data() + static_cast<std::size_t>(c) * buckets;
+    for (std::size_t b = first; b < last; b++) {
+      sum += counts[b];
+    }
+  }
+  block_start_[static_cast<std::size_t>(block) + 1] = sum;
+}
+
+void crowd_grid::assign_offsets(int block, int blocks) {
+  const std::size_t buckets = bucket_mask_ + std::size_t{1};
+  std::size_t first;
+  std::size_t last;
+  part_range(buckets, blocks, block, first, last);
+  // Within a bucket the chunks write one after the other, which keeps the guests in input order
+  std::uint32_t next = block_start_[static_cast<std::size_t>(block)];
+  for (std::size_t b = first; b < last; b++) {
+    bucket_start_[b] = next;
+    for (int c = 0; c < chunks_; c++) {
+      std::uint32_t &offset = offsets_[static_cast<std::size_t>(c) * buckets + b];
+      const std::uint32_t guests = offset;
+      offset = next;
+      next += guests;
+    }
+  }
+}
+
+void crowd_grid::scatter(const std::vector<vec3> &positions, int chunk) {
+  const std::size_t buckets = bucket_mask_ + std::size_t{1};
+  std::uint32_t *offsets = offsets_.data() + static_cast<std::size_t>(chunk) * buckets;
+  std::size_t first;
+  std::size_t last;
+  part_range(positions.size(), chunks_, chunk, first, last);
+  for (std::size_t i = first; i < last; i++) {
+    const std::uint32_t s = offsets[buckets_[i]]++;
+    order_[s] = static_cast<int>(i);
+    sorted_keys_[s] = keys_[i];
+    sorted_x_[s] = positions[i].x;
+    sorted_z_[s] = positions[i].z;
+  }
+}
@@ -0,0 +1,158 @@
+//
+// Uniform grid over the floor for finding guests near a point, hashed so that the floor needs no bounds.
+// Building bins the guests by cell with a counting sort: every chunk of guests counts its buckets, the
+// counts are turned into write offsets, and every chunk writes its guests to theirs. Each of the steps
+// is linear and the chunks run on a thread pool, so building costs the same however the guests cluster.
+// The positions are copied in bucket order, a query reads them without jumping around the input.
+//
+
+#ifndef UEB02_CROWD_GRID_H
+#define UEB02_CROWD_GRID_H
+
+#include "thread_pool.h"
+#include "vecmath.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+class crowd_grid {
+public:
+  /**
+   * Fewer guests than this are binned on the calling thread, the pool would cost more than it saves
+   */
+  static constexpr int parallel_threshold = 4096;
+
+  /**
+   * @param cell_size edge of a cell, queries are fastest with a radius of about one cell
+   */
+  explicit crowd_grid(float cell_size) noexcept : cell_size_(cell_size), inverse_cell_size_(1 / cell_size) {}
+
+  /**
+   * Bin the guests by their x and z, replacing what was built before
+   * @param pool shares out the work if given
+   */
+  void build(const std::vector<vec3> &positions, thread_pool *pool = nullptr);
+
+  /**
+   * Visit the guests within radius of a point on the floor, those in the cell of the point first, so
+   * stopping early finds the nearest ones in a packed crowd. The order is the same for every build of
+   * the same positions.
+   * @param visit called with the index of the guest, its offset from the point and the squared distance,
+   * returns false to stop
+   */
+  template<typename Visit>
+  void for_each_near(float x, float z, float radius, Visit &&visit) const {
+    const int centre_x = cell(x);
+    const int centre_z = cell(z);
+    const float radius_squared = radius * radius;
+    if (!visit_cell(centre_x, centre_z, x, z, radius_squared, visit)) {
+      return;
+    }
+    const int last_x = cell(x + radius);
+    const int last_z = cell(z + radius);
+    for (int cx = cell(x - radius); cx <= last_x; cx++) {
+      for (int cz = cell(z - radius); cz <= last_z; cz++) {
+        if ((cx != centre_x || cz != centre_z) && !visit_cell(cx, cz, x, z, radius_squared, visit)) {
+          return;
+        }
+      }
+    }
+  }
+
+  float cell_size() const noexcept {
+    return cell_size_;
+  }
+
+  std::size_t size() const noexcept {
+    return order_.size();
+  }
+
+  /**
+   * @return input index of the guest at a place in bucket order, guests near each other are near in this order
+   */
+  int sorted_guest(std::size_t place) const noexcept {
+    return order_[place];
+  }
+
+private:
+  static constexpr int max_chunks = 16;
+
+  float cell_size_;
+  float inverse_cell_size_;
+  std::uint32_t bucket_mask_ = 0;
+  int chunks_ = 1;
+  std::vector<std::uint32_t> buckets_;      // bucket of every guest, in input order
+  std::vector<std::uint64_t> keys_;         // cell of every guest, in input order
+  std::vector<std::uint32_t> offsets_;      // guests of each chunk per bucket, then where the chunk writes them
+  std::vector<std::uint32_t> bucket_start_; // first sorted guest of every bucket, one past the end at the back
+  std::vector<std::uint32_t> block_start_;  // first sorted guest of every block of buckets
+  std::vector<int> order_;                  // input index of the sorted guests
+  std::vector<std::uint64_t> sorted_keys_;
+  std::vector<float> sorted_x_;
+  std::vector<float> sorted_z_;
+
+  int cell(float coordinate) const noexcept {
+    return static_cast<int>(std::floor(coordinate * inverse_cell_size_));
+  }
+
+  static std::uint64_t cell_key(int cx, int cz) noexcept {
+    return static_cast<std::uint64_t>(static_cast<std::uint32_t>(cx)) << 32 | static_cast<std::uint32_t>(cz);
+  }
+
+  /**
+   * Cells next to each other along z get buckets next to each other, a query reads a few runs of memory.
+   * Knuth's golden ratio multiplier spreads the runs of the columns evenly over the buckets.
+   */
+  std::uint32_t bucket(int cx, int cz) const noexcept {
+    return (static_cast<std::uint32_t>(cx) * 2654435761u + static_cast<std::uint32_t>(cz)) & bucket_mask_;
+  }
+
+  /**
+   * @return false if visit asked to stop
+   */
+  template<typename Visit>
+  bool visit_cell(int cx, int cz, float x, float z, float radius_squared, Visit &visit) const {
+    const std::uint64_t key = cell_key(cx, cz);
+    const std::uint32_t b = bucket(cx, cz);
+    for (std::uint32_t s = bucket_start_[b]; s < bucket_start_[b + 1]; s++) {
+      // Other cells may share the bucket
+      if (sorted_keys_[s] != key) {
+        continue;
+      }
+      const float dx = sorted_x_[s] - x;
+      const float dz = sorted_z_[s] - z;
+      const float distance_squared = dx * dx + dz * dz;
+      if (distance_squared <= radius_squared && !visit(order_[s], dx, dz, distance_squared)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void count(const std::vector<vec3> &positions, int chunk);
+
+  void sum_buckets(int block, int blocks);
+
+  void assign_offsets(int block, int blocks);
+
+  void scatter(const std::vector<vec3> &positions, int chunk);
+
+  /**
+   * Run step for every chunk index, on the pool if there is more than one
+   */
+  template<typename Step>
+  void for_each_chunk(thread_pool *pool, Step &&step) {
+    if (chunks_ == 1) {
+      step(0);
+      return;
+    }
+    pool->parallel_for(0, chunks_, 1, [&step](int first, int last) {
+      for (int c = first; c < last; c++) {
+        step(c);
+      }
+    });
+  }
+};
+
+#endif //UEB02_CROWD_GRID_H
@@ -0,0 +1,195 @@
+//
+// OpenGL replay of command buffers, see gl_replay.h
+//
+
+#include "gl_replay.h"
+#include "GL/glew.h"
+#include "GL/freeglut.h"
+#include "mesh_optimizer.h"
+
+#include <vector>
+
+namespace {
+
+// Half the side of the square the glyphs are captured in, in font units. The glyphs are 100 high
+// above a descender of about 33 and 105 wide.
+constexpr float font_extent = 160;
+
+// Floats of a line in the feedback buffer, the token and two vertices in window coordinates
+constexpr int feedback_line = 7;
+
+GLenum gl_material(material_param param) noexcept {
+  switch (param) {
+    case material_param::ambient:
+      return GL_AMBIENT;
+    case material_param::diffuse:
+      return GL_DIFFUSE;
+    case material_param::specular:
+      return GL_SPECULAR;
+    case material_param::emission:
+      return GL_EMISSION;
+  }
+  return GL_AMBIENT;
+}
+
+GLenum gl_capability(capability cap) noexcept {
+  switch (cap) {
+    case capability::light0:
+      return GL_LIGHT0;
+    case capability::light1:
+      return GL_LIGHT1;
+    case capability::texture_2d:
+      return GL_TEXTURE_2D;
+    case capability::texture_gen_s:
+      return GL_TEXTURE_GEN_S;
+    case capability::texture_gen_t:
+      return GL_TEXTURE_GEN_T;
+  }
+  return GL_TEXTURE_2D;
+}
+
+} // namespace
+
+void replay(const command_buffer &buffer) {
+  command_reader in(buffer);
+  float f[8];
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  while (!in.done()) {
+    switch (in.op()) {
+      case command::transform:
+        glLoadMatrixf(in.get<mat4>().data());
+        break;
+      case command::material: {
+        const GLenum param = gl_material(in.get<material_param>());
+        in.get_floats(f, 4);
+        glMaterialfv(GL_FRONT, param, f);
+        break;
+      }
+      case command::shininess:
+        glMaterialf(GL_FRONT, GL_SHININESS, in.get<float>());
+        break;
+      case command::flat_shading:
+        glShadeModel(in.get<bool>() ? GL_FLAT : GL_SMOOTH);
+        break;
+      case command::enable:
+        glEnable(gl_capability(in.get<capability>()));
+        break;
+      case command::disable:
+        glDisable(gl_capability(in.get<capability>()));
+        break;
+      case command::push_attributes:
+        glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT);
+        break;
+      case command::pop_attributes:
+        glPopAttrib();
+        break;
+      case command::bind_texture:
+        glBindTexture(GL_TEXTURE_2D, in.get<unsigned>());
+        break;
+      case command::texture_add:
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_ADD);
+        break;
+      case command::tex_gen:
+        in.get_floats(f, 8);
+        glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+        glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+        glTexGenfv(GL_S, GL_OBJECT_PLANE, f);
+        glTexGenfv(GL_T, GL_OBJECT_PLANE, f + 4);
+        glEnable(GL_TEXTURE_GEN_S);
+        glEnable(GL_TEXTURE_GEN_T);
+        break;
+      case command::begin:
+        in.get<primitive>();
+        glBegin(GL_QUADS);
+        break;
+      case command::end:
+        glEnd();
+        break;
+      case command::normal:
+        in.get_floats(f, 3);
+        glNormal3fv(f);
+        break;
+      case command::tex_coord:
+        in.get_floats(f, 2);
+        glTexCoord2fv(f);
+        break;
+      case command::vertex:
+        in.get_floats(f, 3);
+        glVertex3fv(f);
+        break;
+      case command::triangles: {
+        const mesh &m = *in.get<const mesh *>();
+        glVertexPointer(3, GL_FLOAT, sizeof(mesh_vertex), m.vertices.data()->position);
+        glNormalPointer(GL_FLOAT, sizeof(mesh_vertex), m.vertices.data()->normal);
+        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(m.indices.size()), GL_UNSIGNED_INT, m.indices.data());
+        break;
+      }
+      case command::lines: {
+        const auto vertices = in.get<std::uint32_t>();
+        glBegin(GL_LINES);
+        for (std::uint32_t i = 0; i < vertices; i++) {
+          in.get_floats(f, 3);
+          glVertex3fv(f);
+        }
+        glEnd();
+        break;
+      }
+    }
+  }
+  glPopClientAttrib();
+}
+
+bool capture_stroke_font(stroke_font &font) {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (viewport[2] <= 0 || viewport[3] <= 0) {
+    return false;
+  }
+  // Room for far more segments than the busiest glyph has
+  std::vector<GLfloat> feedback(256 * feedback_line);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(-font_extent, font_extent, -font_extent, font_extent, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+
+  bool complete = true;
+  const auto font_x = [&viewport](GLfloat x) {
+    return (x - static_cast<GLfloat>(viewport[0])) / static_cast<GLfloat>(viewport[2]) * 2 * font_extent - font_extent;
+  };
+  const auto font_y = [&viewport](GLfloat y) {
+    return (y - static_cast<GLfloat>(viewport[1])) / static_cast<GLfloat>(viewport[3]) * 2 * font_extent - font_extent;
+  };
+  for (int c = ' '; c < 127; c++) {
+    glLoadIdentity();
+    glFeedbackBuffer(static_cast<GLsizei>(feedback.size()), GL_3D, feedback.data());
+    glRenderMode(GL_FEEDBACK);
+    glutStrokeCharacter(GLUT_STROKE_MONO_ROMAN, c);
+    const GLint used = glRenderMode(GL_RENDER);
+    std::vector<float> &lines = font.lines[c];
+    lines.clear();
+    // A negative count means the buffer overflowed
+    complete &= used >= 0;
+    for (GLint i = 0; i + feedback_line <= used; i += feedback_line) {
+      const auto token = static_cast<GLenum>(feedback[static_cast<std::size_t>(i)]);
+      if (token != GL_LINE_TOKEN && token != GL_LINE_RESET_TOKEN) {
+        break;
+      }
+      for (int v = 0; v < 2; v++) {
+        const GLfloat *window = feedback.data() + i + 1 + 3 * v;
+        lines.push_back(font_x(window[0]));
+        lines.push_back(font_y(window[1]));
+        lines.push_back(0);
+      }
+    }
+  }
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  return complete;
+}
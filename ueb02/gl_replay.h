@@ -0,0 +1,23 @@
+//
+// OpenGL backend of the command buffers, runs on the thread owning the GL context.
+//
+
+#ifndef UEB02_GL_REPLAY_H
+#define UEB02_GL_REPLAY_H
+
+#include "command_buffer.h"
+#include "shape_cache.h"
+
+/**
+ * Issue the recorded commands to the fixed function pipeline, in order
+ */
+void replay(const command_buffer &buffer);
+
+/**
+ * Take the segments of the characters of GLUT_STROKE_MONO_ROMAN through feedback mode, once before
+ * anything records text
+ * @return false if GL couldn't hand the segments back
+ */
+bool capture_stroke_font(stroke_font &font);
+
+#endif //UEB02_GL_REPLAY_H
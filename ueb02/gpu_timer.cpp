@@ -0,0 +1,322 @@
+//
+// Render pass timing, see gpu_timer.h
+//
+
+#include "gpu_timer.h"
+#include "GL/freeglut.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+constexpr float pass_colours[][3] = {
+    {0.90f, 0.30f, 0.30f}, {0.30f, 0.75f, 0.30f}, {0.35f, 0.50f, 0.95f}, {0.95f, 0.80f, 0.25f},
+    {0.80f, 0.40f, 0.90f}, {0.30f, 0.85f, 0.85f}, {0.95f, 0.55f, 0.20f}, {0.70f, 0.70f, 0.70f},
+};
+constexpr int colour_count = sizeof(pass_colours) / sizeof(pass_colours[0]);
+
+constexpr float graph_width = 360;
+constexpr float graph_height = 120;
+constexpr float margin = 10;
+constexpr float line_height = 16;
+
+void text(float x, float y, const char *s) {
+  glRasterPos2f(x, y);
+  glutBitmapString(GLUT_BITMAP_HELVETICA_12, reinterpret_cast<const unsigned char *>(s));
+}
+
+void write_json_string(std::ostream &out, const std::string &s) {
+  out << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out << '\\';
+    }
+    out << c;
+  }
+  out << '"';
+}
+
+/**
+ * Heap allocations as the arguments of a trace event
+ */
+void write_allocations(std::ostream &out, const alloc_counts &counts) {
+  out << ", \"args\": {\"heap_allocations\": " << counts.allocations << ", \"heap_bytes\": " << counts.bytes << "}";
+}
+
+} // namespace
+
+gpu_pass_timer::gpu_pass_timer(int history_frames) : history_(static_cast<std::size_t>(std::max(history_frames, 1))) {}
+
+gpu_pass_timer::~gpu_pass_timer() {
+  for (auto &slot : slots_) {
+    if (!slot.queries.empty()) {
+      glDeleteQueries(static_cast<GLsizei>(slot.queries.size()), slot.queries.data());
+    }
+  }
+}
+
+void gpu_pass_timer::init() {
+  supported_ = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+  if (!supported_) {
+    std::cout << "Timer queries unavailable, pass times are CPU submission times" << std::endl;
+  }
+}
+
+int gpu_pass_timer::pass(const std::string &name) {
+  const auto found = std::find(names_.begin(), names_.end(), name);
+  if (found != names_.end()) {
+    return static_cast<int>(found - names_.begin());
+  }
+  names_.push_back(name);
+  return static_cast<int>(names_.size()) - 1;
+}
+
+void gpu_pass_timer::begin_frame() {
+  frame_allocations_.restart();
+  frame_start_ = std::chrono::steady_clock::now();
+  const double start_us = std::chrono::duration<double, std::micro>(frame_start_ - created_).count();
+  if (!supported_) {
+    restart(current_, start_us);
+    measuring_ = true;
+    return;
+  }
+
+  // Earlier frames may be done by now too, reading them early keeps the graph current
+  for (int i = 1; i <= frames_in_flight; i++) {
+    frame_slot &slot = slots_[(slot_ + i) % frames_in_flight];
+    if (slot.pending && collect(slot)) {
+      slot.pending = false;
+    }
+  }
+  slot_ = (slot_ + 1) % frames_in_flight;
+  frame_slot &slot = slots_[slot_];
+  measuring_ = !slot.pending;
+  if (!measuring_) {
+    dropped_frames_++;
+    return;
+  }
+  slot.used = 0;
+  slot.passes.clear();
+  slot.allocations.clear();
+  restart(slot.record, start_us);
+}
+
+void gpu_pass_timer::begin(int pass) {
+  if (!measuring_ || open_pass_ >= 0) {
+    return;
+  }
+  open_pass_ = pass;
+  if (!supported_) {
+    pass_allocations_.restart();
+    pass_start_ = std::chrono::steady_clock::now();
+    return;
+  }
+  frame_slot &slot = slots_[slot_];
+  if (slot.used == static_cast<int>(slot.queries.size())) {
+    const auto grow = static_cast<GLsizei>(std::max<std::size_t>(slot.queries.size(), 4));
+    slot.queries.resize(slot.queries.size() + static_cast<std::size_t>(grow));
+    glGenQueries(grow, slot.queries.data() + slot.queries.size() - static_cast<std::size_t>(grow));
+  }
+  slot.passes.push_back(pass);
+  glBeginQuery(GL_TIME_ELAPSED, slot.queries[static_cast<std::size_t>(slot.used++)]);
+  pass_allocations_.restart();
+}
+
+void gpu_pass_timer::end() {
+  if (open_pass_ < 0) {
+    return;
+  }
+  const alloc_counts allocations = pass_allocations_.counts();
+  if (supported_) {
+    glEndQuery(GL_TIME_ELAPSED);
+    slots_[slot_].allocations.push_back(allocations);
+  } else {
+    const std::chrono::duration<float, std::milli> took = std::chrono::steady_clock::now() - pass_start_;
+    current_.intervals.push_back({open_pass_, took.count(), allocations});
+  }
+  open_pass_ = -1;
+}
+
+void gpu_pass_timer::end_frame() {
+  end();
+  if (!measuring_) {
+    return;
+  }
+  const double cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start_).count();
+  const alloc_counts allocations = frame_allocations_.counts();
+  if (supported_) {
+    slots_[slot_].record.cpu_ms = cpu_ms;
+    slots_[slot_].record.allocations = allocations;
+    slots_[slot_].pending = true;
+  } else {
+    current_.cpu_ms = cpu_ms;
+    current_.allocations = allocations;
+    store(current_);
+  }
+  measuring_ = false;
+}
+
+bool gpu_pass_timer::collect(frame_slot &slot) {
+  // Results may arrive out of order, every one has to be there before any is read
+  for (int i = 0; i < slot.used; i++) {
+    GLint available = 0;
+    glGetQueryObjectiv(slot.queries[static_cast<std::size_t>(i)], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      return false;
+    }
+  }
+  for (int i = 0; i < slot.used; i++) {
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(slot.queries[static_cast<std::size_t>(i)], GL_QUERY_RESULT, &nanoseconds);
+    slot.record.intervals.push_back({slot.passes[static_cast<std::size_t>(i)],
+                                     static_cast<float>(static_cast<double>(nanoseconds) / 1e6),
+                                     slot.allocations[static_cast<std::size_t>(i)]});
+  }
+  store(slot.record);
+  return true;
+}
+
+void gpu_pass_timer::store(const frame_record &record) {
+  history_[history_next_ % history_.size()] = record;
+  history_next_++;
+}
+
+void gpu_pass_timer::restart(frame_record &record, double start_us) noexcept {
+  record.start_us = start_us;
+  record.cpu_ms = 0;
+  record.allocations = alloc_counts{};
+  record.intervals.clear();
+}
+
+float gpu_pass_timer::pass_time(const frame_record &record, int pass) noexcept {
+  float sum = 0;
+  for (const auto &i : record.intervals) {
+    sum += i.pass == pass ? i.milliseconds : 0;
+  }
+  return sum;
+}
+
+void gpu_pass_timer::draw_overlay(int window_width, int window_height, frame_arena &scratch) const {
+  const std::size_t frames = std::min(history_next_, history_.size());
+  const int pass_count = static_cast<int>(names_.size());
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_FOG);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_TEXTURE_2D);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, window_width, 0, window_height, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  // Averages over the history, the graph scales to the slowest frame
+  frame_vector<float> average(static_cast<std::size_t>(pass_count), 0, arena_allocator<float>(scratch));
+  float slowest = 1;
+  for (std::size_t f = 0; f < frames; f++) {
+    float total = 0;
+    for (int p = 0; p < pass_count; p++) {
+      const float ms = pass_time(history_[f], p);
+      average[static_cast<std::size_t>(p)] += ms / static_cast<float>(frames);
+      total += ms;
+    }
+    slowest = std::max(slowest, total);
+  }
+  const float scale = graph_height / slowest;
+
+  const float legend_height = line_height * static_cast<float>(pass_count + 1);
+  const float left = margin;
+  const float bottom = margin + legend_height;
+  glColor4f(0, 0, 0, 0.6f);
+  glRectf(left - 4, margin - 4, left + graph_width + 4, bottom + graph_height + 2 * line_height + 4);
+
+  // One column per frame, oldest on the left, passes stacked in the order they ran
+  const float column = graph_width / static_cast<float>(history_.size());
+  glBegin(GL_QUADS);
+  for (std::size_t age = 0; age < frames; age++) {
+    const frame_record &record = history_[(history_next_ - 1 - age) % history_.size()];
+    const float x = left + graph_width - static_cast<float>(age + 1) * column;
+    float y = bottom;
+    for (const auto &i : record.intervals) {
+      const float *c = pass_colours[i.pass % colour_count];
+      const float h = i.milliseconds * scale;
+      glColor3fv(c);
+      glVertex2f(x, y);
+      glVertex2f(x + column, y);
+      glVertex2f(x + column, y + h);
+      glVertex2f(x, y + h);
+      y += h;
+    }
+  }
+  glEnd();
+
+  char line[128];
+  glColor3f(1, 1, 1);
+  std::snprintf(line, sizeof(line), "%s ms per pass, top %.2f ms, %llu frames unmeasured", supported_ ? "GPU" : "CPU",
+                slowest, static_cast<unsigned long long>(dropped_frames_));
+  text(left, bottom + graph_height + line_height + 4, line);
+  if (frames > 0) {
+    const alloc_counts &heap = history_[(history_next_ - 1) % history_.size()].allocations;
+    std::snprintf(line, sizeof(line), "heap: %llu allocations, %llu bytes in the last measured frame",
+                  static_cast<unsigned long long>(heap.allocations), static_cast<unsigned long long>(heap.bytes));
+    text(left, bottom + graph_height + 4, line);
+  }
+  for (int p = 0; p < pass_count; p++) {
+    const float y = margin + line_height * static_cast<float>(pass_count - 1 - p) + 2;
+    glColor3fv(pass_colours[p % colour_count]);
+    glRectf(left, y, left + 10, y + 10);
+    glColor3f(1, 1, 1);
+    std::snprintf(line, sizeof(line), "%-16s %7.3f ms", names_[static_cast<std::size_t>(p)].c_str(),
+                  average[static_cast<std::size_t>(p)]);
+    text(left + 16, y, line);
+  }
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopAttrib();
+}
+
+bool gpu_pass_timer::write_trace(const char *path) const {
+  std::ofstream out(path);
+  out.setf(std::ios::fixed);
+  out.precision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  out << R"(  {"name": "thread_name", "ph": "M", "pid": 1, "tid": 1, "args": {"name": "CPU frame"}},)" << "\n";
+  out << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \""
+      << (supported_ ? "GPU" : "CPU submission") << " passes\"}}";
+
+  const std::size_t frames = std::min(history_next_, history_.size());
+  for (std::size_t f = history_next_ - frames; f < history_next_; f++) {
+    const frame_record &record = history_[f % history_.size()];
+    out << ",\n  {\"name\": \"frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " << record.start_us
+        << ", \"dur\": " << record.cpu_ms * 1000;
+    write_allocations(out, record.allocations);
+    out << "}";
+    double ts = record.start_us;
+    for (const auto &i : record.intervals) {
+      out << ",\n  {\"name\": ";
+      write_json_string(out, names_[static_cast<std::size_t>(i.pass)]);
+      out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": " << ts << ", \"dur\": " << i.milliseconds * 1000;
+      write_allocations(out, i.allocations);
+      out << "}";
+      ts += i.milliseconds * 1000;
+    }
+  }
+  out << "\n]}\n";
+  if (!out) {
+    std::cout << "Can't write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,145 @@
+//
+// GPU time of the render passes, measured with GL_TIME_ELAPSED queries.
+// The queries of a frame are read back frames_in_flight frames later, when the GPU is done with them,
+// so reading the results never waits for the GPU. A frame whose results are still not there when its
+// queries are needed again goes unmeasured instead. Without timer queries the CPU time of submitting
+// each pass is recorded, which is all that can be had without stalling.
+// Heap allocations of all threads are counted along, per frame and per pass, see alloc_tracker.h.
+//
+
+#ifndef UEB02_GPU_TIMER_H
+#define UEB02_GPU_TIMER_H
+
+#include "GL/glew.h"
+#include "alloc_tracker.h"
+#include "frame_arena.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class gpu_pass_timer {
+public:
+  static constexpr int frames_in_flight = 3;
+
+  /**
+   * @param history_frames measured frames kept for the graph and the trace
+   */
+  explicit gpu_pass_timer(int history_frames = 240);
+
+  ~gpu_pass_timer();
+
+  gpu_pass_timer(const gpu_pass_timer &) = delete;
+
+  gpu_pass_timer &operator=(const gpu_pass_timer &) = delete;
+
+  /**
+   * Check for timer queries, needs the GL context
+   */
+  void init();
+
+  /**
+   * @return id of the pass with the given name, added if it is new
+   */
+  int pass(const std::string &name);
+
+  /**
+   * Collect the results which arrived and start measuring a frame
+   */
+  void begin_frame();
+
+  /**
+   * Start timing a pass, passes don't nest but may be timed several times a frame, the times add up
+   */
+  void begin(int pass);
+
+  void end();
+
+  void end_frame();
+
+  /**
+   * @return true if the times are GPU times, false if they are CPU submission times
+   */
+  bool gpu() const noexcept {
+    return supported_;
+  }
+
+  /**
+   * Graph of the history stacked by pass, with the average of every pass, in window coordinates
+   * @param scratch holds the averages while drawing
+   */
+  void draw_overlay(int window_width, int window_height, frame_arena &scratch) const;
+
+  /**
+   * Write the history in the Chrome trace event format, as read by chrome://tracing and Perfetto.
+   * Passes are laid end to end from the CPU start of their frame, the GPU doesn't tell when it started them.
+   * @return false if the file can't be written
+   */
+  bool write_trace(const char *path) const;
+
+private:
+  /**
+   * Pass timed within a frame, in the order the passes ran
+   */
+  struct interval {
+    int pass;
+    float milliseconds;
+    alloc_counts allocations;
+  };
+
+  struct frame_record {
+    double start_us = 0;      // CPU time of begin_frame since the timer was created
+    double cpu_ms = 0;        // CPU time from begin_frame to end_frame
+    alloc_counts allocations; // from begin_frame to end_frame
+    std::vector<interval> intervals;
+  };
+
+  /**
+   * Queries of one of the frames in flight
+   */
+  struct frame_slot {
+    std::vector<GLuint> queries; // grows to the most passes timed in a frame
+    std::vector<int> passes;     // pass of each used query
+    std::vector<alloc_counts> allocations; // while the pass of each used query was submitted
+    int used = 0;
+    bool pending = false;        // results not read yet
+    frame_record record;
+  };
+
+  bool supported_ = false;
+  std::vector<std::string> names_;
+  frame_slot slots_[frames_in_flight];
+  int slot_ = 0;
+  bool measuring_ = false;     // the current frame issues queries
+  int open_pass_ = -1;
+  std::chrono::steady_clock::time_point created_ = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point pass_start_;
+  std::chrono::steady_clock::time_point frame_start_;
+  alloc_scope frame_allocations_; // since begin_frame
+  alloc_scope pass_allocations_;  // since the begin of the open pass
+  frame_record current_;       // record of the current frame when measuring on the CPU
+  std::vector<frame_record> history_;
+  std::size_t history_next_ = 0;
+  std::uint64_t dropped_frames_ = 0;
+
+  bool collect(frame_slot &slot);
+
+  /**
+   * Copy a record into the history, the old record's memory is reused so that storing stops allocating
+   * once the history went round
+   */
+  void store(const frame_record &record);
+
+  /**
+   * Start a new record in place, keeping the memory of its intervals
+   */
+  static void restart(frame_record &record, double start_us) noexcept;
+
+  /**
+   * @return milliseconds of the pass in a record, summed over its intervals
+   */
+  static float pass_time(const frame_record &record, int pass) noexcept;
+};
+
+#endif //UEB02_GPU_TIMER_H
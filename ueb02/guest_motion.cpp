@@ -0,0 +1,60 @@
+//
+// Guest movement, see guest_motion.h
+//
+
+#include "guest_motion.h"
+
+void guest_motion::step(vec3 &pos) noexcept {
+  switch (movement_) {
+    case movement::left_right:
+      left_right(pos);
+      break;
+    case movement::front_back:
+      front_back(pos);
+      break;
+    case movement::jump_and_left_right:
+      left_right(pos);
+      // fall through
+    case movement::jump:
+      jump(pos);
+      break;
+  }
+}
+
+void guest_motion::left_right(vec3 &pos) noexcept {
+  if (left_) {
+    pos.x -= movement_speed_;
+    counter++;
+    left_ = counter <= 200;
+  } else {
+    pos.x += movement_speed_;
+    counter--;
+    left_ = counter < -200;
+  }
+}
+
+void guest_motion::front_back(vec3 &pos) noexcept {
+  if (left_) {
+    pos.z -= movement_speed_;
+    counter++;
+    left_ = counter <= 700;
+  } else {
+    pos.z += movement_speed_;
+    counter--;
+    left_ = counter < -700;
+  }
+}
+
+void guest_motion::jump(vec3 &pos) noexcept {
+  if (up_) {
+    pos.y += movement_speed_;
+    if (pos.y > 0.5) {
+      up_ = false;
+    }
+  } else {
+    pos.y -= movement_speed_;
+    if (pos.y <= 0) {
+      up_ = true;
+    }
+  }
+}
@@ -0,0 +1,46 @@
+//
+// How the guests of the disco move, without anything drawn, so it can be benchmarked without a window.
+//
+
+#ifndef UEB02_GUEST_MOTION_H
+#define UEB02_GUEST_MOTION_H
+
+#include "vecmath.h"
+
+/**
+ * How the guests should move
+ */
+enum class movement {
+  jump = 0,
+  left_right = 1,
+  front_back = 2,
+  jump_and_left_right = 3,
+};
+
+class guest_motion {
+public:
+  /**
+   * @param speed distance per step
+   */
+  guest_motion(movement kind, float speed) : movement_(kind), movement_speed_(speed) {}
+
+  /**
+   * Move pos by one frame
+   */
+  void step(vec3 &pos) noexcept;
+
+private:
+  bool up_ = true;
+  bool left_ = true;
+  float counter = 0;
+  movement movement_;
+  float movement_speed_;
+
+  void left_right(vec3 &pos) noexcept;
+
+  void front_back(vec3 &pos) noexcept;
+
+  void jump(vec3 &pos) noexcept;
+};
+
+#endif //UEB02_GUEST_MOTION_H
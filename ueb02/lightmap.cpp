@@ -0,0 +1,509 @@
+//
+// Lightmap baking, see lightmap.h
+//
+
+#include "lightmap.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+namespace {
+
+// Distance of ray origins from their surface, keeps rays from hitting the surface they start on
+constexpr float surface_offset = 1e-3f;
+// Length of rays which leave the scene, far beyond any room
+constexpr float ray_length = 1e6f;
+
+inline vec3 chart_point(const lightmap_chart &chart, float s, float t) noexcept {
+  return chart.origin + chart.u_edge * s + chart.v_edge * t;
+}
+
+inline vec3 chart_normal(const lightmap_chart &chart) noexcept {
+  return normalize(cross(chart.u_edge, chart.v_edge));
+}
+
+/**
+ * @return van der Corput radical inverse in base 2, with i / count the Hammersley point set
+ */
+inline float radical_inverse(std::uint32_t i) noexcept {
+  i = (i << 16u) | (i >> 16u);
+  i = ((i & 0x55555555u) << 1u) | ((i & 0xAAAAAAAAu) >> 1u);
+  i = ((i & 0x33333333u) << 2u) | ((i & 0xCCCCCCCCu) >> 2u);
+  i = ((i & 0x0F0F0F0Fu) << 4u) | ((i & 0xF0F0F0F0u) >> 4u);
+  i = ((i & 0x00FF00FFu) << 8u) | ((i & 0xFF00FF00u) >> 8u);
+  return static_cast<float>(i) * 2.3283064365386963e-10f;
+}
+
+/**
+ * @return value in [0, 1) which differs between samples, so neighbours don't share ray directions
+ */
+inline float sample_rotation(int chart, int x, int y) noexcept {
+  std::uint32_t h = static_cast<std::uint32_t>(chart) * 0x9E3779B1u ^ static_cast<std::uint32_t>(x) * 0x85EBCA77u
+                    ^ static_cast<std::uint32_t>(y) * 0xC2B2AE3Du;
+  h ^= h >> 15u;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12u;
+  return static_cast<float>(h >> 8u) / 16777216.0f;
+}
+
+/**
+ * @return true if the segment from origin along direction up to length crosses the box
+ */
+bool segment_hits_box(const vec3 &origin, const vec3 &direction, float segment_length,
+                      const vec3 &min, const vec3 &max) noexcept {
+  float near = 0;
+  float far = segment_length;
+  const float o[3] = {origin.x, origin.y, origin.z};
+  const float d[3] = {direction.x, direction.y, direction.z};
+  const float lo[3] = {min.x, min.y, min.z};
+  const float hi[3] = {max.x, max.y, max.z};
+  for (int axis = 0; axis < 3; axis++) {
+    if (std::fabs(d[axis]) < 1e-12f) {
+      if (o[axis] < lo[axis] || o[axis] > hi[axis]) {
+        return false;
+      }
+      continue;
+    }
+    float t0 = (lo[axis] - o[axis]) / d[axis];
+    float t1 = (hi[axis] - o[axis]) / d[axis];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    near = std::max(near, t0);
+    far = std::min(far, t1);
+    if (near > far) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Call body for every index in [0, count), a row at a time as the rows cost very different amounts
+ */
+void run_parallel(thread_pool *pool, int count, const std::function<void(int)> &body) {
+  parallel_for(pool, 0, count, 1, [&body](int first, int last) {
+    for (int i = first; i < last; i++) {
+      body(i);
+    }
+  });
+}
+
+/**
+ * Bilinear lookup in a grid of rgb values, cell centred
+ */
+void sample_grid(const float *grid, int width, int height, float s, float t, float rgb[3]) noexcept {
+  const float x = std::min(std::max(s * static_cast<float>(width) - 0.5f, 0.0f), static_cast<float>(width - 1));
+  const float y = std::min(std::max(t * static_cast<float>(height) - 0.5f, 0.0f), static_cast<float>(height - 1));
+  const int x0 = static_cast<int>(x);
+  const int y0 = static_cast<int>(y);
+  const int x1 = std::min(x0 + 1, width - 1);
+  const int y1 = std::min(y0 + 1, height - 1);
+  const float fx = x - static_cast<float>(x0);
+  const float fy = y - static_cast<float>(y0);
+  for (int c = 0; c < 3; c++) {
+    const float top = grid[(y0 * width + x0) * 3 + c] * (1 - fx) + grid[(y0 * width + x1) * 3 + c] * fx;
+    const float bottom = grid[(y1 * width + x0) * 3 + c] * (1 - fx) + grid[(y1 * width + x1) * 3 + c] * fx;
+    rgb[c] = top * (1 - fy) + bottom * fy;
+  }
+}
+
+} // namespace
+
+int lightmap_baker::add_chart(const lightmap_chart &chart) {
+  charts_.emplace_back();
+  const int id = static_cast<int>(charts_.size()) - 1;
+  update_chart(id, chart);
+  return id;
+}
+
+void lightmap_baker::update_chart(int id, const lightmap_chart &chart) {
+  chart_data &data = charts_[id];
+  const auto add_change = [&](const lightmap_chart &c) {
+    const vec3 corners[] = {c.origin, c.origin + c.u_edge, c.origin + c.v_edge,
+                                    c.origin + c.u_edge + c.v_edge};
+    bounds box{corners[0], corners[0]};
+    for (const auto &corner : corners) {
+      box.min = component_min(box.min, corner);
+      box.max = component_max(box.max, corner);
+    }
+    changes_.push_back(box);
+  };
+  if (data.width > 0) {
+    add_change(data.desc);
+  }
+  add_change(chart);
+
+  const int width = std::max(static_cast<int>(std::ceil(length(chart.u_edge) * settings_.texels_per_unit)), 1);
+  const int height = std::max(static_cast<int>(std::ceil(length(chart.v_edge) * settings_.texels_per_unit)), 1);
+  const int spacing = std::max(settings_.bounce_spacing, 1);
+  pack_dirty_ = pack_dirty_ || width != data.width || height != data.height;
+  data.desc = chart;
+  data.width = width;
+  data.height = height;
+  data.bounce_width = (width + spacing - 1) / spacing;
+  data.bounce_height = (height + spacing - 1) / spacing;
+  data.dirty = true;
+  data.rays_dirty = true;
+}
+
+int lightmap_baker::add_light(const lightmap_light &light) {
+  lights_.push_back(light);
+  for (auto &chart : charts_) {
+    chart.dirty = true;
+  }
+  return static_cast<int>(lights_.size()) - 1;
+}
+
+void lightmap_baker::pack() {
+  // Shelves of charts sorted by height, each chart with a one texel gutter so bilinear filtering
+  // at its edges doesn't pick up its neighbours
+  std::vector<int> order(charts_.size());
+  int area = 0;
+  int widest = 0;
+  for (int i = 0; i < static_cast<int>(charts_.size()); i++) {
+    order[i] = i;
+    area += (charts_[i].width + 2) * (charts_[i].height + 2);
+    widest = std::max(widest, charts_[i].width + 2);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return charts_[a].height > charts_[b].height;
+  });
+  atlas_width_ = 4; // keeps RGB rows 4 byte aligned
+  while (atlas_width_ < widest || atlas_width_ * atlas_width_ < area) {
+    atlas_width_ *= 2;
+  }
+  int x = 0;
+  int y = 0;
+  int shelf = 0;
+  for (const int id : order) {
+    chart_data &chart = charts_[id];
+    if (x + chart.width + 2 > atlas_width_) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    chart.atlas_x = x + 1;
+    chart.atlas_y = y + 1;
+    x += chart.width + 2;
+    shelf = std::max(shelf, chart.height + 2);
+  }
+  atlas_height_ = std::max(y + shelf, 1);
+  pack_dirty_ = false;
+}
+
+int lightmap_baker::bake(thread_pool *pool) {
+  if (pack_dirty_) {
+    pack();
+  }
+  const int light_count = static_cast<int>(lights_.size());
+  const int bounces = std::max(settings_.bounces, 0);
+  const int rays = std::max(settings_.bounce_rays, 1);
+
+  // A change between a chart and a light may cast or lift a shadow on it, then the texels whose
+  // shadow rays cross the change are baked again
+  int direct_count = 0;
+  for (auto &chart : charts_) {
+    chart.shadows_dirty = false;
+    if (!chart.dirty) {
+      const vec3 corners[] = {chart.desc.origin, chart.desc.origin + chart.desc.u_edge,
+                                      chart.desc.origin + chart.desc.v_edge,
+                                      chart.desc.origin + chart.desc.u_edge + chart.desc.v_edge};
+      vec3 min = corners[0];
+      vec3 max = corners[0];
+      for (const auto &p : corners) {
+        min = component_min(min, p);
+        max = component_max(max, p);
+      }
+      for (const auto &light : lights_) {
+        min = component_min(min, light.position);
+        max = component_max(max, light.position);
+      }
+      for (const auto &change : changes_) {
+        if (change.min.x <= max.x && change.max.x >= min.x && change.min.y <= max.y && change.max.y >= min.y
+            && change.min.z <= max.z && change.max.z >= min.z) {
+          chart.shadows_dirty = true;
+          break;
+        }
+      }
+    }
+    direct_count += chart.dirty || chart.shadows_dirty ? 1 : 0;
+  }
+  if (direct_count == 0 && changes_.empty()) {
+    return 0;
+  }
+
+  for (auto &chart : charts_) {
+    if (chart.dirty) {
+      chart.direct.assign(static_cast<std::size_t>(light_count) * chart.width * chart.height * 3, 0.0f);
+    }
+    const std::size_t samples = static_cast<std::size_t>(chart.bounce_width) * chart.bounce_height;
+    chart.bounce.resize(static_cast<std::size_t>(bounces));
+    for (auto &pass : chart.bounce) {
+      pass.assign(samples * light_count * 3, 0.0f);
+    }
+    if (bounces > 0 && chart.rays.size() != samples * rays) {
+      chart.rays.resize(samples * rays);
+      chart.rays_dirty = true;
+    }
+  }
+
+  std::vector<std::pair<int, int>> rows;
+  for (int id = 0; id < static_cast<int>(charts_.size()); id++) {
+    if (charts_[id].dirty || charts_[id].shadows_dirty) {
+      for (int row = 0; row < charts_[id].height; row++) {
+        rows.emplace_back(id, row);
+      }
+    }
+  }
+  run_parallel(pool, static_cast<int>(rows.size()), [&](int i) {
+    bake_direct(charts_[rows[i].first], rows[i].second);
+  });
+
+  // Bounce light depends on every chart, but only rays through a change need tracing again,
+  // the others just look up the new light where they hit
+  if (bounces > 0) {
+    rows.clear();
+    for (int id = 0; id < static_cast<int>(charts_.size()); id++) {
+      for (int row = 0; row < charts_[id].bounce_height; row++) {
+        rows.emplace_back(id, row);
+      }
+    }
+    run_parallel(pool, static_cast<int>(rows.size()), [&](int i) {
+      trace_bounce_rays(rows[i].first, rows[i].second, charts_[rows[i].first].rays_dirty);
+    });
+    for (int pass = 0; pass < bounces; pass++) {
+      run_parallel(pool, static_cast<int>(rows.size()), [&](int i) {
+        gather_bounce(charts_[rows[i].first], pass, rows[i].second);
+      });
+    }
+  }
+
+  for (auto &chart : charts_) {
+    chart.dirty = false;
+    chart.rays_dirty = false;
+  }
+  changes_.clear();
+  return direct_count;
+}
+
+void lightmap_baker::bake_direct(chart_data &chart, int row) const {
+  const int id = static_cast<int>(&chart - charts_.data());
+  const vec3 normal = chart_normal(chart.desc);
+  const std::size_t layer = static_cast<std::size_t>(chart.width) * chart.height * 3;
+  const float t = (static_cast<float>(row) + 0.5f) / static_cast<float>(chart.height);
+  for (int x = 0; x < chart.width; x++) {
+    const float s = (static_cast<float>(x) + 0.5f) / static_cast<float>(chart.width);
+    const vec3 p = chart_point(chart.desc, s, t) + normal * surface_offset;
+    for (int l = 0; l < static_cast<int>(lights_.size()); l++) {
+      const lightmap_light &light = lights_[l];
+      const vec3 to_light = light.position - p;
+      const float distance = length(to_light);
+      const float cosine = distance > 0 ? dot(normal, to_light) / distance : 0;
+      float *out = chart.direct.data() + l * layer + (static_cast<std::size_t>(row) * chart.width + x) * 3;
+      if (cosine <= 0) {
+        out[0] = out[1] = out[2] = 0;
+        continue;
+      }
+      const vec3 direction = to_light * (1 / distance);
+      if (!chart.dirty && !crosses_change(p, direction, distance)) {
+        continue;
+      }
+      ray_hit hit{};
+      if (trace(p, direction, distance, id, hit)) {
+        out[0] = out[1] = out[2] = 0;
+        continue;
+      }
+      const float attenuation = 1 / (light.constant_attenuation + light.linear_attenuation * distance
+                                     + light.quadratic_attenuation * distance * distance);
+      out[0] = light.colour.x * cosine * attenuation;
+      out[1] = light.colour.y * cosine * attenuation;
+      out[2] = light.colour.z * cosine * attenuation;
+    }
+  }
+}
+
+void lightmap_baker::trace_bounce_rays(int id, int row, bool all) {
+  chart_data &chart = charts_[id];
+  const int rays = std::max(settings_.bounce_rays, 1);
+  const vec3 normal = chart_normal(chart.desc);
+  const vec3 tangent = normalize(chart.desc.u_edge);
+  const vec3 bitangent = cross(normal, tangent);
+  const float t = (static_cast<float>(row) + 0.5f) / static_cast<float>(chart.bounce_height);
+  for (int x = 0; x < chart.bounce_width; x++) {
+    const float s = (static_cast<float>(x) + 0.5f) / static_cast<float>(chart.bounce_width);
+    const vec3 p = chart_point(chart.desc, s, t) + normal * surface_offset;
+    const float rotation = sample_rotation(id, x, row);
+    ray_hit *hits = chart.rays.data() + (static_cast<std::size_t>(row) * chart.bounce_width + x) * rays;
+    for (int r = 0; r < rays; r++) {
+      // Cosine distributed directions from the Hammersley set, turned differently for every sample
+      const float a = (static_cast<float>(r) + 0.5f) / static_cast<float>(rays);
+      const float phi = 2 * vecmath_pi * (radical_inverse(static_cast<std::uint32_t>(r)) + rotation);
+      const float radius = std::sqrt(a);
+      float sin;
+      float cos;
+      fast_sincos(phi, sin, cos);
+      const vec3 direction = tangent * (radius * cos) + bitangent * (radius * sin) + normal * std::sqrt(1 - a);
+      if (!all && !crosses_change(p, direction, hits[r].distance)) {
+        continue;
+      }
+      ray_hit hit{};
+      if (!trace(p, direction, ray_length, id, hit)) {
+        hit = ray_hit{-1, 0, 0, ray_length};
+      }
+      hits[r] = hit;
+    }
+  }
+}
+
+void lightmap_baker::gather_bounce(chart_data &chart, int pass, int row) const {
+  const int rays = std::max(settings_.bounce_rays, 1);
+  const std::size_t layer = static_cast<std::size_t>(chart.bounce_width) * chart.bounce_height * 3;
+  for (int x = 0; x < chart.bounce_width; x++) {
+    const std::size_t sample = static_cast<std::size_t>(row) * chart.bounce_width + x;
+    const ray_hit *hits = chart.rays.data() + sample * rays;
+    for (int l = 0; l < static_cast<int>(lights_.size()); l++) {
+      // With cosine distributed rays the irradiance is the mean of the light coming back along them
+      float sum[3] = {0, 0, 0};
+      for (int r = 0; r < rays; r++) {
+        if (hits[r].chart >= 0) {
+          float rgb[3];
+          radiance(hits[r], pass, l, rgb);
+          sum[0] += rgb[0];
+          sum[1] += rgb[1];
+          sum[2] += rgb[2];
+        }
+      }
+      float *out = chart.bounce[pass].data() + l * layer + sample * 3;
+      for (int c = 0; c < 3; c++) {
+        out[c] = sum[c] / static_cast<float>(rays);
+      }
+    }
+  }
+}
+
+bool lightmap_baker::crosses_change(const vec3 &origin, const vec3 &direction,
+                                    float distance) const noexcept {
+  for (const auto &change : changes_) {
+    if (segment_hits_box(origin, direction, distance, change.min, change.max)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool lightmap_baker::trace(const vec3 &origin, const vec3 &direction, float max_distance,
+                           int skip, ray_hit &hit) const noexcept {
+  bool found = false;
+  float nearest = max_distance;
+  for (int id = 0; id < static_cast<int>(charts_.size()); id++) {
+    if (id == skip) {
+      continue; // planar, can't be hit from itself
+    }
+    const lightmap_chart &chart = charts_[id].desc;
+    const vec3 n = cross(chart.u_edge, chart.v_edge);
+    const float denominator = dot(direction, n);
+    if (std::fabs(denominator) < 1e-12f) {
+      continue;
+    }
+    const float distance = dot(chart.origin - origin, n) / denominator;
+    if (distance <= 0 || distance >= nearest) {
+      continue;
+    }
+    const vec3 q = origin + direction * distance - chart.origin;
+    const float nn = dot(n, n);
+    const float s = dot(cross(q, chart.v_edge), n) / nn;
+    const float t = dot(cross(chart.u_edge, q), n) / nn;
+    if (s < 0 || s > 1 || t < 0 || t > 1) {
+      continue;
+    }
+    nearest = distance;
+    found = true;
+    // The back of a chart blocks light but gives none
+    hit = ray_hit{denominator < 0 ? id : -1, s, t, distance};
+  }
+  return found;
+}
+
+void lightmap_baker::radiance(const ray_hit &hit, int pass, int light, float rgb[3]) const noexcept {
+  const chart_data &chart = charts_[hit.chart];
+  float irradiance[3];
+  if (pass == 0) {
+    const int x = std::min(static_cast<int>(hit.s * static_cast<float>(chart.width)), chart.width - 1);
+    const int y = std::min(static_cast<int>(hit.t * static_cast<float>(chart.height)), chart.height - 1);
+    const float *texel = chart.direct.data()
+                         + (static_cast<std::size_t>(light) * chart.height * chart.width
+                            + static_cast<std::size_t>(y) * chart.width + x) * 3;
+    std::copy(texel, texel + 3, irradiance);
+  } else {
+    const std::size_t layer = static_cast<std::size_t>(chart.bounce_width) * chart.bounce_height * 3;
+    sample_grid(chart.bounce[pass - 1].data() + light * layer, chart.bounce_width, chart.bounce_height, hit.s,
+                hit.t, irradiance);
+  }
+  rgb[0] = chart.desc.albedo.x * irradiance[0];
+  rgb[1] = chart.desc.albedo.y * irradiance[1];
+  rgb[2] = chart.desc.albedo.z * irradiance[2];
+}
+
+void lightmap_baker::atlas_coord(int id, float s, float t, float &u, float &v) const noexcept {
+  const chart_data &chart = charts_[id];
+  u = (static_cast<float>(chart.atlas_x) + s * static_cast<float>(chart.width)) / static_cast<float>(atlas_width_);
+  v = (static_cast<float>(chart.atlas_y) + t * static_cast<float>(chart.height)) / static_cast<float>(atlas_height_);
+}
+
+void lightmap_baker::compose(const std::vector<bool> &enabled, std::vector<unsigned char> &rgb) const {
+  rgb.assign(static_cast<std::size_t>(atlas_width_) * atlas_height_ * 3, 0);
+  const auto on = [&](int light) {
+    return light < static_cast<int>(enabled.size()) && enabled[light];
+  };
+  for (const auto &chart : charts_) {
+    const std::size_t direct_layer = static_cast<std::size_t>(chart.width) * chart.height * 3;
+    const std::size_t bounce_layer = static_cast<std::size_t>(chart.bounce_width) * chart.bounce_height * 3;
+    const float albedo[3] = {chart.desc.albedo.x, chart.desc.albedo.y, chart.desc.albedo.z};
+    for (int y = 0; y < chart.height; y++) {
+      const float t = (static_cast<float>(y) + 0.5f) / static_cast<float>(chart.height);
+      unsigned char *out = rgb.data() + (static_cast<std::size_t>(chart.atlas_y + y) * atlas_width_ + chart.atlas_x) * 3;
+      for (int x = 0; x < chart.width; x++) {
+        const float s = (static_cast<float>(x) + 0.5f) / static_cast<float>(chart.width);
+        float irradiance[3] = {0, 0, 0};
+        for (int l = 0; l < static_cast<int>(lights_.size()); l++) {
+          if (!on(l)) {
+            continue;
+          }
+          const float *direct = chart.direct.data() + l * direct_layer + (static_cast<std::size_t>(y) * chart.width + x) * 3;
+          for (int c = 0; c < 3; c++) {
+            irradiance[c] += direct[c];
+          }
+          for (const auto &pass : chart.bounce) {
+            float bounce[3];
+            sample_grid(pass.data() + l * bounce_layer, chart.bounce_width, chart.bounce_height, s, t, bounce);
+            for (int c = 0; c < 3; c++) {
+              irradiance[c] += bounce[c];
+            }
+          }
+        }
+        for (int c = 0; c < 3; c++) {
+          out[x * 3 + c] = static_cast<unsigned char>(std::min(albedo[c] * irradiance[c], 1.0f) * 255.0f + 0.5f);
+        }
+      }
+    }
+
+    // Gutter, copies of the edge texels
+    const auto texel = [&](int x, int y) {
+      return rgb.data() + (static_cast<std::size_t>(y) * atlas_width_ + x) * 3;
+    };
+    const int x0 = chart.atlas_x;
+    const int x1 = chart.atlas_x + chart.width - 1;
+    for (int y = chart.atlas_y; y < chart.atlas_y + chart.height; y++) {
+      std::copy(texel(x0, y), texel(x0, y) + 3, texel(x0 - 1, y));
+      std::copy(texel(x1, y), texel(x1, y) + 3, texel(x1 + 1, y));
+    }
+    const std::size_t row_bytes = static_cast<std::size_t>(chart.width + 2) * 3;
+    std::copy(texel(x0 - 1, chart.atlas_y), texel(x0 - 1, chart.atlas_y) + row_bytes, texel(x0 - 1, chart.atlas_y - 1));
+    const int last = chart.atlas_y + chart.height - 1;
+    std::copy(texel(x0 - 1, last), texel(x0 - 1, last) + row_bytes, texel(x0 - 1, last + 1));
+  }
+}
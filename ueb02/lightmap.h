@@ -0,0 +1,149 @@
+//
+// CPU lightmap baker for the static surfaces of the disco.
+// Every static surface is a planar parallelogram which becomes one chart of the lightmap atlas,
+// its own parametrisation being the unwrap. Direct light of point lights is ray traced against all
+// charts, bounces are gathered with cosine distributed rays on a coarser grid. Each light is kept in
+// its own layer, so lights can be switched without baking again, and only charts an edit can affect
+// are rebaked.
+//
+
+#ifndef UEB02_LIGHTMAP_H
+#define UEB02_LIGHTMAP_H
+
+#include "vecmath.h"
+
+#include <vector>
+
+class thread_pool;
+
+/**
+ * Surface origin + s * u_edge + t * v_edge for s, t in [0, 1], lit on the side u_edge x v_edge points to
+ */
+struct lightmap_chart {
+  vec3 origin;
+  vec3 u_edge;
+  vec3 v_edge;
+  vec3 albedo; // diffuse reflectance, as the diffuse material colour
+};
+
+/**
+ * Point light, attenuated like the lights of the fixed function pipeline
+ */
+struct lightmap_light {
+  vec3 position;
+  vec3 colour;
+  float constant_attenuation = 1;
+  float linear_attenuation = 0;
+  float quadratic_attenuation = 0;
+};
+
+struct lightmap_settings {
+  float texels_per_unit = 8;
+  int bounces = 1;
+  int bounce_spacing = 4; // texels between bounce samples, indirect light changes slowly
+  int bounce_rays = 64;   // rays per bounce sample
+};
+
+class lightmap_baker {
+public:
+  explicit lightmap_baker(lightmap_settings settings = lightmap_settings{}) : settings_(settings) {}
+
+  /**
+   * @return id of the new chart
+   */
+  int add_chart(const lightmap_chart &chart);
+
+  /**
+   * Replace a chart, the next bake updates it and everything its old or new shape may shadow or light
+   */
+  void update_chart(int id, const lightmap_chart &chart);
+
+  /**
+   * @return id of the new light, its layer in compose
+   */
+  int add_light(const lightmap_light &light);
+
+  /**
+   * Bake what changed since the last call
+   * @param pool threads the rows of the charts are spread over, nullptr to stay on the calling thread
+   * @return number of charts whose direct light was baked completely or in part
+   */
+  int bake(thread_pool *pool = nullptr);
+
+  int atlas_width() const noexcept {
+    return atlas_width_;
+  }
+
+  int atlas_height() const noexcept {
+    return atlas_height_;
+  }
+
+  /**
+   * Texture coordinates in the atlas of the point (s, t) of a chart
+   */
+  void atlas_coord(int id, float s, float t, float &u, float &v) const noexcept;
+
+  /**
+   * Sum the layers of the enabled lights into an RGB atlas of the outgoing diffuse light,
+   * rows from t = 0 up as glTexImage2D expects them
+   * @param enabled one entry per light, missing entries count as off
+   */
+  void compose(const std::vector<bool> &enabled, std::vector<unsigned char> &rgb) const;
+
+private:
+  struct ray_hit {
+    int chart;      // -1 if the ray left the scene
+    float s;
+    float t;
+    float distance;
+  };
+
+  struct chart_data {
+    lightmap_chart desc;
+    int width = 0;              // texels
+    int height = 0;
+    int bounce_width = 0;       // bounce samples
+    int bounce_height = 0;
+    int atlas_x = 0;            // first texel inside the gutter
+    int atlas_y = 0;
+    bool dirty = true;          // direct light needs baking
+    bool shadows_dirty = false; // direct light needs baking where shadow rays cross a change
+    bool rays_dirty = true;     // all bounce rays need tracing
+    std::vector<float> direct;              // rgb irradiance per light and texel
+    std::vector<std::vector<float>> bounce; // rgb irradiance per bounce, light and sample
+    std::vector<ray_hit> rays;
+  };
+
+  /**
+   * Box of a changed chart
+   */
+  struct bounds {
+    vec3 min;
+    vec3 max;
+  };
+
+  lightmap_settings settings_;
+  std::vector<chart_data> charts_;
+  std::vector<lightmap_light> lights_;
+  std::vector<bounds> changes_;
+  bool pack_dirty_ = true;
+  int atlas_width_ = 0;
+  int atlas_height_ = 0;
+
+  void pack();
+
+  void bake_direct(chart_data &chart, int row) const;
+
+  void trace_bounce_rays(int id, int row, bool all);
+
+  void gather_bounce(chart_data &chart, int pass, int row) const;
+
+  bool crosses_change(const vec3 &origin, const vec3 &direction, float distance) const noexcept;
+
+  bool trace(const vec3 &origin, const vec3 &direction, float max_distance, int skip,
+             ray_hit &hit) const noexcept;
+
+  void radiance(const ray_hit &hit, int pass, int light, float rgb[3]) const noexcept;
+};
+
+#endif //UEB02_LIGHTMAP_H
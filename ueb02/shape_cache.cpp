@@ -0,0 +1,54 @@
+//
+// Cached solids of the disco, see shape_cache.h
+//
+
+#include "shape_cache.h"
+
+namespace {
+
+/**
+ * Turn the y axis of the generators onto the z axis GLUT uses, a quarter turn around x
+ */
+void y_to_z(mesh &m) noexcept {
+  for (auto &v : m.vertices) {
+    for (float *p : {v.position, v.normal}) {
+      const float y = p[1];
+      p[1] = -p[2];
+      p[2] = y;
+    }
+  }
+}
+
+} // namespace
+
+const mesh &shape_cache::sphere(float radius, int slices, int stacks) {
+  const auto added = meshes_.emplace(key{shape::sphere, radius, 0, slices, stacks}, mesh{});
+  mesh &m = added.first->second;
+  if (added.second) {
+    add_sphere(m, vec3{}, radius, slices, stacks);
+    y_to_z(m);
+    optimize_mesh(m);
+  }
+  return m;
+}
+
+const mesh &shape_cache::cone(float base, float height, int slices, int stacks) {
+  const auto added = meshes_.emplace(key{shape::cone, base, height, slices, stacks}, mesh{});
+  mesh &m = added.first->second;
+  if (added.second) {
+    add_cone(m, vec3{}, base, height, slices, stacks);
+    y_to_z(m);
+    optimize_mesh(m);
+  }
+  return m;
+}
+
+const mesh &shape_cache::cube(float size) {
+  const auto added = meshes_.emplace(key{shape::cube, size, 0, 0, 0}, mesh{});
+  mesh &m = added.first->second;
+  if (added.second) {
+    add_box(m, vec3{}, size);
+    optimize_mesh(m);
+  }
+  return m;
+}
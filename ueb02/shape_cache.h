@@ -0,0 +1,63 @@
+//
+// Geometry of the solids and text of the disco, built once and shared by everything that draws it.
+// The solids replace glutSolidSphere, glutSolidCone and glutSolidCube: the meshes of mesh_optimizer.h in
+// the orientation GLUT uses, optimised for the vertex cache and cached per shape and parameters. The text
+// is the monospaced stroke font of GLUT as line segments, see capture_stroke_font in gl_replay.h.
+// Game objects take what they draw when they join the game, recording then reads it from any thread.
+//
+
+#ifndef UEB02_SHAPE_CACHE_H
+#define UEB02_SHAPE_CACHE_H
+
+#include "mesh_optimizer.h"
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+/**
+ * Glyphs of a stroke font, 100 units high like GLUT_STROKE_MONO_ROMAN
+ */
+struct stroke_font {
+  std::vector<float> lines[128]; // x, y, z of both ends of every segment, per ASCII character
+};
+
+/**
+ * Not thread safe, meshes are made while game objects join and only read afterwards
+ */
+class shape_cache {
+public:
+  /**
+   * Sphere around the origin, the poles on the z axis
+   */
+  const mesh &sphere(float radius, int slices, int stacks);
+
+  /**
+   * Cone with its base around the origin and the tip on the z axis
+   */
+  const mesh &cone(float base, float height, int slices, int stacks);
+
+  /**
+   * Cube around the origin
+   */
+  const mesh &cube(float size);
+
+  stroke_font &font() noexcept {
+    return font_;
+  }
+
+  const stroke_font &font() const noexcept {
+    return font_;
+  }
+
+private:
+  enum class shape {
+    sphere, cone, cube
+  };
+  using key = std::tuple<shape, float, float, int, int>;
+
+  std::map<key, mesh> meshes_; // references stay valid as the map grows
+  stroke_font font_;
+};
+
+#endif //UEB02_SHAPE_CACHE_H